@@ -9,11 +9,85 @@
 
 #include "CANdalorian.hpp"
 
+CANdalorian *CANdalorian::instances[ CANDALORIAN_MAX_INSTANCES ] = { NULL };
+
 CANdalorian::CANdalorian( CAN_HandleTypeDef *can_device_p ){
 
 	// We save the peripheral data to a local variable.
 	can_device = can_device_p;
 
+	registerInstance();
+
+}
+
+CANdalorian::CANdalorian( CAN_HandleTypeDef *can_device_p, frame_t *rx_buffer_p, uint32_t rx_length_p, frame_t *tx_buffer_p, uint32_t tx_length_p ){
+
+	// We save the peripheral data to a local variable.
+	can_device = can_device_p;
+
+	rx_buffer = rx_buffer_p;
+	rx_length = rx_length_p;
+
+	tx_buffer = tx_buffer_p;
+	tx_length = tx_length_p;
+
+	registerInstance();
+
+}
+
+void CANdalorian::registerInstance(){
+
+	uint32_t i;
+
+	// Register the object, so the HAL callbacks can find it by its handle.
+	for( i = 0; i < CANDALORIAN_MAX_INSTANCES; i++ ){
+
+		if( instances[ i ] == NULL ){
+
+			instances[ i ] = this;
+			break;
+
+		}
+
+	}
+
+	// Without a slot the object would never get its callbacks,
+	// so the recive ring and the transmitt queue would stall.
+	if( i == CANDALORIAN_MAX_INSTANCES ){
+
+		Error_Handler();
+
+	}
+
+}
+
+CANdalorian::~CANdalorian(){
+
+	uint32_t i;
+	uint32_t primask;
+
+	// The callbacks must not find the object while it is removed.
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	for( i = 0; i < CANDALORIAN_MAX_INSTANCES; i++ ){
+
+		if( instances[ i ] == this ){
+
+			instances[ i ] = NULL;
+
+		}
+
+	}
+
+	__set_PRIMASK( primask );
+
+}
+
+bool CANdalorian::validAddress( uint32_t address, uint8_t flags ){
+
+	return address <= ( ( flags & CANDALORIAN_IDE ) ? CANDALORIAN_EXT_ID_MAX : CANDALORIAN_STD_ID_MAX );
+
 }
 
 void CANdalorian::beginSlave( uint32_t slave_address_p ){
@@ -96,6 +170,10 @@ void CANdalorian::beginSlave( uint32_t slave_address_p ){
 	// Finally start the peripheral.
 	HAL_CAN_Start( can_device );
 
+	// With recive ring and transmitt queue the messages are moved in interrupts.
+	startRecive();
+	startTransmitt();
+
 }
 
 void CANdalorian::begin(){
@@ -176,6 +254,9 @@ void CANdalorian::begin(){
 	// Finally start the peripheral.
 	HAL_CAN_Start( can_device );
 
+	// With recive ring and transmitt queue the messages are moved in interrupts.
+	startRecive();
+	startTransmitt();
 
 }
 
@@ -204,8 +285,8 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 	// This variable will hold pending status of the massage.
 	uint32_t pending;
 
-	// This variable will hold the number of trys in case of failed transmission.
-	uint32_t try_count = 0;
+	// This variable will hold the start of the transmission in ms.
+	uint32_t start;
 
 	// We have to check if the address is valid.
 	if( address > 2047 ){
@@ -238,18 +319,19 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 
 	}
 
+	// Save the start time.
+	start = HAL_GetTick();
+
 	// Check the status of the message.
 	pending = HAL_CAN_IsTxMessagePending( can_device, canTxMailbox );
 
 	// Wait until it gets sent out or timeout occurs.
+	// The status is checked continuously, so it returns right after the transmission.
 	while( pending ){
 
-		// Increment the try_count variable.
-		try_count++;
-
 		// Check if timeout happened.
 		// In this case 100ms.
-		if( try_count >= 100 ){
+		if( HAL_GetTick() - start >= 100 ){
 
 			// If timeout happened abort the request.
 			HAL_CAN_AbortTxRequest( can_device, canTxMailbox );
@@ -259,9 +341,6 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 
 		}
 
-		// Delay 1ms.
-		delay( 1 );
-
 		// Check the status of the message again.
 		pending = HAL_CAN_IsTxMessagePending( can_device, canTxMailbox );
 
@@ -283,8 +362,8 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 	// This variable will hold pending status of the massage.
 	uint32_t pending;
 
-	// This variable will hold the number of trys in case of failed transmission.
-	uint32_t try_count = 0;
+	// This variable will hold the start of the transmission in ms.
+	uint32_t start;
 
 	// We have to check if the address is valid.
 	if( address > 2047 ){
@@ -317,17 +396,18 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 
 	}
 
+	// Save the start time.
+	start = HAL_GetTick();
+
 	// Check the status of the message.
 	pending = HAL_CAN_IsTxMessagePending( can_device, canTxMailbox );
 
 	// Wait until it gets sent out or timeout occurs.
+	// The status is checked continuously, so it returns right after the transmission.
 	while( pending ){
 
-		// Increment the try_count variable.
-		try_count++;
-
 		// Check if timeout happened.
-		if( try_count >= timeout ){
+		if( HAL_GetTick() - start >= timeout ){
 
 			// If timeout happened abort the request.
 			HAL_CAN_AbortTxRequest( can_device, canTxMailbox );
@@ -337,9 +417,6 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 
 		}
 
-		// Delay 1ms.
-		delay( 1 );
-
 		// Check the status of the message again.
 		pending = HAL_CAN_IsTxMessagePending( can_device, canTxMailbox );
 
@@ -350,75 +427,1087 @@ HAL_StatusTypeDef CANdalorian::transmitt( uint32_t address, uint8_t *data, uint8
 
 }
 
-uint32_t CANdalorian::available(){
+HAL_StatusTypeDef CANdalorian::transmitt( const frame_t *frame, uint32_t timeout ){
 
-	// This variable will store the result.
-	uint32_t res;
+	// This variable will hold the mailbox ID.
+	uint32_t canTxMailbox;
 
-	// Check if peripheral is in master or slave mode.
-	if( slave_address == 0 ){
+	// This variable will hold the start of the transmission in ms.
+	uint32_t start;
 
-		// In master mode we have to read from FIFO0
-		res = HAL_CAN_GetRxFifoFillLevel( can_device, CAN_RX_FIFO0 );
+	// We have to check if the address is valid.
+	if( !validAddress( frame -> id, frame -> flags ) || ( frame -> dlc > 8 ) ){
+
+		// If not return with error.
+		return HAL_ERROR;
 
 	}
 
-	else{
+	// Trying to add the message to the output queue.
+	if( mailboxAdd( frame, &canTxMailbox ) != HAL_OK ){
 
-		// In slave mode we have to read from FIFO1
-		res = HAL_CAN_GetRxFifoFillLevel( can_device, CAN_RX_FIFO1 );
+		// If it fails return with error.
+		return HAL_ERROR;
 
 	}
 
-	// Return the result.
-	return res;
+	// Save the start time.
+	start = HAL_GetTick();
+
+	// Wait until it gets sent out or timeout occurs.
+	while( HAL_CAN_IsTxMessagePending( can_device, canTxMailbox ) ){
+
+		// Check if timeout happened.
+		if( HAL_GetTick() - start >= timeout ){
+
+			// If timeout happened abort the request.
+			HAL_CAN_AbortTxRequest( can_device, canTxMailbox );
+
+			// Return with timeout error.
+			return HAL_TIMEOUT;
+
+		}
+
+	}
+
+	// If the message is sent and timeout not occurred return with HAL_OK.
+	return HAL_OK;
+
 }
 
-HAL_StatusTypeDef CANdalorian::read( uint8_t *data, uint8_t *size, uint32_t *addr ){
+uint32_t CANdalorian::transmittFree(){
 
-	// This variable will store the message header
-	CAN_RxHeaderTypeDef canRxHeader;
+	return HAL_CAN_GetTxMailboxesFreeLevel( can_device );
 
-	// Check if peripheral is in master or slave mode.
-	if( slave_address == 0 ){
+}
 
-		// Try to read out the message from the FIFO. In master mode we have to read from FIFO0.
-		if( HAL_CAN_GetRxMessage( can_device, CAN_RX_FIFO0, &canRxHeader, data ) != HAL_OK ){
+HAL_StatusTypeDef CANdalorian::transmittNoWait( uint32_t address, const uint8_t *data, uint8_t size, uint8_t flags ){
 
-			// If there was a problem while reading out the data we have to zero out the size, and the address.
-			*size = 0;
-			*addr = 0;
+	// This variable will hold the message header.
+	CAN_TxHeaderTypeDef canTxHeader;
 
-			// We have to return with an error.
-			return HAL_ERROR;
+	// This variable will hold the mailbox ID.
+	uint32_t canTxMailbox;
 
-		}
+	// We have to check if the address is valid.
+	if( !validAddress( address, flags ) ){
+
+		// If not return with error.
+		return HAL_ERROR;
 
 	}
 
-	else{
+	// We can send 8 bytes with one transfer maximum.
+	if( size > 8 ){
 
-		// Try to read out the message from the FIFO. In slave mode we have to read from FIFO1.
-		if( HAL_CAN_GetRxMessage( can_device, CAN_RX_FIFO1, &canRxHeader, data ) != HAL_OK ){
+		size = 8;
 
-			// If there was a problem while reading out the data we have to zero out the size, and the address.
-			*size = 0;
-			*addr = 0;
+	}
 
-			// We have to return with an error.
-			return HAL_ERROR;
+	// Configure the header.
+	canTxHeader.DLC = size;			// size config
+	canTxHeader.StdId = address;	// address config
+	canTxHeader.ExtId = address;	// extended address config
+	canTxHeader.IDE = ( flags & CANDALORIAN_IDE ) ? CAN_ID_EXT : CAN_ID_STD;		// ID type config
+	canTxHeader.RTR = ( flags & CANDALORIAN_RTR ) ? CAN_RTR_REMOTE : CAN_RTR_DATA;	// Data type config
+	canTxHeader.TransmitGlobalTime = DISABLE;
+
+	// The HAL does not modify the data, it only copies it to the mailbox.
+	return HAL_CAN_AddTxMessage( can_device, &canTxHeader, (uint8_t*)data, &canTxMailbox );
+
+}
+
+HAL_StatusTypeDef CANdalorian::transmittAsync( uint32_t address, const uint8_t *data, uint8_t size, uint32_t *ticket ){
+
+	return enqueue( address, 0, data, size, ticket );
+
+}
+
+HAL_StatusTypeDef CANdalorian::transmittAsync( const frame_t *frame, uint32_t *ticket ){
+
+	return enqueue( frame -> id, frame -> flags, frame -> data, frame -> dlc, ticket );
+
+}
+
+HAL_StatusTypeDef CANdalorian::enqueue( uint32_t address, uint8_t flags, const uint8_t *data, uint8_t size, uint32_t *ticket ){
+
+	frame_t *frame;
+	uint32_t next;
+	uint32_t fill;
+	uint32_t primask;
+
+	// We have to check if the address is valid.
+	if( !validAddress( address, flags ) ){
+
+		// If not return with error.
+		return HAL_ERROR;
+
+	}
+
+	// We can send 8 bytes with one transfer maximum.
+	if( size > 8 ){
+
+		size = 8;
+
+	}
+
+	// Without queue only the mailboxes can hold the message.
+	if( tx_buffer == NULL ){
+
+		if( transmittNoWait( address, data, size, flags ) != HAL_OK ){
+
+			return HAL_BUSY;
+
+		}
+
+		if( ticket != NULL ){
+
+			*ticket = tx_ticket;
 
 		}
 
+		tx_ticket++;
+
+		return HAL_OK;
+
 	}
 
-	// If the reading was successful we have to return the size of the message.
-	*size = canRxHeader.DLC;
+	primask = __get_PRIMASK();
+	__disable_irq();
 
-	// We also have to return the address of the destination node.
-	*addr = canRxHeader.StdId;
+	next = tx_head + 1;
+
+	if( next == tx_length ){
+
+		next = 0;
+
+	}
+
+	if( next == tx_tail ){
+
+		__set_PRIMASK( primask );
+		return HAL_BUSY;
+
+	}
+
+	frame = &tx_buffer[ tx_head ];
+
+	frame -> id = address;
+	frame -> dlc = size;
+	frame -> flags = flags & ( CANDALORIAN_IDE | CANDALORIAN_RTR );
+	frame -> timestamp = 0;
+	memcpy( frame -> data, data, size );
+
+	tx_head = next;
+
+	if( ticket != NULL ){
+
+		*ticket = tx_ticket;
+
+	}
+
+	tx_ticket++;
+
+	fill = next + tx_length - tx_tail;
+
+	if( fill >= tx_length ){
+
+		fill -= tx_length;
+
+	}
+
+	if( fill > can_stats.tx_peak ){
+
+		can_stats.tx_peak = fill;
+
+	}
+
+	// The queue is only used when every mailbox is full,
+	// so the message goes to a mailbox if there is a free one.
+	transmittRefill();
+
+	__set_PRIMASK( primask );
 
-	// Return with HAL_OK.
 	return HAL_OK;
 
 }
+
+uint32_t CANdalorian::transmittBatch( const frame_t *frames, uint32_t count, uint32_t *ticket ){
+
+	frame_t *frame;
+	uint32_t head;
+	uint32_t space;
+	uint32_t fill;
+	uint32_t primask;
+	uint32_t i;
+
+	// The messages are copied in one critical section, so a transmittAsync
+	// from an interrupt can not take the same slots or tickets.
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// Without queue only the mailboxes can hold the messages.
+	if( tx_buffer == NULL ){
+
+		if( ticket != NULL ){
+
+			*ticket = tx_ticket;
+
+		}
+
+		for( i = 0; i < count; i++ ){
+
+			if( enqueue( frames[ i ].id, frames[ i ].flags, frames[ i ].data, frames[ i ].dlc, NULL ) != HAL_OK ){
+
+				break;
+
+			}
+
+		}
+
+		__set_PRIMASK( primask );
+
+		return i;
+
+	}
+
+	if( ticket != NULL ){
+
+		*ticket = tx_ticket;
+
+	}
+
+	space = tx_tail + tx_length - tx_head - 1;
+
+	if( space >= tx_length ){
+
+		space -= tx_length;
+
+	}
+
+	if( count > space ){
+
+		count = space;
+
+	}
+
+	head = tx_head;
+
+	for( i = 0; i < count; i++ ){
+
+		if( !validAddress( frames[ i ].id, frames[ i ].flags ) ){
+
+			break;
+
+		}
+
+		frame = &tx_buffer[ head ];
+
+		*frame = frames[ i ];
+		frame -> flags &= CANDALORIAN_IDE | CANDALORIAN_RTR;
+		frame -> timestamp = 0;
+
+		// We can send 8 bytes with one transfer maximum.
+		if( frame -> dlc > 8 ){
+
+			frame -> dlc = 8;
+
+		}
+
+		head = ( head + 1 == tx_length ) ? 0 : head + 1;
+
+	}
+
+	count = i;
+
+	if( count == 0 ){
+
+		__set_PRIMASK( primask );
+		return 0;
+
+	}
+
+	tx_head = head;
+	tx_ticket += count;
+
+	fill = head + tx_length - tx_tail;
+
+	if( fill >= tx_length ){
+
+		fill -= tx_length;
+
+	}
+
+	if( fill > can_stats.tx_peak ){
+
+		can_stats.tx_peak = fill;
+
+	}
+
+	transmittRefill();
+
+	__set_PRIMASK( primask );
+
+	return count;
+
+}
+
+uint32_t CANdalorian::transmittPending(){
+
+	uint32_t res;
+
+	res = tx_head + tx_length - tx_tail;
+
+	if( res >= tx_length ){
+
+		res -= tx_length;
+
+	}
+
+	return res + 3 - HAL_CAN_GetTxMailboxesFreeLevel( can_device );
+
+}
+
+void CANdalorian::transmittAbort(){
+
+	uint32_t ticket;
+	uint32_t count;
+	uint32_t mailboxes;
+	uint32_t primask;
+
+	if( tx_buffer == NULL ){
+
+		return;
+
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// The queue is emptied first, otherwise the abort interrupts would refill the mailboxes.
+	while( tx_tail != tx_head ){
+
+		count = tx_head + tx_length - tx_tail;
+
+		if( count >= tx_length ){
+
+			count -= tx_length;
+
+		}
+
+		ticket = tx_ticket - count;
+
+		tx_tail = ( tx_tail + 1 == tx_length ) ? 0 : tx_tail + 1;
+
+		can_stats.tx_aborted++;
+
+		if( tx_callback != NULL ){
+
+			tx_callback( ticket, TX_ABORTED );
+
+		}
+
+	}
+
+	mailboxes = tx_mailbox_used;
+
+	__set_PRIMASK( primask );
+
+	// The messages of the mailboxes are reported from the abort interrupts.
+	if( mailboxes != 0 ){
+
+		HAL_CAN_AbortTxRequest( can_device, mailboxes );
+
+	}
+
+}
+
+void CANdalorian::setTransmittCallback( txCallback_t callback ){
+
+	tx_callback = callback;
+
+}
+
+uint32_t CANdalorian::available(){
+
+	// This variable will store the result.
+	uint32_t res;
+
+	// In interrupt mode the messages are in the recive ring.
+	if( rx_buffer != NULL ){
+
+		res = rx_head + rx_length - rx_tail;
+
+		if( res >= rx_length ){
+
+			res -= rx_length;
+
+		}
+
+		return res;
+
+	}
+
+	// Check if peripheral is in master or slave mode.
+	if( slave_address == 0 ){
+
+		// In master mode we have to read from FIFO0
+		res = HAL_CAN_GetRxFifoFillLevel( can_device, CAN_RX_FIFO0 );
+
+	}
+
+	else{
+
+		// In slave mode we have to read from FIFO1
+		res = HAL_CAN_GetRxFifoFillLevel( can_device, CAN_RX_FIFO1 );
+
+	}
+
+	// Return the result.
+	return res;
+}
+
+HAL_StatusTypeDef CANdalorian::read( uint8_t *data, uint8_t *size, uint32_t *addr ){
+
+	// This variable will store the message header
+	CAN_RxHeaderTypeDef canRxHeader;
+
+	// This variable will store the message from the recive ring
+	frame_t frame;
+
+	// In interrupt mode the message comes from the recive ring.
+	if( rx_buffer != NULL ){
+
+		if( read( &frame ) != HAL_OK ){
+
+			// If the ring is empty we have to zero out the size, and the address.
+			*size = 0;
+			*addr = 0;
+
+			return HAL_ERROR;
+
+		}
+
+		memcpy( data, frame.data, 8 );
+		*size = frame.dlc;
+		*addr = frame.id;
+
+		return HAL_OK;
+
+	}
+
+	// Check if peripheral is in master or slave mode.
+	if( slave_address == 0 ){
+
+		// Try to read out the message from the FIFO. In master mode we have to read from FIFO0.
+		if( HAL_CAN_GetRxMessage( can_device, CAN_RX_FIFO0, &canRxHeader, data ) != HAL_OK ){
+
+			// If there was a problem while reading out the data we have to zero out the size, and the address.
+			*size = 0;
+			*addr = 0;
+
+			// We have to return with an error.
+			return HAL_ERROR;
+
+		}
+
+	}
+
+	else{
+
+		// Try to read out the message from the FIFO. In slave mode we have to read from FIFO1.
+		if( HAL_CAN_GetRxMessage( can_device, CAN_RX_FIFO1, &canRxHeader, data ) != HAL_OK ){
+
+			// If there was a problem while reading out the data we have to zero out the size, and the address.
+			*size = 0;
+			*addr = 0;
+
+			// We have to return with an error.
+			return HAL_ERROR;
+
+		}
+
+	}
+
+	// If the reading was successful we have to return the size of the message.
+	*size = canRxHeader.DLC;
+
+	// We also have to return the address of the destination node.
+	*addr = ( canRxHeader.IDE == CAN_ID_EXT ) ? canRxHeader.ExtId : canRxHeader.StdId;
+
+	// Return with HAL_OK.
+	return HAL_OK;
+
+}
+
+HAL_StatusTypeDef CANdalorian::read( frame_t *frame ){
+
+	CAN_RxHeaderTypeDef canRxHeader;
+	uint32_t tail;
+
+	if( rx_buffer == NULL ){
+
+		frame -> timestamp = cycles();
+
+		if( HAL_CAN_GetRxMessage( can_device, ( slave_address == 0 ) ? CAN_RX_FIFO0 : CAN_RX_FIFO1, &canRxHeader, frame -> data ) != HAL_OK ){
+
+			return HAL_ERROR;
+
+		}
+
+		frame -> id = ( canRxHeader.IDE == CAN_ID_EXT ) ? canRxHeader.ExtId : canRxHeader.StdId;
+		frame -> dlc = ( canRxHeader.DLC > 8 ) ? 8 : canRxHeader.DLC;
+		frame -> flags = ( ( canRxHeader.IDE == CAN_ID_EXT ) ? CANDALORIAN_IDE : 0 ) | ( ( canRxHeader.RTR == CAN_RTR_REMOTE ) ? CANDALORIAN_RTR : 0 );
+
+		return HAL_OK;
+
+	}
+
+	tail = rx_tail;
+
+	if( tail == rx_head ){
+
+		return HAL_ERROR;
+
+	}
+
+	*frame = rx_buffer[ tail ];
+
+	// The slot can be overwritten by the interrupt only after the copy.
+	__DMB();
+
+	tail++;
+
+	if( tail == rx_length ){
+
+		tail = 0;
+
+	}
+
+	rx_tail = tail;
+
+	return HAL_OK;
+
+}
+
+uint32_t CANdalorian::readBatch( frame_t *frames, uint32_t max ){
+
+	uint32_t head;
+	uint32_t tail;
+	uint32_t count;
+	uint32_t part;
+	uint32_t i;
+
+	if( rx_buffer == NULL ){
+
+		count = HAL_CAN_GetRxFifoFillLevel( can_device, ( slave_address == 0 ) ? CAN_RX_FIFO0 : CAN_RX_FIFO1 );
+
+		if( count > max ){
+
+			count = max;
+
+		}
+
+		for( i = 0; i < count; i++ ){
+
+			if( read( &frames[ i ] ) != HAL_OK ){
+
+				break;
+
+			}
+
+		}
+
+		return i;
+
+	}
+
+	head = rx_head;
+	tail = rx_tail;
+
+	count = head + rx_length - tail;
+
+	if( count >= rx_length ){
+
+		count -= rx_length;
+
+	}
+
+	if( count > max ){
+
+		count = max;
+
+	}
+
+	// The messages can wrap around the end of the ring.
+	part = rx_length - tail;
+
+	if( part > count ){
+
+		part = count;
+
+	}
+
+	memcpy( frames, &rx_buffer[ tail ], part * sizeof( frame_t ) );
+	memcpy( &frames[ part ], rx_buffer, ( count - part ) * sizeof( frame_t ) );
+
+	// The slots can be overwritten by the interrupt only after the copy.
+	__DMB();
+
+	tail += count;
+
+	if( tail >= rx_length ){
+
+		tail -= rx_length;
+
+	}
+
+	rx_tail = tail;
+
+	return count;
+
+}
+
+CANdalorian::stats_t CANdalorian::stats(){
+
+	stats_t ret;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	ret = can_stats;
+
+	__set_PRIMASK( primask );
+
+	return ret;
+
+}
+
+void CANdalorian::resetStats(){
+
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	memset( &can_stats, 0, sizeof( can_stats ) );
+
+	__set_PRIMASK( primask );
+
+}
+
+void CANdalorian::startRecive(){
+
+	if( rx_buffer == NULL ){
+
+		return;
+
+	}
+
+	// The messages get a DWT timestamp.
+	cyclesBegin();
+
+	rx_head = 0;
+	rx_tail = 0;
+
+	if( HAL_CAN_ActivateNotification( can_device, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING |
+										CAN_IT_RX_FIFO0_OVERRUN | CAN_IT_RX_FIFO1_OVERRUN ) != HAL_OK ){
+
+		Error_Handler();
+
+	}
+
+}
+
+void CANdalorian::startTransmitt(){
+
+	if( tx_buffer == NULL ){
+
+		return;
+
+	}
+
+	tx_head = 0;
+	tx_tail = 0;
+	tx_mailbox_used = 0;
+
+	if( HAL_CAN_ActivateNotification( can_device, CAN_IT_TX_MAILBOX_EMPTY ) != HAL_OK ){
+
+		Error_Handler();
+
+	}
+
+}
+
+/// Returns the index of a mailbox
+///
+/// @param mailbox CAN_TX_MAILBOX0, CAN_TX_MAILBOX1 or CAN_TX_MAILBOX2.
+/// @returns 0, 1 or 2.
+static uint32_t mailboxIndex( uint32_t mailbox ){
+
+	if( mailbox == CAN_TX_MAILBOX0 ){
+
+		return 0;
+
+	}
+
+	return ( mailbox == CAN_TX_MAILBOX1 ) ? 1 : 2;
+
+}
+
+HAL_StatusTypeDef CANdalorian::mailboxAdd( const frame_t *frame, uint32_t *mailbox ){
+
+	// This variable will hold the message header.
+	CAN_TxHeaderTypeDef canTxHeader;
+
+	// Configure the header.
+	canTxHeader.DLC = frame -> dlc;		// size config
+	canTxHeader.StdId = frame -> id;	// address config
+	canTxHeader.ExtId = frame -> id;	// extended address config
+	canTxHeader.IDE = ( frame -> flags & CANDALORIAN_IDE ) ? CAN_ID_EXT : CAN_ID_STD;		// ID type config
+	canTxHeader.RTR = ( frame -> flags & CANDALORIAN_RTR ) ? CAN_RTR_REMOTE : CAN_RTR_DATA;	// Data type config
+	canTxHeader.TransmitGlobalTime = DISABLE;
+
+	// The HAL does not modify the data, it only copies it to the mailbox.
+	return HAL_CAN_AddTxMessage( can_device, &canTxHeader, (uint8_t*)frame -> data, mailbox );
+
+}
+
+void CANdalorian::transmittRefill(){
+
+	uint32_t mailbox;
+	uint32_t count;
+
+	while( ( tx_tail != tx_head ) && ( HAL_CAN_GetTxMailboxesFreeLevel( can_device ) > 0 ) ){
+
+		count = tx_head + tx_length - tx_tail;
+
+		if( count >= tx_length ){
+
+			count -= tx_length;
+
+		}
+
+		if( mailboxAdd( &tx_buffer[ tx_tail ], &mailbox ) != HAL_OK ){
+
+			break;
+
+		}
+
+		// The tickets are given in the order of the queue.
+		tx_mailbox_tickets[ mailboxIndex( mailbox ) ] = tx_ticket - count;
+		tx_mailbox_used |= mailbox;
+
+		tx_tail = ( tx_tail + 1 == tx_length ) ? 0 : tx_tail + 1;
+
+	}
+
+}
+
+void CANdalorian::transmittHandler( uint32_t mailbox, txResult_t result ){
+
+	uint32_t ticket;
+	bool used;
+
+	used = ( tx_mailbox_used & mailbox ) != 0;
+	ticket = tx_mailbox_tickets[ mailboxIndex( mailbox ) ];
+
+	tx_mailbox_used &= ~mailbox;
+
+	// The mailbox is refilled first, so the bus does not wait for the callback.
+	transmittRefill();
+
+	// The messages of transmittNoWait and transmitt are not reported.
+	if( !used ){
+
+		return;
+
+	}
+
+	switch( result ){
+
+		case TX_SENT:
+			can_stats.tx_frames++;
+			break;
+
+		case TX_ABORTED:
+			can_stats.tx_aborted++;
+			break;
+
+		default:
+			can_stats.tx_errors++;
+			break;
+
+	}
+
+	if( tx_callback != NULL ){
+
+		tx_callback( ticket, result );
+
+	}
+
+}
+
+void CANdalorian::reciveFifoHandler( uint32_t fifo ){
+
+	CAN_RxHeaderTypeDef canRxHeader;
+	frame_t *frame;
+	frame_t dropped;
+	uint32_t next;
+	uint32_t fill;
+
+	while( HAL_CAN_GetRxFifoFillLevel( can_device, fifo ) > 0 ){
+
+		next = rx_head + 1;
+
+		if( next == rx_length ){
+
+			next = 0;
+
+		}
+
+		// The message is read out even if the ring is full,
+		// otherwise the interrupt would fire again and again.
+		frame = ( next == rx_tail ) ? &dropped : &rx_buffer[ rx_head ];
+
+		frame -> timestamp = cycles();
+
+		if( HAL_CAN_GetRxMessage( can_device, fifo, &canRxHeader, frame -> data ) != HAL_OK ){
+
+			break;
+
+		}
+
+		if( frame == &dropped ){
+
+			can_stats.rx_dropped++;
+			continue;
+
+		}
+
+		frame -> id = ( canRxHeader.IDE == CAN_ID_EXT ) ? canRxHeader.ExtId : canRxHeader.StdId;
+		frame -> dlc = ( canRxHeader.DLC > 8 ) ? 8 : canRxHeader.DLC;
+		frame -> flags = ( ( canRxHeader.IDE == CAN_ID_EXT ) ? CANDALORIAN_IDE : 0 ) | ( ( canRxHeader.RTR == CAN_RTR_REMOTE ) ? CANDALORIAN_RTR : 0 );
+
+		// The message has to be in the ring before the reader can see it.
+		__DMB();
+
+		rx_head = next;
+
+		can_stats.rx_frames++;
+
+		fill = next + rx_length - rx_tail;
+
+		if( fill >= rx_length ){
+
+			fill -= rx_length;
+
+		}
+
+		if( fill > can_stats.rx_peak ){
+
+			can_stats.rx_peak = fill;
+
+		}
+
+	}
+
+}
+
+void CANdalorian::errorHandler(){
+
+	uint32_t error;
+
+	error = can_device -> ErrorCode;
+
+	if( error & HAL_CAN_ERROR_RX_FOV0 ){
+
+		can_stats.fifo0_overruns++;
+
+	}
+
+	if( error & HAL_CAN_ERROR_RX_FOV1 ){
+
+		can_stats.fifo1_overruns++;
+
+	}
+
+	// The HAL collects the errors, the counted ones are cleared.
+	can_device -> ErrorCode = error & ~( HAL_CAN_ERROR_RX_FOV0 | HAL_CAN_ERROR_RX_FOV1 |
+										HAL_CAN_ERROR_TX_ALST0 | HAL_CAN_ERROR_TX_TERR0 |
+										HAL_CAN_ERROR_TX_ALST1 | HAL_CAN_ERROR_TX_TERR1 |
+										HAL_CAN_ERROR_TX_ALST2 | HAL_CAN_ERROR_TX_TERR2 );
+
+	if( tx_buffer == NULL ){
+
+		return;
+
+	}
+
+	// Without automatic retransmission a lost arbitration or an error ends the message.
+	if( error & ( HAL_CAN_ERROR_TX_ALST0 | HAL_CAN_ERROR_TX_TERR0 ) ){
+
+		transmittHandler( CAN_TX_MAILBOX0, TX_ERROR );
+
+	}
+
+	if( error & ( HAL_CAN_ERROR_TX_ALST1 | HAL_CAN_ERROR_TX_TERR1 ) ){
+
+		transmittHandler( CAN_TX_MAILBOX1, TX_ERROR );
+
+	}
+
+	if( error & ( HAL_CAN_ERROR_TX_ALST2 | HAL_CAN_ERROR_TX_TERR2 ) ){
+
+		transmittHandler( CAN_TX_MAILBOX2, TX_ERROR );
+
+	}
+
+}
+
+CANdalorian *CANdalorian::findInstance( CAN_HandleTypeDef *hcan ){
+
+	uint32_t i;
+
+	for( i = 0; i < CANDALORIAN_MAX_INSTANCES; i++ ){
+
+		if( ( instances[ i ] != NULL ) && ( instances[ i ] -> can_device == hcan ) ){
+
+			return instances[ i ];
+
+		}
+
+	}
+
+	return NULL;
+
+}
+
+void CANdalorian::rxFifo0Callback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian *can;
+
+	can = findInstance( hcan );
+
+	if( ( can != NULL ) && ( can -> rx_buffer != NULL ) ){
+
+		can -> reciveFifoHandler( CAN_RX_FIFO0 );
+
+	}
+
+}
+
+void CANdalorian::rxFifo1Callback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian *can;
+
+	can = findInstance( hcan );
+
+	if( ( can != NULL ) && ( can -> rx_buffer != NULL ) ){
+
+		can -> reciveFifoHandler( CAN_RX_FIFO1 );
+
+	}
+
+}
+
+void CANdalorian::txCompleteCallback( CAN_HandleTypeDef *hcan, uint32_t mailbox ){
+
+	CANdalorian *can;
+
+	can = findInstance( hcan );
+
+	if( ( can != NULL ) && ( can -> tx_buffer != NULL ) ){
+
+		can -> transmittHandler( mailbox, TX_SENT );
+
+	}
+
+}
+
+void CANdalorian::txAbortCallback( CAN_HandleTypeDef *hcan, uint32_t mailbox ){
+
+	CANdalorian *can;
+
+	can = findInstance( hcan );
+
+	if( ( can != NULL ) && ( can -> tx_buffer != NULL ) ){
+
+		can -> transmittHandler( mailbox, TX_ABORTED );
+
+	}
+
+}
+
+void CANdalorian::errorCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian *can;
+
+	can = findInstance( hcan );
+
+	if( can != NULL ){
+
+		can -> errorHandler();
+
+	}
+
+}
+
+#ifndef CANDALORIAN_NO_HAL_CALLBACKS
+
+extern "C" void HAL_CAN_RxFifo0MsgPendingCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::rxFifo0Callback( hcan );
+
+}
+
+extern "C" void HAL_CAN_RxFifo1MsgPendingCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::rxFifo1Callback( hcan );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox0CompleteCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txCompleteCallback( hcan, CAN_TX_MAILBOX0 );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox1CompleteCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txCompleteCallback( hcan, CAN_TX_MAILBOX1 );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox2CompleteCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txCompleteCallback( hcan, CAN_TX_MAILBOX2 );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox0AbortCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txAbortCallback( hcan, CAN_TX_MAILBOX0 );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox1AbortCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txAbortCallback( hcan, CAN_TX_MAILBOX1 );
+
+}
+
+extern "C" void HAL_CAN_TxMailbox2AbortCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::txAbortCallback( hcan, CAN_TX_MAILBOX2 );
+
+}
+
+extern "C" void HAL_CAN_ErrorCallback( CAN_HandleTypeDef *hcan ){
+
+	CANdalorian::errorCallback( hcan );
+
+}
+
+#endif
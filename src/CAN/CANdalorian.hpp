@@ -22,6 +22,26 @@
 #ifndef STM32_CLASS_FACTORY_CANDALORIAN_HPP_
 #define STM32_CLASS_FACTORY_CANDALORIAN_HPP_
 
+#ifndef CANDALORIAN_MAX_INSTANCES
+/// Maximum number of CANdalorian objects
+///
+/// The HAL callbacks are routed to the CANdalorian objects through a table.
+/// This is the size of this table.
+#define CANDALORIAN_MAX_INSTANCES 3
+#endif
+
+/// Flag of the extended IDs in \link CANdalorian::frame_t \endlink
+#define CANDALORIAN_IDE 0x80
+
+/// Flag of the remote frames in \link CANdalorian::frame_t \endlink
+#define CANDALORIAN_RTR 0x40
+
+/// Largest standard ID
+#define CANDALORIAN_STD_ID_MAX 0x7FFUL
+
+/// Largest extended ID
+#define CANDALORIAN_EXT_ID_MAX 0x1FFFFFFFUL
+
 /// CANdalorian CAN driver class
 ///
 /// CANdalorian is a CAN driver library.
@@ -108,17 +128,105 @@
 /// }
 ///
 /// \endcode
+///
+/// By default available and read poll the hardware FIFO, that holds only
+/// 3 messages. At 1 Mbit/s full bus load it is full in about 400 us. With a
+/// recive ring( see \link CANdalorianBuffered \endlink ) the messages are
+/// moved to the ring from the FIFO0 and FIFO1 message pending interrupts,
+/// and available and read are served from the ring. In this mode the CAN RX0
+/// and RX1 interrupts have to be enabled in the NVIC. The callbacks are
+/// implemented in CANdalorian.cpp. If your project needs its own HAL CAN
+/// callbacks, define CANDALORIAN_NO_HAL_CALLBACKS and call
+/// \link rxFifo0Callback \endlink, \link rxFifo1Callback \endlink and
+/// \link errorCallback \endlink from your implementation.
+///
+/// The lost messages are counted in both places: the overruns of the
+/// hardware FIFOs( FOVR ) and the messages dropped by the full ring, see
+/// \link stats \endlink.
+///
+/// \link transmitt \endlink waits until the message is sent. With a
+/// transmitt queue \link transmittAsync \endlink returns immediately, the
+/// queue keeps all 3 mailboxes filled, and it is refilled from the TX mailbox
+/// complete interrupts. Every queued message gets a ticket, and the callback
+/// set by \link setTransmittCallback \endlink tells from the interrupt if it
+/// was sent or aborted. In this mode the CAN TX interrupt has to be enabled
+/// in the NVIC, and with CANDALORIAN_NO_HAL_CALLBACKS the TX mailbox callbacks
+/// have to call \link txCompleteCallback \endlink and \link txAbortCallback \endlink. Enable the Transmit Fifo Priority of the peripherial to keep
+/// the order of the messages, otherwise the mailboxes send them in the order
+/// of their IDs.
 class CANdalorian{
 
 public:
 
+	/// CAN message
+	///
+	/// This is how the messages are stored in the recive ring and in the
+	/// transmitt queue. The members follow each other without padding, only
+	/// the 2 bytes at the end keep the IDs of an array 4 byte aligned.
+	struct frame_t{
+		uint32_t id;			///< Identifier of the message, 11 or 29-bit long.
+		uint32_t timestamp;		///< DWT cycle counter at the reception, see \link cycles \endlink.
+		uint8_t data[ 8 ];		///< Data bytes of the message.
+		uint8_t dlc;			///< Number of data bytes.
+		uint8_t flags;			///< \link CANDALORIAN_IDE \endlink for extended ID, \link CANDALORIAN_RTR \endlink for remote frame.
+	};
+
+	static_assert( sizeof( frame_t ) == 20, "A message has to fit in 20 bytes." );
+
+	/// Result of a queued transmission
+	enum txResult_t{
+		TX_SENT,		///< The message is sent.
+		TX_ABORTED,		///< The message is aborted before it was sent.
+		TX_ERROR		///< The message is lost because of arbitration or transmission error.
+	};
+
+	/// Transmitt callback
+	///
+	/// It is called from interrupt for every message of the transmitt queue.
+	/// @param ticket the ticket of the message, see \link transmittAsync \endlink.
+	/// @param result the result of the transmission.
+	typedef void ( *txCallback_t )( uint32_t ticket, txResult_t result );
+
+	/// Statistics
+	///
+	/// The counters are 32-bit long and they wrap around.
+	struct stats_t{
+		uint32_t rx_frames;			///< Number of messages moved to the recive ring.
+		uint32_t rx_dropped;		///< Number of messages dropped, because the recive ring was full.
+		uint32_t rx_peak;			///< Highest number of messages in the recive ring.
+		uint32_t fifo0_overruns;	///< Number of messages lost in the hardware FIFO0( FOVR0 ).
+		uint32_t fifo1_overruns;	///< Number of messages lost in the hardware FIFO1( FOVR1 ).
+		uint32_t tx_frames;			///< Number of messages sent from the transmitt queue.
+		uint32_t tx_aborted;		///< Number of messages aborted from the transmitt queue.
+		uint32_t tx_errors;			///< Number of messages lost because of transmission error.
+		uint32_t tx_peak;			///< Highest number of messages in the transmitt queue.
+	};
+
 	/// CANdalorian object constructor
 	///
 	/// You can creat CANdalorian objects with this constructor.
 	/// @param can_device_p  pointer to a CAN peripherial
 	/// @note CAN1 usually good for master device, and CAN2 is usually good for slave.
+	/// @note If there are more objects than \link CANDALORIAN_MAX_INSTANCES \endlink, the Error_Handler is called.
 	CANdalorian( CAN_HandleTypeDef *can_device_p );
 
+	/// CANdalorian object constructor with recive ring and transmitt queue
+	///
+	/// With this constructor the messages are recived and transmitted from interrupts.
+	/// Usually it is easier to use \link CANdalorianBuffered \endlink.
+	/// @param can_device_p  pointer to a CAN peripherial
+	/// @param rx_buffer_p pointer to the recive ring, NULL to poll the hardware FIFO.
+	/// @param rx_length_p number of messages in the recive ring. It can hold rx_length_p - 1 messages.
+	/// @param tx_buffer_p pointer to the transmitt queue, NULL to use only the mailboxes.
+	/// @param tx_length_p number of messages in the transmitt queue. It can hold tx_length_p - 1 messages.
+	/// @note If there are more objects than \link CANDALORIAN_MAX_INSTANCES \endlink, the Error_Handler is called.
+	CANdalorian( CAN_HandleTypeDef *can_device_p, frame_t *rx_buffer_p, uint32_t rx_length_p, frame_t *tx_buffer_p = NULL, uint32_t tx_length_p = 0 );
+
+	/// CANdalorian object destructor
+	///
+	/// It removes the object from the table of the HAL callbacks.
+	~CANdalorian();
+
 	/// Initializtation function for master mode
 	///
 	/// If you want to use the CAN peripherial with master mode( usually CAN1 )
@@ -130,7 +238,7 @@ public:
 	/// If you want to use the CAN peripherial with slave mode( usually CAN2 )
 	/// you have to use this initialization function.
 	/// @param slave_address_p the address of the slave device.
-	/// @warning This driver only works with 11-bit Standard ID-s.
+	/// @warning The slave address has to be an 11-bit Standard ID.
 	void beginSlave( uint32_t slave_address_p );
 
 	/// Enable loop back mode
@@ -149,7 +257,8 @@ public:
 	/// Returns the number of available messages
 	///
 	/// You can read the number of available messages in the FIFO.
-	/// Each FIFO can store 3 CAN messages maximum.
+	/// Each FIFO can store 3 CAN messages maximum. With recive ring it
+	/// returns the number of messages in the ring.
 	/// @returns the number of available messages in the FIFO
 	uint32_t available();
 
@@ -160,12 +269,29 @@ public:
 	/// @param data pointer to an array which will store the CAN message. This array has to be 8 byte long!
 	/// @param size pointer to a 8-bit number. This number will tell you how much byte long is the CAN message.
 	/// @param addr pointer to a 32-bit number. This number will tell you the address of the node that has to recive this message.
+	/// For extended messages it is the 29-bit ID, use \link read( frame_t* ) \endlink to tell them apart.
 	HAL_StatusTypeDef read( uint8_t *data, uint8_t *size, uint32_t *addr );
 
+	/// Read one message
+	///
+	/// @param frame the message is copied here.
+	/// @returns HAL_OK if there was a message, HAL_ERROR otherwise.
+	HAL_StatusTypeDef read( frame_t *frame );
+
+	/// Read many messages at once
+	///
+	/// With recive ring the messages are copied in one pass and the ring is
+	/// released once for all of them. Without it the hardware FIFO is emptied.
+	/// @param frames the messages are copied here.
+	/// @param max maximum number of messages to read.
+	/// @returns the number of messages read, 0 if there was none.
+	uint32_t readBatch( frame_t *frames, uint32_t max );
+
 	/// Transmitt a message to a node
 	///
 	/// With this function you can transmitt a message to a CAN node.
 	/// The function has a timeout and this is 100ms by default.
+	/// It returns as soon as the message is sent.
 	/// @param address the address of the node where the message has to arrive
 	/// @param data pointer to the data that has to be sent. With one transfer you can only send 8 bytes maximum.
 	/// @param size the number of bytes in the message. It can send maximum 8 bytes.
@@ -178,8 +304,135 @@ public:
 	/// @param address the address of the node where the message has to arrive
 	/// @param data pointer to the data that has to be sent. With one transfer you can only send 8 bytes maximum.
 	/// @param size the number of bytes in the message. It can send maximum 8 bytes.
+	/// @param timeout the timeout in ms.
 	HAL_StatusTypeDef transmitt( uint32_t address, uint8_t *data, uint8_t size, uint32_t timeout );
 
+	/// Transmitt a message with standard or extended ID
+	///
+	/// It waits until the message is sent, like the other transmitt functions.
+	/// @param frame the message. The flags select the ID type and the remote frame.
+	/// @param timeout the timeout in ms.
+	/// @returns HAL_OK if the message is sent, HAL_ERROR if the ID or the DLC is invalid
+	/// or every mailbox is full, HAL_TIMEOUT if it was aborted.
+	HAL_StatusTypeDef transmitt( const frame_t *frame, uint32_t timeout = 100 );
+
+	/// Returns the number of free transmitt mailboxes
+	///
+	/// The peripherial has 3 mailboxes. If it is not 0,
+	/// \link transmittNoWait \endlink can queue a message.
+	/// @returns the number of free mailboxes.
+	uint32_t transmittFree();
+
+	/// Queue a message without waiting for the transmission
+	///
+	/// The message is put to a free mailbox, and the function returns
+	/// immediately. It does not abort the message if it can not be sent.
+	/// @param address the address of the node where the message has to arrive
+	/// @param data pointer to the data that has to be sent. With one transfer you can only send 8 bytes maximum.
+	/// @param size the number of bytes in the message. It can send maximum 8 bytes.
+	/// @param flags \link CANDALORIAN_IDE \endlink for 29-bit address, \link CANDALORIAN_RTR \endlink for remote frame.
+	/// @returns HAL_OK if the message is queued, HAL_ERROR if the address is invalid or every mailbox is full.
+	HAL_StatusTypeDef transmittNoWait( uint32_t address, const uint8_t *data, uint8_t size, uint8_t flags = 0 );
+
+	/// Queue a message to the transmitt queue
+	///
+	/// The message goes to a free mailbox, or it waits in the transmitt queue
+	/// until a mailbox gets free. The function never waits. Without transmitt
+	/// queue it works like \link transmittNoWait \endlink, and there is no callback.
+	/// @param address the address of the node where the message has to arrive
+	/// @param data pointer to the data that has to be sent. With one transfer you can only send 8 bytes maximum.
+	/// @param size the number of bytes in the message. It can send maximum 8 bytes.
+	/// @param ticket if it is not NULL, the ticket of the message is written here.
+	/// The tickets are increasing numbers, the callback gets the same number.
+	/// @returns HAL_OK if the message is queued, HAL_ERROR if the address is invalid,
+	/// HAL_BUSY if the queue is full.
+	HAL_StatusTypeDef transmittAsync( uint32_t address, const uint8_t *data, uint8_t size, uint32_t *ticket = NULL );
+
+	/// Queue a message with standard or extended ID to the transmitt queue
+	///
+	/// It works like the other transmittAsync.
+	/// @param frame the message. The flags select the ID type and the remote frame.
+	/// @param ticket if it is not NULL, the ticket of the message is written here.
+	/// @returns HAL_OK if the message is queued, HAL_ERROR if the ID is invalid,
+	/// HAL_BUSY if the queue is full.
+	HAL_StatusTypeDef transmittAsync( const frame_t *frame, uint32_t *ticket = NULL );
+
+	/// Queue many messages at once
+	///
+	/// As many messages go to the free mailboxes and the transmitt queue as
+	/// they can hold. The messages are copied and the queue is updated in one
+	/// critical section, so the interrupts are disabled for the copy of the
+	/// whole batch. The function never waits.
+	/// @param frames the messages. The flags select the ID type and the remote frame.
+	/// @param count number of messages.
+	/// @param ticket if it is not NULL, the ticket of the first message is written here.
+	/// The next messages get the next tickets.
+	/// @returns the number of messages queued. It stops at the first message with invalid ID.
+	uint32_t transmittBatch( const frame_t *frames, uint32_t count, uint32_t *ticket = NULL );
+
+	/// Returns the number of messages that are not finished yet
+	///
+	/// @returns the number of messages in the transmitt queue and in the mailboxes.
+	uint32_t transmittPending();
+
+	/// Abort every message of the transmitt queue
+	///
+	/// The messages in the mailboxes are aborted, unless they are on the bus
+	/// already. The callback is called for every message.
+	void transmittAbort();
+
+	/// Set the transmitt callback
+	///
+	/// @param callback the function to call from interrupt when a message of
+	/// the transmitt queue is finished, NULL to disable it.
+	void setTransmittCallback( txCallback_t callback );
+
+	/// Returns the statistics
+	///
+	/// @returns a copy of the counters.
+	stats_t stats();
+
+	/// Clear the statistics
+	void resetStats();
+
+	/// FIFO0 message pending callback
+	///
+	/// This function has to be called from HAL_CAN_RxFifo0MsgPendingCallback.
+	/// It moves the messages from the FIFO0 to the recive ring of the object
+	/// that belongs to hcan.
+	/// @param hcan pointer to the CAN handle that recived the message.
+	static void rxFifo0Callback( CAN_HandleTypeDef *hcan );
+
+	/// FIFO1 message pending callback
+	///
+	/// This function has to be called from HAL_CAN_RxFifo1MsgPendingCallback.
+	/// @param hcan pointer to the CAN handle that recived the message.
+	static void rxFifo1Callback( CAN_HandleTypeDef *hcan );
+
+	/// TX mailbox complete callback
+	///
+	/// This function has to be called from HAL_CAN_TxMailbox0CompleteCallback,
+	/// HAL_CAN_TxMailbox1CompleteCallback and HAL_CAN_TxMailbox2CompleteCallback.
+	/// It refills the mailboxes from the transmitt queue.
+	/// @param hcan pointer to the CAN handle that sent the message.
+	/// @param mailbox CAN_TX_MAILBOX0, CAN_TX_MAILBOX1 or CAN_TX_MAILBOX2.
+	static void txCompleteCallback( CAN_HandleTypeDef *hcan, uint32_t mailbox );
+
+	/// TX mailbox abort callback
+	///
+	/// This function has to be called from HAL_CAN_TxMailbox0AbortCallback,
+	/// HAL_CAN_TxMailbox1AbortCallback and HAL_CAN_TxMailbox2AbortCallback.
+	/// @param hcan pointer to the CAN handle that aborted the message.
+	/// @param mailbox CAN_TX_MAILBOX0, CAN_TX_MAILBOX1 or CAN_TX_MAILBOX2.
+	static void txAbortCallback( CAN_HandleTypeDef *hcan, uint32_t mailbox );
+
+	/// Error callback
+	///
+	/// This function has to be called from HAL_CAN_ErrorCallback. It counts
+	/// the FIFO overruns and the failed transmissions.
+	/// @param hcan pointer to the CAN handle that detected the error.
+	static void errorCallback( CAN_HandleTypeDef *hcan );
+
 private:
 
 	/// This pointer will store the device data
@@ -191,6 +444,142 @@ private:
 	/// Filter configuration
 	CAN_FilterTypeDef filter;
 
+	/// Recive ring, NULL in polling mode
+	frame_t *rx_buffer = NULL;
+
+	/// Number of messages in the recive ring
+	uint32_t rx_length = 0;
+
+	/// The next message is written here by the interrupt
+	volatile uint32_t rx_head = 0;
+
+	/// The next message is read from here
+	volatile uint32_t rx_tail = 0;
+
+	/// Transmitt queue, NULL without queue
+	frame_t *tx_buffer = NULL;
+
+	/// Number of messages in the transmitt queue
+	uint32_t tx_length = 0;
+
+	/// The next message is written here
+	volatile uint32_t tx_head = 0;
+
+	/// The next message is moved to a mailbox from here
+	volatile uint32_t tx_tail = 0;
+
+	/// Ticket of the next message
+	volatile uint32_t tx_ticket = 0;
+
+	/// Tickets of the messages in the mailboxes
+	volatile uint32_t tx_mailbox_tickets[ 3 ] = { 0 };
+
+	/// Bit mask of the mailboxes that have a message from the transmitt queue
+	volatile uint32_t tx_mailbox_used = 0;
+
+	/// Transmitt callback
+	txCallback_t tx_callback = NULL;
+
+	/// Statistics
+	stats_t can_stats = {};
+
+	/// Objects to route the HAL callbacks to
+	static CANdalorian *instances[ CANDALORIAN_MAX_INSTANCES ];
+
+	/// Find the object of a CAN handle
+	///
+	/// @param hcan pointer to the CAN handle.
+	/// @returns the object, NULL if there is no object for the handle.
+	static CANdalorian *findInstance( CAN_HandleTypeDef *hcan );
+
+	/// Register the object for the HAL callbacks
+	///
+	/// The Error_Handler is called if the table is full.
+	void registerInstance();
+
+	/// Check an address
+	///
+	/// @param address the address.
+	/// @param flags the flags of the message.
+	/// @returns true if the address fits in the standard or extended ID.
+	static bool validAddress( uint32_t address, uint8_t flags );
+
+	/// Put a message to the transmitt queue
+	///
+	/// @param address the address.
+	/// @param flags the flags of the message.
+	/// @param data pointer to the data.
+	/// @param size the number of bytes.
+	/// @param ticket output for the ticket, it can be NULL.
+	/// @returns the result of \link transmittAsync \endlink.
+	HAL_StatusTypeDef enqueue( uint32_t address, uint8_t flags, const uint8_t *data, uint8_t size, uint32_t *ticket );
+
+	/// Enable the interrupts of the recive ring, after the peripherial is started
+	void startRecive();
+
+	/// Move the messages from a hardware FIFO to the recive ring
+	///
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	void reciveFifoHandler( uint32_t fifo );
+
+	/// Enable the interrupts of the transmitt queue, after the peripherial is started
+	void startTransmitt();
+
+	/// Put a message to a free mailbox
+	///
+	/// @param frame the message.
+	/// @param mailbox output, the mailbox of the message.
+	/// @returns the status of HAL_CAN_AddTxMessage.
+	HAL_StatusTypeDef mailboxAdd( const frame_t *frame, uint32_t *mailbox );
+
+	/// Report a finished message of a mailbox and refill the mailboxes
+	///
+	/// It has to be called with disabled interrupts or from interrupt.
+	/// @param mailbox CAN_TX_MAILBOX0, CAN_TX_MAILBOX1 or CAN_TX_MAILBOX2.
+	/// @param result the result of the transmission.
+	void transmittHandler( uint32_t mailbox, txResult_t result );
+
+	/// Move the messages from the transmitt queue to the free mailboxes
+	void transmittRefill();
+
+	/// Count the errors reported by the HAL
+	void errorHandler();
+
+};
+
+/// CANdalorian with recive ring and transmitt queue
+///
+/// The messages are moved from the hardware FIFOs to the ring, and from the
+/// queue to the mailboxes in interrupts.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// // It can recive 63 and queue 15 messages.
+/// CANdalorianBuffered< 64, 16 > canMaster( &hcan1 );
+///
+/// \endcode
+/// @tparam RX_LENGTH number of messages in the recive ring. It can hold RX_LENGTH - 1 messages.
+/// @tparam TX_LENGTH number of messages in the transmitt queue. It can hold TX_LENGTH - 1 messages.
+template< uint32_t RX_LENGTH = 32, uint32_t TX_LENGTH = 16 >
+class CANdalorianBuffered : public CANdalorian{
+
+	static_assert( RX_LENGTH > 1, "The recive ring has to be at least 2 messages long." );
+	static_assert( TX_LENGTH > 1, "The transmitt queue has to be at least 2 messages long." );
+
+public:
+
+	/// CANdalorianBuffered object constructor
+	///
+	/// @param can_device_p  pointer to a CAN peripherial
+	CANdalorianBuffered( CAN_HandleTypeDef *can_device_p ) : CANdalorian( can_device_p, recive_storage, RX_LENGTH, transmitt_storage, TX_LENGTH ){}
+
+private:
+
+	frame_t recive_storage[ RX_LENGTH ];
+
+	frame_t transmitt_storage[ TX_LENGTH ];
+
 };
 
 
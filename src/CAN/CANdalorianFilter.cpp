@@ -0,0 +1,433 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#include "CANdalorianFilter.hpp"
+
+/// Largest standard ID
+#define CANDALORIAN_FILTER_STD_MAX 0x7FFUL
+
+/// Largest extended ID
+#define CANDALORIAN_FILTER_EXT_MAX 0x1FFFFFFFUL
+
+CANdalorianFilter::CANdalorianFilter(){
+
+	clear();
+
+}
+
+bool CANdalorianFilter::addId( uint32_t id, uint32_t fifo ){
+
+	return addRange( id, id, fifo );
+
+}
+
+bool CANdalorianFilter::addRange( uint32_t first, uint32_t last, uint32_t fifo ){
+
+	if( ( first > last ) || ( last > CANDALORIAN_FILTER_STD_MAX ) ){
+
+		return false;
+
+	}
+
+	return insert( first, last, fifo, false );
+
+}
+
+bool CANdalorianFilter::addExtendedId( uint32_t id, uint32_t fifo ){
+
+	return addExtendedRange( id, id, fifo );
+
+}
+
+bool CANdalorianFilter::addExtendedRange( uint32_t first, uint32_t last, uint32_t fifo ){
+
+	if( ( first > last ) || ( last > CANDALORIAN_FILTER_EXT_MAX ) ){
+
+		return false;
+
+	}
+
+	return insert( first, last, fifo, true );
+
+}
+
+void CANdalorianFilter::clear(){
+
+	range_count = 0;
+
+}
+
+void CANdalorianFilter::acceptRemote( bool enable ){
+
+	remote = enable;
+
+}
+
+uint32_t CANdalorianFilter::banks(){
+
+	return pack( NULL, 0, 0 );
+
+}
+
+HAL_StatusTypeDef CANdalorianFilter::program( CAN_HandleTypeDef *hcan, uint32_t first_bank, uint32_t bank_count, uint32_t slave_start_bank ){
+
+	CAN_FilterTypeDef filter;
+	int32_t used;
+	uint32_t bank;
+
+	if( ( hcan == NULL ) || ( first_bank + bank_count > CANDALORIAN_FILTER_BANKS ) || ( banks() > bank_count ) ){
+
+		return HAL_ERROR;
+
+	}
+
+	used = pack( hcan, first_bank, slave_start_bank );
+
+	if( used < 0 ){
+
+		return HAL_ERROR;
+
+	}
+
+	// The rest of the banks are disabled, so the old filters do not accept anything.
+	filter.FilterMode = CAN_FILTERMODE_IDMASK;
+	filter.FilterScale = CAN_FILTERSCALE_32BIT;
+	filter.FilterIdHigh = 0x0000;
+	filter.FilterIdLow = 0x0000;
+	filter.FilterMaskIdHigh = 0x0000;
+	filter.FilterMaskIdLow = 0x0000;
+	filter.FilterFIFOAssignment = CAN_RX_FIFO0;
+	filter.FilterActivation = CAN_FILTER_DISABLE;
+	filter.SlaveStartFilterBank = slave_start_bank;
+
+	for( bank = first_bank + used; bank < first_bank + bank_count; bank++ ){
+
+		filter.FilterBank = bank;
+
+		if( HAL_CAN_ConfigFilter( hcan, &filter ) != HAL_OK ){
+
+			return HAL_ERROR;
+
+		}
+
+	}
+
+	return HAL_OK;
+
+}
+
+bool CANdalorianFilter::insert( uint32_t first, uint32_t last, uint32_t fifo, bool extended ){
+
+	range_t *range;
+	uint32_t pos;
+	uint32_t i;
+
+	if( ( fifo != CAN_RX_FIFO0 ) && ( fifo != CAN_RX_FIFO1 ) ){
+
+		return false;
+
+	}
+
+	// The overlapping and neighbouring ranges of the same kind are merged to the new one.
+	i = 0;
+
+	while( i < range_count ){
+
+		range = &ranges[ i ];
+
+		if( ( range -> fifo == fifo ) && ( ( range -> extended != 0 ) == extended ) &&
+			( range -> first <= last + 1 ) && ( first <= range -> last + 1 ) ){
+
+			first = ( range -> first < first ) ? range -> first : first;
+			last = ( range -> last > last ) ? range -> last : last;
+
+			memmove( range, range + 1, ( range_count - i - 1 ) * sizeof( range_t ) );
+			range_count--;
+
+			continue;
+
+		}
+
+		i++;
+
+	}
+
+	// If a range was merged, there is room for the new one.
+	if( range_count >= CANDALORIAN_FILTER_MAX_RANGES ){
+
+		return false;
+
+	}
+
+	// The ranges are sorted by FIFO, type and first ID.
+	for( pos = 0; pos < range_count; pos++ ){
+
+		range = &ranges[ pos ];
+
+		if( ( range -> fifo > fifo ) ||
+			( ( range -> fifo == fifo ) && ( ( range -> extended != 0 ) > extended ) ) ||
+			( ( range -> fifo == fifo ) && ( ( range -> extended != 0 ) == extended ) && ( range -> first > first ) ) ){
+
+			break;
+
+		}
+
+	}
+
+	memmove( &ranges[ pos + 1 ], &ranges[ pos ], ( range_count - pos ) * sizeof( range_t ) );
+	range_count++;
+
+	ranges[ pos ].first = first;
+	ranges[ pos ].last = last;
+	ranges[ pos ].fifo = fifo;
+	ranges[ pos ].extended = extended ? 1 : 0;
+
+	return true;
+
+}
+
+int32_t CANdalorianFilter::pack( CAN_HandleTypeDef *hcan, uint32_t first_bank, uint32_t slave_start_bank ){
+
+	packer_t packer;
+	uint32_t rtr16;
+	uint32_t rtr32;
+	bool list;
+	bank_t list16;
+	bank_t mask16;
+	bank_t list32;
+	bank_t mask32;
+	range_t *range;
+	uint32_t fifo;
+	uint32_t pass;
+	uint32_t first;
+	uint32_t size;
+	uint32_t i;
+
+	packer.hcan = hcan;
+	packer.next_bank = first_bank;
+	packer.slave_start_bank = slave_start_bank;
+	packer.failed = false;
+
+	// The RTR bit has to match only if the remote frames are not accepted.
+	// The list filters compare it always, so then only mask filters are used.
+	rtr16 = remote ? 0 : 0x10;
+	rtr32 = remote ? 0 : 0x2;
+
+	for( fifo = CAN_RX_FIFO0; fifo <= CAN_RX_FIFO1; fifo++ ){
+
+		list16 = { CAN_FILTERMODE_IDLIST, CAN_FILTERSCALE_16BIT, fifo, 0, { 0 } };
+		mask16 = { CAN_FILTERMODE_IDMASK, CAN_FILTERSCALE_16BIT, fifo, 0, { 0 } };
+		list32 = { CAN_FILTERMODE_IDLIST, CAN_FILTERSCALE_32BIT, fifo, 0, { 0 } };
+		mask32 = { CAN_FILTERMODE_IDMASK, CAN_FILTERSCALE_32BIT, fifo, 0, { 0 } };
+
+		// Pass 0: extended IDs and blocks, pass 1: standard blocks, pass 2: standard IDs.
+		// The standard IDs come last, so they can fill the half filled banks.
+		for( pass = 0; pass < 3; pass++ ){
+
+			for( i = 0; i < range_count; i++ ){
+
+				range = &ranges[ i ];
+
+				if( ( range -> fifo != fifo ) || ( ( range -> extended != 0 ) != ( pass == 0 ) ) ){
+
+					continue;
+
+				}
+
+				first = range -> first;
+
+				while( true ){
+
+					size = blockSize( first, range -> last );
+					list = ( size == 1 ) && !remote;
+
+					// 32-bit format: STID[10:0] EXID[17:0] IDE RTR 0, the extended ID fills the first 29 bits.
+					// 16-bit format: STID[10:0] RTR IDE EXID[17:15]
+					if( pass == 0 ){
+
+						if( list ){
+
+							put( &packer, &list32, ( first << 3 ) | 0x4 );
+
+						}
+
+						else{
+
+							// IDE has to match too.
+							put( &packer, &mask32, ( first << 3 ) | 0x4 );
+							put( &packer, &mask32, ( ( ~( size - 1 ) & CANDALORIAN_FILTER_EXT_MAX ) << 3 ) | 0x4 | rtr32 );
+
+						}
+
+					}
+
+					else if( ( pass == 1 ) && !list ){
+
+						put( &packer, &mask16, first << 5 );
+						put( &packer, &mask16, ( ( ~( size - 1 ) & CANDALORIAN_FILTER_STD_MAX ) << 5 ) | 0x8 | rtr16 );
+
+					}
+
+					else if( ( pass == 2 ) && list ){
+
+						if( list32.count == 1 ){
+
+							put( &packer, &list32, first << 21 );
+
+						}
+
+						else if( mask16.count == 2 ){
+
+							put( &packer, &mask16, first << 5 );
+							put( &packer, &mask16, ( CANDALORIAN_FILTER_STD_MAX << 5 ) | 0x18 );
+
+						}
+
+						else{
+
+							put( &packer, &list16, first << 5 );
+
+						}
+
+					}
+
+					if( range -> last - first < size ){
+
+						break;
+
+					}
+
+					first += size;
+
+				}
+
+			}
+
+		}
+
+		// The half filled banks of the FIFO.
+		if( list16.count > 0 ){
+
+			write( &packer, &list16 );
+
+		}
+
+		if( mask16.count > 0 ){
+
+			write( &packer, &mask16 );
+
+		}
+
+		if( list32.count > 0 ){
+
+			write( &packer, &list32 );
+
+		}
+
+	}
+
+	if( packer.failed ){
+
+		return -1;
+
+	}
+
+	return packer.next_bank - first_bank;
+
+}
+
+void CANdalorianFilter::put( packer_t *packer, bank_t *bank, uint32_t value ){
+
+	bank -> regs[ bank -> count++ ] = value;
+
+	// A bank has 4 registers in 16-bit scale and 2 in 32-bit scale.
+	if( bank -> count == ( ( bank -> scale == CAN_FILTERSCALE_16BIT ) ? 4U : 2U ) ){
+
+		write( packer, bank );
+
+	}
+
+}
+
+void CANdalorianFilter::write( packer_t *packer, bank_t *bank ){
+
+	CAN_FilterTypeDef filter;
+	uint32_t capacity;
+	uint32_t step;
+	uint32_t i;
+
+	capacity = ( bank -> scale == CAN_FILTERSCALE_16BIT ) ? 4 : 2;
+
+	// In 16-bit mask mode a filter is an ID and mask pair.
+	step = ( ( bank -> scale == CAN_FILTERSCALE_16BIT ) && ( bank -> mode == CAN_FILTERMODE_IDMASK ) ) ? 2 : 1;
+
+	for( i = bank -> count; i < capacity; i++ ){
+
+		bank -> regs[ i ] = bank -> regs[ i % step ];
+
+	}
+
+	bank -> count = 0;
+
+	if( packer -> hcan != NULL ){
+
+		// The registers are mapped like in HAL_CAN_ConfigFilter.
+		if( bank -> scale == CAN_FILTERSCALE_16BIT ){
+
+			filter.FilterIdLow = bank -> regs[ 0 ];
+			filter.FilterMaskIdLow = bank -> regs[ 1 ];
+			filter.FilterIdHigh = bank -> regs[ 2 ];
+			filter.FilterMaskIdHigh = bank -> regs[ 3 ];
+
+		}
+
+		else{
+
+			filter.FilterIdHigh = bank -> regs[ 0 ] >> 16;
+			filter.FilterIdLow = bank -> regs[ 0 ] & 0xFFFF;
+			filter.FilterMaskIdHigh = bank -> regs[ 1 ] >> 16;
+			filter.FilterMaskIdLow = bank -> regs[ 1 ] & 0xFFFF;
+
+		}
+
+		filter.FilterBank = packer -> next_bank;
+		filter.FilterMode = bank -> mode;
+		filter.FilterScale = bank -> scale;
+		filter.FilterFIFOAssignment = bank -> fifo;
+		filter.FilterActivation = CAN_FILTER_ENABLE;
+		filter.SlaveStartFilterBank = packer -> slave_start_bank;
+
+		if( HAL_CAN_ConfigFilter( packer -> hcan, &filter ) != HAL_OK ){
+
+			packer -> failed = true;
+
+		}
+
+	}
+
+	packer -> next_bank++;
+
+}
+
+uint32_t CANdalorianFilter::blockSize( uint32_t first, uint32_t last ){
+
+	uint32_t size;
+
+	// The block is aligned to its size, so the lowest set bit of the first ID limits it.
+	size = ( first == 0 ) ? ( CANDALORIAN_FILTER_EXT_MAX + 1 ) : ( first & ( ~first + 1 ) );
+
+	while( size - 1 > last - first ){
+
+		size >>= 1;
+
+	}
+
+	return size;
+
+}
@@ -0,0 +1,216 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_CANDALORIANFILTER_HPP_
+#define STM32_CLASS_FACTORY_CANDALORIANFILTER_HPP_
+
+#include<stdlib.h>
+#include<string.h>
+#include<inttypes.h>
+#include<stdint.h>
+
+#include "stm32f4xx_hal.h"
+
+#ifndef CANDALORIAN_FILTER_MAX_RANGES
+/// Maximum number of ID ranges in a CANdalorianFilter
+///
+/// The overlapping and neighbouring ranges of the same FIFO are merged,
+/// so they take only one place.
+#define CANDALORIAN_FILTER_MAX_RANGES 32
+#endif
+
+/// Number of filter banks of the bxCAN
+#define CANDALORIAN_FILTER_BANKS 28
+
+/// Acceptance filter manager
+///
+/// CANdalorianFilter programs the filter banks of the bxCAN from a set of
+/// standard and extended IDs and ID ranges, so the unwanted messages are
+/// dropped by the hardware, without interrupt and software check.
+///
+/// The ranges are split into aligned blocks, a block is one filter: a single
+/// ID goes to a list filter, a longer block to a mask filter. The filters are
+/// packed into the fewest banks:
+///
+/// | Filter                | Scale  | Mode | Filters / bank |
+/// |-----------------------|--------|------|----------------|
+/// | standard ID           | 16-bit | list | 4              |
+/// | standard ID block     | 16-bit | mask | 2              |
+/// | extended ID           | 32-bit | list | 2              |
+/// | extended ID block     | 32-bit | mask | 1              |
+///
+/// The free place of a half filled 32-bit list or 16-bit mask bank is
+/// used for a standard ID. The filters accept exactly the requested IDs,
+/// by default only data frames. With \link acceptRemote \endlink the
+/// remote frames pass too, then the single IDs need mask filters, so
+/// they take twice as much room.
+///
+/// @note If an ID is requested for both FIFOs, the message goes only to one
+/// of them, to the filter with the higher priority.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// CANdalorianBuffered<> canMaster( &hcan1 );
+/// CANdalorianFilter filters;
+///
+/// int main(){
+///
+/// canMaster.begin();
+///
+/// filters.addId( 0x100 );
+/// filters.addRange( 0x200, 0x27F );
+/// filters.addExtendedId( 0x18FF1234, CAN_RX_FIFO1 );
+///
+/// // CAN1 gets every bank, it replaces the accept all filter of begin.
+/// filters.program( &hcan1 );
+///
+/// }
+///
+/// \endcode
+class CANdalorianFilter{
+
+public:
+
+	/// CANdalorianFilter object constructor
+	///
+	/// The new object does not accept any ID.
+	CANdalorianFilter();
+
+	/// Accept a standard ID
+	///
+	/// @param id the ID, 0 - 0x7FF.
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	/// @returns true if the ID is added, false if it is invalid or there is no room.
+	bool addId( uint32_t id, uint32_t fifo = CAN_RX_FIFO0 );
+
+	/// Accept a range of standard IDs
+	///
+	/// @param first the first ID of the range.
+	/// @param last the last ID of the range, it is accepted too. Maximum 0x7FF.
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	/// @returns true if the range is added, false if it is invalid or there is no room.
+	bool addRange( uint32_t first, uint32_t last, uint32_t fifo = CAN_RX_FIFO0 );
+
+	/// Accept an extended ID
+	///
+	/// @param id the ID, 0 - 0x1FFFFFFF.
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	/// @returns true if the ID is added, false if it is invalid or there is no room.
+	bool addExtendedId( uint32_t id, uint32_t fifo = CAN_RX_FIFO0 );
+
+	/// Accept a range of extended IDs
+	///
+	/// @param first the first ID of the range.
+	/// @param last the last ID of the range, it is accepted too. Maximum 0x1FFFFFFF.
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	/// @returns true if the range is added, false if it is invalid or there is no room.
+	bool addExtendedRange( uint32_t first, uint32_t last, uint32_t fifo = CAN_RX_FIFO0 );
+
+	/// Remove every ID
+	///
+	/// It does not change \link acceptRemote \endlink.
+	void clear();
+
+	/// Accept the remote frames of the IDs too
+	///
+	/// @param enable true to accept the remote frames, false for data frames only.
+	void acceptRemote( bool enable );
+
+	/// Returns the number of filter banks that the IDs need
+	uint32_t banks();
+
+	/// Program the filter banks
+	///
+	/// The filters are written from first_bank, the rest of the given
+	/// banks are disabled. Nothing is changed if the filters do not fit.
+	/// @param hcan pointer to the CAN handle.
+	/// @param first_bank the first bank to use. 14 for CAN2 with the default split.
+	/// @param bank_count number of banks to use.
+	/// @param slave_start_bank the first bank of CAN2. It is shared by CAN1 and CAN2,
+	/// so it has to be the same for both.
+	/// @returns HAL_OK on success, HAL_ERROR if the filters do not fit or the HAL failed.
+	HAL_StatusTypeDef program( CAN_HandleTypeDef *hcan, uint32_t first_bank = 0, uint32_t bank_count = CANDALORIAN_FILTER_BANKS, uint32_t slave_start_bank = CANDALORIAN_FILTER_BANKS );
+
+private:
+
+	/// A range of accepted IDs
+	struct range_t{
+		uint32_t first;		///< The first ID.
+		uint32_t last;		///< The last ID.
+		uint8_t fifo;		///< CAN_RX_FIFO0 or CAN_RX_FIFO1.
+		uint8_t extended;	///< 1 for extended IDs.
+	};
+
+	/// A filter bank under construction
+	struct bank_t{
+		uint32_t mode;		///< CAN_FILTERMODE_IDLIST or CAN_FILTERMODE_IDMASK.
+		uint32_t scale;		///< CAN_FILTERSCALE_16BIT or CAN_FILTERSCALE_32BIT.
+		uint32_t fifo;		///< CAN_RX_FIFO0 or CAN_RX_FIFO1.
+		uint32_t count;		///< Number of used registers.
+		uint32_t regs[ 4 ];	///< Values of the filter registers, 16 or 32-bit long.
+	};
+
+	/// State of the packing
+	struct packer_t{
+		CAN_HandleTypeDef *hcan;	///< The CAN handle, NULL to count the banks only.
+		uint32_t next_bank;			///< The next bank to write.
+		uint32_t slave_start_bank;	///< The first bank of CAN2.
+		bool failed;				///< The HAL failed.
+	};
+
+	/// The ranges, sorted by FIFO, type and first ID
+	range_t ranges[ CANDALORIAN_FILTER_MAX_RANGES ];
+
+	/// Number of ranges
+	uint32_t range_count = 0;
+
+	/// The remote frames are accepted too
+	bool remote = false;
+
+	/// Add a range and merge it with its neighbours
+	///
+	/// @param first the first ID.
+	/// @param last the last ID.
+	/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+	/// @param extended true for extended IDs.
+	/// @returns true if the range is added.
+	bool insert( uint32_t first, uint32_t last, uint32_t fifo, bool extended );
+
+	/// Pack the filters into banks
+	///
+	/// If hcan is NULL, it only counts the banks.
+	/// @param hcan pointer to the CAN handle.
+	/// @param first_bank the first bank to write.
+	/// @param slave_start_bank the first bank of CAN2.
+	/// @returns the number of banks, or -1 if the HAL failed.
+	int32_t pack( CAN_HandleTypeDef *hcan, uint32_t first_bank, uint32_t slave_start_bank );
+
+	/// Put a register value to a bank, write the bank if it is full
+	///
+	/// @param packer state of the packing.
+	/// @param bank the bank.
+	/// @param value the value of the register.
+	void put( packer_t *packer, bank_t *bank, uint32_t value );
+
+	/// Write a bank, the free registers are filled with copies of the first filter
+	///
+	/// @param packer state of the packing.
+	/// @param bank the bank, it is emptied.
+	void write( packer_t *packer, bank_t *bank );
+
+	/// Returns the size of the next aligned block of a range
+	///
+	/// @param first the first ID of the remaining range.
+	/// @param last the last ID of the range.
+	static uint32_t blockSize( uint32_t first, uint32_t last );
+
+};
+
+#endif /* STM32_CLASS_FACTORY_CANDALORIANFILTER_HPP_ */
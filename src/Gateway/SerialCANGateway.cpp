@@ -0,0 +1,264 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#include "SerialCANGateway.hpp"
+
+SerialCANGateway::SerialCANGateway( SerialPacket *packets_p, CANdalorian *can_p, uint8_t *batch_p, uint32_t batch_frames_p ){
+
+	packets = packets_p;
+	can = can_p;
+	batch = batch_p;
+	batch_frames = batch_frames_p;
+
+	resetStats();
+
+}
+
+void SerialCANGateway::setFlushDelay( uint32_t delay_us ){
+
+	if( delay_us > 0 ){
+
+		cyclesBegin();
+
+	}
+
+	flush_delay = delay_us;
+
+}
+
+void SerialCANGateway::poll(){
+
+	serialToCan();
+	canToSerial();
+
+}
+
+uint32_t SerialCANGateway::serialToCan(){
+
+	const uint8_t *payload;
+	uint32_t payload_size;
+	uint32_t record_size;
+	uint32_t moved = 0;
+	uint32_t address;
+	uint32_t id_size;
+	uint8_t header;
+	uint8_t dlc;
+	uint8_t data[ 8 ];
+
+	while( true ){
+
+		if( !packet_pending ){
+
+			// The next packet is decoded only when the previous one is done,
+			// so the host is slowed down by the recive buffer of the port.
+			if( packets -> receive() < 0 ){
+
+				break;
+
+			}
+
+			packet_pending = true;
+			packet_pos = 0;
+
+		}
+
+		payload = packets -> data();
+		payload_size = packets -> size();
+
+		while( packet_pos < payload_size ){
+
+			header = payload[ packet_pos ];
+			dlc = header & SERIAL_CAN_GATEWAY_DLC_MASK;
+
+			id_size = ( header & SERIAL_CAN_GATEWAY_IDE ) ? 4 : 2;
+			record_size = 1 + id_size + ( ( header & SERIAL_CAN_GATEWAY_RTR ) ? 0 : dlc );
+
+			if( ( dlc > 8 ) || ( header & 0x30 ) || ( packet_pos + record_size > payload_size ) ){
+
+				// The rest of the packet can not be parsed.
+				gateway_stats.rejected++;
+				packet_pos = payload_size;
+				break;
+
+			}
+
+			if( can -> transmittFree() == 0 ){
+
+				// Every mailbox is full, the frame is sent in the next round.
+				gateway_stats.can_stalls++;
+				return moved;
+
+			}
+
+			address = payload[ packet_pos + 1 ] | ( payload[ packet_pos + 2 ] << 8 );
+
+			if( id_size == 4 ){
+
+				address |= ( (uint32_t)payload[ packet_pos + 3 ] << 16 ) | ( (uint32_t)payload[ packet_pos + 4 ] << 24 );
+
+			}
+
+			// The HAL reads all 8 data bytes whatever the DLC is, so the data is
+			// copied out of the packet to a zeroed buffer. A remote frame has no data in the record.
+			memset( data, 0, sizeof( data ) );
+
+			if( !( header & SERIAL_CAN_GATEWAY_RTR ) ){
+
+				memcpy( data, &payload[ packet_pos + 1 + id_size ], dlc );
+
+			}
+
+			// An invalid ID is refused by transmittNoWait.
+			if( can -> transmittNoWait( address, data, dlc, header & ( SERIAL_CAN_GATEWAY_IDE | SERIAL_CAN_GATEWAY_RTR ) ) == HAL_OK ){
+
+				gateway_stats.to_can++;
+				moved++;
+
+			}
+
+			else{
+
+				gateway_stats.rejected++;
+
+			}
+
+			packet_pos += record_size;
+
+		}
+
+		packet_pending = false;
+
+	}
+
+	return moved;
+
+}
+
+uint32_t SerialCANGateway::canToSerial(){
+
+	CANdalorian::frame_t frame;
+	uint32_t moved = 0;
+	uint32_t pos;
+	uint8_t *record;
+
+	while( true ){
+
+		if( batch_count >= batch_frames ){
+
+			// The frames stay in the CAN FIFO until the batch is sent.
+			if( !flush() ){
+
+				return moved;
+
+			}
+
+		}
+
+		if( can -> available() == 0 ){
+
+			break;
+
+		}
+
+		if( can -> read( &frame ) != HAL_OK ){
+
+			break;
+
+		}
+
+		if( ( batch_count == 0 ) && ( flush_delay > 0 ) ){
+
+			batch_time = (uint32_t)micros64();
+
+		}
+
+		record = &batch[ batch_size ];
+
+		// The DLC of the frame is at most 8.
+		record[ 0 ] = frame.flags | frame.dlc;
+		record[ 1 ] = frame.id & 0xFF;
+		record[ 2 ] = ( frame.id >> 8 ) & 0xFF;
+		pos = 3;
+
+		if( frame.flags & CANDALORIAN_IDE ){
+
+			record[ 3 ] = ( frame.id >> 16 ) & 0xFF;
+			record[ 4 ] = ( frame.id >> 24 ) & 0xFF;
+			pos = 5;
+
+		}
+
+		if( !( frame.flags & CANDALORIAN_RTR ) ){
+
+			memcpy( &record[ pos ], frame.data, frame.dlc );
+			pos += frame.dlc;
+
+		}
+
+		batch_size += pos;
+		batch_count++;
+		moved++;
+
+	}
+
+	if( ( batch_count > 0 ) && ( ( flush_delay == 0 ) || ( (uint32_t)micros64() - batch_time >= flush_delay ) ) ){
+
+		flush();
+
+	}
+
+	return moved;
+
+}
+
+bool SerialCANGateway::flush(){
+
+	if( batch_count == 0 ){
+
+		return true;
+
+	}
+
+	// The packet is sent only if it fits, so the gateway never waits
+	// for the UART, and the full buffer policy never drops it.
+	if( !packets -> canSend( batch_size ) ){
+
+		gateway_stats.serial_stalls++;
+		return false;
+
+	}
+
+	if( packets -> send( batch, batch_size ) == 0 ){
+
+		gateway_stats.serial_stalls++;
+		return false;
+
+	}
+
+	gateway_stats.to_serial += batch_count;
+	gateway_stats.packets_to_serial++;
+
+	batch_size = 0;
+	batch_count = 0;
+
+	return true;
+
+}
+
+SerialCANGateway::stats_t SerialCANGateway::stats(){
+
+	return gateway_stats;
+
+}
+
+void SerialCANGateway::resetStats(){
+
+	memset( &gateway_stats, 0, sizeof( gateway_stats ) );
+
+}
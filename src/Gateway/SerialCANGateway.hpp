@@ -0,0 +1,232 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_GATEWAY_SERIALCANGATEWAY_HPP_
+#define STM32_CLASS_FACTORY_GATEWAY_SERIALCANGATEWAY_HPP_
+
+#include<stdlib.h>
+#include<string.h>
+#include<inttypes.h>
+#include<stdint.h>
+
+#include "stm32f4xx_hal.h"
+
+#include "Serial.hpp"
+#include "SerialPacket.hpp"
+#include "CANdalorian.hpp"
+
+/// Maximum length of a CAN frame record in a packet
+#define SERIAL_CAN_GATEWAY_RECORD_LENGTH 13
+
+/// Mask of the DLC in the record header
+#define SERIAL_CAN_GATEWAY_DLC_MASK 0x0F
+
+/// Flag of the remote frames in the record header
+#define SERIAL_CAN_GATEWAY_RTR 0x40
+
+/// Flag of the extended IDs in the record header
+#define SERIAL_CAN_GATEWAY_IDE 0x80
+
+static_assert( ( SERIAL_CAN_GATEWAY_IDE == CANDALORIAN_IDE ) && ( SERIAL_CAN_GATEWAY_RTR == CANDALORIAN_RTR ), "The record header uses the flags of CANdalorian." );
+
+/// Serial to CAN gateway
+///
+/// SerialCANGateway bridges a UART and a CAN bus. The CAN frames travel on the
+/// UART in \link SerialPacket \endlink packets, one packet carries a batch of
+/// frames, so the COBS, CRC and delimiter overhead is shared by them.
+///
+/// Payload format, repeated for every frame of the batch:
+///
+/// | Size  | Content                                                   |
+/// |-------|-----------------------------------------------------------|
+/// | 1     | bit 7: IDE, bit 6: RTR, bit 4-5: 0, bit 0-3: DLC( 0-8 )    |
+/// | 2 / 4 | ID, little endian. 4 bytes long if IDE is set.            |
+/// | DLC   | data, it is missing if RTR is set                         |
+///
+/// A standard data frame with 8 bytes takes 11 bytes, an extended one 13 bytes.
+/// A remote frame has no data, only its DLC is sent.
+///
+/// The packets are decoded from the recive buffer of the DMA, and the frames
+/// go from the packet buffer to the mailboxes without an extra copy.
+///
+/// Both directions apply backpressure instead of dropping frames:
+/// - Serial to CAN: the next packet is not decoded until every frame of the
+///   current one got a mailbox. Meanwhile the bytes wait in the recive buffer
+///   of the serial port, so it has to be long enough for the bursts of the host.
+/// - CAN to serial: the frames are not read from the CAN FIFO until the
+///   full batch can be sent. The packet is only sent if it fits in the
+///   transmitt buffer, so the gateway never waits for the UART.
+///
+/// A partial batch is sent when the CAN FIFO is empty, or if a flush delay
+/// is set, when its first frame is older than the delay. Under load the
+/// batches grow by themselves.
+///
+/// At 1 Mbit/s a fully loaded bus carries about 8000 frames/s. It is about
+/// 100 KB/s in batches, so the UART needs at least 2 Mbaud. The hardware
+/// FIFO of the CAN peripherial holds only 3 frames, so \link poll \endlink
+/// has to be called at least every 300 us.
+///
+/// @note Enable the Transmit Fifo Priority of the CAN peripherial, otherwise
+/// the mailboxes send the frames in the order of their IDs, not in the order
+/// they arrived on the UART.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// Serial SerialToPC( &huart2 );
+/// CANdalorian canBus( &hcan1 );
+///
+/// uint8_t packetBuffer[ 16 * SERIAL_CAN_GATEWAY_RECORD_LENGTH + 2 ];
+/// SerialPacket packets( &SerialToPC, packetBuffer, sizeof( packetBuffer ) );
+///
+/// SerialCANGatewayBuffered< 16 > gateway( &packets, &canBus );
+///
+/// int main(){
+///
+/// SerialToPC.begin( 2000000 );
+///
+/// canBus.normalMode();
+/// canBus.begin();
+///
+/// while( 1 ){
+///
+/// gateway.poll();
+///
+/// }
+///
+/// }
+///
+/// \endcode
+class SerialCANGateway{
+
+public:
+
+	/// Gateway statistics
+	///
+	/// The counters are 32-bit long and they wrap around.
+	struct stats_t{
+		uint32_t to_can;			///< Number of frames transmitted to the CAN bus.
+		uint32_t to_serial;			///< Number of frames sent to the UART.
+		uint32_t packets_to_serial;	///< Number of packets sent to the UART.
+		uint32_t rejected;			///< Number of records dropped, because they were broken or had an invalid ID.
+		uint32_t can_stalls;		///< Number of times the serial to CAN direction waited for a mailbox.
+		uint32_t serial_stalls;		///< Number of times the CAN to serial direction waited for the transmitt buffer.
+	};
+
+	/// SerialCANGateway object constructor
+	///
+	/// Usually it is easier to use \link SerialCANGatewayBuffered \endlink.
+	/// @param packets_p the packet layer on the UART. Its buffer has to hold
+	/// batch_frames_p * \link SERIAL_CAN_GATEWAY_RECORD_LENGTH \endlink bytes and the CRC.
+	/// @param can_p the CAN peripherial.
+	/// @param batch_p buffer for the batch, \link batchLength \endlink( batch_frames_p ) long.
+	/// @param batch_frames_p maximum number of frames in a packet.
+	SerialCANGateway( SerialPacket *packets_p, CANdalorian *can_p, uint8_t *batch_p, uint32_t batch_frames_p );
+
+	/// Set the flush delay
+	///
+	/// A partial batch waits this long for more frames. With 0 it is sent
+	/// when the CAN FIFO gets empty. It is 0 by default.
+	/// @param delay_us the delay in us. The DWT cycle counter is used for the time.
+	void setFlushDelay( uint32_t delay_us );
+
+	/// Move the frames in both directions
+	///
+	/// It has to be called from the main loop. It does not wait in any case.
+	void poll();
+
+	/// Move the frames from the UART to the CAN bus
+	///
+	/// @returns the number of frames queued to the mailboxes.
+	uint32_t serialToCan();
+
+	/// Move the frames from the CAN bus to the UART
+	///
+	/// @returns the number of frames read from the CAN FIFO.
+	uint32_t canToSerial();
+
+	/// Send the partial batch
+	///
+	/// @returns true if the batch is empty, false if it did not fit in the transmitt buffer.
+	bool flush();
+
+	/// Returns the gateway statistics
+	stats_t stats();
+
+	/// Clear the gateway statistics
+	void resetStats();
+
+	/// Returns the length of the batch buffer for the given number of frames
+	static constexpr uint32_t batchLength( uint32_t batch_frames_p ){
+
+		return batch_frames_p * SERIAL_CAN_GATEWAY_RECORD_LENGTH;
+
+	}
+
+private:
+
+	/// The packet layer on the UART
+	SerialPacket *packets = NULL;
+
+	/// The CAN peripherial
+	CANdalorian *can = NULL;
+
+	/// Buffer for the batch
+	uint8_t *batch = NULL;
+
+	/// Maximum number of frames in a batch
+	uint32_t batch_frames = 0;
+
+	/// Number of bytes in the batch
+	uint32_t batch_size = 0;
+
+	/// Number of frames in the batch
+	uint32_t batch_count = 0;
+
+	/// Time of the first frame in the batch in us
+	uint32_t batch_time = 0;
+
+	/// Flush delay in us
+	uint32_t flush_delay = 0;
+
+	/// The last recived packet has frames that are not transmitted yet
+	bool packet_pending = false;
+
+	/// Position of the next record in the last recived packet
+	uint32_t packet_pos = 0;
+
+	/// Gateway statistics
+	stats_t gateway_stats;
+
+};
+
+/// SerialCANGateway with its own batch buffer
+///
+/// @tparam BATCH_FRAMES maximum number of frames in a packet.
+template< uint32_t BATCH_FRAMES >
+class SerialCANGatewayBuffered : public SerialCANGateway{
+
+public:
+
+	/// SerialCANGatewayBuffered object constructor
+	///
+	/// @param packets_p the packet layer on the UART.
+	/// @param can_p the CAN peripherial.
+	SerialCANGatewayBuffered( SerialPacket *packets_p, CANdalorian *can_p ) :
+		SerialCANGateway( packets_p, can_p, batch_buffer, BATCH_FRAMES ){}
+
+private:
+
+	static_assert( ( BATCH_FRAMES > 0 ) && ( BATCH_FRAMES <= 64 ), "A batch can have 1 to 64 frames." );
+
+	uint8_t batch_buffer[ batchLength( BATCH_FRAMES ) ];
+
+};
+
+#endif /* STM32_CLASS_FACTORY_GATEWAY_SERIALCANGATEWAY_HPP_ */
@@ -9,737 +9,1989 @@
 
 #include "Serial.hpp"
 
-Serial::Serial( UART_HandleTypeDef *usart_device_p ){
+SerialPort *SerialPort::instances[ SERIAL_MAX_INSTANCES ] = { NULL };
+
+SerialPort::SerialPort( UART_HandleTypeDef *usart_device_p, uint8_t *recive_buffer_p, uint32_t recive_length_p, uint8_t *transmit_buffer_p, uint32_t transmit_length_p ){
+
+	uint32_t i;
 
 	usart_device = usart_device_p;
 
-}
+	recive_buffer = recive_buffer_p;
+	recive_length = recive_length_p;
 
-void Serial::begin( uint32_t baudrate_p ){
+	transmit_buffer = transmit_buffer_p;
+	transmit_length = transmit_length_p;
+
+	// Power of two sizes can wrap with a mask instead of a compare.
+	if( ( recive_length & ( recive_length - 1 ) ) == 0 ){
+
+		recive_mask = recive_length - 1;
 
-	if (HAL_UART_DeInit( usart_device ) != HAL_OK)
-	{
-		Error_Handler();
 	}
 
-	usart_device -> Init.BaudRate = baudrate_p;
+	if( ( transmit_length & ( transmit_length - 1 ) ) == 0 ){
 
+		transmit_mask = transmit_length - 1;
 
-	if (HAL_UART_Init( usart_device ) != HAL_OK)
-	{
-		Error_Handler();
 	}
 
-	recive_buffer_counter = 0;
+	// Register the object, so the HAL callbacks can find it by its handle.
+	for( i = 0; i < SERIAL_MAX_INSTANCES; i++ ){
 
-	if (HAL_UART_Receive_DMA( usart_device, recive_buffer, SERIAL_RECIVE_BUFFER_LENGTH ) != HAL_OK)
-	{
-		Error_Handler();
-	}
+		if( instances[ i ] == NULL ){
 
+			instances[ i ] = this;
+			break;
 
+		}
 
-}
+	}
 
-int Serial::available(){
+	// Without a slot the object would never get its callbacks,
+	// and the transmitt would hang on the first flush.
+	if( i == SERIAL_MAX_INSTANCES ){
 
-	uint32_t dma_ptr;
+		Error_Handler();
 
-	dma_ptr = SERIAL_RECIVE_BUFFER_LENGTH - ( usart_device -> hdmarx -> Instance -> NDTR );
+	}
 
-	if( dma_ptr == recive_buffer_counter ){
+}
 
-		return 0;
+SerialPort::~SerialPort(){
 
-	}
+	uint32_t i;
+	uint32_t primask;
 
-	else if( dma_ptr > recive_buffer_counter ){
+	// The callbacks must not find the object while it is removed.
+	primask = __get_PRIMASK();
+	__disable_irq();
 
-		return dma_ptr - recive_buffer_counter;
+	for( i = 0; i < SERIAL_MAX_INSTANCES; i++ ){
 
-	}
+		if( instances[ i ] == this ){
 
-	else{
+			instances[ i ] = NULL;
 
-		return SERIAL_RECIVE_BUFFER_LENGTH - recive_buffer_counter +  dma_ptr;
+		}
 
 	}
 
-}
+	__set_PRIMASK( primask );
 
-int Serial::read(){
+}
 
-	uint32_t dma_ptr;
-	uint8_t ret;
+void SerialPort::begin( uint32_t baudrate_p ){
 
-	dma_ptr = SERIAL_RECIVE_BUFFER_LENGTH - ( usart_device -> hdmarx -> Instance -> NDTR );
+	if (HAL_UART_DeInit( usart_device ) != HAL_OK)
+	{
+		Error_Handler();
+	}
 
-	if( dma_ptr == recive_buffer_counter ){
+	usart_device -> Init.BaudRate = baudrate_p;
 
-		return -1;
 
+	if (HAL_UART_Init( usart_device ) != HAL_OK)
+	{
+		Error_Handler();
 	}
 
-	else{
+	transmit_head = 0;
+	transmit_tail = 0;
+	transmit_release = 0;
+	transmit_reserved = 0;
+	transmit_wrap = transmit_length;
+	transmit_writers = 0;
+	transmit_busy = false;
 
-		ret = (uint8_t)recive_buffer[ recive_buffer_counter ];
+	link_stats = stats_t();
+
+	startRecive();
+
+}
 
-		recive_buffer_counter++;
+void SerialPort::startRecive(){
 
-		if( recive_buffer_counter >= SERIAL_RECIVE_BUFFER_LENGTH ){
+	recive_buffer_counter = 0;
+	recive_write_index = 0;
+	recive_half_laps = 0;
+	recive_write_total = 0;
+	recive_read_total = 0;
+	recive_event = false;
+
+#ifdef HAL_UART_RECEPTION_TOIDLE
 
-			recive_buffer_counter = 0;
+	if( rx_mode == RX_EVENT ){
 
+		// The HAL calls HAL_UARTEx_RxEventCallback on half transfer,
+		// transfer complete and when the line goes idle.
+		if (HAL_UARTEx_ReceiveToIdle_DMA( usart_device, recive_buffer, recive_length ) != HAL_OK)
+		{
+			Error_Handler();
 		}
 
-		return ret;
+		return;
 
 	}
 
-}
-
-int Serial::peek(){
+#endif
 
-	uint32_t dma_ptr;
+	if (HAL_UART_Receive_DMA( usart_device, recive_buffer, recive_length ) != HAL_OK)
+	{
+		Error_Handler();
+	}
 
-	dma_ptr = SERIAL_RECIVE_BUFFER_LENGTH - ( usart_device -> hdmarx -> Instance -> NDTR );
+}
 
-	if( dma_ptr == recive_buffer_counter ){
+void SerialPort::setReciveMode( rxMode_t rx_mode_p ){
 
-		return -1;
+#ifdef HAL_UART_RECEPTION_TOIDLE
 
-	}
+	rx_mode = rx_mode_p;
 
-	else{
+#else
 
-		return (uint8_t)recive_buffer[ recive_buffer_counter ];
+	// This HAL version can not report the idle line, we stay in polling mode.
+	( void )rx_mode_p;
 
-	}
+#endif
 
 }
 
-size_t Serial::readBytes( uint8_t *buff, uint32_t size ){
+void SerialPort::setReciveCallback( reciveCallback_t callback_p ){
 
-	uint32_t i;
+	recive_callback = callback_p;
 
-	for( i = 0; i < size; i++ ){
+}
 
-		while( available() == 0 ){};
+bool SerialPort::dataArrived(){
 
-		buff[ i ] = read();
+	bool ret;
 
-	}
+	ret = recive_event;
+	recive_event = false;
 
-	return i;
+	return ret;
 
 }
 
-void Serial::flush(){
+uint32_t SerialPort::reciveWriteIndex(){
 
-}
+	uint32_t index;
+	uint32_t total;
+	uint32_t fill;
+
+	total = reciveWriteTotal( &index );
+	fill = total - recive_read_total;
 
-size_t Serial::write( uint8_t b ){
+	if( fill >= recive_length ){
 
-	if( HAL_UART_Transmit( usart_device, &b, 1, 100 ) == HAL_OK ){
+		// The DMA lapped the reader, so the unread data is partly overwritten.
+		// It is dropped, and the reader continues with the new data.
+		link_stats.rx_overruns++;
+		link_stats.rx_lost += fill;
 
-		return 1;
+		recive_buffer_counter = index;
+		recive_read_total = total;
+
+		return index;
 
 	}
 
-	else{
+	if( fill > link_stats.rx_peak ){
 
-		return 0;
+		link_stats.rx_peak = fill;
 
 	}
 
+	return index;
+
 }
 
-///
-size_t Serial::print( char c ){
+uint32_t SerialPort::reciveWriteTotal( uint32_t *index ){
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&c, 1, 100 ) == HAL_OK ){
+	uint32_t primask;
+	uint32_t laps;
+	uint32_t total;
 
-		return 1;
+	// In event mode the index is updated from the interrupt, we don't have to touch the DMA.
+	if( rx_mode == RX_EVENT ){
 
-	}
+		primask = __get_PRIMASK();
+		__disable_irq();
 
-	else{
+		*index = recive_write_index;
+		total = recive_write_total;
 
-		return 0;
+		__set_PRIMASK( primask );
+
+		return total;
 
 	}
 
-}
+	laps = recive_half_laps;
 
-size_t Serial::print( char *str ){
+	*index = wrapRecive( recive_length - ( usart_device -> hdmarx -> Instance -> NDTR ) );
 
-	uint32_t dataSize = strlen( str );
+	total = ( laps / 2 ) * recive_length + *index;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)str, dataSize, 1000 ) == HAL_OK ){
+	// The DMA is in the first half, but the last interrupt was the half
+	// transfer. The transfer complete interrupt is still pending.
+	if( ( laps & 1 ) && ( *index < recive_length / 2 ) ){
 
-		return dataSize;
+		total += recive_length;
 
 	}
 
-	else{
+	return total;
 
-		return 0;
+}
 
-	}
+int SerialPort::available(){
 
-}
+	uint32_t dma_ptr;
+
+	dma_ptr = reciveWriteIndex();
+
+	if( dma_ptr == recive_buffer_counter ){
 
-size_t Serial::print( const char *str ){
+		return 0;
 
-	uint32_t dataSize = strlen( str );
+	}
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)str, dataSize, 1000 ) == HAL_OK ){
+	else if( dma_ptr > recive_buffer_counter ){
 
-		return dataSize;
+		return dma_ptr - recive_buffer_counter;
 
 	}
 
 	else{
 
-		return 0;
+		return recive_length - recive_buffer_counter + dma_ptr;
 
 	}
 
 }
 
-size_t Serial::print( int8_t b ){
-
-	char outBuff[10];
-	uint32_t dataSize;
+int SerialPort::read(){
 
-	snprintf( outBuff, 10, "%d", (int)b );
+	uint32_t dma_ptr;
+	uint8_t ret;
 
-	dataSize = strlen( outBuff );
+	dma_ptr = reciveWriteIndex();
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	if( dma_ptr == recive_buffer_counter ){
 
-		return dataSize;
+		return -1;
 
 	}
 
 	else{
 
-		return 0;
+		ret = (uint8_t)recive_buffer[ recive_buffer_counter ];
+
+		recive_buffer_counter = wrapRecive( recive_buffer_counter + 1 );
+		recive_read_total++;
+
+		return ret;
 
 	}
 
 }
 
-size_t Serial::print( uint8_t b ){
-
-	char outBuff[10];
-	uint32_t dataSize;
+int SerialPort::peek(){
 
-	snprintf( outBuff, 10, "%u", (int)b );
+	uint32_t dma_ptr;
 
-	dataSize = strlen( outBuff );
+	dma_ptr = reciveWriteIndex();
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	if( dma_ptr == recive_buffer_counter ){
 
-		return dataSize;
+		return -1;
 
 	}
 
 	else{
 
-		return 0;
+		return (uint8_t)recive_buffer[ recive_buffer_counter ];
 
 	}
 
 }
 
-size_t Serial::print( int16_t b ){
+size_t SerialPort::readAvailable( uint8_t *buff, size_t size ){
 
-	char outBuff[10];
-	uint32_t dataSize;
+	segment_t segments[ 2 ];
+	size_t ret;
 
-	snprintf( outBuff, 10, "%d", (int)b );
+	if( reciveSegments( segments ) == 0 ){
+
+		return 0;
 
-	dataSize = strlen( outBuff );
+	}
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	if( segments[ 0 ].size >= size ){
 
-		return dataSize;
+		memcpy( buff, segments[ 0 ].data, size );
+		ret = size;
 
 	}
 
 	else{
 
-		return 0;
+		// The data wraps around the end of the recive buffer.
+		memcpy( buff, segments[ 0 ].data, segments[ 0 ].size );
+		ret = segments[ 0 ].size;
 
-	}
+		if( segments[ 1 ].size > size - ret ){
 
-}
+			segments[ 1 ].size = size - ret;
 
-size_t Serial::print( uint16_t b ){
+		}
 
-	char outBuff[10];
-	uint32_t dataSize;
+		memcpy( &buff[ ret ], segments[ 1 ].data, segments[ 1 ].size );
+		ret += segments[ 1 ].size;
+
+	}
 
-	snprintf( outBuff, 10, "%u", (int)b );
+	// The read bytes are known to be in the buffer, so the DMA position
+	// is not read again like in consume.
+	recive_buffer_counter = wrapRecive( recive_buffer_counter + ret );
+	recive_read_total += ret;
 
-	dataSize = strlen( outBuff );
+	return ret;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+}
 
-		return dataSize;
+size_t SerialPort::readBytes( uint8_t *buff, uint32_t size ){
 
-	}
+	size_t ret = 0;
 
-	else{
+	while( ret < size ){
 
-		return 0;
+		ret += readAvailable( &buff[ ret ], size - ret );
 
 	}
 
+	return ret;
+
 }
 
-size_t Serial::print( int32_t b ){
+size_t SerialPort::readBytes( uint8_t *buff, uint32_t size, uint32_t timeout ){
 
-	char outBuff[15];
-	uint32_t dataSize;
+	size_t ret = 0;
+	uint32_t start;
 
-	snprintf( outBuff, 15, "%d", (int)b );
+	start = millis();
 
-	dataSize = strlen( outBuff );
+	while( true ){
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+		ret += readAvailable( &buff[ ret ], size - ret );
 
-		return dataSize;
+		if( ( ret >= size ) || ( ( millis() - start ) >= timeout ) ){
 
-	}
+			break;
 
-	else{
+		}
 
-		return 0;
+		// Sleep until the next interrupt. The SysTick wakes us up at least every ms.
+		__WFI();
 
 	}
 
+	return ret;
+
 }
 
-size_t Serial::print( uint32_t b ){
+size_t SerialPort::readBytesUntil( char delimiter, uint8_t *buff, size_t size, uint32_t timeout ){
 
-	char outBuff[15];
-	uint32_t dataSize;
+	segment_t segments[ 2 ];
+	const uint8_t *found;
+	uint32_t start;
+	uint32_t i;
+	size_t chunk;
+	size_t ret = 0;
 
-	snprintf( outBuff, 15, "%u", (int)b );
+	start = millis();
 
-	dataSize = strlen( outBuff );
+	while( ret < size ){
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+		if( reciveSegments( segments ) == 0 ){
 
-		return dataSize;
+			if( ( millis() - start ) >= timeout ){
 
-	}
+				break;
 
-	else{
+			}
 
-		return 0;
+			__WFI();
+			continue;
 
-	}
+		}
 
-}
+		for( i = 0; i < 2; i++ ){
 
-size_t Serial::print( int64_t b ){
+			chunk = segments[ i ].size;
 
-	char outBuff[25];
-	uint32_t dataSize;
+			if( chunk > size - ret ){
 
-	snprintf( outBuff, 25, "%d", (int)b );
+				chunk = size - ret;
 
-	dataSize = strlen( outBuff );
+			}
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+			found = (const uint8_t*)memchr( segments[ i ].data, delimiter, chunk );
 
-		return dataSize;
+			if( found != NULL ){
 
-	}
+				chunk = found - segments[ i ].data;
 
-	else{
+				memcpy( &buff[ ret ], segments[ i ].data, chunk );
+				ret += chunk;
 
-		return 0;
+				// The delimiter is removed from the buffer, but it is not copied.
+				consume( chunk + 1 );
 
-	}
+				return ret;
 
-}
+			}
 
-size_t Serial::print( uint64_t b ){
+			memcpy( &buff[ ret ], segments[ i ].data, chunk );
+			ret += chunk;
 
-	char outBuff[25];
-	uint32_t dataSize;
+			consume( chunk );
 
-	snprintf( outBuff, 25, "%u", (int)b );
+			if( ret >= size ){
 
-	dataSize = strlen( outBuff );
+				break;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+			}
 
-		return dataSize;
+		}
 
 	}
 
-	else{
+	return ret;
 
-		return 0;
+}
 
-	}
+size_t SerialPort::peekLine( segment_t *line, char delimiter ){
 
-}
+	segment_t segments[ 2 ];
+	const uint8_t *found;
 
-size_t Serial::print( int i ){
+	line[ 0 ].data = NULL;
+	line[ 0 ].size = 0;
+	line[ 1 ].data = NULL;
+	line[ 1 ].size = 0;
 
-	char outBuff[25];
-	uint32_t dataSize;
+	if( reciveSegments( segments ) == 0 ){
+
+		return 0;
+
+	}
 
-	snprintf( outBuff, 25, "%d", i );
+	found = (const uint8_t*)memchr( segments[ 0 ].data, delimiter, segments[ 0 ].size );
 
-	dataSize = strlen( outBuff );
+	if( found != NULL ){
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+		line[ 0 ].data = segments[ 0 ].data;
+		line[ 0 ].size = found - segments[ 0 ].data + 1;
 
-		return dataSize;
+		return line[ 0 ].size;
 
 	}
 
-	else{
+	if( segments[ 1 ].size == 0 ){
 
 		return 0;
 
 	}
 
-}
+	// The line continues at the beginning of the buffer.
+	found = (const uint8_t*)memchr( segments[ 1 ].data, delimiter, segments[ 1 ].size );
 
-size_t Serial::print( unsigned int i ){
+	if( found == NULL ){
 
-	char outBuff[25];
-	uint32_t dataSize;
+		return 0;
 
-	snprintf( outBuff, 25, "%u", i );
+	}
 
-	dataSize = strlen( outBuff );
+	line[ 0 ] = segments[ 0 ];
+	line[ 1 ].data = segments[ 1 ].data;
+	line[ 1 ].size = found - segments[ 1 ].data + 1;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	return line[ 0 ].size + line[ 1 ].size;
 
-		return dataSize;
+}
 
-	}
+void SerialPort::consume( size_t size ){
 
-	else{
+	uint32_t avail;
 
-		return 0;
+	avail = available();
+
+	if( size > avail ){
+
+		size = avail;
 
 	}
 
+	recive_buffer_counter = wrapRecive( recive_buffer_counter + size );
+	recive_read_total += size;
+
 }
 
-size_t Serial::print( float f ){
+uint32_t SerialPort::reciveSegments( segment_t *segments ){
 
-	char outBuff[25];
-	uint32_t dataSize;
+	uint32_t write_index;
 
-	snprintf( outBuff, 25, "%f", f );
+	write_index = reciveWriteIndex();
 
-	dataSize = strlen( outBuff );
+	segments[ 0 ].data = &recive_buffer[ recive_buffer_counter ];
+	segments[ 1 ].data = recive_buffer;
+	segments[ 1 ].size = 0;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	if( write_index >= recive_buffer_counter ){
 
-		return dataSize;
+		segments[ 0 ].size = write_index - recive_buffer_counter;
 
 	}
 
 	else{
 
-		return 0;
+		// The data wraps around the end of the buffer.
+		segments[ 0 ].size = recive_length - recive_buffer_counter;
+		segments[ 1 ].size = write_index;
 
 	}
 
+	return segments[ 0 ].size + segments[ 1 ].size;
+
 }
 
-size_t Serial::print( double d ){
+void SerialPort::flush(){
 
-	char outBuff[25];
-	uint32_t dataSize;
+	// In an interrupt only the transfer is started. Only the DMA transfer complete
+	// interrupt can end it, so waiting here could lock up. Without DMA
+	// the interrupts do not send, the main loop does it.
+	if( inInterrupt() ){
 
-	snprintf( outBuff, 25, "%lf", d );
+		startTransmit();
+		return;
 
-	dataSize = strlen( outBuff );
+	}
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&outBuff, dataSize, 100 ) == HAL_OK ){
+	// Wait until the DMA has sent out every byte from the transmit buffer.
+	while( transmit_busy || ( transmit_tail != transmit_head ) ){
 
-		return dataSize;
+		startTransmit();
 
 	}
 
-	else{
+}
 
-		return 0;
+void SerialPort::setTxFullPolicy( txFullPolicy_t policy_p ){
 
-	}
+	tx_full_policy = policy_p;
 
 }
 
-size_t Serial::println(){
-
-	size_t ret;
+SerialPort::stats_t SerialPort::stats(){
 
-	ret = print( "\r\n" );
+	stats_t ret;
+	uint32_t primask;
+	uint32_t index;
 
-	return ret;
+	// Check the reader first, so a pending overrun is counted.
+	reciveWriteIndex();
 
-}
+	primask = __get_PRIMASK();
+	__disable_irq();
 
-size_t Serial::println( char c ){
+	ret = link_stats;
 
-	size_t ret;
+	__set_PRIMASK( primask );
 
-	ret = print( c );
-	ret += print( "\r\n" );
+	// The recived bytes are counted by the DMA.
+	ret.rx_bytes += reciveWriteTotal( &index );
 
 	return ret;
 
 }
 
-size_t Serial::println( char *str ){
+void SerialPort::resetStats(){
 
-	size_t ret;
+	uint32_t primask;
+	uint32_t index;
 
-	ret = print( str );
-	ret += print( "\r\n" );
+	primask = __get_PRIMASK();
+	__disable_irq();
 
-	return ret;
+	link_stats = stats_t();
 
-}
+	// rx_bytes is added to the position of the DMA, so it starts from the current position.
+	link_stats.rx_bytes = 0 - reciveWriteTotal( &index );
 
-size_t Serial::println( const char *str ){
+	__set_PRIMASK( primask );
 
-	size_t ret;
+}
 
-	ret = print( str );
-	ret += print( "\r\n" );
+size_t SerialPort::write( uint8_t b ){
 
-	return ret;
+	return transmit( &b, 1 );
 
 }
 
-size_t Serial::println( int8_t b ){
+size_t SerialPort::write( const uint8_t *buff, size_t size ){
 
-	size_t ret;
+	return transmit( buff, size );
 
-	ret = print( b );
-	ret += print( "\r\n" );
+}
 
-	return ret;
+size_t SerialPort::writev( const segment_t *segments, uint32_t count ){
+
+	return transmitSegments( segments, count );
 
 }
 
-size_t Serial::println( uint8_t b ){
+///
+size_t SerialPort::print( char c ){
+
+	return transmit( (uint8_t*)&c, 1 );
 
-	size_t ret;
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( char *str ){
 
-	return ret;
+	return printString( str, false );
 
 }
 
-size_t Serial::println( int16_t b ){
+size_t SerialPort::print( const char *str ){
 
-	size_t ret;
+	return printString( str, false );
+
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( int8_t b, int base ){
 
-	return ret;
+	return printSigned( b, (uint8_t)b, base, false );
 
 }
 
-size_t Serial::println( uint16_t b ){
+size_t SerialPort::print( uint8_t b, int base ){
 
-	size_t ret;
+	return printUnsigned( b, base, false );
+
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( int16_t b, int base ){
 
-	return ret;
+	return printSigned( b, (uint16_t)b, base, false );
 
 }
 
-size_t Serial::println( int32_t b ){
+size_t SerialPort::print( uint16_t b, int base ){
 
-	size_t ret;
+	return printUnsigned( b, base, false );
+
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( int32_t b, int base ){
 
-	return ret;
+	return printSigned( b, (uint32_t)b, base, false );
 
 }
 
-size_t Serial::println( uint32_t b ){
+size_t SerialPort::print( uint32_t b, int base ){
 
-	size_t ret;
+	return printUnsigned( b, base, false );
+
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( int64_t b, int base ){
 
-	return ret;
+	return printSigned( b, (uint64_t)b, base, false );
 
 }
 
-size_t Serial::println( int64_t b ){
+size_t SerialPort::print( uint64_t b, int base ){
 
-	size_t ret;
+	return printUnsigned( b, base, false );
 
-	ret = print( b );
-	ret += print( "\r\n" );
+}
 
-	return ret;
+#if SERIAL_INT_OVERLOADS
 
-}
+size_t SerialPort::print( int i, int base ){
 
-size_t Serial::println( uint64_t b ){
+	return printSigned( i, (unsigned int)i, base, false );
 
-	size_t ret;
+}
 
-	ret = print( b );
-	ret += print( "\r\n" );
+size_t SerialPort::print( unsigned int i, int base ){
 
-	return ret;
+	return printUnsigned( i, base, false );
 
 }
 
-size_t Serial::println( int i ){
-
-	size_t ret;
+#endif
 
-	ret = print( i );
-	ret += print( "\r\n" );
+size_t SerialPort::print( float f, int digits ){
 
-	return ret;
+	return printFloat( f, digits, false );
 
 }
 
-size_t Serial::println( unsigned int i ){
+size_t SerialPort::print( double d, int digits ){
 
-	size_t ret;
+	return printDouble( d, digits, false );
+
+}
 
-	ret = print( i );
-	ret += print( "\r\n" );
+size_t SerialPort::println(){
 
-	return ret;
+	return transmit( (const uint8_t*)SERIAL_LINE_ENDING, sizeof( SERIAL_LINE_ENDING ) - 1 );
 
 }
 
-size_t Serial::println( float f ){
+size_t SerialPort::println( char c ){
 
-	size_t ret;
+	char outBuff[ PRINT_BUFFER_LENGTH ];
 
-	ret = print( f );
-	ret += print( "\r\n" );
+	outBuff[ 0 ] = c;
 
-	return ret;
+	return printText( outBuff, 1, true );
 
 }
 
-size_t Serial::println( double d ){
+size_t SerialPort::println( char *str ){
 
-	size_t ret;
+	return printString( str, true );
+
+}
 
-	ret = print( d );
-	ret += print( "\r\n" );
+size_t SerialPort::println( const char *str ){
 
-	return ret;
+	return printString( str, true );
 
 }
 
-int Serial::printf( const char *fmt, ... ){
+size_t SerialPort::println( int8_t b, int base ){
 
-	int ret;
+	return printSigned( b, (uint8_t)b, base, true );
 
-	char out_buff[ SERIAL_PRINTF_BUFFER_LENGTH ];
+}
 
-	va_list args;
+size_t SerialPort::println( uint8_t b, int base ){
 
-	va_start( args, fmt );
+	return printUnsigned( b, base, true );
 
-	ret = vsnprintf( out_buff, SERIAL_PRINTF_BUFFER_LENGTH, fmt, args );
+}
 
-	va_end( args );
+size_t SerialPort::println( int16_t b, int base ){
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&out_buff, strlen( out_buff ), 100 ) == HAL_OK ){
+	return printSigned( b, (uint16_t)b, base, true );
 
-		return ret;
+}
 
-	}
+size_t SerialPort::println( uint16_t b, int base ){
 
-	else{
+	return printUnsigned( b, base, true );
 
-		return -1;
+}
+
+size_t SerialPort::println( int32_t b, int base ){
+
+	return printSigned( b, (uint32_t)b, base, true );
+
+}
+
+size_t SerialPort::println( uint32_t b, int base ){
+
+	return printUnsigned( b, base, true );
+
+}
+
+size_t SerialPort::println( int64_t b, int base ){
+
+	return printSigned( b, (uint64_t)b, base, true );
+
+}
+
+size_t SerialPort::println( uint64_t b, int base ){
+
+	return printUnsigned( b, base, true );
+
+}
+
+#if SERIAL_INT_OVERLOADS
+
+size_t SerialPort::println( int i, int base ){
+
+	return printSigned( i, (unsigned int)i, base, true );
+
+}
+
+size_t SerialPort::println( unsigned int i, int base ){
+
+	return printUnsigned( i, base, true );
+
+}
+
+#endif
+
+size_t SerialPort::println( float f, int digits ){
+
+	return printFloat( f, digits, true );
+
+}
+
+size_t SerialPort::println( double d, int digits ){
+
+	return printDouble( d, digits, true );
+
+}
+
+size_t SerialPort::printText( char *buff, uint32_t size, bool line ){
+
+	if( line ){
+
+		// The line ending goes right after the text, so they are sent together.
+		memcpy( &buff[ size ], SERIAL_LINE_ENDING, sizeof( SERIAL_LINE_ENDING ) - 1 );
+		size += sizeof( SERIAL_LINE_ENDING ) - 1;
 
 	}
 
+	return transmit( (uint8_t*)buff, size );
+
 }
 
-int Serial::printf( char *fmt, ... ){
+size_t SerialPort::printString( const char *str, bool line ){
 
-	int ret;
+	segment_t segments[ 2 ];
 
-	char out_buff[ SERIAL_PRINTF_BUFFER_LENGTH ];
+	segments[ 0 ].data = (const uint8_t*)str;
+	segments[ 0 ].size = strlen( str );
 
-	va_list args;
+	if( !line ){
 
-	va_start( args, fmt );
+		return transmitSegments( segments, 1 );
+
+	}
 
-	ret = vsnprintf( out_buff, SERIAL_PRINTF_BUFFER_LENGTH, (const char*)fmt, args );
+	// The string is not copied to a temporary buffer, the two segments
+	// are put next to each other in the transmitt buffer.
+	segments[ 1 ].data = (const uint8_t*)SERIAL_LINE_ENDING;
+	segments[ 1 ].size = sizeof( SERIAL_LINE_ENDING ) - 1;
 
-	va_end( args );
+	return transmitSegments( segments, 2 );
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&out_buff, strlen( out_buff ), 100 ) == HAL_OK ){
+}
 
-		return ret;
+size_t SerialPort::printSigned( int64_t value, uint64_t raw, int base, bool line ){
+
+	char outBuff[ PRINT_BUFFER_LENGTH ];
+	uint32_t dataSize;
+
+	// Only the decimal format has a sign, the other bases show the raw bits.
+	if( ( base == DEC ) || ( value >= 0 ) ){
+
+		dataSize = serialFormatSigned( outBuff, value, base );
 
 	}
 
 	else{
 
-		return -1;
+		dataSize = serialFormatUnsigned( outBuff, raw, base );
 
 	}
 
+	return printText( outBuff, dataSize, line );
+
+}
+
+size_t SerialPort::printUnsigned( uint64_t value, int base, bool line ){
+
+	char outBuff[ PRINT_BUFFER_LENGTH ];
+	uint32_t dataSize;
+
+	dataSize = serialFormatUnsigned( outBuff, value, base );
+
+	return printText( outBuff, dataSize, line );
+
+}
+
+size_t SerialPort::printFloat( float value, int digits, bool line ){
+
+	char outBuff[ PRINT_BUFFER_LENGTH ];
+	uint32_t dataSize;
+
+	dataSize = serialFormatFloat( outBuff, value, digits );
+
+	return printText( outBuff, dataSize, line );
+
+}
+
+size_t SerialPort::printDouble( double value, int digits, bool line ){
+
+	char outBuff[ PRINT_BUFFER_LENGTH ];
+	uint32_t dataSize;
+
+	dataSize = serialFormatDouble( outBuff, value, digits );
+
+	return printText( outBuff, dataSize, line );
+
 }
 
-int Serial::dbgPrintf( const char *fmt, ... ){
+int SerialPort::printf( const char *fmt, ... ){
 
 	int ret;
 
-	char out_buff[ SERIAL_PRINTF_BUFFER_LENGTH ];
+	va_list args;
+
+	va_start( args, fmt );
+
+	ret = vprintf( fmt, args );
+
+	va_end( args );
+
+	return ret;
+
+}
+
+int SerialPort::vprintf( const char *fmt, va_list args ){
+
+	return printfUnit( NULL, 0, fmt, args );
+
+}
+
+int SerialPort::dbgPrintf( const char *fmt, ... ){
+
+	char prefix[ SERIAL_LOG_PREFIX_LENGTH ];
+	uint32_t prefix_size;
+	int ret;
 
 	va_list args;
 
+	// The prefix is part of the same unit as the message.
+	prefix_size = logPrefix( prefix, '\0', "dbg" );
+
 	va_start( args, fmt );
 
-	ret = vsnprintf( out_buff, SERIAL_PRINTF_BUFFER_LENGTH, fmt, args );
+	ret = printfUnit( prefix, prefix_size, fmt, args );
 
 	va_end( args );
 
-	printf( "[ %d ] dbg: ", millis() );
+	return ret;
 
-	if( HAL_UART_Transmit( usart_device, (uint8_t*)&out_buff, strlen( out_buff ), 100 ) == HAL_OK ){
+}
 
-		return ret;
+int SerialPort::logPrintf( char level, const char *module, const char *fmt, ... ){
+
+	char prefix[ SERIAL_LOG_PREFIX_LENGTH ];
+	uint32_t prefix_size;
+	int ret;
+
+	va_list args;
+
+	prefix_size = logPrefix( prefix, level, module );
+
+	va_start( args, fmt );
+
+	ret = printfUnit( prefix, prefix_size, fmt, args );
+
+	va_end( args );
+
+	return ret;
+
+}
+
+uint32_t SerialPort::logPrefix( char *prefix, char level, const char *name ){
+
+	uint32_t prefix_size;
+	uint32_t name_size;
+
+	memcpy( prefix, "[ ", 2 );
+	prefix_size = 2;
+
+	switch( log_timestamp ){
+
+		case TIMESTAMP_MICROS:
+			prefix_size += serialFormatUnsigned( &prefix[ prefix_size ], micros64() );
+			break;
+
+		case TIMESTAMP_CYCLES:
+			prefix_size += serialFormatUnsigned( &prefix[ prefix_size ], cycles64() );
+			break;
+
+		default:
+			prefix_size += serialFormatUnsigned( &prefix[ prefix_size ], millis() );
+			break;
 
 	}
 
-	else{
+	memcpy( &prefix[ prefix_size ], " ] ", 3 );
+	prefix_size += 3;
+
+	if( level != '\0' ){
+
+		prefix[ prefix_size++ ] = level;
+		prefix[ prefix_size++ ] = ' ';
+
+	}
+
+	for( name_size = 0; ( name_size < SERIAL_LOG_NAME_LENGTH ) && ( name[ name_size ] != '\0' ); name_size++ ){
+
+		prefix[ prefix_size++ ] = name[ name_size ];
+
+	}
+
+	memcpy( &prefix[ prefix_size ], ": ", 2 );
+	prefix_size += 2;
+
+	return prefix_size;
+
+}
+
+int SerialPort::printfUnit( const char *prefix, uint32_t prefix_size, const char *fmt, va_list args ){
+
+	printfContext_t context;
+	va_list first_args;
+	int size;
+	int ret;
+
+	context.port = this;
+	context.size = 0;
+	context.lost = false;
+
+	// The first pass collects the text in the chunk and counts the characters,
+	// so the whole text can be reserved at once, and the other producers can not break it.
+	va_copy( first_args, args );
+	size = serialFormatVPrintf( printfCollect, &context, fmt, first_args );
+	va_end( first_args );
+
+	// The usual short text is formatted only once.
+	if( ( (uint32_t)size <= SERIAL_PRINTF_CHUNK_LENGTH ) && ( prefix_size + size <= transmit_length - 1 ) ){
+
+		if( !transmitReserve( prefix_size + size, &context.start ) ){
+
+			return -1;
+
+		}
+
+		transmitCopy( context.start, 0, (const uint8_t*)prefix, prefix_size );
+		transmitCopy( context.start, prefix_size, context.chunk, size );
+
+		transmitCommit();
+
+		return size;
+
+	}
+
+	context.size = 0;
+
+	if( prefix_size + size <= transmit_length - 1 ){
+
+		if( !transmitReserve( prefix_size + size, &context.start ) ){
+
+			return -1;
+
+		}
+
+		context.reserved = prefix_size + size;
+		context.offset = prefix_size;
+
+		transmitCopy( context.start, 0, (const uint8_t*)prefix, prefix_size );
+
+		serialFormatVPrintf( printfCopy, &context, fmt, args );
+
+		// The second pass can be shorter, if an argument changed meanwhile.
+		// The rest of the reserved room is committed too, so it is filled with spaces.
+		while( context.offset < context.reserved ){
+
+			transmitCopy( context.start, context.offset, (const uint8_t*)" ", 1 );
+			context.offset++;
+
+		}
+
+		transmitCommit();
+
+		return size;
+
+	}
+
+	// The text is longer than the transmitt buffer, it is sent in chunks.
+	if( prefix_size > 0 ){
+
+		printfOutput( &context, prefix, prefix_size );
+
+	}
+
+	ret = serialFormatVPrintf( printfOutput, &context, fmt, args );
+
+	printfFlush( &context );
+
+	if( context.lost ){
 
 		return -1;
 
 	}
 
+	return ret;
+
+}
+
+void SerialPort::setLogMode( logMode_t log_mode_p ){
+
+	log_mode = log_mode_p;
+
+}
+
+void SerialPort::setTimestamp( timestamp_t timestamp_p ){
+
+	if( timestamp_p != TIMESTAMP_MILLIS ){
+
+		cyclesBegin();
+
+	}
+
+	log_timestamp = timestamp_p;
+
+}
+
+int SerialPort::logRecord( const char *fmt, const uint32_t *words, uint32_t count ){
+
+	uint8_t header[ 10 ];
+	uint32_t address;
+	uint32_t timestamp;
+	segment_t segments[ 2 ];
+
+	address = (uint32_t)(uintptr_t)fmt;
+	timestamp = millis();
+
+	header[ 0 ] = SERIAL_LOG_SYNC;
+	header[ 1 ] = count;
+	memcpy( &header[ 2 ], &address, 4 );
+	memcpy( &header[ 6 ], &timestamp, 4 );
+
+	segments[ 0 ].data = header;
+	segments[ 0 ].size = sizeof( header );
+	segments[ 1 ].data = (const uint8_t*)words;
+	segments[ 1 ].size = count * 4;
+
+	return transmitSegments( segments, 2 );
+
+}
+
+void SerialPort::printfCollect( void *context_p, const char *data, uint32_t size ){
+
+	printfContext_t *context = (printfContext_t*)context_p;
+
+	// serialFormatVPrintf counts the characters, only the ones that fit are kept.
+	if( context -> size < SERIAL_PRINTF_CHUNK_LENGTH ){
+
+		memcpy( &context -> chunk[ context -> size ], data, ( size < SERIAL_PRINTF_CHUNK_LENGTH - context -> size ) ? size : SERIAL_PRINTF_CHUNK_LENGTH - context -> size );
+
+	}
+
+	context -> size += size;
+
+}
+
+void SerialPort::printfCopy( void *context_p, const char *data, uint32_t size ){
+
+	printfContext_t *context = (printfContext_t*)context_p;
+
+	// The second pass gives the same text, but it must not write out of the reserved room.
+	if( context -> offset + size > context -> reserved ){
+
+		size = context -> reserved - context -> offset;
+
+	}
+
+	context -> port -> transmitCopy( context -> start, context -> offset, (const uint8_t*)data, size );
+	context -> offset += size;
+
+}
+
+void SerialPort::printfOutput( void *context_p, const char *data, uint32_t size ){
+
+	printfContext_t *context = (printfContext_t*)context_p;
+
+	// Small pieces are collected, so a line does not become many tiny transfers.
+	if( context -> size + size <= SERIAL_PRINTF_CHUNK_LENGTH ){
+
+		memcpy( &context -> chunk[ context -> size ], data, size );
+		context -> size += size;
+		return;
+
+	}
+
+	printfFlush( context );
+
+	if( size <= SERIAL_PRINTF_CHUNK_LENGTH ){
+
+		memcpy( context -> chunk, data, size );
+		context -> size = size;
+		return;
+
+	}
+
+	// Long pieces, like a long %s argument go directly to the transmitt buffer.
+	if( context -> port -> transmit( (const uint8_t*)data, size ) != size ){
+
+		context -> lost = true;
+
+	}
+
+}
+
+void SerialPort::printfFlush( printfContext_t *context ){
+
+	if( context -> size == 0 ){
+
+		return;
+
+	}
+
+	if( context -> port -> transmit( context -> chunk, context -> size ) != context -> size ){
+
+		context -> lost = true;
+
+	}
+
+	context -> size = 0;
+
+}
+
+size_t SerialPort::transmit( const uint8_t *data, uint32_t size ){
+
+	segment_t segment;
+
+	segment.data = data;
+	segment.size = size;
+
+	return transmitSegments( &segment, 1 );
+
 }
+
+size_t SerialPort::transmitSegments( const segment_t *segments, uint32_t count ){
+
+	uint32_t size = 0;
+	uint32_t skip = 0;
+	uint32_t piece;
+	uint32_t offset;
+	uint32_t start;
+	uint32_t chunk;
+	uint32_t i;
+	uint32_t position = 0;
+	size_t ret = 0;
+
+	for( i = 0; i < count; i++ ){
+
+		size += segments[ i ].size;
+
+	}
+
+	if( size == 0 ){
+
+		return 0;
+
+	}
+
+	// A message that is longer than the transmitt buffer can not be reserved at once.
+	if( size > transmit_length - 1 ){
+
+		if( tx_full_policy == TX_FULL_OVERWRITE ){
+
+			// Only the newest bytes of the message are kept.
+			skip = size - ( transmit_length - 1 );
+			size -= skip;
+			link_stats.tx_dropped += skip;
+
+		}
+
+		else if( ( tx_full_policy == TX_FULL_DROP ) || inInterrupt() ){
+
+			link_stats.tx_dropped += size;
+			return 0;
+
+		}
+
+	}
+
+	i = 0;
+
+	while( size > 0 ){
+
+		// With TX_FULL_BLOCK a long message is sent in pieces, that are
+		// not protected from the other producers.
+		piece = size;
+
+		if( piece > transmit_length - 1 ){
+
+			piece = transmit_length - 1;
+
+		}
+
+		if( !transmitReserve( piece, &start ) ){
+
+			return ret;
+
+		}
+
+		offset = 0;
+
+		while( offset < piece ){
+
+			// Skip the empty and the dropped parts of the segments.
+			if( position + skip >= segments[ i ].size ){
+
+				skip -= segments[ i ].size - position;
+				position = 0;
+				i++;
+				continue;
+
+			}
+
+			position += skip;
+			skip = 0;
+
+			chunk = segments[ i ].size - position;
+
+			if( chunk > piece - offset ){
+
+				chunk = piece - offset;
+
+			}
+
+			transmitCopy( start, offset, &segments[ i ].data[ position ], chunk );
+
+			offset += chunk;
+			position += chunk;
+
+		}
+
+		// Every segment is in the buffer, so they go out in one transfer.
+		transmitCommit();
+
+		size -= piece;
+		ret += piece;
+
+	}
+
+	return ret;
+
+}
+
+void SerialPort::transmitWait( uint32_t size ){
+
+	uint32_t start;
+
+	start = millis();
+
+	while( transmitFree() < size ){
+
+		startTransmit();
+
+	}
+
+	link_stats.tx_stalls++;
+	link_stats.tx_stall_time += millis() - start;
+
+}
+
+void SerialPort::transmitUpdatePeak(){
+
+	uint32_t fill;
+
+	fill = transmit_length - 1 - transmitFree();
+
+	if( fill > link_stats.tx_peak ){
+
+		link_stats.tx_peak = fill;
+
+	}
+
+}
+
+uint32_t SerialPort::transmitFree(){
+
+	// The ring always keeps one byte free to tell the full and the empty state apart.
+	return wrapTransmit( transmit_release + transmit_length - transmit_reserved - 1 );
+
+}
+
+void SerialPort::transmitDiscard( uint32_t size ){
+
+	uint32_t pending;
+	uint32_t tail;
+	uint32_t head;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	tail = transmit_tail;
+	head = transmit_head;
+
+	// Only the bytes that are not handed to the DMA yet can be discarded.
+	// The padding at the end of the buffer is not counted.
+	pending = ( head >= tail ) ? ( head - tail ) : ( transmit_wrap - tail + head );
+
+	if( size > pending ){
+
+		size = pending;
+
+	}
+
+	if( ( head < tail ) && ( size >= transmit_wrap - tail ) ){
+
+		transmit_tail = size - ( transmit_wrap - tail );
+		transmit_wrap = transmit_length;
+
+	}
+
+	else{
+
+		transmit_tail = tail + size;
+
+	}
+
+	link_stats.tx_dropped += size;
+
+	// Fewer bytes were handed to the DMA than what we discarded, the
+	// freed space starts at the new tail after the transfer is done.
+	if( !transmit_busy ){
+
+		transmit_release = transmit_tail;
+
+	}
+
+	__set_PRIMASK( primask );
+
+}
+
+bool SerialPort::transmitReserve( uint32_t size, uint32_t *start ){
+
+	uint32_t primask;
+	uint32_t free_space;
+	uint32_t padding;
+	uint32_t needed;
+	bool wrapping;
+
+	if( size > transmit_length - 1 ){
+
+		link_stats.tx_dropped += size;
+		return false;
+
+	}
+
+	while( true ){
+
+		// The check and the reservation has to be atomic, because an
+		// interrupt can reserve room between them.
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		free_space = transmitFree();
+
+		if( ( free_space < size ) && ( tx_full_policy == TX_FULL_OVERWRITE ) ){
+
+			transmitDiscard( size - free_space );
+
+			free_space = transmitFree();
+
+		}
+
+		// An empty buffer starts again at the beginning, like without DMA.
+		if( ( free_space == transmit_length - 1 ) && ( transmit_writers == 0 ) && !transmit_busy ){
+
+			transmit_head = 0;
+			transmit_tail = 0;
+			transmit_release = 0;
+			transmit_reserved = 0;
+			transmit_wrap = transmit_length;
+
+		}
+
+		// A message that would wrap around the end of the buffer starts at the
+		// beginning if there is room, so it is sent in one transfer. The
+		// rest of the buffer is padding, it is not sent.
+		padding = transmit_length - transmit_reserved;
+		wrapping = ( transmit_reserved + size > transmit_length ) && ( transmit_wrap == transmit_length );
+
+		if( wrapping && ( free_space >= size + padding ) ){
+
+			transmit_wrap = transmit_reserved;
+			*start = 0;
+			transmit_reserved = size;
+			transmit_writers++;
+
+			__set_PRIMASK( primask );
+
+			return true;
+
+		}
+
+		// TX_FULL_BLOCK rather waits for the room of the padding too, or for
+		// the empty buffer, so the message is not split. The other policies split it.
+		needed = size;
+
+		if( wrapping && ( tx_full_policy == TX_FULL_BLOCK ) && !inInterrupt() ){
+
+			needed = ( size + padding <= transmit_length - 1 ) ? size + padding : transmit_length - 1;
+
+		}
+
+		if( free_space >= needed ){
+
+			*start = transmit_reserved;
+			transmit_reserved = wrapTransmit( transmit_reserved + size );
+			transmit_writers++;
+
+			__set_PRIMASK( primask );
+
+			return true;
+
+		}
+
+		__set_PRIMASK( primask );
+
+		// An interrupt never waits, it could block the DMA interrupt.
+		if( ( tx_full_policy != TX_FULL_BLOCK ) || inInterrupt() ){
+
+			link_stats.tx_dropped += size;
+			return false;
+
+		}
+
+		// TX_FULL_BLOCK: wait for the DMA to make some room.
+		transmitWait( needed );
+
+	}
+
+}
+
+void SerialPort::transmitCopy( uint32_t start, uint32_t offset, const uint8_t *data, uint32_t size ){
+
+	uint32_t index;
+	uint32_t chunk;
+
+	if( size == 0 ){
+
+		return;
+
+	}
+
+	index = wrapTransmit( start + offset );
+	chunk = transmit_length - index;
+
+	if( chunk >= size ){
+
+		memcpy( &transmit_buffer[ index ], data, size );
+		return;
+
+	}
+
+	// The data wraps around the end of the buffer.
+	memcpy( &transmit_buffer[ index ], data, chunk );
+	memcpy( transmit_buffer, data + chunk, size - chunk );
+
+}
+
+void SerialPort::transmitCommit(){
+
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// The data can be sent only when every earlier reservation is written,
+	// so the last producer commits the room of the others too.
+	transmit_writers--;
+
+	if( transmit_writers == 0 ){
+
+		transmit_head = transmit_reserved;
+
+	}
+
+	__set_PRIMASK( primask );
+
+	transmitUpdatePeak();
+
+	startTransmit();
+
+}
+
+void SerialPort::startTransmit(){
+
+	uint32_t primask;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t wrap;
+	uint32_t size;
+
+	// Without a TX DMA stream the buffer is sent out with blocking calls.
+	if( usart_device -> hdmatx == NULL ){
+
+		// An interrupt only queues its message, the blocking calls would stall it
+		// for the whole buffer. The main loop sends it with its next message.
+		if( transmit_busy || inInterrupt() ){
+
+			return;
+
+		}
+
+		transmit_busy = true;
+
+		while( true ){
+
+			primask = __get_PRIMASK();
+			__disable_irq();
+
+			transmitAdvance( transmit_tail, 0 );
+			transmit_release = transmit_tail;
+
+			tail = transmit_tail;
+			head = transmit_head;
+
+			__set_PRIMASK( primask );
+
+			if( tail == head ){
+
+				break;
+
+			}
+
+			size = ( head > tail ) ? ( head - tail ) : ( transmit_wrap - tail );
+
+			// A failed transfer is dropped, retrying it could block the main loop forever.
+			if( HAL_UART_Transmit( usart_device, &transmit_buffer[ tail ], size, SERIAL_BLOCKING_TIMEOUT ) == HAL_OK ){
+
+				link_stats.tx_bytes += size;
+
+			}
+
+			else{
+
+				link_stats.tx_errors += size;
+
+			}
+
+			primask = __get_PRIMASK();
+			__disable_irq();
+
+			transmitAdvance( tail, size );
+			transmit_release = transmit_tail;
+
+			__set_PRIMASK( primask );
+
+		}
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		// The buffer is empty, the next message can start at the beginning, so it is not split.
+		if( ( transmit_writers == 0 ) && ( transmit_reserved == transmit_tail ) ){
+
+			transmit_head = 0;
+			transmit_tail = 0;
+			transmit_release = 0;
+			transmit_reserved = 0;
+			transmit_wrap = transmit_length;
+
+		}
+
+		transmit_busy = false;
+
+		__set_PRIMASK( primask );
+		return;
+
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// If the tail stopped at the padding, it goes to the beginning.
+	if( !transmit_busy ){
+
+		transmitAdvance( transmit_tail, 0 );
+
+	}
+
+	head = transmit_head;
+	tail = transmit_tail;
+	wrap = transmit_wrap;
+
+	if( transmit_busy || ( head == tail ) ){
+
+		__set_PRIMASK( primask );
+		return;
+
+	}
+
+	// The DMA can only send a contiguous block, so we stop at the end of the data.
+	if( head > tail ){
+
+		size = head - tail;
+
+	}
+
+	else{
+
+		size = wrap - tail;
+
+	}
+
+	transmit_busy = true;
+	transmit_release = tail;
+	transmitAdvance( tail, size );
+
+	if( HAL_UART_Transmit_DMA( usart_device, &transmit_buffer[ tail ], size ) != HAL_OK ){
+
+		// The peripheral is busy with something else, we will try again later.
+		transmit_busy = false;
+		transmit_tail = tail;
+		transmit_wrap = wrap;
+
+	}
+
+	else{
+
+		link_stats.tx_bytes += size;
+
+	}
+
+	__set_PRIMASK( primask );
+
+}
+
+void SerialPort::transmitAdvance( uint32_t tail, uint32_t size ){
+
+	tail += size;
+
+	// The padding is skipped when the data after it is committed.
+	if( ( tail >= transmit_wrap ) && ( transmit_head != tail ) ){
+
+		tail = 0;
+		transmit_wrap = transmit_length;
+
+	}
+
+	transmit_tail = tail;
+
+}
+
+void SerialPort::transmitCompleteHandler(){
+
+	// The bytes of the finished transfer are free again.
+	transmit_release = transmit_tail;
+	transmit_busy = false;
+
+	// Send the bytes that were queued while the DMA was running.
+	startTransmit();
+
+}
+
+void SerialPort::reciveEventHandler( uint16_t position ){
+
+	uint32_t index;
+
+	// The DMA reports the end of the buffer as the buffer size.
+	index = wrapRecive( position );
+
+	// The events come at least every half buffer, so the DMA can not make a whole lap between them.
+	recive_write_total += wrapRecive( index + recive_length - recive_write_index );
+	recive_write_index = index;
+	recive_event = true;
+
+	if( recive_callback != NULL ){
+
+		recive_callback( this );
+
+	}
+
+}
+
+void SerialPort::reciveHalfLapHandler(){
+
+	recive_half_laps++;
+
+}
+
+void SerialPort::errorHandler(){
+
+	uint32_t error;
+	uint32_t index;
+	uint32_t total;
+
+	error = usart_device -> ErrorCode;
+
+	if( error & HAL_UART_ERROR_ORE ){
+
+		link_stats.overrun_errors++;
+
+	}
+
+	if( error & HAL_UART_ERROR_FE ){
+
+		link_stats.framing_errors++;
+
+	}
+
+	if( error & HAL_UART_ERROR_NE ){
+
+		link_stats.noise_errors++;
+
+	}
+
+	// The HAL stops the DMA reception after an error. The DMA starts again
+	// at the beginning of the buffer, so the unread bytes are dropped.
+	if( usart_device -> RxState == HAL_UART_STATE_READY ){
+
+		total = reciveWriteTotal( &index );
+
+		link_stats.rx_bytes += total;
+		link_stats.rx_lost += total - recive_read_total;
+
+		startRecive();
+
+	}
+
+	// A DMA error stops the transmission too, the transfer will never complete.
+	if( transmit_busy && ( usart_device -> hdmatx != NULL ) && ( usart_device -> gState == HAL_UART_STATE_READY ) ){
+
+		transmitCompleteHandler();
+
+	}
+
+}
+
+SerialPort *SerialPort::findInstance( UART_HandleTypeDef *huart ){
+
+	uint32_t i;
+
+	for( i = 0; i < SERIAL_MAX_INSTANCES; i++ ){
+
+		if( ( instances[ i ] != NULL ) && ( instances[ i ] -> usart_device == huart ) ){
+
+			return instances[ i ];
+
+		}
+
+	}
+
+	return NULL;
+
+}
+
+void SerialPort::txCompleteCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort *port;
+
+	port = findInstance( huart );
+
+	if( port != NULL ){
+
+		port -> transmitCompleteHandler();
+
+	}
+
+}
+
+void SerialPort::rxEventCallback( UART_HandleTypeDef *huart, uint16_t size ){
+
+	SerialPort *port;
+
+	port = findInstance( huart );
+
+	if( port != NULL ){
+
+		port -> reciveEventHandler( size );
+
+	}
+
+}
+
+void SerialPort::rxHalfCompleteCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort *port;
+
+	port = findInstance( huart );
+
+	if( port != NULL ){
+
+		port -> reciveHalfLapHandler();
+
+	}
+
+}
+
+void SerialPort::rxCompleteCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort *port;
+
+	port = findInstance( huart );
+
+	if( port != NULL ){
+
+		port -> reciveHalfLapHandler();
+
+	}
+
+}
+
+void SerialPort::errorCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort *port;
+
+	port = findInstance( huart );
+
+	if( port != NULL ){
+
+		port -> errorHandler();
+
+	}
+
+}
+
+#ifndef SERIAL_NO_HAL_CALLBACKS
+
+extern "C" void HAL_UART_TxCpltCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort::txCompleteCallback( huart );
+
+}
+
+extern "C" void HAL_UART_RxHalfCpltCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort::rxHalfCompleteCallback( huart );
+
+}
+
+extern "C" void HAL_UART_RxCpltCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort::rxCompleteCallback( huart );
+
+}
+
+extern "C" void HAL_UART_ErrorCallback( UART_HandleTypeDef *huart ){
+
+	SerialPort::errorCallback( huart );
+
+}
+
+#ifdef HAL_UART_RECEPTION_TOIDLE
+
+extern "C" void HAL_UARTEx_RxEventCallback( UART_HandleTypeDef *huart, uint16_t Size ){
+
+	SerialPort::rxEventCallback( huart, Size );
+
+}
+
+#endif
+
+#endif
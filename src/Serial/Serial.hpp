@@ -21,23 +21,102 @@
 #include "usart.h"
 
 #include "System.hpp"
+#include "SerialFormat.hpp"
+#include "SerialFmt.hpp"
 
+#ifndef SERIAL_RECIVE_BUFFER_LENGTH
 /// Length of the recive buffer
 ///
 /// You can specify how much bytes you want to recive maximum.
 /// If this buffer is to large, then it will waste your RAM.
 /// If this buffer is to short, then you can't send your data properly.
+/// This is the default size, every object can have its own size with
+/// \link SerialBuffered \endlink.
 #define SERIAL_RECIVE_BUFFER_LENGTH 10
+#endif
 
-/// Length of the printf buffer
+#ifndef SERIAL_PRINTF_CHUNK_LENGTH
+/// Length of the printf chunk buffer
 ///
-/// You can specify how much bytes you want to put in a formatted string maximum.
-/// If this buffer is to large, then it will waste your RAM.
-/// If this buffer is to short, then you can't send your data properly.
-#define SERIAL_PRINTF_BUFFER_LENGTH 100
+/// The printf functions collect the formatted text in a buffer of this size
+/// on the stack. A text that fits in it is formatted only once, a longer
+/// one is formatted twice. It does not limit the length of the formatted text.
+#define SERIAL_PRINTF_CHUNK_LENGTH 64
+#endif
+
+#ifndef SERIAL_TRANSMIT_BUFFER_LENGTH
+/// Length of the transmitt buffer
+///
+/// The outgoing data is copied to this buffer, and the DMA sends it out
+/// in the background. If this buffer is to large, then it will waste your RAM.
+/// If this buffer is to short, then the full buffer policy has to be used often.
+/// This is the default size, every object can have its own size with
+/// \link SerialBuffered \endlink.
+#define SERIAL_TRANSMIT_BUFFER_LENGTH 256
+#endif
+
+#ifndef SERIAL_LINE_ENDING
+/// Line ending of the println functions
+///
+/// It is "\r\n" by default. Define it as "\n" for LF only, or as "" to
+/// send no line ending at all. The println functions put the line ending
+/// next to the data, so a line goes out in one transfer. A line that would
+/// wrap around the end of the transmitt buffer starts at its beginning, and
+/// the rest of the buffer is skipped.
+#define SERIAL_LINE_ENDING "\r\n"
+#endif
+
+#ifndef SERIAL_INT_OVERLOADS
+/// Enable the int and unsigned int print overloads
+///
+/// On the ARM toolchain int32_t is long, so int needs its own overloads.
+/// On the toolchains where int32_t is int, like the host build in
+/// tools/host_sim, define it as 0.
+#define SERIAL_INT_OVERLOADS 1
+#endif
+
+#ifndef SERIAL_LOG_NAME_LENGTH
+/// Maximum length of a module name in the log prefix
+///
+/// Longer names are truncated. See SerialLog.hpp.
+#define SERIAL_LOG_NAME_LENGTH 16
+#endif
+
+/// Length of the buffer that holds a log prefix
+///
+/// "[ ", the timestamp( a 64-bit number in the worst case ), " ] ", the level,
+/// a space, the module name and ": ".
+#define SERIAL_LOG_PREFIX_LENGTH ( SERIAL_FORMAT_BUFFER_LENGTH + SERIAL_LOG_NAME_LENGTH + 8 )
+
+/// First byte of a binary log record
+///
+/// See \link SerialPort::dbgLog \endlink.
+#define SERIAL_LOG_SYNC 0xA5
+
+#ifndef SERIAL_MAX_INSTANCES
+/// Maximum number of Serial objects
+///
+/// The HAL callbacks are routed to the Serial objects through a table.
+/// This is the size of this table.
+#define SERIAL_MAX_INSTANCES 6
+#endif
+
+#ifndef SERIAL_BLOCKING_TIMEOUT
+/// Timeout of the blocking transmission in ms
+///
+/// This timeout is used, when the UART has no TX DMA stream linked to it.
+#define SERIAL_BLOCKING_TIMEOUT 1000
+#endif
 
 /// Serial RS232 Class
 ///
+/// SerialPort is the implementation of the \link Serial \endlink objects.
+/// It does not own its buffers, so the same code serves every buffer size.
+/// Use \link Serial \endlink for the default buffer sizes, or
+/// \link SerialBuffered \endlink to specify them for each object.
+/// If the size of a buffer is a power of two, the indexes are wrapped with
+/// a mask instead of a compare.
+///
 /// Serial is an RS232 library. This is an Arduino Serial like object, the
 /// functionality is ment to be the same.
 ///
@@ -60,20 +139,147 @@
 /// }
 ///
 /// \endcode
-class Serial{
+///
+/// If the UART has a TX DMA stream linked to it( hdmatx ), the transmitt
+/// functions are not blocking. They copy the data to a ring buffer and the
+/// DMA sends it out in the background. The next transfer is started from the
+/// HAL_UART_TxCpltCallback, which is implemented in Serial.cpp, just like
+/// HAL_UARTEx_RxEventCallback, HAL_UART_RxHalfCpltCallback, HAL_UART_RxCpltCallback
+/// and HAL_UART_ErrorCallback. If your project needs its own HAL UART callbacks,
+/// define SERIAL_NO_HAL_CALLBACKS and call \link txCompleteCallback \endlink,
+/// \link rxEventCallback \endlink, \link rxHalfCompleteCallback \endlink,
+/// \link rxCompleteCallback \endlink and \link errorCallback \endlink from
+/// your implementation.
+///
+/// The half and full transfer interrupts of the recive DMA are counted, so
+/// the object knows how many laps the DMA made in the recive buffer. If the
+/// reader falls behind by a whole buffer, the overwritten data is dropped and
+/// the overrun is counted instead of reporting a wrong number of bytes. These
+/// counters and the UART errors can be read with \link stats \endlink.
+///
+/// The object can be used from the main loop and from interrupts at the
+/// same time. Every message, like a print, println or printf call, reserves
+/// its room in the transmitt buffer in a short critical section, then it is
+/// copied without disabling the interrupts. The messages of the different
+/// producers never get mixed, and the transmitt functions never wait in an
+/// interrupt. If there is no room in an interrupt, the message is dropped,
+/// even with TX_FULL_BLOCK policy. Without TX DMA stream the messages of the
+/// interrupts are only put to the transmitt buffer, they are sent with blocking
+/// calls by the next transmitt function or \link flush \endlink of the main loop.
+class SerialPort{
 
 public:
-  /// Serial object constructor
+
+  /// Enumeration for the full transmitt buffer policies
+  enum txFullPolicy_t{
+    TX_FULL_BLOCK,      ///< Wait until the DMA makes enough room.
+    TX_FULL_DROP,       ///< Drop the new message.
+    TX_FULL_OVERWRITE   ///< Discard the oldest bytes that are not sent yet.
+  };
+
+  /// Enumeration for the recive modes
+  enum rxMode_t{
+    RX_POLLING,   ///< The DMA counter is read on every access.
+    RX_EVENT      ///< The write index is updated from the idle line, half and full transfer interrupts.
+  };
+
+  /// Memory segment
+  ///
+  /// It is used for the scatter-gather transmission, and to access the
+  /// recive buffer without copy.
+  struct segment_t{
+    const uint8_t *data;  ///< Pointer to the first byte of the segment.
+    size_t size;          ///< Number of bytes in the segment.
+  };
+
+  /// Enumeration for the debug log modes
+  enum logMode_t{
+    LOG_TEXT,     ///< dbgLog formats the message like dbgPrintf.
+    LOG_BINARY    ///< dbgLog transmitts a binary record, the host formats it.
+  };
+
+  /// Enumeration for the timestamp of the text debug and log messages
+  enum timestamp_t{
+    TIMESTAMP_MILLIS,   ///< HAL tick in ms.
+    TIMESTAMP_MICROS,   ///< DWT cycle counter in us, see \link micros64 \endlink.
+    TIMESTAMP_CYCLES    ///< DWT cycle counter in CPU cycles, see \link cycles64 \endlink.
+  };
+
+  /// Link statistics
+  ///
+  /// The counters are 32-bit long and they wrap around. \link begin \endlink clears them.
+  struct stats_t{
+    uint32_t rx_bytes;          ///< Number of bytes written to the recive buffer by the DMA.
+    uint32_t tx_bytes;          ///< Number of bytes handed to the UART.
+    uint32_t rx_overruns;       ///< Number of times the DMA lapped the reader.
+    uint32_t rx_lost;           ///< Number of unread bytes dropped by overruns and reception restarts.
+    uint32_t overrun_errors;    ///< Number of UART overrun errors( ORE ).
+    uint32_t framing_errors;    ///< Number of UART framing errors( FE ).
+    uint32_t noise_errors;      ///< Number of UART noise errors( NE ).
+    uint32_t rx_peak;           ///< Highest number of unread bytes seen by the reading functions.
+    uint32_t tx_peak;           ///< Highest number of bytes in the transmitt buffer.
+    uint32_t tx_dropped;        ///< Number of bytes dropped by the full transmitt buffer policy.
+    uint32_t tx_stalls;         ///< Number of times a transmitt function waited for room.
+    uint32_t tx_stall_time;     ///< Time spent waiting for room in the transmitt buffer in ms.
+    uint32_t tx_errors;         ///< Number of bytes dropped by failed or timed out blocking transfers, without TX DMA.
+  };
+
+  /// Type of the recive callback
   ///
+  /// @param port the object that recived the data.
+  typedef void (*reciveCallback_t)( SerialPort *port );
+
+  /// SerialPort object constructor
+  ///
+  /// With this constructor you can give your own buffers to the object.
+  /// Usually it is easier to use \link SerialBuffered \endlink.
   /// @param usart_device_p pointer to an RS232 peripherial.
-  Serial( UART_HandleTypeDef *usart_device_p );
+  /// @param recive_buffer_p pointer to the recive buffer. The DMA writes it in circular mode.
+  /// @param recive_length_p size of the recive buffer. It can be 65535 bytes maximum.
+  /// @param transmit_buffer_p pointer to the transmitt buffer.
+  /// @param transmit_length_p size of the transmitt buffer.
+  /// @note If there are more objects than \link SERIAL_MAX_INSTANCES \endlink, the Error_Handler is called.
+  SerialPort( UART_HandleTypeDef *usart_device_p, uint8_t *recive_buffer_p, uint32_t recive_length_p, uint8_t *transmit_buffer_p, uint32_t transmit_length_p );
+
+  /// SerialPort object destructor
+  ///
+  /// It removes the object from the table of the HAL callbacks.
+  ~SerialPort();
 
   /// Begin function
   ///
   /// It initalises the peripherial and starts the reception with DMA.
+  /// The link statistics are cleared.
   /// @param baudrate_p You can specify the baudrate with this argument.
   void begin( uint32_t baudrate_p );
 
+  /// Set the recive mode
+  ///
+  /// In RX_POLLING mode, which is the default, every access reads the DMA counter.
+  /// In RX_EVENT mode the reception is started with HAL_UARTEx_ReceiveToIdle_DMA,
+  /// and the write index is updated from the idle line, the half transfer and
+  /// the transfer complete interrupts. The data is visible only after one of
+  /// these events, but the DMA registers are not touched by the reading functions.
+  /// @param rx_mode_p the new recive mode.
+  /// @warning This function has to be called before begin function.
+  /// @note RX_EVENT mode needs the UART global interrupt to be enabled.
+  /// If the HAL does not support reception to idle, the mode stays RX_POLLING.
+  void setReciveMode( rxMode_t rx_mode_p );
+
+  /// Set the recive callback
+  ///
+  /// In RX_EVENT mode this function is called from the interrupt after new
+  /// data arrived. Keep it short!
+  /// @param callback_p the function to call, NULL to disable.
+  void setReciveCallback( reciveCallback_t callback_p );
+
+  /// Check if new data arrived
+  ///
+  /// In RX_EVENT mode this flag is set from the interrupt after new data arrived.
+  /// Reading the flag clears it.
+  /// @returns true if data arrived since the last call.
+  bool dataArrived();
+
   /// Returns the number of bytes in the recive buffer
 	///
 	/// With this function you can read that how many bytes arrived into the
@@ -94,276 +300,581 @@ public:
 	/// any data to read. If the buffer is empty then this function will return -1.
   int peek();
 
+  /// Read the arrived bytes to a buffer without waiting
+  ///
+  /// This command copies the bytes that are in the recive buffer, but not
+  /// more than size, and returns immediately. The DMA position is read once,
+  /// and the data is copied with one memcpy, or with two if it wraps around
+  /// the end of the recive buffer.
+  /// @param buff the pointer to the buffer.
+  /// @param size the size of the buffer.
+  /// @returns the number of bytes read, 0 if the recive buffer is empty.
+  size_t readAvailable( uint8_t *buff, size_t size );
+
   /// Read bytes to a buffer
   ///
-  /// This command reads a predefined amount of bytes to a buffer.
+  /// This command reads a predefined amount of bytes to a buffer. It waits
+  /// until every byte arrives, use the version with timeout if the data
+  /// can stop. The bytes are copied in blocks, like \link readAvailable \endlink.
   /// @param buff the pointer to the buffer.
   /// @param size the size of the buffer.
   size_t readBytes( uint8_t *buff, uint32_t size );
 
+  /// Read bytes to a buffer with timeout
+  ///
+  /// This command reads a predefined amount of bytes to a buffer, or less if
+  /// the timeout elapses. While it waits for the data the CPU sleeps. The
+  /// bytes are copied in blocks, like \link readAvailable \endlink.
+  /// @param buff the pointer to the buffer.
+  /// @param size the size of the buffer.
+  /// @param timeout timeout in ms.
+  /// @returns the number of bytes read.
+  size_t readBytes( uint8_t *buff, uint32_t size, uint32_t timeout );
+
+  /// Read bytes to a buffer until a delimiter
+  ///
+  /// This command reads bytes to a buffer until the delimiter arrives, the
+  /// buffer is full or the timeout elapses. The delimiter is removed from
+  /// the recive buffer, but it is not copied. The delimiter is searched with
+  /// memchr and the data is copied in blocks.
+  /// @param delimiter the character that ends the reading.
+  /// @param buff the pointer to the buffer.
+  /// @param size the size of the buffer.
+  /// @param timeout timeout in ms.
+  /// @returns the number of bytes copied to the buffer.
+  size_t readBytesUntil( char delimiter, uint8_t *buff, size_t size, uint32_t timeout );
+
+  /// Find a line in the recive buffer without copy
+  ///
+  /// If a complete line is in the recive buffer, this function returns it
+  /// as segments that point directly into the recive buffer. If the line
+  /// wraps around the end of the buffer, it has two segments, otherwise the
+  /// second one is empty. The data stays in the buffer until \link consume \endlink
+  /// is called.
+  ///
+  /// Example code:
+  /// \code{.cpp}
+  ///
+  /// SerialPort::segment_t line[ 2 ];
+  /// size_t length;
+  ///
+  /// length = SerialToPC.peekLine( line );
+  ///
+  /// if( length > 0 ){
+  ///
+  ///   parser.feed( line[ 0 ].data, line[ 0 ].size );
+  ///   parser.feed( line[ 1 ].data, line[ 1 ].size );
+  ///
+  ///   SerialToPC.consume( length );
+  ///
+  /// }
+  ///
+  /// \endcode
+  /// @param line array of two segments for the result.
+  /// @param delimiter the character at the end of the line. '\\n' by default.
+  /// @returns the length of the line with the delimiter, 0 if there is no complete line.
+  /// @warning The DMA overwrites the data if the line is not consumed in time.
+  size_t peekLine( segment_t *line, char delimiter = '\n' );
+
+  /// Remove bytes from the recive buffer
+  ///
+  /// @param size the number of bytes to remove. It is limited to the available bytes.
+  void consume( size_t size );
+
   /// Flush the transmitt buffer
   ///
-  /// Actually this is not needed because the transmitt function is a blocked
-  /// implementation. It is implemented only because compatibility reasons.
+  /// This function waits until every byte from the transmitt buffer is sent out.
+  /// It waits only in thread context. In an interrupt it starts the
+  /// transfer and returns without waiting.
   void flush();
 
+  /// Set the full transmitt buffer policy
+  ///
+  /// With this function you can specify what happens, when there is not
+  /// enough space in the transmitt buffer for a new message. By default the
+  /// transmitt functions wait for the DMA.
+  /// @param policy_p the new policy.
+  /// @note In an interrupt TX_FULL_BLOCK drops the message instead of waiting.
+  void setTxFullPolicy( txFullPolicy_t policy_p );
+
+  /// Returns the link statistics
+  ///
+  /// The counters can be used to size the buffers and to choose the baudrate
+  /// based on the real traffic.
+  ///
+  /// Example code:
+  /// \code{.cpp}
+  ///
+  /// SerialPort::stats_t stats = SerialToPC.stats();
+  ///
+  /// if( stats.rx_overruns > 0 ){
+  ///
+  ///   // The recive buffer is too short, or it is not read often enough.
+  ///
+  /// }
+  ///
+  /// \endcode
+  /// @returns a copy of the counters.
+  stats_t stats();
+
+  /// Clear the link statistics
+  void resetStats();
+
+  /// Transmit complete callback
+  ///
+  /// This function has to be called from HAL_UART_TxCpltCallback. It starts
+  /// the next DMA transfer of the object that belongs to huart.
+  /// @param huart pointer to the UART handle that finished the transfer.
+  static void txCompleteCallback( UART_HandleTypeDef *huart );
+
+  /// Recive event callback
+  ///
+  /// This function has to be called from HAL_UARTEx_RxEventCallback in RX_EVENT mode.
+  /// @param huart pointer to the UART handle that recived data.
+  /// @param size the position of the DMA in the recive buffer.
+  static void rxEventCallback( UART_HandleTypeDef *huart, uint16_t size );
+
+  /// Recive half complete callback
+  ///
+  /// This function has to be called from HAL_UART_RxHalfCpltCallback in RX_POLLING mode.
+  /// @param huart pointer to the UART handle that recived data.
+  static void rxHalfCompleteCallback( UART_HandleTypeDef *huart );
+
+  /// Recive complete callback
+  ///
+  /// This function has to be called from HAL_UART_RxCpltCallback in RX_POLLING mode.
+  /// @param huart pointer to the UART handle that recived data.
+  static void rxCompleteCallback( UART_HandleTypeDef *huart );
+
+  /// Error callback
+  ///
+  /// This function has to be called from HAL_UART_ErrorCallback. It counts
+  /// the errors and restarts the reception, because the HAL stops the DMA
+  /// after an error.
+  /// @param huart pointer to the UART handle that detected the error.
+  static void errorCallback( UART_HandleTypeDef *huart );
+
   /// Transmitt a byte
   ///
-  /// Transmitt a byte. It is using blockint code!
+  /// Transmitt a byte.
   /// @param b the byte that you want to transmitt
   size_t write( uint8_t b );
 
+  /// Transmitt a buffer
+  ///
+  /// Transmitt a buffer with one copy to the transmitt buffer.
+  /// @param buff pointer to the data that you want to transmitt
+  /// @param size the number of bytes to transmitt
+  /// @returns the number of bytes accepted
+  size_t write( const uint8_t *buff, size_t size );
+
+  /// Transmitt more buffers as one message
+  ///
+  /// Every segment is copied to the transmitt buffer before the DMA is
+  /// started, so for example a header, a payload and a CRC go out in one
+  /// transfer. The full buffer policy applies to the whole message.
+  ///
+  /// Example code:
+  /// \code{.cpp}
+  ///
+  /// SerialPort::segment_t packet[] = {
+  ///   { header, sizeof( header ) },
+  ///   { payload, payload_size },
+  ///   { (uint8_t*)&crc, sizeof( crc ) }
+  /// };
+  ///
+  /// SerialToPC.writev( packet, 3 );
+  ///
+  /// \endcode
+  /// @param segments array of the segments.
+  /// @param count the number of segments.
+  /// @returns the number of bytes accepted
+  size_t writev( const segment_t *segments, uint32_t count );
+
   /// Transmitt a character
   ///
-  /// Transmitt a character. It is using blockint code!
+  /// Transmitt a character.
   /// @param c the character that you want to transmitt
   size_t print( char c );
 
   /// Transmitt a string
   ///
-  /// Transmitt a string. It is using blockint code!
+  /// Transmitt a string.
   /// The string has to be a c/c++ like '\0' terminated data.
   /// @param str the string that you want to transmitt
   size_t print( char *str );
 
   /// Transmitt a string
   ///
-  /// Transmitt a string. It is using blockint code!
+  /// Transmitt a string.
   /// The string has to be a c/c++ like '\0' terminated data.
   /// @param str the string that you want to transmitt
   size_t print( const char *str );
 
   /// Transmitt a int8_t
   ///
-  /// Transmitt a int8_t. It is using blockint code!
+  /// Transmitt a int8_t.
   /// @param b the data that you want to transmitt
-  size_t print( int8_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( int8_t b, int base = DEC );
 
   /// Transmitt an uint8_t
   ///
-  /// Transmitt an uint8_t. It is using blockint code!
+  /// Transmitt an uint8_t.
   /// @param b the data that you want to transmitt
-  size_t print( uint8_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( uint8_t b, int base = DEC );
 
   /// Transmitt a int16_t
   ///
-  /// Transmitt a int16_t. It is using blockint code!
+  /// Transmitt a int16_t.
   /// @param b the data that you want to transmitt
-  size_t print( int16_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( int16_t b, int base = DEC );
 
   /// Transmitt an uint16_t
   ///
-  /// Transmitt an uint16_t. It is using blockint code!
+  /// Transmitt an uint16_t.
   /// @param b the data that you want to transmitt
-  size_t print( uint16_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( uint16_t b, int base = DEC );
 
   /// Transmitt a int32_t
   ///
-  /// Transmitt a int32_t. It is using blockint code!
+  /// Transmitt a int32_t.
   /// @param b the data that you want to transmitt
-  size_t print( int32_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( int32_t b, int base = DEC );
 
   /// Transmitt an uint32_t
   ///
-  /// Transmitt an uint32_t. It is using blockint code!
+  /// Transmitt an uint32_t.
   /// @param b the data that you want to transmitt
-  size_t print( uint32_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( uint32_t b, int base = DEC );
 
   /// Transmitt a int64_t
   ///
-  /// Transmitt a int64_t. It is using blockint code!
+  /// Transmitt a int64_t.
   /// @param b the data that you want to transmitt
-  size_t print( int64_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( int64_t b, int base = DEC );
 
   /// Transmitt an uint64_t
   ///
-  /// Transmitt an uint64_t. It is using blockint code!
+  /// Transmitt an uint64_t.
   /// @param b the data that you want to transmitt
-  size_t print( uint64_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( uint64_t b, int base = DEC );
+
+#if SERIAL_INT_OVERLOADS
 
   /// Transmitt an int
   ///
-  /// Transmitt an int. It is using blockint code!
+  /// Transmitt an int.
   /// @param b the data that you want to transmitt
-  size_t print( int i );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( int i, int base = DEC );
 
   /// Transmitt an unsigned int
   ///
-  /// Transmitt an unsigned int. It is using blockint code!
+  /// Transmitt an unsigned int.
   /// @param b the data that you want to transmitt
-  size_t print( unsigned int i );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t print( unsigned int i, int base = DEC );
+
+#endif
 
   /// Transmitt a float
   ///
-  /// Transmitt a float. It is using blockint code!
+  /// Transmitt a float.
   /// @param f the float that you want to transmitt
-  size_t print( float f );
+  /// @param digits the number of fractional digits. 6 by default, 9 maximum.
+  size_t print( float f, int digits = 6 );
 
   /// Transmitt a double
   ///
-  /// Transmitt a double. It is using blockint code!
+  /// Transmitt a double.
   /// @param d the float that you want to transmitt
-  size_t print( double d );
+  /// @param digits the number of fractional digits. 6 by default, 9 maximum.
+  size_t print( double d, int digits = 6 );
 
   /// Print a new line sequence
   ///
   /// Print a new line sequence.
-  /// The new line consist of a "\r\n" combo.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   size_t println();
 
 
   /// Transmitt a character with a new line
   ///
-  /// Transmitt a character  with a new line. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a character  with a new line.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param c the character that you want to transmitt
   size_t println( char c );
 
   /// Transmitt a string with a new line
   ///
-  /// Transmitt a string with a new line. It is using blockint code!
+  /// Transmitt a string with a new line.
   /// The string has to be a c/c++ like '\0' terminated data.
-  /// The new line consist of a "\r\n" combo.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param str the string that you want to transmitt
   size_t println( char *str );
 
   /// Transmitt a string with a new line
   ///
-  /// Transmitt a string with a new line. It is using blockint code!
+  /// Transmitt a string with a new line.
   /// The string has to be a c/c++ like '\0' terminated data.
-  /// The new line consist of a "\r\n" combo.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param str the string that you want to transmitt
+  /// @note The line goes out in one transfer. It can be split in two only
+  /// when the buffer is nearly full and it can not wait: with TX_FULL_DROP or
+  /// TX_FULL_OVERWRITE policy, or in an interrupt.
   size_t println( const char *str );
 
   /// Transmitt a int8_t with a new line
   ///
-  /// Transmitt a int8_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a int8_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( int8_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( int8_t b, int base = DEC );
 
   /// Transmitt an uint8_t with a new line
   ///
-  /// Transmitt an uint8_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an uint8_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( uint8_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( uint8_t b, int base = DEC );
 
   /// Transmitt a int16_t with a new line
   ///
-  /// Transmitt a int16_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a int16_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( int16_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( int16_t b, int base = DEC );
 
   /// Transmitt an uint16_t with a new line
   ///
-  /// Transmitt an uint16_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an uint16_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( uint16_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( uint16_t b, int base = DEC );
 
   /// Transmitt a int32_t with a new line
   ///
-  /// Transmitt a int32_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a int32_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( int32_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( int32_t b, int base = DEC );
 
   /// Transmitt an uint32_t with a new line
   ///
-  /// Transmitt an uint32_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an uint32_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( uint32_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( uint32_t b, int base = DEC );
 
   /// Transmitt a int64_t with a new line
   ///
-  /// Transmitt a int64_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a int64_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( int64_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( int64_t b, int base = DEC );
 
   /// Transmitt an uint64_t with a new line
   ///
-  /// Transmitt an uint64_t. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an uint64_t.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( uint64_t b );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( uint64_t b, int base = DEC );
+
+#if SERIAL_INT_OVERLOADS
 
   /// Transmitt an int with a new line
   ///
-  /// Transmitt an int. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an int.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( int i );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( int i, int base = DEC );
 
   /// Transmitt an unsigned int with a new line
   ///
-  /// Transmitt an unsigned int. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt an unsigned int.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param b the data that you want to transmitt
-  size_t println( unsigned int i );
+  /// @param base the base of the number( DEC, HEX, OCT, BIN ). DEC by default.
+  size_t println( unsigned int i, int base = DEC );
+
+#endif
 
   /// Transmitt a float with a new line
   ///
-  /// Transmitt a float. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a float.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param f the float that you want to transmitt
-  size_t println( float f );
+  /// @param digits the number of fractional digits. 6 by default, 9 maximum.
+  size_t println( float f, int digits = 6 );
 
   /// Transmitt a double with a new line
   ///
-  /// Transmitt a double. It is using blockint code!
-  /// The new line consist of a "\r\n" combo.
+  /// Transmitt a double.
+  /// The new line is \link SERIAL_LINE_ENDING \endlink.
   /// @param d the float that you want to transmitt
-  size_t println( double d );
+  /// @param digits the number of fractional digits. 6 by default, 9 maximum.
+  size_t println( double d, int digits = 6 );
 
   /// Transmit a formatted string
   ///
   /// This is a printf like function. The usage is exactly the same.
-  /// It can transmitt a formatted string. The length of the formatted
-  /// string is limited to a size of the \link SERIAL_PRINTF_BUFFER_LENGTH \endlink
-  /// buffer size.
+  /// It can transmitt a formatted string. The text is formatted directly
+  /// to the transmitt buffer as one message. A text that is longer than the
+  /// transmitt buffer is sent in pieces of \link SERIAL_PRINTF_CHUNK_LENGTH \endlink
+  /// bytes, so its length is not limited. See \link serialFormatVPrintf \endlink
+  /// for the supported conversions.
   /// @param fmt formatt string
   /// @param ... arguments
+  /// @returns the number of characters transmitted, or -1 if some of them were dropped.
   int printf( const char *fmt, ... );
 
-  /// Transmit a formatted string
+  /// Transmit a formatted string with a va_list
   ///
-  /// This is a printf like function. The usage is exactly the same.
-  /// It can transmitt a formatted string. The length of the formatted
-  /// string is limited to a size of the \link SERIAL_PRINTF_BUFFER_LENGTH \endlink
-  /// buffer size.
+  /// It works like \link printf \endlink, but the arguments are given as a va_list.
   /// @param fmt formatt string
-  /// @param ... arguments
-  int printf( char *fmt, ... );
+  /// @param args arguments
+  /// @returns the number of characters transmitted, or -1 if some of them were dropped.
+  int vprintf( const char *fmt, va_list args );
+
+  /// Transmit a formatted string with a compile time format
+  ///
+  /// The format string is parsed by the compiler, see SerialFmt.hpp for the
+  /// syntax. Every call site gets its own formatter without varargs, and
+  /// a wrong number or type of the arguments is a compile error. The
+  /// numbers are formatted to a buffer on the stack, that is exactly as
+  /// long as they need. The literal parts and the string arguments are
+  /// copied directly to the transmitt buffer, and the whole text goes out
+  /// as one message, like \link writev \endlink.
+  ///
+  /// Example code:
+  /// \code{.cpp}
+  ///
+  /// SerialToPC.format( SERIAL_FMT( "T={} V={:.2f} flags=0x{:X}\r\n" ), tick, voltage, flags );
+  ///
+  /// \endcode
+  /// @param fmt format string created with \link SERIAL_FMT \endlink.
+  /// @param args arguments.
+  /// @returns the number of characters accepted.
+  template< typename F, typename... Args >
+  size_t format( F fmt, Args... args ){
+
+    static_assert( serialFmtValid( F::text(), 0 ), "Invalid format string." );
+    static_assert( serialFmtFields( F::text(), 0 ) == sizeof...( Args ), "The number of arguments does not match the format string." );
+
+    // One extra element, so the arrays are not empty.
+    segment_t segments[ serialFmtSegments( F::text(), 0 ) + 1 ];
+    char scratch[ serialFmtEmit_t< F, 0 >::template scratch< Args... >() + 1 ];
+    uint32_t count;
+
+    ( void )fmt;
+
+    count = serialFmtEmit_t< F, 0 >::emit( segments, scratch, args... );
+
+    return transmitSegments( segments, count );
+
+  }
 
   /// Transmit a debug message as a formatted string
   ///
   /// This is a printf like function. The usage is exactly the same.
-  /// It can transmitt a formatted string. The length of the formatted
-  /// string is limited to a size of the \link SERIAL_PRINTF_BUFFER_LENGTH \endlink
-  /// buffer size.
+  /// The message starts with a "[ millis ] dbg: " prefix.
   /// @param fmt formatt string
   /// @param ... arguments
+  /// @returns the number of characters transmitted without the prefix, or -1 if some of them were dropped.
   int dbgPrintf( const char *fmt, ... );
 
-  /// Transmit a debug message as a formatted string
+  /// Transmit a leveled log message as a formatted string
   ///
-  /// This is a printf like function. The usage is exactly the same.
-  /// It can transmitt a formatted string. The length of the formatted
-  /// string is limited to a size of the \link SERIAL_PRINTF_BUFFER_LENGTH \endlink
-  /// buffer size.
+  /// This is the output of the SERIAL_LOG_ERROR ... SERIAL_LOG_TRACE macros,
+  /// see SerialLog.hpp. The message starts with a "[ millis ] L module: "
+  /// prefix, where L is the letter of the level. The prefix and the message
+  /// go out as one unit, like \link dbgPrintf \endlink.
+  /// @param level letter of the level, for example 'E' or 'W'.
+  /// @param module name of the module. It is truncated to \link SERIAL_LOG_NAME_LENGTH \endlink characters.
   /// @param fmt formatt string
   /// @param ... arguments
-  int dbgPrintf( char *fmt, ... );
+  /// @returns the number of characters transmitted without the prefix, or -1 if some of them were dropped.
+  int logPrintf( char level, const char *module, const char *fmt, ... );
 
+  /// Set the debug log mode
+  ///
+  /// @param log_mode_p the new mode. LOG_TEXT by default.
+  void setLogMode( logMode_t log_mode_p );
 
+  /// Set the timestamp of the text debug and log messages
+  ///
+  /// The timestamp is in the prefix of \link dbgPrintf \endlink and
+  /// \link logPrintf \endlink, it goes out in the same transfer as the
+  /// message. The DWT based timestamps resolve the events of a fast control
+  /// loop, the cycles show their order with sub-microsecond resolution.
+  /// They start the cycle counter with \link cyclesBegin \endlink.
+  /// @param timestamp_p the new timestamp. TIMESTAMP_MILLIS by default.
+  void setTimestamp( timestamp_t timestamp_p );
 
+  /// Transmit a debug message with deferred formatting
+  ///
+  /// In LOG_TEXT mode this function works like \link dbgPrintf \endlink.
+  /// In LOG_BINARY mode the message is not formatted on the MCU. A compact
+  /// record is transmitted instead, and tools/dbglog_decode.py rebuilds the
+  /// text on the host from the ELF file. The record is little endian:
+  ///
+  /// | Size | Content                                   |
+  /// |------|-------------------------------------------|
+  /// | 1    | \link SERIAL_LOG_SYNC \endlink             |
+  /// | 1    | number of argument words                  |
+  /// | 4    | address of the format string               |
+  /// | 4    | timestamp in ms                           |
+  /// | 4*n  | argument words                            |
+  ///
+  /// 64-bit integers and floating point numbers take two words, they are
+  /// sent as double. Everything else takes one word.
+  /// @param fmt formatt string. It has to be a string literal, because the
+  /// host reads it from the ELF file.
+  /// @param args arguments. The %s arguments have to point to constant strings too.
+  /// @returns the number of bytes transmitted in LOG_BINARY mode, the result of
+  /// \link dbgPrintf \endlink in LOG_TEXT mode.
+  template< typename... Args >
+  int dbgLog( const char *fmt, Args... args ){
+
+    // One extra word, so the array is not empty without arguments.
+    uint32_t words[ 2 * sizeof...( Args ) + 1 ];
+    uint32_t count = 0;
+
+    if( log_mode == LOG_TEXT ){
+
+      return dbgPrintf( fmt, args... );
 
+    }
+
+    // Every argument is packed by the matching logPack overload.
+    int unpack[] = { 0, ( count += logPack( &words[ count ], args ), 0 )... };
+    ( void )unpack;
+
+    return logRecord( fmt, words, count );
+
+  }
 
 private:
+  /// The packet layer writes directly to the transmitt buffer.
+  friend class SerialPacket;
+
   /// Uart peripherial address
   UART_HandleTypeDef *usart_device = NULL;
 
@@ -371,11 +882,425 @@ private:
   uint32_t baudrate = 0;
 
   /// Recive buffer
-  uint8_t recive_buffer[ SERIAL_RECIVE_BUFFER_LENGTH ];
+  uint8_t *recive_buffer = NULL;
+
+  /// Size of the recive buffer
+  uint32_t recive_length = 0;
+
+  /// Mask for the recive buffer indexes if its size is a power of two, otherwise 0
+  uint32_t recive_mask = 0;
 
   /// Points to the next free element in the recive buffer
   uint32_t recive_buffer_counter = 0;
+
+  /// Points to the next element that the DMA will write, in RX_EVENT mode
+  volatile uint32_t recive_write_index = 0;
+
+  /// Number of half and full transfer interrupts of the recive DMA, in RX_POLLING mode
+  volatile uint32_t recive_half_laps = 0;
+
+  /// Number of bytes written by the DMA since the reception started, in RX_EVENT mode
+  volatile uint32_t recive_write_total = 0;
+
+  /// Number of bytes read since the reception started
+  uint32_t recive_read_total = 0;
+
+  /// Set when data arrived, in RX_EVENT mode
+  volatile bool recive_event = false;
+
+  /// Recive mode
+  rxMode_t rx_mode = RX_POLLING;
+
+  /// Called from the interrupt when data arrived
+  reciveCallback_t recive_callback = NULL;
+
+  /// Transmitt buffer
+  uint8_t *transmit_buffer = NULL;
+
+  /// Size of the transmitt buffer
+  uint32_t transmit_length = 0;
+
+  /// Mask for the transmitt buffer indexes if its size is a power of two, otherwise 0
+  uint32_t transmit_mask = 0;
+
+  /// Points to the end of the data that is ready to send
+  volatile uint32_t transmit_head = 0;
+
+  /// Points to the next free element in the transmitt buffer
+  volatile uint32_t transmit_reserved = 0;
+
+  /// Number of reservations that are not committed yet
+  volatile uint32_t transmit_writers = 0;
+
+  /// Points to the first element that is not handed to the DMA yet
+  volatile uint32_t transmit_tail = 0;
+
+  /// Points to the first element that is still used by the DMA
+  volatile uint32_t transmit_release = 0;
+
+  /// The data ends here before the end of the buffer, the rest is padding
+  ///
+  /// It is transmit_length if the data goes to the end of the buffer.
+  volatile uint32_t transmit_wrap = 0;
+
+  /// True while a DMA transfer is running
+  volatile bool transmit_busy = false;
+
+  /// What to do when the transmitt buffer is full
+  txFullPolicy_t tx_full_policy = TX_FULL_BLOCK;
+
+  /// Link statistics
+  stats_t link_stats = {};
+
+  /// Objects to route the HAL callbacks to
+  static SerialPort *instances[ SERIAL_MAX_INSTANCES ];
+
+  /// Wrap an index of the recive buffer
+  ///
+  /// @param index the index to wrap. It has to be smaller than two times the buffer size.
+  uint32_t wrapRecive( uint32_t index ){
+
+    if( recive_mask ){
+
+      return index & recive_mask;
+
+    }
+
+    return ( index >= recive_length ) ? ( index - recive_length ) : index;
+
+  }
+
+  /// Wrap an index of the transmitt buffer
+  ///
+  /// @param index the index to wrap. It has to be smaller than two times the buffer size.
+  uint32_t wrapTransmit( uint32_t index ){
+
+    if( transmit_mask ){
+
+      return index & transmit_mask;
+
+    }
+
+    return ( index >= transmit_length ) ? ( index - transmit_length ) : index;
+
+  }
+
+  /// Put data to the transmitt buffer and start the DMA
+  ///
+  /// @param data pointer to the data.
+  /// @param size number of bytes to send.
+  /// @returns the number of bytes accepted.
+  size_t transmit( const uint8_t *data, uint32_t size );
+
+  /// Put more segments to the transmitt buffer and start the DMA
+  ///
+  /// @param segments array of the segments.
+  /// @param count the number of segments.
+  /// @returns the number of bytes accepted.
+  size_t transmitSegments( const segment_t *segments, uint32_t count );
+
+  /// Start a DMA transfer if it is idle and there is data to send
+  ///
+  /// Without a TX DMA stream it sends out the buffer with blocking calls,
+  /// but only outside of the interrupts.
+  void startTransmit();
+
+  /// Wait for room in the transmitt buffer
+  ///
+  /// The waiting time is added to the link statistics.
+  /// @param size the number of free bytes to wait for.
+  void transmitWait( uint32_t size );
+
+  /// Save the fill level of the transmitt buffer if it is the highest so far
+  void transmitUpdatePeak();
+
+  /// Returns the number of free bytes in the transmitt buffer
+  uint32_t transmitFree();
+
+  /// Discard bytes from the transmitt buffer
+  ///
+  /// Only the bytes that are not handed to the DMA yet can be discarded.
+  /// @param size the number of the oldest bytes to discard.
+  void transmitDiscard( uint32_t size );
+
+  /// Make room for a message in the transmitt buffer
+  ///
+  /// The full buffer policy decides what happens if there is not enough room.
+  /// After a successful call the message can be written with \link transmitCopy \endlink
+  /// and sent with \link transmitCommit \endlink. It can be called from interrupts.
+  /// @param size the size of the message.
+  /// @param start output, the index of the reserved room.
+  /// @returns true if there is enough room.
+  bool transmitReserve( uint32_t size, uint32_t *start );
+
+  /// Copy data to the reserved room
+  ///
+  /// @param start the index of the reserved room.
+  /// @param offset offset from the beginning of the reserved room.
+  /// @param data pointer to the data.
+  /// @param size number of bytes.
+  void transmitCopy( uint32_t start, uint32_t offset, const uint8_t *data, uint32_t size );
+
+  /// Send the reserved room
+  ///
+  /// The data is handed to the DMA when every earlier reservation is committed.
+  void transmitCommit();
+
+  /// Returns true if the code runs in an interrupt
+  static bool inInterrupt(){
+
+    return __get_IPSR() != 0;
+
+  }
+
+  /// Move the tail after a block that is handed to the UART
+  ///
+  /// If the block ends at the padding and the data after it is committed,
+  /// the tail goes to the beginning of the buffer. It has to be called with
+  /// disabled interrupts.
+  /// @param tail the start of the block.
+  /// @param size the length of the block, 0 to skip only the padding.
+  void transmitAdvance( uint32_t tail, uint32_t size );
+
+  /// Release the sent bytes and start the next transfer
+  void transmitCompleteHandler();
+
+  /// Start the DMA reception from the beginning of the recive buffer
+  void startRecive();
+
+  /// Returns the index of the next element that the DMA will write
+  ///
+  /// If the DMA lapped the reader, the unread data is dropped and the overrun is counted.
+  uint32_t reciveWriteIndex();
+
+  /// Returns the number of bytes written by the DMA since the reception started
+  ///
+  /// @param index output, the index of the next element that the DMA will write.
+  uint32_t reciveWriteTotal( uint32_t *index );
+
+  /// Count a half or full transfer interrupt of the recive DMA
+  void reciveHalfLapHandler();
+
+  /// Count the UART errors and restart the stopped transfers
+  void errorHandler();
+
+  /// Returns the unread data of the recive buffer as segments
+  ///
+  /// @param segments array of two segments. The second one is used when the data wraps around.
+  /// @returns the number of unread bytes.
+  uint32_t reciveSegments( segment_t *segments );
+
+  /// Save the new write index and signal the arrival of data
+  ///
+  /// @param position the position of the DMA in the recive buffer.
+  void reciveEventHandler( uint16_t position );
+
+  /// Debug log mode
+  logMode_t log_mode = LOG_TEXT;
+
+  /// Timestamp of the text debug and log messages
+  timestamp_t log_timestamp = TIMESTAMP_MILLIS;
+
+  /// Transmitt a binary log record
+  ///
+  /// @param fmt formatt string.
+  /// @param words the packed arguments.
+  /// @param count the number of words.
+  /// @returns the number of bytes transmitted.
+  int logRecord( const char *fmt, const uint32_t *words, uint32_t count );
+
+  /// Pack a log argument to 32-bit words
+  ///
+  /// @param words the output.
+  /// @param value the argument.
+  /// @returns the number of words used.
+  static uint32_t logPack( uint32_t *words, int value ){ words[ 0 ] = (uint32_t)value; return 1; }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, unsigned int value ){ words[ 0 ] = (uint32_t)value; return 1; }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, long value ){ words[ 0 ] = (uint32_t)value; return 1; }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, unsigned long value ){ words[ 0 ] = (uint32_t)value; return 1; }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, long long value ){ return logPack( words, (unsigned long long)value ); }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, unsigned long long value ){
+
+    words[ 0 ] = (uint32_t)value;
+    words[ 1 ] = (uint32_t)( value >> 32 );
+    return 2;
+
+  }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, double value ){
+
+    memcpy( words, &value, sizeof( value ) );
+    return 2;
+
+  }
+
+  /// \copydoc logPack( uint32_t*, int )
+  static uint32_t logPack( uint32_t *words, const void *value ){ words[ 0 ] = (uint32_t)(uintptr_t)value; return 1; }
+
+  /// State of a printf call
+  struct printfContext_t{
+    SerialPort *port;                               ///< The object that transmitts the text.
+    uint8_t chunk[ SERIAL_PRINTF_CHUNK_LENGTH ];    ///< The collected pieces of the text.
+    uint32_t size;                                  ///< Number of bytes in chunk. In the first pass every formatted character is counted.
+    bool lost;                                      ///< Set if the transmitt buffer did not accept something.
+    uint32_t start;                                 ///< Index of the reserved room.
+    uint32_t offset;                                ///< Number of bytes written to the reserved room.
+    uint32_t reserved;                              ///< Size of the reserved room.
+  };
+
+  /// Format and transmitt a printf text as one message
+  ///
+  /// The first pass formats the text to the chunk and counts the characters.
+  /// If it fits in the chunk, it is copied to the transmitt buffer. A longer
+  /// text is formatted again to the reserved room of the transmitt buffer.
+  /// A text that is longer than the transmitt buffer is sent in chunks.
+  /// @param prefix text before the formatted string, it can be NULL.
+  /// @param prefix_size length of the prefix.
+  /// @param fmt formatt string.
+  /// @param args arguments.
+  /// @returns the number of characters without the prefix, or -1 if some of them were dropped.
+  int printfUnit( const char *prefix, uint32_t prefix_size, const char *fmt, va_list args );
+
+  /// Build the prefix of a debug or log message
+  ///
+  /// @param prefix buffer for the prefix, it has to be \link SERIAL_LOG_PREFIX_LENGTH \endlink long.
+  /// @param level letter of the level, or '\0' for no level.
+  /// @param name name of the source, it is truncated to \link SERIAL_LOG_NAME_LENGTH \endlink characters.
+  /// @returns the length of the prefix.
+  uint32_t logPrefix( char *prefix, char level, const char *name );
+
+  /// Output function for the first pass of the formatter
+  ///
+  /// It copies the text to the chunk while it fits, and counts every character in size.
+  /// @param context_p pointer to a printfContext_t.
+  /// @param data pointer to the piece of text.
+  /// @param size number of characters.
+  static void printfCollect( void *context_p, const char *data, uint32_t size );
+
+  /// Output function that writes to the reserved room
+  ///
+  /// @param context_p pointer to a printfContext_t.
+  /// @param data pointer to the piece of text.
+  /// @param size number of characters.
+  static void printfCopy( void *context_p, const char *data, uint32_t size );
+
+  /// Output function for the printf formatter
+  ///
+  /// @param context_p pointer to a printfContext_t.
+  /// @param data pointer to the piece of text.
+  /// @param size number of characters.
+  static void printfOutput( void *context_p, const char *data, uint32_t size );
+
+  /// Transmitt the collected text of a printf call
+  ///
+  /// @param context pointer to the state of the printf call.
+  static void printfFlush( printfContext_t *context );
+
+  /// Find the object that uses a UART handle
+  ///
+  /// @param huart pointer to the UART handle.
+  /// @returns the object or NULL if there is no such object.
+  static SerialPort *findInstance( UART_HandleTypeDef *huart );
+
+  /// Length of a buffer that holds a formatted number and the line ending
+  static const uint32_t PRINT_BUFFER_LENGTH = SERIAL_FORMAT_BUFFER_LENGTH + sizeof( SERIAL_LINE_ENDING ) - 1;
+
+  /// Transmitt a formatted text, optionally with the line ending
+  ///
+  /// The line ending is appended to the text, so they are copied to the
+  /// transmitt buffer in one piece.
+  /// @param buff the text. It has to be \link PRINT_BUFFER_LENGTH \endlink long.
+  /// @param size the length of the text.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  /// @returns the number of bytes accepted.
+  size_t printText( char *buff, uint32_t size, bool line );
+
+  /// Transmitt a string, optionally with the line ending
+  ///
+  /// @param str the '\0' terminated string.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  /// @returns the number of bytes accepted.
+  size_t printString( const char *str, bool line );
+
+  /// Format and transmitt a signed number
+  ///
+  /// @param value the number.
+  /// @param raw the number converted to an unsigned type with the same size.
+  /// It is used for the non decimal bases.
+  /// @param base the base of the number.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  size_t printSigned( int64_t value, uint64_t raw, int base, bool line );
+
+  /// Format and transmitt an unsigned number
+  ///
+  /// @param value the number.
+  /// @param base the base of the number.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  size_t printUnsigned( uint64_t value, int base, bool line );
+
+  /// Format and transmitt a float
+  ///
+  /// @param value the number.
+  /// @param digits the number of fractional digits.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  size_t printFloat( float value, int digits, bool line );
+
+  /// Format and transmitt a double
+  ///
+  /// @param value the number.
+  /// @param digits the number of fractional digits.
+  /// @param line true to append \link SERIAL_LINE_ENDING \endlink.
+  size_t printDouble( double value, int digits, bool line );
+};
+
+/// Serial RS232 Class with compile time buffer sizes
+///
+/// This is a \link SerialPort \endlink, that owns its buffers. Every object can
+/// have buffers sized to its traffic. Power of two sizes are recommended.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// // 512 byte long recive and 1024 byte long transmitt buffer for UART1
+/// SerialBuffered< 512, 1024 > SerialFast( &huart1 );
+///
+/// \endcode
+template< uint32_t RX_LENGTH = SERIAL_RECIVE_BUFFER_LENGTH, uint32_t TX_LENGTH = SERIAL_TRANSMIT_BUFFER_LENGTH >
+class SerialBuffered : public SerialPort{
+
+  static_assert( ( RX_LENGTH > 0 ) && ( RX_LENGTH <= 65535 ), "The DMA can handle 1 to 65535 byte long recive buffer." );
+  static_assert( ( TX_LENGTH > 1 ) && ( TX_LENGTH <= 65535 ), "The DMA can handle 2 to 65535 byte long transmitt buffer." );
+
+public:
+  /// SerialBuffered object constructor
+  ///
+  /// @param usart_device_p pointer to an RS232 peripherial.
+  SerialBuffered( UART_HandleTypeDef *usart_device_p ) : SerialPort( usart_device_p, recive_storage, RX_LENGTH, transmit_storage, TX_LENGTH ){}
+
+private:
+  /// Memory of the recive buffer
+  uint8_t recive_storage[ RX_LENGTH ];
+
+  /// Memory of the transmitt buffer
+  uint8_t transmit_storage[ TX_LENGTH ];
 };
 
+/// Serial RS232 Class with the default buffer sizes
+///
+/// The buffer sizes are \link SERIAL_RECIVE_BUFFER_LENGTH \endlink and
+/// \link SERIAL_TRANSMIT_BUFFER_LENGTH \endlink.
+typedef SerialBuffered<> Serial;
+
 
 #endif
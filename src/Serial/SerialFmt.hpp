@@ -0,0 +1,507 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_SERIAL_SERIALFMT_HPP_
+#define STM32_CLASS_FACTORY_SERIAL_SERIALFMT_HPP_
+
+#include<stdint.h>
+#include<stddef.h>
+#include<string.h>
+
+#include "SerialFormat.hpp"
+
+/// Compile time format strings
+///
+/// This file is the engine of \link SerialPort::format \endlink. The format
+/// string is parsed by constexpr functions, and every piece of it becomes a
+/// template instance. So the compiler generates a specialised formatter for
+/// every call site, and the mismatched arguments are compile errors.
+///
+/// The syntax is a subset of the fmt / std::format syntax:
+///
+/// | Field    | Arguments                 | Output                          |
+/// |----------|---------------------------|---------------------------------|
+/// | {}       | any supported type        | default format                  |
+/// | {:d}     | integers, char            | decimal                         |
+/// | {:x}     | integers, char            | lower case hexadecimal          |
+/// | {:X}     | integers, char            | upper case hexadecimal          |
+/// | {:o}     | integers, char            | octal                           |
+/// | {:b}     | integers, char            | binary                          |
+/// | {:c}     | char                      | the character                   |
+/// | {:s}     | const char*, char*        | the string                      |
+/// | {:f}     | float, double             | 6 fractional digits             |
+/// | {:.Nf}   | float, double             | N fractional digits( 0 to 9 )   |
+/// | {{ }}    |                           | '{' and '}'                     |
+///
+/// The hexadecimal, octal and binary formats print negative numbers in two's
+/// complement, like print( value, HEX ).
+///
+/// The parser uses C++11 constexpr recursion, so a format string can be a
+/// few hundred characters long, depending on the constexpr depth limit of
+/// the compiler.
+
+/// Turn a string literal to a compile time format string
+///
+/// The literal is wrapped in a unique type, so it can be a template parameter.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// SerialToPC.format( SERIAL_FMT( "T={} V={:.2f}\r\n" ), tick, voltage );
+///
+/// \endcode
+#define SERIAL_FMT( str ) ( []{ struct serialFmtString_t{ static constexpr const char *text(){ return str; } }; return serialFmtString_t(); }() )
+
+/// Kind of the format string part that starts at a position
+enum serialFmtKind_t{
+  SERIAL_FMT_END,       ///< End of the string.
+  SERIAL_FMT_LITERAL,   ///< Characters that are copied.
+  SERIAL_FMT_ESCAPE,    ///< "{{" or "}}".
+  SERIAL_FMT_FIELD,     ///< Replacement field.
+  SERIAL_FMT_ERROR      ///< A '}' without a field.
+};
+
+constexpr serialFmtKind_t serialFmtKind( const char *s, uint32_t i ){
+
+  return ( s[ i ] == '\0' ) ? SERIAL_FMT_END :
+         ( s[ i ] == '{' ) ? ( ( s[ i + 1 ] == '{' ) ? SERIAL_FMT_ESCAPE : SERIAL_FMT_FIELD ) :
+         ( s[ i ] == '}' ) ? ( ( s[ i + 1 ] == '}' ) ? SERIAL_FMT_ESCAPE : SERIAL_FMT_ERROR ) :
+         SERIAL_FMT_LITERAL;
+
+}
+
+/// Returns the end of the literal that starts at i
+constexpr uint32_t serialFmtLiteralEnd( const char *s, uint32_t i ){
+
+  return ( ( s[ i ] == '\0' ) || ( s[ i ] == '{' ) || ( s[ i ] == '}' ) ) ? i : serialFmtLiteralEnd( s, i + 1 );
+
+}
+
+/// Returns the position of the '}' of the field that starts at i, or the end of the string
+constexpr uint32_t serialFmtFieldEnd( const char *s, uint32_t i ){
+
+  return ( ( s[ i ] == '\0' ) || ( s[ i ] == '}' ) ) ? i : serialFmtFieldEnd( s, i + 1 );
+
+}
+
+/// Returns the position after the field that starts at i
+///
+/// An unterminated field ends at the end of the string, so the parsing stops there.
+constexpr uint32_t serialFmtFieldNext( const char *s, uint32_t i ){
+
+  return serialFmtFieldEnd( s, i ) + ( ( s[ serialFmtFieldEnd( s, i ) ] == '}' ) ? 1 : 0 );
+
+}
+
+constexpr bool serialFmtIsDigit( char c ){
+
+  return ( c >= '0' ) && ( c <= '9' );
+
+}
+
+constexpr uint32_t serialFmtNumberEnd( const char *s, uint32_t i ){
+
+  return serialFmtIsDigit( s[ i ] ) ? serialFmtNumberEnd( s, i + 1 ) : i;
+
+}
+
+constexpr int serialFmtNumber( const char *s, uint32_t i, int value ){
+
+  return serialFmtIsDigit( s[ i ] ) ? serialFmtNumber( s, i + 1, value * 10 + ( s[ i ] - '0' ) ) : value;
+
+}
+
+/// Returns the position of the type character of the field that starts at i
+constexpr uint32_t serialFmtTypePos( const char *s, uint32_t i ){
+
+  return ( s[ i + 1 ] != ':' ) ? i + 1 :
+         ( s[ i + 2 ] == '.' ) ? serialFmtNumberEnd( s, i + 3 ) :
+         i + 2;
+
+}
+
+/// Returns the type character of the field that starts at i, or '\0' if it has no type
+constexpr char serialFmtType( const char *s, uint32_t i ){
+
+  return ( s[ serialFmtTypePos( s, i ) ] == '}' ) ? '\0' : s[ serialFmtTypePos( s, i ) ];
+
+}
+
+/// Returns the precision of the field that starts at i, or -1 if it has no precision
+constexpr int serialFmtPrecision( const char *s, uint32_t i ){
+
+  return ( ( s[ i + 1 ] == ':' ) && ( s[ i + 2 ] == '.' ) ) ? serialFmtNumber( s, i + 3, 0 ) : -1;
+
+}
+
+constexpr bool serialFmtIsType( char c ){
+
+  return ( c == 'd' ) || ( c == 'x' ) || ( c == 'X' ) || ( c == 'o' ) || ( c == 'b' ) || ( c == 'c' ) || ( c == 's' ) || ( c == 'f' );
+
+}
+
+/// Check the syntax of the field that starts at i
+constexpr bool serialFmtFieldValid( const char *s, uint32_t i ){
+
+  return ( s[ serialFmtFieldEnd( s, i ) ] == '}' ) &&
+         ( ( s[ i + 1 ] == '}' ) ||
+           ( ( s[ i + 1 ] == ':' ) &&
+             ( ( s[ i + 2 ] != '.' ) || serialFmtIsDigit( s[ i + 3 ] ) ) &&
+             ( serialFmtPrecision( s, i ) <= SERIAL_FORMAT_MAX_DIGITS ) &&
+             ( ( serialFmtTypePos( s, i ) == serialFmtFieldEnd( s, i ) ) ||
+               ( ( serialFmtTypePos( s, i ) + 1 == serialFmtFieldEnd( s, i ) ) && serialFmtIsType( s[ serialFmtTypePos( s, i ) ] ) ) ) ) );
+
+}
+
+/// Check the syntax of the format string from position i
+constexpr bool serialFmtValid( const char *s, uint32_t i ){
+
+  return ( serialFmtKind( s, i ) == SERIAL_FMT_END ) ? true :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_LITERAL ) ? serialFmtValid( s, serialFmtLiteralEnd( s, i ) ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_ESCAPE ) ? serialFmtValid( s, i + 2 ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_FIELD ) ? ( serialFmtFieldValid( s, i ) && serialFmtValid( s, serialFmtFieldNext( s, i ) ) ) :
+         false;
+
+}
+
+/// Returns the number of fields in the format string from position i
+///
+/// The string has to be valid.
+constexpr uint32_t serialFmtFields( const char *s, uint32_t i ){
+
+  return ( serialFmtKind( s, i ) == SERIAL_FMT_LITERAL ) ? serialFmtFields( s, serialFmtLiteralEnd( s, i ) ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_ESCAPE ) ? serialFmtFields( s, i + 2 ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_FIELD ) ? 1 + serialFmtFields( s, serialFmtFieldNext( s, i ) ) :
+         0;
+
+}
+
+/// Returns the number of output segments of the format string from position i
+///
+/// The string has to be valid.
+constexpr uint32_t serialFmtSegments( const char *s, uint32_t i ){
+
+  return ( serialFmtKind( s, i ) == SERIAL_FMT_LITERAL ) ? 1 + serialFmtSegments( s, serialFmtLiteralEnd( s, i ) ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_ESCAPE ) ? 1 + serialFmtSegments( s, i + 2 ) :
+         ( serialFmtKind( s, i ) == SERIAL_FMT_FIELD ) ? 1 + serialFmtSegments( s, serialFmtFieldNext( s, i ) ) :
+         0;
+
+}
+
+/// Returns the length of the longest integer with the given bits, sign and format, with the '\0'
+constexpr uint32_t serialFmtIntegerSize( uint32_t bits, bool sign, char type ){
+
+  return ( type == 'b' ) ? bits + 1 :
+         ( type == 'o' ) ? ( bits + 2 ) / 3 + 1 :
+         ( ( type == 'x' ) || ( type == 'X' ) ) ? bits / 4 + 1 :
+         ( bits <= 8 ? 3 : bits <= 16 ? 5 : bits <= 32 ? 10 : 20 ) + ( sign ? 1 : 0 ) + 1;
+
+}
+
+/// Formatter of an argument type
+///
+/// The types without a specialisation are not supported.
+template< typename T >
+struct serialFmtArg_t{
+
+  static constexpr bool supported = false;
+
+  static constexpr bool accepts( char, int ){ return false; }
+
+  static constexpr uint32_t size( char ){ return 0; }
+
+};
+
+/// Formatter of the integer types
+template< typename T, typename U >
+struct serialFmtInteger_t{
+
+  static constexpr bool supported = true;
+
+  static constexpr bool accepts( char type, int precision ){
+
+    return ( precision < 0 ) && ( ( type == '\0' ) || ( type == 'd' ) || ( type == 'x' ) || ( type == 'X' ) || ( type == 'o' ) || ( type == 'b' ) );
+
+  }
+
+  static constexpr uint32_t size( char type ){
+
+    return serialFmtIntegerSize( sizeof( T ) * 8, (T)-1 < 0, type );
+
+  }
+
+  static const uint8_t *format( char *scratch, const T &value, char type, int, size_t *size ){
+
+    uint32_t i;
+
+    if( ( type == '\0' ) || ( type == 'd' ) ){
+
+      *size = ( (T)-1 < 0 ) ? serialFormatSigned( scratch, (int64_t)value ) : serialFormatUnsigned( scratch, (uint64_t)value );
+
+    }
+
+    else{
+
+      // The other bases print the raw bits, like print( value, HEX ).
+      *size = serialFormatUnsigned( scratch, (U)value, ( type == 'b' ) ? BIN : ( type == 'o' ) ? OCT : HEX );
+
+      if( type == 'x' ){
+
+        for( i = 0; i < *size; i++ ){
+
+          if( scratch[ i ] >= 'A' ){
+
+            scratch[ i ] += 'a' - 'A';
+
+          }
+
+        }
+
+      }
+
+    }
+
+    return (const uint8_t*)scratch;
+
+  }
+
+};
+
+template<> struct serialFmtArg_t< signed char > : serialFmtInteger_t< signed char, unsigned char >{};
+template<> struct serialFmtArg_t< unsigned char > : serialFmtInteger_t< unsigned char, unsigned char >{};
+template<> struct serialFmtArg_t< short > : serialFmtInteger_t< short, unsigned short >{};
+template<> struct serialFmtArg_t< unsigned short > : serialFmtInteger_t< unsigned short, unsigned short >{};
+template<> struct serialFmtArg_t< int > : serialFmtInteger_t< int, unsigned int >{};
+template<> struct serialFmtArg_t< unsigned int > : serialFmtInteger_t< unsigned int, unsigned int >{};
+template<> struct serialFmtArg_t< long > : serialFmtInteger_t< long, unsigned long >{};
+template<> struct serialFmtArg_t< unsigned long > : serialFmtInteger_t< unsigned long, unsigned long >{};
+template<> struct serialFmtArg_t< long long > : serialFmtInteger_t< long long, unsigned long long >{};
+template<> struct serialFmtArg_t< unsigned long long > : serialFmtInteger_t< unsigned long long, unsigned long long >{};
+
+/// Formatter of char
+///
+/// It is a character by default, and a number with the integer formats.
+template<>
+struct serialFmtArg_t< char >{
+
+  static constexpr bool supported = true;
+
+  static constexpr bool accepts( char type, int precision ){
+
+    return ( type == 'c' ) || serialFmtInteger_t< char, unsigned char >::accepts( type, precision );
+
+  }
+
+  static constexpr uint32_t size( char type ){
+
+    return ( ( type == '\0' ) || ( type == 'c' ) ) ? 0 : serialFmtInteger_t< char, unsigned char >::size( type );
+
+  }
+
+  static const uint8_t *format( char *scratch, const char &value, char type, int precision, size_t *size ){
+
+    if( ( type == '\0' ) || ( type == 'c' ) ){
+
+      *size = 1;
+      return (const uint8_t*)&value;
+
+    }
+
+    return serialFmtInteger_t< char, unsigned char >::format( scratch, value, type, precision, size );
+
+  }
+
+};
+
+/// Formatter of float
+template<>
+struct serialFmtArg_t< float >{
+
+  static constexpr bool supported = true;
+
+  static constexpr bool accepts( char type, int ){
+
+    return ( type == '\0' ) || ( type == 'f' );
+
+  }
+
+  // Sign, 10 integer digits, point, 9 fractional digits and '\0'.
+  static constexpr uint32_t size( char ){ return 22; }
+
+  static const uint8_t *format( char *scratch, const float &value, char, int precision, size_t *size ){
+
+    *size = serialFormatFloat( scratch, value, ( precision < 0 ) ? 6 : precision );
+    return (const uint8_t*)scratch;
+
+  }
+
+};
+
+/// Formatter of double
+template<>
+struct serialFmtArg_t< double >{
+
+  static constexpr bool supported = true;
+
+  static constexpr bool accepts( char type, int ){
+
+    return ( type == '\0' ) || ( type == 'f' );
+
+  }
+
+  // Sign, 20 integer digits, point, 9 fractional digits and '\0'.
+  static constexpr uint32_t size( char ){ return 32; }
+
+  static const uint8_t *format( char *scratch, const double &value, char, int precision, size_t *size ){
+
+    *size = serialFormatDouble( scratch, value, ( precision < 0 ) ? 6 : precision );
+    return (const uint8_t*)scratch;
+
+  }
+
+};
+
+/// Formatter of the strings
+///
+/// The string is not copied, it goes directly to the transmitt buffer.
+template<>
+struct serialFmtArg_t< const char* >{
+
+  static constexpr bool supported = true;
+
+  static constexpr bool accepts( char type, int precision ){
+
+    return ( precision < 0 ) && ( ( type == '\0' ) || ( type == 's' ) );
+
+  }
+
+  static constexpr uint32_t size( char ){ return 0; }
+
+  static const uint8_t *format( char *, const char * const &value, char, int, size_t *size ){
+
+    const char *str = ( value == NULL ) ? "(null)" : value;
+
+    *size = strlen( str );
+    return (const uint8_t*)str;
+
+  }
+
+};
+
+template<> struct serialFmtArg_t< char* > : serialFmtArg_t< const char* >{};
+
+/// Segment generator of the format string part at POS
+///
+/// Every specialisation puts its output to the next segment, then calls the
+/// generator of the next part. The formatted numbers are written to the
+/// scratch buffer, the literals and the strings are not copied.
+template< typename F, uint32_t POS, serialFmtKind_t KIND = serialFmtKind( F::text(), POS ) >
+struct serialFmtEmit_t;
+
+template< typename F, uint32_t POS >
+struct serialFmtEmit_t< F, POS, SERIAL_FMT_END >{
+
+  template< typename... Args >
+  static constexpr uint32_t scratch(){ return 0; }
+
+  template< typename S, typename... Args >
+  static uint32_t emit( S *, char *, Args&... ){ return 0; }
+
+};
+
+template< typename F, uint32_t POS >
+struct serialFmtEmit_t< F, POS, SERIAL_FMT_ERROR >{
+
+  static_assert( sizeof( F ) == 0, "Unmatched '}' in the format string, use '}}' for a '}' character." );
+
+  template< typename... Args >
+  static constexpr uint32_t scratch(){ return 0; }
+
+  template< typename S, typename... Args >
+  static uint32_t emit( S *, char *, Args&... ){ return 0; }
+
+};
+
+template< typename F, uint32_t POS >
+struct serialFmtEmit_t< F, POS, SERIAL_FMT_LITERAL >{
+
+  static constexpr uint32_t END = serialFmtLiteralEnd( F::text(), POS );
+
+  template< typename... Args >
+  static constexpr uint32_t scratch(){ return serialFmtEmit_t< F, END >::template scratch< Args... >(); }
+
+  template< typename S, typename... Args >
+  static uint32_t emit( S *segments, char *scratch, Args&... args ){
+
+    segments->data = (const uint8_t*)&F::text()[ POS ];
+    segments->size = END - POS;
+
+    return 1 + serialFmtEmit_t< F, END >::emit( segments + 1, scratch, args... );
+
+  }
+
+};
+
+template< typename F, uint32_t POS >
+struct serialFmtEmit_t< F, POS, SERIAL_FMT_ESCAPE >{
+
+  template< typename... Args >
+  static constexpr uint32_t scratch(){ return serialFmtEmit_t< F, POS + 2 >::template scratch< Args... >(); }
+
+  template< typename S, typename... Args >
+  static uint32_t emit( S *segments, char *scratch, Args&... args ){
+
+    // The first character of "{{" or "}}" is the output.
+    segments->data = (const uint8_t*)&F::text()[ POS ];
+    segments->size = 1;
+
+    return 1 + serialFmtEmit_t< F, POS + 2 >::emit( segments + 1, scratch, args... );
+
+  }
+
+};
+
+template< typename F, uint32_t POS >
+struct serialFmtEmit_t< F, POS, SERIAL_FMT_FIELD >{
+
+  static_assert( serialFmtFieldValid( F::text(), POS ), "Invalid field in the format string." );
+
+  static constexpr char TYPE = serialFmtType( F::text(), POS );
+  static constexpr int PRECISION = serialFmtPrecision( F::text(), POS );
+
+  static constexpr uint32_t NEXT = serialFmtFieldNext( F::text(), POS );
+
+  template< int UNUSED = 0 >
+  static constexpr uint32_t scratch(){ return 0; }
+
+  template< typename T, typename... Args >
+  static constexpr uint32_t scratch(){ return serialFmtArg_t< T >::size( TYPE ) + serialFmtEmit_t< F, NEXT >::template scratch< Args... >(); }
+
+  // Not enough arguments, it is reported by SerialPort::format.
+  template< typename S >
+  static uint32_t emit( S *, char * ){ return 0; }
+
+  template< typename S, typename T, typename... Args >
+  static uint32_t emit( S *segments, char *scratch, T &arg, Args&... args ){
+
+    static_assert( serialFmtArg_t< T >::supported, "Unsupported argument type in the format call." );
+    static_assert( serialFmtArg_t< T >::accepts( TYPE, PRECISION ), "The argument type does not match the format field." );
+
+    size_t size;
+
+    segments->data = serialFmtArg_t< T >::format( scratch, arg, TYPE, PRECISION, &size );
+    segments->size = size;
+
+    return 1 + serialFmtEmit_t< F, NEXT >::emit( segments + 1, scratch + serialFmtArg_t< T >::size( TYPE ), args... );
+
+  }
+
+};
+
+#endif /* STM32_CLASS_FACTORY_SERIAL_SERIALFMT_HPP_ */
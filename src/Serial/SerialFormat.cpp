@@ -0,0 +1,1300 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#include "SerialFormat.hpp"
+
+#include<math.h>
+#include<stddef.h>
+
+/// Every two digit number from 00 to 99 as character pairs
+static const char digit_pairs[ 201 ] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/// Digits for the bases above 10
+static const char digit_chars[ 37 ] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/// Powers of 10 that fit in 32-bit
+static const uint32_t pow10_32[ 10 ] = {
+	1UL,
+	10UL,
+	100UL,
+	1000UL,
+	10000UL,
+	100000UL,
+	1000000UL,
+	10000000UL,
+	100000000UL,
+	1000000000UL
+};
+
+/// Half of the last fractional digit for rounding, in single precision
+static const float round_32[ SERIAL_FORMAT_MAX_DIGITS + 1 ] = {
+	0.5f,
+	0.05f,
+	0.005f,
+	0.0005f,
+	0.00005f,
+	0.000005f,
+	0.0000005f,
+	0.00000005f,
+	0.000000005f,
+	0.0000000005f
+};
+
+/// Half of the last fractional digit for rounding, in double precision
+static const double round_64[ SERIAL_FORMAT_MAX_DIGITS + 1 ] = {
+	0.5,
+	0.05,
+	0.005,
+	0.0005,
+	0.00005,
+	0.000005,
+	0.0000005,
+	0.00000005,
+	0.000000005,
+	0.0000000005
+};
+
+static uint32_t countDigits32( uint32_t value ){
+
+	uint32_t n = 1;
+
+	while( ( n < 10 ) && ( value >= pow10_32[ n ] ) ){
+
+		n++;
+
+	}
+
+	return n;
+
+}
+
+// Writes the number backwards, the last digit goes to end - 1.
+// It writes exactly digits characters, the number is padded with zeros.
+static void writeDecimal32( char *end, uint32_t value, uint32_t digits ){
+
+	uint32_t pair;
+
+	while( digits >= 2 ){
+
+		pair = ( value % 100 ) * 2;
+		value /= 100;
+
+		*--end = digit_pairs[ pair + 1 ];
+		*--end = digit_pairs[ pair ];
+
+		digits -= 2;
+
+	}
+
+	if( digits ){
+
+		*--end = '0' + value;
+
+	}
+
+}
+
+static uint32_t formatDecimal( char *buff, uint64_t value ){
+
+	uint32_t high;
+	uint32_t middle;
+	uint32_t low;
+	uint32_t digits;
+
+	// Most of the numbers fit in 32-bit, they don't need 64-bit arithmetic at all.
+	if( value <= 0xFFFFFFFFUL ){
+
+		low = (uint32_t)value;
+		digits = countDigits32( low );
+
+		writeDecimal32( buff + digits, low, digits );
+
+		buff[ digits ] = '\0';
+		return digits;
+
+	}
+
+	// Split the number to 9 digit long chunks.
+	low = (uint32_t)( value % 1000000000UL );
+	value /= 1000000000UL;
+
+	if( value <= 0xFFFFFFFFUL ){
+
+		middle = (uint32_t)value;
+		digits = countDigits32( middle );
+
+		writeDecimal32( buff + digits, middle, digits );
+
+	}
+
+	else{
+
+		// The largest 64-bit number has 20 digits, so the highest chunk is 2 digits long.
+		middle = (uint32_t)( value % 1000000000UL );
+		high = (uint32_t)( value / 1000000000UL );
+		digits = countDigits32( high );
+
+		writeDecimal32( buff + digits, high, digits );
+		writeDecimal32( buff + digits + 9, middle, 9 );
+
+		digits += 9;
+
+	}
+
+	writeDecimal32( buff + digits + 9, low, 9 );
+
+	digits += 9;
+
+	buff[ digits ] = '\0';
+	return digits;
+
+}
+
+static uint32_t formatPowerOfTwo( char *buff, uint64_t value, uint32_t shift ){
+
+	char tmp[ 64 ];
+	uint32_t mask = ( 1UL << shift ) - 1;
+	uint32_t pos = sizeof( tmp );
+	uint32_t digits;
+
+	do{
+
+		tmp[ --pos ] = digit_chars[ (uint32_t)value & mask ];
+		value >>= shift;
+
+	}while( value );
+
+	digits = sizeof( tmp ) - pos;
+
+	memcpy( buff, &tmp[ pos ], digits );
+
+	buff[ digits ] = '\0';
+	return digits;
+
+}
+
+static uint32_t formatGeneric( char *buff, uint64_t value, uint32_t base ){
+
+	char tmp[ 64 ];
+	uint32_t pos = sizeof( tmp );
+	uint32_t digits;
+
+	do{
+
+		tmp[ --pos ] = digit_chars[ value % base ];
+		value /= base;
+
+	}while( value );
+
+	digits = sizeof( tmp ) - pos;
+
+	memcpy( buff, &tmp[ pos ], digits );
+
+	buff[ digits ] = '\0';
+	return digits;
+
+}
+
+uint32_t serialFormatUnsigned( char *buff, uint64_t value, int base ){
+
+	switch( base ){
+
+		case HEX:
+			return formatPowerOfTwo( buff, value, 4 );
+
+		case BIN:
+			return formatPowerOfTwo( buff, value, 1 );
+
+		case OCT:
+			return formatPowerOfTwo( buff, value, 3 );
+
+		case DEC:
+			return formatDecimal( buff, value );
+
+		default:
+			break;
+
+	}
+
+	if( ( base < 2 ) || ( base > 36 ) ){
+
+		return formatDecimal( buff, value );
+
+	}
+
+	return formatGeneric( buff, value, base );
+
+}
+
+uint32_t serialFormatSigned( char *buff, int64_t value, int base ){
+
+	if( value < 0 ){
+
+		buff[ 0 ] = '-';
+
+		// The negation is done in unsigned, so INT64_MIN is formatted correctly too.
+		return serialFormatUnsigned( buff + 1, -(uint64_t)value, base ) + 1;
+
+	}
+
+	return serialFormatUnsigned( buff, value, base );
+
+}
+
+// Handles the values that can not be formatted as a number.
+// Returns 0 if value is a normal number.
+static uint32_t formatSpecial( char *buff, bool nan, bool inf, bool negative ){
+
+	const char *str;
+	uint32_t len;
+
+	if( nan ){
+
+		str = "nan";
+
+	}
+
+	else if( inf ){
+
+		str = negative ? "-inf" : "inf";
+
+	}
+
+	else{
+
+		return 0;
+
+	}
+
+	len = strlen( str );
+	memcpy( buff, str, len + 1 );
+
+	return len;
+
+}
+
+// Appends the decimal point and the fractional digits.
+static uint32_t formatFraction( char *buff, uint32_t fraction, int digits ){
+
+	if( digits == 0 ){
+
+		buff[ 0 ] = '\0';
+		return 0;
+
+	}
+
+	buff[ 0 ] = '.';
+
+	writeDecimal32( buff + 1 + digits, fraction, digits );
+
+	buff[ 1 + digits ] = '\0';
+	return 1 + digits;
+
+}
+
+uint32_t serialFormatFloat( char *buff, float value, int digits ){
+
+	uint32_t len = 0;
+	uint32_t integer;
+	uint32_t fraction;
+	bool negative;
+
+	negative = signbit( value );
+
+	len = formatSpecial( buff, isnan( value ), isinf( value ), negative );
+
+	if( len ){
+
+		return len;
+
+	}
+
+	if( digits < 0 ){
+
+		digits = 0;
+
+	}
+
+	if( digits > SERIAL_FORMAT_MAX_DIGITS ){
+
+		digits = SERIAL_FORMAT_MAX_DIGITS;
+
+	}
+
+	if( negative ){
+
+		value = -value;
+		buff[ len++ ] = '-';
+
+	}
+
+	value += round_32[ digits ];
+
+	// This is the largest float below 2^32.
+	if( value > 4294967040.0f ){
+
+		memcpy( buff, "ovf", 4 );
+		return 3;
+
+	}
+
+	integer = (uint32_t)value;
+	fraction = (uint32_t)( ( value - (float)integer ) * (float)pow10_32[ digits ] );
+
+	// The float rounding can push the fraction over the limit.
+	if( fraction >= pow10_32[ digits ] ){
+
+		fraction = pow10_32[ digits ] - 1;
+
+	}
+
+	len += formatDecimal( buff + len, integer );
+	len += formatFraction( buff + len, fraction, digits );
+
+	return len;
+
+}
+
+uint32_t serialFormatDouble( char *buff, double value, int digits ){
+
+	uint32_t len = 0;
+	uint64_t integer;
+	uint32_t fraction;
+	bool negative;
+
+	negative = signbit( value );
+
+	len = formatSpecial( buff, isnan( value ), isinf( value ), negative );
+
+	if( len ){
+
+		return len;
+
+	}
+
+	if( digits < 0 ){
+
+		digits = 0;
+
+	}
+
+	if( digits > SERIAL_FORMAT_MAX_DIGITS ){
+
+		digits = SERIAL_FORMAT_MAX_DIGITS;
+
+	}
+
+	if( negative ){
+
+		value = -value;
+		buff[ len++ ] = '-';
+
+	}
+
+	value += round_64[ digits ];
+
+	// This is the largest double below 2^64.
+	if( value > 18446744073709549568.0 ){
+
+		memcpy( buff, "ovf", 4 );
+		return 3;
+
+	}
+
+	integer = (uint64_t)value;
+	fraction = (uint32_t)( ( value - (double)integer ) * (double)pow10_32[ digits ] );
+
+	if( fraction >= pow10_32[ digits ] ){
+
+		fraction = pow10_32[ digits ] - 1;
+
+	}
+
+	len += formatDecimal( buff + len, integer );
+	len += formatFraction( buff + len, fraction, digits );
+
+	return len;
+
+}
+
+/// Flags of a printf conversion
+#define FORMAT_FLAG_LEFT	0x01
+#define FORMAT_FLAG_PLUS	0x02
+#define FORMAT_FLAG_SPACE	0x04
+#define FORMAT_FLAG_ALT		0x08
+#define FORMAT_FLAG_ZERO	0x10
+#define FORMAT_FLAG_UPPER	0x20
+
+/// Length modifiers of a printf conversion
+enum formatLength_t{
+	FORMAT_LENGTH_DEFAULT,
+	FORMAT_LENGTH_CHAR,
+	FORMAT_LENGTH_SHORT,
+	FORMAT_LENGTH_LONG,
+	FORMAT_LENGTH_LONG_LONG,
+	FORMAT_LENGTH_SIZE,
+	FORMAT_LENGTH_DOUBLE
+};
+
+/// Field of a printf conversion
+///
+/// The output is: padding, prefix, zeros, body, trailing zeros, suffix, padding.
+struct formatField_t{
+	const char *prefix;
+	uint32_t prefix_len;
+	int zeros;
+	const char *body;
+	uint32_t body_len;
+	int trailing;
+	const char *suffix;
+	uint32_t suffix_len;
+};
+
+/// Binary powers of 10 to find the exponent of a double
+static const double pow10_binary[ 9 ] = { 1e256, 1e128, 1e64, 1e32, 1e16, 1e8, 1e4, 1e2, 1e1 };
+static const int pow10_binary_exp[ 9 ] = { 256, 128, 64, 32, 16, 8, 4, 2, 1 };
+
+static void outputRepeat( serialFormatOutput_t output, void *context, char c, int count ){
+
+	char pad[ 16 ];
+	int chunk;
+
+	if( count <= 0 ){
+
+		return;
+
+	}
+
+	memset( pad, c, sizeof( pad ) );
+
+	while( count > 0 ){
+
+		chunk = ( count > (int)sizeof( pad ) ) ? (int)sizeof( pad ) : count;
+
+		output( context, pad, chunk );
+
+		count -= chunk;
+
+	}
+
+}
+
+static int outputField( serialFormatOutput_t output, void *context, const formatField_t *field, int width, uint32_t flags ){
+
+	int len;
+	int pad;
+
+	len = field -> prefix_len + field -> zeros + field -> body_len + field -> trailing + field -> suffix_len;
+	pad = width - len;
+
+	if( !( flags & FORMAT_FLAG_LEFT ) && !( flags & FORMAT_FLAG_ZERO ) ){
+
+		outputRepeat( output, context, ' ', pad );
+
+	}
+
+	if( field -> prefix_len ){
+
+		output( context, field -> prefix, field -> prefix_len );
+
+	}
+
+	// With the '0' flag the padding goes between the sign and the digits.
+	if( !( flags & FORMAT_FLAG_LEFT ) && ( flags & FORMAT_FLAG_ZERO ) ){
+
+		outputRepeat( output, context, '0', pad );
+
+	}
+
+	outputRepeat( output, context, '0', field -> zeros );
+
+	if( field -> body_len ){
+
+		output( context, field -> body, field -> body_len );
+
+	}
+
+	outputRepeat( output, context, '0', field -> trailing );
+
+	if( field -> suffix_len ){
+
+		output( context, field -> suffix, field -> suffix_len );
+
+	}
+
+	if( flags & FORMAT_FLAG_LEFT ){
+
+		outputRepeat( output, context, ' ', pad );
+
+	}
+
+	return ( len > width ) ? len : width;
+
+}
+
+static void lowerCase( char *buff, uint32_t len ){
+
+	uint32_t i;
+
+	for( i = 0; i < len; i++ ){
+
+		if( ( buff[ i ] >= 'A' ) && ( buff[ i ] <= 'Z' ) ){
+
+			buff[ i ] += 'a' - 'A';
+
+		}
+
+	}
+
+}
+
+// Scales value to the [ 1, 10 ) range and returns the decimal exponent.
+static int normalizeDouble( double *value ){
+
+	double m = *value;
+	int exp = 0;
+	int i;
+
+	if( m == 0.0 ){
+
+		return 0;
+
+	}
+
+	if( m >= 10.0 ){
+
+		for( i = 0; i < 9; i++ ){
+
+			if( m >= pow10_binary[ i ] ){
+
+				m /= pow10_binary[ i ];
+				exp += pow10_binary_exp[ i ];
+
+			}
+
+		}
+
+	}
+
+	else if( m < 1.0 ){
+
+		for( i = 0; i < 9; i++ ){
+
+			if( m * pow10_binary[ i ] < 10.0 ){
+
+				m *= pow10_binary[ i ];
+				exp -= pow10_binary_exp[ i ];
+
+			}
+
+		}
+
+	}
+
+	*value = m;
+	return exp;
+
+}
+
+// Formats a positive value in the d.ddd format and returns the exponent.
+static uint32_t formatMantissa( char *buff, double value, int digits, int *exp ){
+
+	uint32_t len;
+
+	*exp = normalizeDouble( &value );
+
+	len = serialFormatDouble( buff, value, digits );
+
+	// The rounding can carry to a new digit, like 9.99 -> 10.0
+	if( ( len > 1 ) && ( buff[ 0 ] == '1' ) && ( buff[ 1 ] == '0' ) ){
+
+		*exp += 1;
+		len = serialFormatDouble( buff, value / 10.0, digits );
+
+	}
+
+	return len;
+
+}
+
+static uint32_t formatExponentSuffix( char *buff, int exp, uint32_t flags ){
+
+	uint32_t len = 0;
+
+	buff[ len++ ] = ( flags & FORMAT_FLAG_UPPER ) ? 'E' : 'e';
+
+	if( exp < 0 ){
+
+		buff[ len++ ] = '-';
+		exp = -exp;
+
+	}
+
+	else{
+
+		buff[ len++ ] = '+';
+
+	}
+
+	if( exp < 10 ){
+
+		buff[ len++ ] = '0';
+
+	}
+
+	len += serialFormatUnsigned( buff + len, exp, DEC );
+
+	return len;
+
+}
+
+// Removes the trailing zeros of the fraction for the %g conversion.
+static uint32_t stripZeros( const char *buff, uint32_t len ){
+
+	if( memchr( buff, '.', len ) == NULL ){
+
+		return len;
+
+	}
+
+	while( ( len > 0 ) && ( buff[ len - 1 ] == '0' ) ){
+
+		len--;
+
+	}
+
+	if( ( len > 0 ) && ( buff[ len - 1 ] == '.' ) ){
+
+		len--;
+
+	}
+
+	return len;
+
+}
+
+static int outputDouble( serialFormatOutput_t output, void *context, double value, char conversion, int width, int precision, uint32_t flags ){
+
+	char body[ SERIAL_FORMAT_BUFFER_LENGTH ];
+	char suffix[ 8 ];
+	char sign[ 1 ];
+	formatField_t field;
+	int digits;
+	int exp;
+	bool exponential;
+
+	memset( &field, 0, sizeof( field ) );
+
+	field.body = body;
+	field.suffix = suffix;
+
+	if( signbit( value ) ){
+
+		sign[ 0 ] = '-';
+		field.prefix_len = 1;
+		value = -value;
+
+	}
+
+	else if( flags & FORMAT_FLAG_PLUS ){
+
+		sign[ 0 ] = '+';
+		field.prefix_len = 1;
+
+	}
+
+	else if( flags & FORMAT_FLAG_SPACE ){
+
+		sign[ 0 ] = ' ';
+		field.prefix_len = 1;
+
+	}
+
+	field.prefix = sign;
+
+	if( ( conversion >= 'A' ) && ( conversion <= 'Z' ) ){
+
+		flags |= FORMAT_FLAG_UPPER;
+		conversion += 'a' - 'A';
+
+	}
+
+	if( isnan( value ) || isinf( value ) ){
+
+		memcpy( body, isnan( value ) ? "nan" : "inf", 3 );
+		field.body_len = 3;
+
+		if( !( flags & FORMAT_FLAG_UPPER ) ){
+
+			lowerCase( body, 3 );
+
+		}
+
+		else{
+
+			body[ 0 ] -= 'a' - 'A';
+			body[ 1 ] -= 'a' - 'A';
+			body[ 2 ] -= 'a' - 'A';
+
+		}
+
+		return outputField( output, context, &field, width, flags & ~FORMAT_FLAG_ZERO );
+
+	}
+
+	if( precision < 0 ){
+
+		precision = 6;
+
+	}
+
+	exponential = ( conversion == 'e' );
+
+	if( conversion == 'g' ){
+
+		if( precision == 0 ){
+
+			precision = 1;
+
+		}
+
+		digits = ( precision - 1 > SERIAL_FORMAT_MAX_DIGITS ) ? SERIAL_FORMAT_MAX_DIGITS : precision - 1;
+
+		formatMantissa( body, value, digits, &exp );
+
+		if( ( exp < precision ) && ( exp >= -4 ) ){
+
+			precision = precision - 1 - exp;
+
+		}
+
+		else{
+
+			exponential = true;
+			precision = precision - 1;
+
+		}
+
+	}
+
+	// Values that do not fit in 64-bit are formatted as exponential.
+	if( value > 18446744073709549568.0 ){
+
+		exponential = true;
+
+	}
+
+	digits = ( precision > SERIAL_FORMAT_MAX_DIGITS ) ? SERIAL_FORMAT_MAX_DIGITS : precision;
+
+	if( exponential ){
+
+		field.body_len = formatMantissa( body, value, digits, &exp );
+		field.suffix_len = formatExponentSuffix( suffix, exp, flags );
+
+	}
+
+	else{
+
+		field.body_len = serialFormatDouble( body, value, digits );
+
+	}
+
+	field.trailing = precision - digits;
+
+	if( conversion == 'g' && !( flags & FORMAT_FLAG_ALT ) ){
+
+		field.body_len = stripZeros( body, field.body_len );
+		field.trailing = 0;
+
+	}
+
+	// The '#' flag keeps the decimal point.
+	if( ( flags & FORMAT_FLAG_ALT ) && ( precision == 0 ) ){
+
+		body[ field.body_len++ ] = '.';
+
+	}
+
+	return outputField( output, context, &field, width, flags );
+
+}
+
+static int outputInteger( serialFormatOutput_t output, void *context, uint64_t value, bool negative, char conversion, int width, int precision, uint32_t flags ){
+
+	char body[ SERIAL_FORMAT_BUFFER_LENGTH ];
+	char prefix[ 3 ];
+	formatField_t field;
+	int base;
+
+	memset( &field, 0, sizeof( field ) );
+
+	field.prefix = prefix;
+	field.body = body;
+
+	switch( conversion ){
+
+		case 'x':
+		case 'X':
+		case 'p':
+			base = HEX;
+			break;
+
+		case 'o':
+			base = OCT;
+			break;
+
+		case 'b':
+			base = BIN;
+			break;
+
+		default:
+			base = DEC;
+			break;
+
+	}
+
+	if( negative ){
+
+		prefix[ field.prefix_len++ ] = '-';
+
+	}
+
+	else if( base == DEC ){
+
+		if( flags & FORMAT_FLAG_PLUS ){
+
+			prefix[ field.prefix_len++ ] = '+';
+
+		}
+
+		else if( flags & FORMAT_FLAG_SPACE ){
+
+			prefix[ field.prefix_len++ ] = ' ';
+
+		}
+
+	}
+
+	if( ( ( flags & FORMAT_FLAG_ALT ) && ( value != 0 ) ) || ( conversion == 'p' ) ){
+
+		if( base == HEX ){
+
+			prefix[ field.prefix_len++ ] = '0';
+			prefix[ field.prefix_len++ ] = ( conversion == 'X' ) ? 'X' : 'x';
+
+		}
+
+		else if( base == BIN ){
+
+			prefix[ field.prefix_len++ ] = '0';
+			prefix[ field.prefix_len++ ] = 'b';
+
+		}
+
+	}
+
+	// Zero value with zero precision has no digits.
+	if( ( precision != 0 ) || ( value != 0 ) ){
+
+		field.body_len = serialFormatUnsigned( body, value, base );
+
+	}
+
+	if( conversion != 'X' ){
+
+		lowerCase( body, field.body_len );
+
+	}
+
+	if( precision >= 0 ){
+
+		field.zeros = precision - (int)field.body_len;
+
+		if( field.zeros < 0 ){
+
+			field.zeros = 0;
+
+		}
+
+		// With precision the '0' flag is ignored.
+		flags &= ~FORMAT_FLAG_ZERO;
+
+	}
+
+	// The '#' flag makes sure that an octal number starts with zero.
+	if( ( base == OCT ) && ( flags & FORMAT_FLAG_ALT ) && ( field.zeros == 0 ) && ( ( field.body_len == 0 ) || ( body[ 0 ] != '0' ) ) ){
+
+		field.zeros = 1;
+
+	}
+
+	return outputField( output, context, &field, width, flags );
+
+}
+
+int serialFormatVPrintf( serialFormatOutput_t output, void *context, const char *fmt, va_list args ){
+
+	const char *start;
+	const char *str;
+	const char *end;
+	uint32_t flags;
+	int width;
+	int precision;
+	formatLength_t length;
+	int64_t signed_value;
+	uint64_t value;
+	formatField_t field;
+	char c;
+	int ret = 0;
+
+	while( *fmt ){
+
+		// Send the plain text in one piece.
+		start = fmt;
+
+		while( *fmt && ( *fmt != '%' ) ){
+
+			fmt++;
+
+		}
+
+		if( fmt != start ){
+
+			output( context, start, fmt - start );
+			ret += fmt - start;
+
+		}
+
+		if( *fmt == '\0' ){
+
+			break;
+
+		}
+
+		fmt++;
+
+		// Flags
+		flags = 0;
+
+		for( ;; ){
+
+			if( *fmt == '-' ) flags |= FORMAT_FLAG_LEFT;
+			else if( *fmt == '+' ) flags |= FORMAT_FLAG_PLUS;
+			else if( *fmt == ' ' ) flags |= FORMAT_FLAG_SPACE;
+			else if( *fmt == '#' ) flags |= FORMAT_FLAG_ALT;
+			else if( *fmt == '0' ) flags |= FORMAT_FLAG_ZERO;
+			else break;
+
+			fmt++;
+
+		}
+
+		// Width
+		width = 0;
+
+		if( *fmt == '*' ){
+
+			width = va_arg( args, int );
+
+			if( width < 0 ){
+
+				flags |= FORMAT_FLAG_LEFT;
+				width = -width;
+
+			}
+
+			fmt++;
+
+		}
+
+		while( ( *fmt >= '0' ) && ( *fmt <= '9' ) ){
+
+			width = width * 10 + ( *fmt - '0' );
+			fmt++;
+
+		}
+
+		// Precision
+		precision = -1;
+
+		if( *fmt == '.' ){
+
+			fmt++;
+			precision = 0;
+
+			if( *fmt == '*' ){
+
+				precision = va_arg( args, int );
+				fmt++;
+
+			}
+
+			while( ( *fmt >= '0' ) && ( *fmt <= '9' ) ){
+
+				precision = precision * 10 + ( *fmt - '0' );
+				fmt++;
+
+			}
+
+		}
+
+		if( flags & FORMAT_FLAG_LEFT ){
+
+			flags &= ~FORMAT_FLAG_ZERO;
+
+		}
+
+		// Length
+		length = FORMAT_LENGTH_DEFAULT;
+
+		switch( *fmt ){
+
+			case 'h':
+				fmt++;
+				length = FORMAT_LENGTH_SHORT;
+
+				if( *fmt == 'h' ){
+
+					fmt++;
+					length = FORMAT_LENGTH_CHAR;
+
+				}
+				break;
+
+			case 'l':
+				fmt++;
+				length = FORMAT_LENGTH_LONG;
+
+				if( *fmt == 'l' ){
+
+					fmt++;
+					length = FORMAT_LENGTH_LONG_LONG;
+
+				}
+				break;
+
+			case 'j':
+				fmt++;
+				length = FORMAT_LENGTH_LONG_LONG;
+				break;
+
+			case 'z':
+			case 't':
+				fmt++;
+				length = FORMAT_LENGTH_SIZE;
+				break;
+
+			case 'L':
+				fmt++;
+				length = FORMAT_LENGTH_DOUBLE;
+				break;
+
+			default:
+				break;
+
+		}
+
+		c = *fmt;
+
+		if( c == '\0' ){
+
+			break;
+
+		}
+
+		fmt++;
+
+		switch( c ){
+
+			case 'd':
+			case 'i':
+
+				switch( length ){
+
+					case FORMAT_LENGTH_CHAR:
+						signed_value = (signed char)va_arg( args, int );
+						break;
+
+					case FORMAT_LENGTH_SHORT:
+						signed_value = (short)va_arg( args, int );
+						break;
+
+					case FORMAT_LENGTH_LONG:
+						signed_value = va_arg( args, long );
+						break;
+
+					case FORMAT_LENGTH_LONG_LONG:
+						signed_value = va_arg( args, long long );
+						break;
+
+					case FORMAT_LENGTH_SIZE:
+						signed_value = va_arg( args, ptrdiff_t );
+						break;
+
+					default:
+						signed_value = va_arg( args, int );
+						break;
+
+				}
+
+				if( signed_value < 0 ){
+
+					ret += outputInteger( output, context, -(uint64_t)signed_value, true, c, width, precision, flags );
+
+				}
+
+				else{
+
+					ret += outputInteger( output, context, signed_value, false, c, width, precision, flags );
+
+				}
+
+				break;
+
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			case 'b':
+
+				switch( length ){
+
+					case FORMAT_LENGTH_CHAR:
+						value = (unsigned char)va_arg( args, unsigned int );
+						break;
+
+					case FORMAT_LENGTH_SHORT:
+						value = (unsigned short)va_arg( args, unsigned int );
+						break;
+
+					case FORMAT_LENGTH_LONG:
+						value = va_arg( args, unsigned long );
+						break;
+
+					case FORMAT_LENGTH_LONG_LONG:
+						value = va_arg( args, unsigned long long );
+						break;
+
+					case FORMAT_LENGTH_SIZE:
+						value = va_arg( args, size_t );
+						break;
+
+					default:
+						value = va_arg( args, unsigned int );
+						break;
+
+				}
+
+				ret += outputInteger( output, context, value, false, c, width, precision, flags );
+
+				break;
+
+			case 'p':
+
+				value = (uintptr_t)va_arg( args, void* );
+
+				ret += outputInteger( output, context, value, false, c, width, precision, flags & ~FORMAT_FLAG_ALT );
+
+				break;
+
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+
+				if( length == FORMAT_LENGTH_DOUBLE ){
+
+					ret += outputDouble( output, context, (double)va_arg( args, long double ), c, width, precision, flags );
+
+				}
+
+				else{
+
+					ret += outputDouble( output, context, va_arg( args, double ), c, width, precision, flags );
+
+				}
+
+				break;
+
+			case 'c':
+
+				c = (char)va_arg( args, int );
+
+				memset( &field, 0, sizeof( field ) );
+				field.body = &c;
+				field.body_len = 1;
+
+				ret += outputField( output, context, &field, width, flags & ~FORMAT_FLAG_ZERO );
+
+				break;
+
+			case 's':
+
+				str = va_arg( args, const char* );
+
+				if( str == NULL ){
+
+					str = "(null)";
+
+				}
+
+				memset( &field, 0, sizeof( field ) );
+				field.body = str;
+
+				if( precision >= 0 ){
+
+					end = (const char*)memchr( str, '\0', precision );
+					field.body_len = ( end != NULL ) ? (uint32_t)( end - str ) : (uint32_t)precision;
+
+				}
+
+				else{
+
+					field.body_len = strlen( str );
+
+				}
+
+				ret += outputField( output, context, &field, width, flags & ~FORMAT_FLAG_ZERO );
+
+				break;
+
+			case '%':
+
+				output( context, "%", 1 );
+				ret++;
+
+				break;
+
+			default:
+
+				// Unknown conversion, it is printed as it is.
+				output( context, fmt - 1, 1 );
+				ret++;
+
+				break;
+
+		}
+
+	}
+
+	return ret;
+
+}
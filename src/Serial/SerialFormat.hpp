@@ -0,0 +1,123 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_SERIAL_SERIALFORMAT_HPP_
+#define STM32_CLASS_FACTORY_SERIAL_SERIALFORMAT_HPP_
+
+#include<stdlib.h>
+#include<stdarg.h>
+#include<string.h>
+#include<inttypes.h>
+#include<stdint.h>
+
+#ifndef DEC
+/// Decimal base for the print functions
+#define DEC 10
+#endif
+
+#ifndef HEX
+/// Hexadecimal base for the print functions
+#define HEX 16
+#endif
+
+#ifndef OCT
+/// Octal base for the print functions
+#define OCT 8
+#endif
+
+#ifndef BIN
+/// Binary base for the print functions
+#define BIN 2
+#endif
+
+/// Length of the buffer that can hold any formatted number
+///
+/// The longest number is a 64-bit value in binary format( 64 digits ),
+/// plus a sign and a terminating '\0' character.
+#define SERIAL_FORMAT_BUFFER_LENGTH 66
+
+/// Maximum number of fractional digits
+///
+/// The fractional part is calculated in a 32-bit integer, so it can
+/// not be longer than 9 digits.
+#define SERIAL_FORMAT_MAX_DIGITS 9
+
+/// Format an unsigned number
+///
+/// This function converts a number to text without snprintf. The decimal
+/// format uses a digit-pair lookup table and 32-bit arithmetic. A 64-bit
+/// number is split to 9 digit long chunks, so it needs two 64-bit
+/// divisions in the worst case. Power of two bases use shifts only.
+/// @param buff the output buffer. It has to be \link SERIAL_FORMAT_BUFFER_LENGTH \endlink long.
+/// @param value the number that you want to format.
+/// @param base the base of the number system. It can be 2 to 36, anything else is handled as DEC.
+/// @returns the number of characters written, without the terminating '\0'.
+uint32_t serialFormatUnsigned( char *buff, uint64_t value, int base = DEC );
+
+/// Format a signed number
+///
+/// It works like \link serialFormatUnsigned \endlink, but negative numbers
+/// get a '-' sign.
+/// @param buff the output buffer. It has to be \link SERIAL_FORMAT_BUFFER_LENGTH \endlink long.
+/// @param value the number that you want to format.
+/// @param base the base of the number system. It can be 2 to 36, anything else is handled as DEC.
+/// @returns the number of characters written, without the terminating '\0'.
+uint32_t serialFormatSigned( char *buff, int64_t value, int base = DEC );
+
+/// Format a float
+///
+/// This function converts a float to text without the newlib float printf.
+/// It uses single precision arithmetic only, so it runs on the FPU. The
+/// fractional part is scaled with a power of 10 table. NaN is formatted as
+/// "nan", infinite values as "inf" or "-inf". If the integer part does not
+/// fit in 32-bit, the result is "ovf".
+/// @param buff the output buffer. It has to be \link SERIAL_FORMAT_BUFFER_LENGTH \endlink long.
+/// @param value the number that you want to format.
+/// @param digits the number of fractional digits. It is limited to \link SERIAL_FORMAT_MAX_DIGITS \endlink.
+/// @returns the number of characters written, without the terminating '\0'.
+uint32_t serialFormatFloat( char *buff, float value, int digits = 6 );
+
+/// Format a double
+///
+/// It works like \link serialFormatFloat \endlink, but the calculation is
+/// done in double precision and the integer part can be 64-bit long.
+/// @param buff the output buffer. It has to be \link SERIAL_FORMAT_BUFFER_LENGTH \endlink long.
+/// @param value the number that you want to format.
+/// @param digits the number of fractional digits. It is limited to \link SERIAL_FORMAT_MAX_DIGITS \endlink.
+/// @returns the number of characters written, without the terminating '\0'.
+uint32_t serialFormatDouble( char *buff, double value, int digits = 6 );
+
+/// Output function of the printf formatter
+///
+/// The formatter calls this function with the pieces of the formatted text.
+/// @param context the pointer that was given to \link serialFormatVPrintf \endlink.
+/// @param data pointer to the characters, it is not '\\0' terminated.
+/// @param size the number of characters.
+typedef void (*serialFormatOutput_t)( void *context, const char *data, uint32_t size );
+
+/// Streaming printf formatter
+///
+/// This is a printf like formatter, that does not need an output buffer. The
+/// formatted text is passed to the output function in pieces, so the length
+/// of the text is not limited. The numbers are formatted with the functions
+/// above, so it does not use snprintf.
+///
+/// Supported conversions: d, i, u, x, X, o, b, c, s, p, f, F, e, E, g, G and %.
+/// Supported flags: '-', '+', ' ', '#' and '0'. The width and the precision
+/// can be given with numbers or with '*'. The length modifiers( hh, h, l, ll,
+/// j, z, t, L ) are accepted. The float conversions have 9 significant
+/// fractional digits maximum, the rest is filled with zeros.
+/// @param output the output function.
+/// @param context pointer that is passed to the output function.
+/// @param fmt format string.
+/// @param args arguments.
+/// @returns the number of characters formatted.
+int serialFormatVPrintf( serialFormatOutput_t output, void *context, const char *fmt, va_list args );
+
+#endif /* STM32_CLASS_FACTORY_SERIAL_SERIALFORMAT_HPP_ */
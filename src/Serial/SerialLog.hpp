@@ -0,0 +1,164 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_SERIAL_SERIALLOG_HPP_
+#define STM32_CLASS_FACTORY_SERIAL_SERIALLOG_HPP_
+
+#include "Serial.hpp"
+
+/// Leveled logging
+///
+/// The log messages are sent by the SERIAL_LOG_ERROR, SERIAL_LOG_WARN,
+/// SERIAL_LOG_INFO, SERIAL_LOG_DEBUG and SERIAL_LOG_TRACE macros. Every
+/// message belongs to a module, that tells the port of the messages and
+/// has a runtime level filter.
+///
+/// The levels above \link SERIAL_LOG_LEVEL \endlink are removed by the
+/// preprocessor. Their arguments are not evaluated, and their format
+/// strings are not in the flash. The runtime filter costs one compare
+/// for the levels that are compiled in.
+///
+/// A message looks like this:
+///
+///     [ 1234 ] W motor: current limit 2.50 A
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// // motor.cpp
+/// SERIAL_LOG_MODULE( motor, SerialToPC, SERIAL_LOG_LEVEL_INFO );
+///
+/// SERIAL_LOG_WARN( motor, "current limit %.2f A\r\n", limit );
+/// SERIAL_LOG_DEBUG( motor, "pwm: %u\r\n", pwm );  // Filtered at runtime.
+///
+/// // Enable the debug messages of the motor module.
+/// serialLogSetLevel( motor, SERIAL_LOG_LEVEL_DEBUG );
+///
+/// \endcode
+
+/// No log messages
+#define SERIAL_LOG_LEVEL_NONE 0
+
+/// Errors
+#define SERIAL_LOG_LEVEL_ERROR 1
+
+/// Warnings
+#define SERIAL_LOG_LEVEL_WARN 2
+
+/// Information about the normal operation
+#define SERIAL_LOG_LEVEL_INFO 3
+
+/// Messages for debugging
+#define SERIAL_LOG_LEVEL_DEBUG 4
+
+/// Detailed messages for debugging
+#define SERIAL_LOG_LEVEL_TRACE 5
+
+#ifndef SERIAL_LOG_LEVEL
+#ifdef NDEBUG
+/// Highest level that is compiled in
+///
+/// The messages above this level are removed from the code. It is
+/// \link SERIAL_LOG_LEVEL_INFO \endlink in release builds( NDEBUG ),
+/// and \link SERIAL_LOG_LEVEL_TRACE \endlink otherwise.
+#define SERIAL_LOG_LEVEL SERIAL_LOG_LEVEL_INFO
+#else
+#define SERIAL_LOG_LEVEL SERIAL_LOG_LEVEL_TRACE
+#endif
+#endif
+
+/// Log module
+///
+/// Create it with \link SERIAL_LOG_MODULE \endlink.
+struct serialLogModule_t{
+
+	const char *name;			///< Name of the module in the prefix of the messages.
+	SerialPort *port;			///< The messages are sent to this port.
+	volatile uint8_t level;		///< Highest level that is sent, this is the runtime filter.
+
+};
+
+/// Define a log module
+///
+/// @param module name of the module. It is the name of the variable and the name in the messages too.
+/// @param serial the Serial object that sends the messages.
+/// @param initial_level the initial runtime level of the module.
+#define SERIAL_LOG_MODULE( module, serial, initial_level ) serialLogModule_t module = { #module, &( serial ), ( initial_level ) }
+
+/// Declare a log module that is defined in an other file
+///
+/// @param module name of the module.
+#define SERIAL_LOG_MODULE_EXTERN( module ) extern serialLogModule_t module
+
+/// Set the runtime level of a module
+///
+/// @param module the module.
+/// @param level the highest level that is sent. SERIAL_LOG_LEVEL_NONE disables the module.
+static inline void serialLogSetLevel( serialLogModule_t &module, uint8_t level ){
+
+	module.level = level;
+
+}
+
+/// Send a message if the runtime filter of the module lets it through
+///
+/// This is the common part of the level macros, use them instead.
+#define SERIAL_LOG_WRITE( module, msg_level, letter, ... ) do{ if( ( module ).level >= ( msg_level ) ){ ( module ).port->logPrintf( ( letter ), ( module ).name, __VA_ARGS__ ); } }while( 0 )
+
+#if SERIAL_LOG_LEVEL >= SERIAL_LOG_LEVEL_ERROR
+/// Send an error message
+///
+/// @param module the module of the message.
+/// @param ... printf like format string and arguments.
+#define SERIAL_LOG_ERROR( module, ... ) SERIAL_LOG_WRITE( module, SERIAL_LOG_LEVEL_ERROR, 'E', __VA_ARGS__ )
+#else
+#define SERIAL_LOG_ERROR( module, ... ) do{ }while( 0 )
+#endif
+
+#if SERIAL_LOG_LEVEL >= SERIAL_LOG_LEVEL_WARN
+/// Send a warning message
+///
+/// @param module the module of the message.
+/// @param ... printf like format string and arguments.
+#define SERIAL_LOG_WARN( module, ... ) SERIAL_LOG_WRITE( module, SERIAL_LOG_LEVEL_WARN, 'W', __VA_ARGS__ )
+#else
+#define SERIAL_LOG_WARN( module, ... ) do{ }while( 0 )
+#endif
+
+#if SERIAL_LOG_LEVEL >= SERIAL_LOG_LEVEL_INFO
+/// Send an information message
+///
+/// @param module the module of the message.
+/// @param ... printf like format string and arguments.
+#define SERIAL_LOG_INFO( module, ... ) SERIAL_LOG_WRITE( module, SERIAL_LOG_LEVEL_INFO, 'I', __VA_ARGS__ )
+#else
+#define SERIAL_LOG_INFO( module, ... ) do{ }while( 0 )
+#endif
+
+#if SERIAL_LOG_LEVEL >= SERIAL_LOG_LEVEL_DEBUG
+/// Send a debug message
+///
+/// @param module the module of the message.
+/// @param ... printf like format string and arguments.
+#define SERIAL_LOG_DEBUG( module, ... ) SERIAL_LOG_WRITE( module, SERIAL_LOG_LEVEL_DEBUG, 'D', __VA_ARGS__ )
+#else
+#define SERIAL_LOG_DEBUG( module, ... ) do{ }while( 0 )
+#endif
+
+#if SERIAL_LOG_LEVEL >= SERIAL_LOG_LEVEL_TRACE
+/// Send a trace message
+///
+/// @param module the module of the message.
+/// @param ... printf like format string and arguments.
+#define SERIAL_LOG_TRACE( module, ... ) SERIAL_LOG_WRITE( module, SERIAL_LOG_LEVEL_TRACE, 'T', __VA_ARGS__ )
+#else
+#define SERIAL_LOG_TRACE( module, ... ) do{ }while( 0 )
+#endif
+
+#endif /* STM32_CLASS_FACTORY_SERIAL_SERIALLOG_HPP_ */
@@ -0,0 +1,250 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_SERIAL_SERIALPACKET_HPP_
+#define STM32_CLASS_FACTORY_SERIAL_SERIALPACKET_HPP_
+
+#include<stdlib.h>
+#include<string.h>
+#include<inttypes.h>
+#include<stdint.h>
+
+#include "stm32f4xx_hal.h"
+
+#include "Serial.hpp"
+
+/// Serial packet layer
+///
+/// SerialPacket transmitts and recives binary packets over a \link SerialPort \endlink.
+/// The packets are framed with COBS( Consistent Overhead Byte Stuffing ), so
+/// a packet never contains a zero byte, and every packet ends with a zero.
+/// After a corrupted packet the decoder is in sync again at the next zero.
+/// A CRC is appended to the payload before the encoding.
+///
+/// Frame format:
+///
+/// COBS( payload, CRC ) 0x00
+///
+/// The CRC is little endian. CRC_16 is CRC-16/CCITT-FALSE( poly 0x1021,
+/// init 0xFFFF ). CRC_32 is CRC-32/MPEG-2( poly 0x04C11DB7, init 0xFFFFFFFF )
+/// calculated on little endian 32-bit words, the last word is padded with
+/// zeros. This is how the CRC unit of the STM32 works, so it can be calculated
+/// in hardware, see \link setHardwareCrc \endlink. Without the CRC unit both
+/// of them are calculated with a lookup table.
+///
+/// The encoder writes the frame directly to the transmitt buffer, and the
+/// decoder reads the recive buffer of the DMA without extra copy.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// Serial SerialToPC( &huart2 );
+///
+/// uint8_t packetBuffer[ 64 ];
+/// SerialPacket packets( &SerialToPC, packetBuffer, sizeof( packetBuffer ) );
+///
+/// int main(){
+///
+/// SerialToPC.begin( 115200 );
+///
+/// packets.send( telemetry, sizeof( telemetry ) );
+///
+/// while( 1 ){
+///
+/// if( packets.receive() >= 0 ){
+///
+/// process( packets.data(), packets.size() );
+///
+/// }
+///
+/// }
+///
+/// }
+///
+/// \endcode
+class SerialPacket{
+
+public:
+
+	/// Enumeration for the CRC types
+	enum crc_t{
+		CRC_16,		///< CRC-16/CCITT-FALSE, 2 bytes.
+		CRC_32		///< CRC-32/MPEG-2 on 32-bit words, 4 bytes.
+	};
+
+	/// SerialPacket object constructor
+	///
+	/// @param port_p the serial port that carries the packets.
+	/// @param buffer_p buffer for the recived packets. It has to hold the payload and the CRC.
+	/// @param length_p size of the buffer.
+	/// @param crc_type_p type of the CRC. CRC_16 by default.
+	SerialPacket( SerialPort *port_p, uint8_t *buffer_p, uint32_t length_p, crc_t crc_type_p = CRC_16 );
+
+#ifdef HAL_CRC_MODULE_ENABLED
+
+	/// Use the CRC unit for CRC_32
+	///
+	/// The CRC unit has to be initialised before the first packet.
+	/// Only the main loop uses it, in interrupts the lookup table is used.
+	/// Other code must not use the CRC unit from interrupts either.
+	/// @param crc_device_p pointer to the CRC peripherial, NULL to use the lookup table.
+	void setHardwareCrc( CRC_HandleTypeDef *crc_device_p );
+
+#endif
+
+	/// Transmitt a packet
+	///
+	/// The packet is encoded directly to the transmitt buffer of the serial port.
+	/// The full buffer policy of the port applies to the whole packet.
+	/// @param data pointer to the payload.
+	/// @param size size of the payload.
+	/// @returns the number of bytes transmitted on the line, 0 if the packet did
+	/// not fit in the transmitt buffer.
+	size_t send( const uint8_t *data, size_t size );
+
+	/// Check if a packet fits in the transmitt buffer
+	///
+	/// It can be used to apply backpressure instead of blocking or dropping
+	/// in \link send \endlink. The worst case length of the frame is checked.
+	/// @param size size of the payload.
+	/// @returns true if a packet with this payload size can be sent now.
+	bool canSend( size_t size );
+
+	/// Returns the worst case length of a frame on the line
+	///
+	/// @param size size of the payload.
+	/// @param crc_size size of the CRC in bytes.
+	/// @returns the length of the frame with the COBS overhead and the delimiter.
+	static constexpr uint32_t frameLength( uint32_t size, uint32_t crc_size = 2 ){
+
+		return size + crc_size + ( size + crc_size ) / 254 + 2;
+
+	}
+
+	/// Process the recived data
+	///
+	/// This function decodes the data from the recive buffer of the serial port.
+	/// It stops after a complete packet, so the packet can be read with
+	/// \link data \endlink and \link size \endlink before it is overwritten.
+	/// @returns the size of the payload if a valid packet arrived, -1 otherwise.
+	int32_t receive();
+
+	/// Returns the payload of the last recived packet
+	const uint8_t *data();
+
+	/// Returns the size of the payload of the last recived packet
+	uint32_t size();
+
+	/// Returns the number of packets dropped because of wrong CRC
+	uint32_t crcErrors();
+
+	/// Returns the number of packets dropped because of wrong framing or overflow
+	uint32_t frameErrors();
+
+	/// Calculate CRC-16/CCITT-FALSE
+	///
+	/// @param crc the starting value, 0xFFFF for a new calculation.
+	/// @param data pointer to the data.
+	/// @param size number of bytes.
+	/// @returns the new CRC value.
+	static uint16_t crc16( uint16_t crc, const uint8_t *data, uint32_t size );
+
+	/// Calculate CRC-32/MPEG-2 on little endian 32-bit words
+	///
+	/// It gives the same result as the CRC unit of the STM32. The last word
+	/// is padded with zeros.
+	/// @param data pointer to the data.
+	/// @param size number of bytes.
+	/// @returns the CRC value.
+	static uint32_t crc32( const uint8_t *data, uint32_t size );
+
+private:
+
+	/// The serial port that carries the packets
+	SerialPort *port = NULL;
+
+	/// Buffer for the recived packets
+	uint8_t *buffer = NULL;
+
+	/// Size of the buffer
+	uint32_t length = 0;
+
+	/// Type of the CRC
+	crc_t crc_type = CRC_16;
+
+#ifdef HAL_CRC_MODULE_ENABLED
+
+	/// CRC peripherial address, NULL if the lookup table is used
+	CRC_HandleTypeDef *crc_device = NULL;
+
+#endif
+
+	/// Number of decoded bytes in the buffer
+	uint32_t decoded = 0;
+
+	/// Remaining data bytes of the current COBS block
+	uint32_t block_remaining = 0;
+
+	/// A zero has to be inserted before the next block
+	bool zero_pending = false;
+
+	/// The current frame is broken, skip to the next zero
+	bool skip_frame = false;
+
+	/// The first COBS block of the current frame arrived
+	bool frame_started = false;
+
+	/// Size of the last recived payload
+	uint32_t payload_size = 0;
+
+	/// Number of packets with wrong CRC
+	uint32_t crc_error_counter = 0;
+
+	/// Number of packets with wrong framing
+	uint32_t frame_error_counter = 0;
+
+	/// Returns the size of the CRC in bytes
+	uint32_t crcSize();
+
+	/// Calculate the CRC of a payload
+	///
+	/// @param data pointer to the payload.
+	/// @param size size of the payload.
+	/// @param crc output, little endian.
+	void crcCalculate( const uint8_t *data, uint32_t size, uint8_t *crc );
+
+	/// COBS encoder
+	///
+	/// If write is false, it only calculates the length of the frame.
+	/// @param segments the data to encode.
+	/// @param count number of segments.
+	/// @param start index of the reserved room in the transmitt buffer.
+	/// @param write true to write the frame to the reserved room of the transmitt buffer.
+	/// @returns the length of the frame with the delimiter.
+	uint32_t encode( const SerialPort::segment_t *segments, uint32_t count, uint32_t start, bool write );
+
+	/// Decode a block of recived bytes
+	///
+	/// @param data pointer to the recived bytes.
+	/// @param size number of bytes.
+	/// @param end output, set to true if a frame ended.
+	/// @returns the number of bytes processed.
+	uint32_t decode( const uint8_t *data, uint32_t size, bool *end );
+
+	/// Check the decoded frame and reset the decoder
+	///
+	/// @returns true if the frame is a valid packet.
+	bool finishFrame();
+
+	/// Reset the decoder for a new frame
+	void resetDecoder();
+
+};
+
+#endif /* STM32_CLASS_FACTORY_SERIAL_SERIALPACKET_HPP_ */
@@ -0,0 +1,211 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#include "SerialTelemetry.hpp"
+
+SerialTelemetry::SerialTelemetry( SerialPacket *packets_p, int32_t *reference_p, uint8_t *frame_p, uint32_t channels_p, uint32_t key_interval_p ){
+
+	packets = packets_p;
+	reference = reference_p;
+	frame = frame_p;
+	channels = channels_p;
+	key_interval = key_interval_p;
+
+	memset( reference, 0, channels * sizeof( int32_t ) );
+
+	// The first frame is a key frame.
+	frames_since_key = key_interval;
+
+}
+
+size_t SerialTelemetry::send( const int32_t *values ){
+
+	uint32_t size = 1;
+	uint32_t delta;
+	uint32_t i;
+	size_t ret;
+	bool key;
+
+	key = frames_since_key >= key_interval;
+
+	frame[ 0 ] = ( sequence & SERIAL_TELEMETRY_SEQUENCE_MASK ) | ( key ? SERIAL_TELEMETRY_KEY_FRAME : 0 );
+
+	for( i = 0; i < channels; i++ ){
+
+		// The difference wraps around like the reciver adds it back.
+		delta = (uint32_t)values[ i ] - ( key ? 0 : (uint32_t)reference[ i ] );
+
+		// Zigzag: 0, -1, 1, -2, 2 ... becomes 0, 1, 2, 3, 4 ...
+		delta = ( delta << 1 ) ^ (uint32_t)( (int32_t)delta >> 31 );
+
+		size += encodeVarint( &frame[ size ], delta );
+
+	}
+
+	ret = packets -> send( frame, size );
+
+	if( ret == 0 ){
+
+		// The reciver can not follow the deltas without this frame,
+		// so the stream continues with a key frame.
+		frames_since_key = key_interval;
+		return 0;
+
+	}
+
+	memcpy( reference, values, channels * sizeof( int32_t ) );
+
+	sequence++;
+	frames_since_key = key ? 1 : frames_since_key + 1;
+
+	return ret;
+
+}
+
+void SerialTelemetry::keyFrame(){
+
+	frames_since_key = key_interval;
+
+}
+
+int32_t SerialTelemetry::receive(){
+
+	const uint8_t *payload;
+	uint32_t payload_size;
+	uint32_t pos = 1;
+	uint32_t delta = 0;
+	uint32_t len;
+	uint32_t i;
+	uint8_t header;
+	bool key;
+
+	if( packets -> receive() < 0 ){
+
+		return -1;
+
+	}
+
+	payload = packets -> data();
+	payload_size = packets -> size();
+
+	if( payload_size < 1 ){
+
+		return -1;
+
+	}
+
+	header = payload[ 0 ];
+	key = header & SERIAL_TELEMETRY_KEY_FRAME;
+
+	if( synced && ( ( header & SERIAL_TELEMETRY_SEQUENCE_MASK ) != ( sequence & SERIAL_TELEMETRY_SEQUENCE_MASK ) ) ){
+
+		lost += ( header - sequence ) & SERIAL_TELEMETRY_SEQUENCE_MASK;
+		synced = false;
+
+	}
+
+	if( !synced && !key ){
+
+		lost++;
+		return -1;
+
+	}
+
+	// The frame is checked before the reference is changed.
+	for( i = 0; i < channels; i++ ){
+
+		len = decodeVarint( &payload[ pos ], payload_size - pos, &delta );
+
+		if( len == 0 ){
+
+			break;
+
+		}
+
+		pos += len;
+
+	}
+
+	if( ( i != channels ) || ( pos != payload_size ) ){
+
+		lost++;
+		synced = false;
+		return -1;
+
+	}
+
+	pos = 1;
+
+	for( i = 0; i < channels; i++ ){
+
+		pos += decodeVarint( &payload[ pos ], payload_size - pos, &delta );
+
+		delta = ( delta >> 1 ) ^ ( 0 - ( delta & 1 ) );
+
+		reference[ i ] = (int32_t)( ( key ? 0 : (uint32_t)reference[ i ] ) + delta );
+
+	}
+
+	synced = true;
+	sequence = header + 1;
+
+	return channels;
+
+}
+
+const int32_t *SerialTelemetry::values(){
+
+	return reference;
+
+}
+
+uint32_t SerialTelemetry::lostFrames(){
+
+	return lost;
+
+}
+
+uint32_t SerialTelemetry::encodeVarint( uint8_t *buff, uint32_t value ){
+
+	uint32_t size = 0;
+
+	while( value >= 0x80 ){
+
+		buff[ size++ ] = ( value & 0x7F ) | 0x80;
+		value >>= 7;
+
+	}
+
+	buff[ size++ ] = value;
+
+	return size;
+
+}
+
+uint32_t SerialTelemetry::decodeVarint( const uint8_t *buff, uint32_t size, uint32_t *value ){
+
+	uint32_t result = 0;
+	uint32_t i;
+
+	for( i = 0; ( i < size ) && ( i < SERIAL_TELEMETRY_VARINT_LENGTH ); i++ ){
+
+		result |= (uint32_t)( buff[ i ] & 0x7F ) << ( 7 * i );
+
+		if( !( buff[ i ] & 0x80 ) ){
+
+			*value = result;
+			return i + 1;
+
+		}
+
+	}
+
+	return 0;
+
+}
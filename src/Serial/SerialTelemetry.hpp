@@ -0,0 +1,188 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_SERIAL_SERIALTELEMETRY_HPP_
+#define STM32_CLASS_FACTORY_SERIAL_SERIALTELEMETRY_HPP_
+
+#include<stdlib.h>
+#include<string.h>
+#include<inttypes.h>
+#include<stdint.h>
+
+#include "SerialPacket.hpp"
+
+/// Maximum length of a varint encoded 32-bit value
+#define SERIAL_TELEMETRY_VARINT_LENGTH 5
+
+/// Flag of the key frames in the header byte
+#define SERIAL_TELEMETRY_KEY_FRAME 0x80
+
+/// Mask of the sequence number in the header byte
+#define SERIAL_TELEMETRY_SEQUENCE_MASK 0x7F
+
+/// Compressed telemetry stream
+///
+/// SerialTelemetry transmitts frames of numeric channels with delta and
+/// varint encoding. Every channel is sent as the difference from its value
+/// in the previous frame. The difference is zigzag encoded, so the small
+/// negative numbers are small too, then it is sent in 7-bit groups. A slowly
+/// changing 16-bit sensor value takes 1 byte instead of 2 or 4. The frames
+/// are sent as \link SerialPacket \endlink packets, so they have a CRC, and
+/// a broken frame does not break the stream.
+///
+/// Payload format:
+///
+/// | Size  | Content                                                   |
+/// |-------|-----------------------------------------------------------|
+/// | 1     | bit 7: key frame, bit 0-6: sequence number                |
+/// | 1-5   | varint( zigzag( value - previous ) ) for every channel     |
+///
+/// In the key frames the previous values are 0, so they can be decoded
+/// alone. The first frame and every key_interval-th frame is a key frame.
+/// The reciver drops the delta frames after a lost frame, until the next key
+/// frame. The encoder needs only the previous values, 4 bytes per channel.
+///
+/// tools/telemetry_decode.py decodes the stream on the host.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// Serial SerialToPC( &huart2 );
+///
+/// uint8_t packetBuffer[ 64 ];
+/// SerialPacket packets( &SerialToPC, packetBuffer, sizeof( packetBuffer ) );
+///
+/// SerialTelemetryBuffered< 8 > telemetry( &packets );
+///
+/// int32_t samples[ 8 ];
+///
+/// readSensors( samples );
+/// telemetry.send( samples );
+///
+/// \endcode
+class SerialTelemetry{
+
+public:
+
+	/// SerialTelemetry object constructor
+	///
+	/// An object is the sender or the reciver of one stream, not both.
+	/// @param packets_p the packet layer that carries the frames. For the
+	/// reciver its buffer has to hold 1 + 5 * channels_p bytes and the CRC.
+	/// @param reference_p buffer for the previous values, channels_p long.
+	/// @param frame_p buffer for the encoded frame, \link frameLength \endlink( channels_p ) long.
+	/// @param channels_p number of channels in a frame.
+	/// @param key_interval_p a key frame is sent after this many frames. 32 by default.
+	SerialTelemetry( SerialPacket *packets_p, int32_t *reference_p, uint8_t *frame_p, uint32_t channels_p, uint32_t key_interval_p = 32 );
+
+	/// Transmitt a frame
+	///
+	/// @param values the values of the channels.
+	/// @returns the number of bytes transmitted on the line, 0 if the frame did
+	/// not fit in the transmitt buffer. After a dropped frame the next one is a key frame.
+	size_t send( const int32_t *values );
+
+	/// Send a key frame next time
+	///
+	/// For example, when the host connects to a running stream.
+	void keyFrame();
+
+	/// Process the recived data
+	///
+	/// @returns the number of channels if a frame was decoded, -1 otherwise.
+	int32_t receive();
+
+	/// Returns the values of the last recived frame
+	const int32_t *values();
+
+	/// Returns the number of frames that were lost or dropped by the reciver
+	///
+	/// It counts the gaps in the sequence numbers and the delta frames that
+	/// could not be decoded.
+	uint32_t lostFrames();
+
+	/// Returns the length of the frame buffer for the given number of channels
+	static constexpr uint32_t frameLength( uint32_t channels_p ){
+
+		return 1 + channels_p * SERIAL_TELEMETRY_VARINT_LENGTH;
+
+	}
+
+	/// Encode a value as a varint
+	///
+	/// @param buff the output buffer, it has to be \link SERIAL_TELEMETRY_VARINT_LENGTH \endlink long.
+	/// @param value the value.
+	/// @returns the number of bytes written.
+	static uint32_t encodeVarint( uint8_t *buff, uint32_t value );
+
+	/// Decode a varint
+	///
+	/// @param buff pointer to the varint.
+	/// @param size the number of bytes available.
+	/// @param value the decoded value.
+	/// @returns the number of bytes read, 0 if the varint is broken.
+	static uint32_t decodeVarint( const uint8_t *buff, uint32_t size, uint32_t *value );
+
+private:
+
+	/// The packet layer that carries the frames
+	SerialPacket *packets = NULL;
+
+	/// Values of the previous frame
+	int32_t *reference = NULL;
+
+	/// Buffer for the encoded frame
+	uint8_t *frame = NULL;
+
+	/// Number of channels
+	uint32_t channels = 0;
+
+	/// A key frame is sent after this many frames
+	uint32_t key_interval = 32;
+
+	/// Number of frames since the last key frame, the next frame is a key frame if it reaches key_interval
+	uint32_t frames_since_key = 0;
+
+	/// Sequence number of the next frame
+	uint8_t sequence = 0;
+
+	/// The reciver has valid reference values
+	bool synced = false;
+
+	/// Number of lost frames
+	uint32_t lost = 0;
+
+};
+
+/// SerialTelemetry with its own buffers
+///
+/// @tparam CHANNELS number of channels in a frame.
+template< uint32_t CHANNELS >
+class SerialTelemetryBuffered : public SerialTelemetry{
+
+public:
+
+	/// SerialTelemetryBuffered object constructor
+	///
+	/// @param packets_p the packet layer that carries the frames.
+	/// @param key_interval_p a key frame is sent after this many frames. 32 by default.
+	SerialTelemetryBuffered( SerialPacket *packets_p, uint32_t key_interval_p = 32 ) :
+		SerialTelemetry( packets_p, reference_buffer, frame_buffer, CHANNELS, key_interval_p ){}
+
+private:
+
+	static_assert( ( CHANNELS > 0 ) && ( CHANNELS <= 255 ), "A frame can have 1 to 255 channels." );
+
+	int32_t reference_buffer[ CHANNELS ];
+
+	uint8_t frame_buffer[ frameLength( CHANNELS ) ];
+
+};
+
+#endif /* STM32_CLASS_FACTORY_SERIAL_SERIALTELEMETRY_HPP_ */
@@ -9,6 +9,92 @@
 
 #include "System.hpp"
 
+/// Cycles counted until the last read of the cycle counter
+static uint64_t cycles_total = 0;
 
+/// Value of the cycle counter at the last read
+static uint32_t cycles_last = 0;
 
+/// Value of the HAL tick at the last read
+static uint32_t cycles_tick = 0;
 
+void cyclesBegin(){
+
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	// A running counter is not restarted, so the timestamps of the other
+	// users stay continuous.
+	if( !( DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk ) ){
+
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+		cycles_total = 0;
+		cycles_last = 0;
+		cycles_tick = HAL_GetTick();
+
+	}
+
+	__set_PRIMASK( primask );
+
+}
+
+uint64_t cycles64(){
+
+	uint32_t primask;
+	uint32_t now;
+	uint32_t tick;
+	uint32_t elapsed_ms;
+	uint32_t wrap_ms;
+	uint32_t delta;
+	uint64_t expected;
+	uint64_t ret;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	now = DWT->CYCCNT;
+	tick = HAL_GetTick();
+
+	delta = now - cycles_last;
+	elapsed_ms = tick - cycles_tick;
+
+	// Time of a wrap around in ms.
+	wrap_ms = 0xFFFFFFFFUL / ( SystemCoreClock / 1000UL );
+
+	// After a long break the counter could wrap around more times. The tick
+	// tells the elapsed time with 1ms accuracy, that is much less than a
+	// lap, so the number of the missed laps can be rounded from it.
+	if( elapsed_ms >= wrap_ms / 2 ){
+
+		expected = (uint64_t)elapsed_ms * ( SystemCoreClock / 1000UL );
+
+		if( expected > delta ){
+
+			cycles_total += ( ( expected - delta + 0x80000000ULL ) >> 32 ) << 32;
+
+		}
+
+	}
+
+	cycles_total += delta;
+	cycles_last = now;
+	cycles_tick = tick;
+
+	ret = cycles_total;
+
+	__set_PRIMASK( primask );
+
+	return ret;
+
+}
+
+uint64_t micros64(){
+
+	return cycles64() / ( SystemCoreClock / 1000000UL );
+
+}
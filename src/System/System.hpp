@@ -25,4 +25,34 @@
 /// Macro to emulate Arduino millis function
 #define millis() HAL_GetTick()
 
+/// Enable the DWT cycle counter
+///
+/// The cycle counter of the Cortex-M4 core counts the CPU clock cycles, so
+/// its resolution is 6ns at 168MHz. If the counter runs already, for
+/// example it was started by an earlier call or by the debugger, it is not
+/// restarted.
+void cyclesBegin();
+
+/// Returns the 32-bit value of the cycle counter
+///
+/// It wraps around in 25s at 168MHz, use it for short time differences.
+static inline uint32_t cycles(){
+
+	return DWT->CYCCNT;
+
+}
+
+/// Returns the number of cycles since the start of the counter in 64-bit
+///
+/// The wrap arounds of the 32-bit counter are counted. If the function was
+/// not called for longer than a wrap around, the missed laps are calculated
+/// from the HAL tick, so it does not need a periodic call. It can be called
+/// from interrupts too.
+uint64_t cycles64();
+
+/// Returns the number of microseconds since the start of the counter
+///
+/// It is calculated from \link cycles64 \endlink, so its resolution is 1us.
+uint64_t micros64();
+
 #endif /* STM32_CLASS_FACTORY_SYSTEM_SYSTEM_HPP_ */
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+#
+# Created on April 5 2020
+#
+# Copyright (c) 2020 - Daniel Hajnal
+# hajnal.daniel96@gmail.com
+#
+# This file is part of the STM32 Class Factory project.
+
+"""Decoder for the binary records of SerialPort::dbgLog.
+
+The format strings are read from the ELF file of the firmware, so the MCU
+only has to transmit their addresses. Everything between the records is
+passed through as text, so the output of print and printf stays readable.
+A sync byte is only taken as a record, if the format address is in the ELF
+file and the number of argument words matches the format string. Otherwise
+it is passed through as text too.
+
+Usage:
+    dbglog_decode.py firmware.elf capture.bin
+    dbglog_decode.py firmware.elf /dev/ttyUSB0
+    dbglog_decode.py firmware.elf - < capture.bin
+"""
+
+import re
+import struct
+import sys
+
+# It has to match SERIAL_LOG_SYNC in Serial.hpp.
+LOG_SYNC = 0xA5
+HEADER_LENGTH = 10
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diuxXobcspfFeEgG%])")
+
+
+class ElfImage:
+    """Loadable sections of a 32-bit little endian ELF file."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError("%s is not a 32-bit little endian ELF file" % path)
+
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+
+        self.sections = []
+
+        for i in range(shnum):
+            _, sh_type, _, addr, offset, size = struct.unpack_from("<IIIIII", self.data, shoff + i * shentsize)
+
+            # SHT_PROGBITS sections hold the constant strings.
+            if sh_type == 1 and addr != 0:
+                self.sections.append((addr, offset, size))
+
+    def find(self, address):
+        """Returns the '\\0' terminated string at address, or None if it is not in a section."""
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.find(b"\0", start, offset + size)
+
+                if end < 0:
+                    return None
+
+                return self.data[start:end].decode("utf-8", "replace")
+
+        return None
+
+    def string(self, address):
+        text = self.find(address)
+
+        if text is None:
+            return "<0x%08X>" % address
+
+        return text
+
+
+def argument_words(fmt):
+    """Returns the number of 32-bit argument words that the format string needs."""
+    words = 0
+
+    for m in CONVERSION.finditer(fmt):
+        _, width, precision, length, conv = m.groups()
+
+        if conv == "%":
+            continue
+
+        if width == "*":
+            words += 1
+        if precision == "*":
+            words += 1
+
+        if conv in "fFeEgG" or (length in ("ll", "j") and conv in "diuxXob"):
+            words += 2
+        else:
+            words += 1
+
+    return words
+
+
+def format_record(elf, address, timestamp, words):
+    fmt = elf.string(address)
+    out = []
+    pos = 0
+
+    def take(n):
+        nonlocal words
+        if len(words) < n:
+            raise ValueError("not enough argument words")
+        value, words = words[:n], words[n:]
+        return value
+
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+
+        flags, width, precision, length, conv = m.groups()
+
+        if conv == "%":
+            out.append("%")
+            continue
+
+        if width == "*":
+            width = str(struct.unpack("<i", struct.pack("<I", take(1)[0]))[0])
+        if precision == "*":
+            precision = str(struct.unpack("<i", struct.pack("<I", take(1)[0]))[0])
+
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+
+        if conv in "fFeEgG":
+            value, = struct.unpack("<d", struct.pack("<II", *take(2)))
+            out.append((spec + conv) % value)
+        elif conv == "s":
+            out.append((spec + "s") % elf.string(take(1)[0]))
+        elif conv == "c":
+            out.append((spec + "c") % chr(take(1)[0] & 0xFF))
+        elif conv == "p":
+            out.append((spec + "s") % ("0x%x" % take(1)[0]))
+        else:
+            if length in ("ll", "j"):
+                low, high = take(2)
+                value = low | (high << 32)
+                bits = 64
+            else:
+                value = take(1)[0]
+                bits = 32
+
+            if length == "hh":
+                value &= 0xFF
+                bits = 8
+            elif length == "h":
+                value &= 0xFFFF
+                bits = 16
+
+            if conv in "di" and value >= 1 << (bits - 1):
+                value -= 1 << bits
+
+            if conv == "b":
+                out.append((spec + "s") % format(value, "b"))
+            else:
+                out.append((spec + ("d" if conv in "diu" else conv)) % value)
+
+    out.append(fmt[pos:])
+
+    return "[ %d ] dbg: %s" % (timestamp, "".join(out))
+
+
+def decode(elf, stream, output):
+    buffer = b""
+
+    while True:
+        chunk = stream.read(256)
+
+        if not chunk:
+            break
+
+        buffer += chunk
+
+        while buffer:
+            sync = buffer.find(bytes([LOG_SYNC]))
+
+            if sync < 0:
+                output.write(buffer.decode("latin-1"))
+                buffer = b""
+                break
+
+            if sync > 0:
+                output.write(buffer[:sync].decode("latin-1"))
+                buffer = buffer[sync:]
+
+            if len(buffer) < HEADER_LENGTH:
+                break
+
+            count = buffer[1]
+            length = HEADER_LENGTH + 4 * count
+            address, timestamp = struct.unpack_from("<II", buffer, 2)
+            fmt = elf.find(address)
+
+            # The sync byte can be part of the text or of binary data too.
+            if fmt is None or argument_words(fmt) != count:
+                output.write(buffer[:1].decode("latin-1"))
+                buffer = buffer[1:]
+                continue
+
+            if len(buffer) < length:
+                break
+
+            words = list(struct.unpack_from("<%dI" % count, buffer, HEADER_LENGTH))
+
+            try:
+                output.write(format_record(elf, address, timestamp, words))
+            except (ValueError, TypeError) as error:
+                output.write("<bad record at 0x%08X: %s>\n" % (address, error))
+
+            buffer = buffer[length:]
+
+        output.flush()
+
+    # A broken header at the end of the stream.
+    if buffer:
+        output.write(buffer.decode("latin-1"))
+        output.flush()
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    elf = ElfImage(sys.argv[1])
+
+    if sys.argv[2] == "-":
+        decode(elf, sys.stdin.buffer, sys.stdout)
+    else:
+        with open(sys.argv[2], "rb", buffering=0) as stream:
+            decode(elf, stream, sys.stdout)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,310 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_HOST_SIM_STM32F4XX_HAL_H_
+#define STM32_CLASS_FACTORY_HOST_SIM_STM32F4XX_HAL_H_
+
+/// Simulated STM32F4 HAL for the host build
+///
+/// This header replaces stm32f4xx_hal.h when the library is compiled on
+/// the host. It has only the parts that the Serial and the CAN libraries use.
+/// The UART with the DMA and the bxCAN are simulated in sim_hal.cpp with
+/// baudrate and bitrate timing, see sim_hal.hpp for the functions that
+/// control the simulation.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+
+#define ENABLE 1
+#define DISABLE 0
+
+/// The simulated HAL supports the reception to idle.
+#define HAL_UART_RECEPTION_TOIDLE 1U
+
+typedef enum{
+  HAL_OK = 0x00U,
+  HAL_ERROR = 0x01U,
+  HAL_BUSY = 0x02U,
+  HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_UART_STATE_RESET 0x00U
+#define HAL_UART_STATE_READY 0x20U
+#define HAL_UART_STATE_BUSY_TX 0x21U
+#define HAL_UART_STATE_BUSY_RX 0x22U
+
+#define HAL_UART_ERROR_NONE 0x00U
+#define HAL_UART_ERROR_PE 0x01U
+#define HAL_UART_ERROR_NE 0x02U
+#define HAL_UART_ERROR_FE 0x04U
+#define HAL_UART_ERROR_ORE 0x08U
+#define HAL_UART_ERROR_DMA 0x10U
+
+struct __UART_HandleTypeDef;
+
+/// DMA counter register
+///
+/// Reading it brings the simulated reception up to date, so it works like
+/// the real NDTR register that is decremented by the DMA in the background.
+struct SimNdtr_t{
+
+  /// The UART that uses the DMA stream, it is set when the reception starts
+  struct __UART_HandleTypeDef *owner;
+
+  /// Value of the register when the stream is not used by the simulation
+  uint32_t value;
+
+  operator uint32_t() const;
+
+  SimNdtr_t &operator=( uint32_t value_p ){ value = value_p; return *this; }
+
+};
+
+typedef struct{
+  SimNdtr_t NDTR;
+} DMA_Stream_TypeDef;
+
+typedef struct{
+  DMA_Stream_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+/// DWT cycle counter register
+///
+/// It counts the cycles of SystemCoreClock in the virtual time, while
+/// DWT_CTRL_CYCCNTENA is set.
+struct SimCyccnt_t{
+
+  /// The value of the register is the virtual cycles minus this offset
+  uint32_t offset;
+
+  operator uint32_t() const;
+
+  SimCyccnt_t &operator=( uint32_t value_p );
+
+};
+
+typedef struct{
+  __IO uint32_t CTRL;
+  SimCyccnt_t CYCCNT;
+} DWT_Type;
+
+typedef struct{
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+
+#define DWT ( &sim_dwt )
+#define CoreDebug ( &sim_core_debug )
+
+#define DWT_CTRL_CYCCNTENA_Msk 0x00000001UL
+#define CoreDebug_DEMCR_TRCENA_Msk 0x01000000UL
+
+typedef struct{
+  __IO uint32_t SR;
+  __IO uint32_t DR;
+  __IO uint32_t BRR;
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t CR3;
+} USART_TypeDef;
+
+typedef struct{
+  uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct __UART_HandleTypeDef{
+  USART_TypeDef *Instance;
+  UART_InitTypeDef Init;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+  __IO uint32_t gState;
+  __IO uint32_t RxState;
+  __IO uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+#define HAL_CAN_STATE_RESET 0x00U
+#define HAL_CAN_STATE_READY 0x01U
+#define HAL_CAN_STATE_LISTENING 0x02U
+
+#define HAL_CAN_ERROR_NONE 0x00000000U
+#define HAL_CAN_ERROR_RX_FOV0 0x00000200U
+#define HAL_CAN_ERROR_RX_FOV1 0x00000400U
+#define HAL_CAN_ERROR_TX_ALST0 0x00000800U
+#define HAL_CAN_ERROR_TX_TERR0 0x00001000U
+#define HAL_CAN_ERROR_TX_ALST1 0x00002000U
+#define HAL_CAN_ERROR_TX_TERR1 0x00004000U
+#define HAL_CAN_ERROR_TX_ALST2 0x00008000U
+#define HAL_CAN_ERROR_TX_TERR2 0x00010000U
+#define HAL_CAN_ERROR_NOT_INITIALIZED 0x00100000U
+#define HAL_CAN_ERROR_NOT_STARTED 0x00400000U
+#define HAL_CAN_ERROR_PARAM 0x00800000U
+
+#define CAN_MODE_NORMAL 0x00000000U
+#define CAN_MODE_LOOPBACK 0x40000000U
+
+#define CAN_ID_STD 0x00000000U
+#define CAN_ID_EXT 0x00000004U
+
+#define CAN_RTR_DATA 0x00000000U
+#define CAN_RTR_REMOTE 0x00000002U
+
+#define CAN_RX_FIFO0 0x00000000U
+#define CAN_RX_FIFO1 0x00000001U
+
+#define CAN_FILTER_FIFO0 0x00000000U
+#define CAN_FILTER_FIFO1 0x00000001U
+
+#define CAN_FILTERMODE_IDMASK 0x00000000U
+#define CAN_FILTERMODE_IDLIST 0x00000001U
+
+#define CAN_FILTERSCALE_16BIT 0x00000000U
+#define CAN_FILTERSCALE_32BIT 0x00000001U
+
+#define CAN_FILTER_DISABLE 0x00000000U
+#define CAN_FILTER_ENABLE 0x00000001U
+
+#define CAN_IT_TX_MAILBOX_EMPTY 0x00000001U
+#define CAN_IT_RX_FIFO0_MSG_PENDING 0x00000002U
+#define CAN_IT_RX_FIFO0_FULL 0x00000004U
+#define CAN_IT_RX_FIFO0_OVERRUN 0x00000008U
+#define CAN_IT_RX_FIFO1_MSG_PENDING 0x00000010U
+#define CAN_IT_RX_FIFO1_FULL 0x00000020U
+#define CAN_IT_RX_FIFO1_OVERRUN 0x00000040U
+
+#define CAN_TX_MAILBOX0 0x00000001U
+#define CAN_TX_MAILBOX1 0x00000002U
+#define CAN_TX_MAILBOX2 0x00000004U
+
+typedef struct{
+  uint32_t Prescaler;
+  uint32_t Mode;
+  uint32_t SyncJumpWidth;
+  uint32_t TimeSeg1;
+  uint32_t TimeSeg2;
+  uint32_t TimeTriggeredMode;
+  uint32_t AutoBusOff;
+  uint32_t AutoWakeUp;
+  uint32_t AutoRetransmission;
+  uint32_t ReceiveFifoLocked;
+  uint32_t TransmitFifoPriority;
+} CAN_InitTypeDef;
+
+/// The registers are not simulated, the state is in sim_hal.cpp.
+typedef struct{
+  __IO uint32_t MCR;
+} CAN_TypeDef;
+
+typedef struct{
+  CAN_TypeDef *Instance;
+  CAN_InitTypeDef Init;
+  __IO uint32_t State;
+  __IO uint32_t ErrorCode;
+} CAN_HandleTypeDef;
+
+typedef struct{
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  uint32_t TransmitGlobalTime;
+} CAN_TxHeaderTypeDef;
+
+typedef struct{
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  uint32_t Timestamp;
+  uint32_t FilterMatchIndex;
+} CAN_RxHeaderTypeDef;
+
+typedef struct{
+  uint32_t FilterIdHigh;
+  uint32_t FilterIdLow;
+  uint32_t FilterMaskIdHigh;
+  uint32_t FilterMaskIdLow;
+  uint32_t FilterFIFOAssignment;
+  uint32_t FilterBank;
+  uint32_t FilterMode;
+  uint32_t FilterScale;
+  uint32_t FilterActivation;
+  uint32_t SlaveStartFilterBank;
+} CAN_FilterTypeDef;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+HAL_StatusTypeDef HAL_UART_Init( UART_HandleTypeDef *huart );
+HAL_StatusTypeDef HAL_UART_DeInit( UART_HandleTypeDef *huart );
+HAL_StatusTypeDef HAL_UART_Transmit( UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout );
+HAL_StatusTypeDef HAL_UART_Transmit_DMA( UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size );
+HAL_StatusTypeDef HAL_UART_Receive_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size );
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size );
+HAL_StatusTypeDef HAL_UART_AbortReceive( UART_HandleTypeDef *huart );
+
+void HAL_UART_TxCpltCallback( UART_HandleTypeDef *huart );
+void HAL_UART_RxHalfCpltCallback( UART_HandleTypeDef *huart );
+void HAL_UART_RxCpltCallback( UART_HandleTypeDef *huart );
+void HAL_UART_ErrorCallback( UART_HandleTypeDef *huart );
+void HAL_UARTEx_RxEventCallback( UART_HandleTypeDef *huart, uint16_t Size );
+
+HAL_StatusTypeDef HAL_CAN_Init( CAN_HandleTypeDef *hcan );
+HAL_StatusTypeDef HAL_CAN_DeInit( CAN_HandleTypeDef *hcan );
+HAL_StatusTypeDef HAL_CAN_ConfigFilter( CAN_HandleTypeDef *hcan, CAN_FilterTypeDef *sFilterConfig );
+HAL_StatusTypeDef HAL_CAN_Start( CAN_HandleTypeDef *hcan );
+HAL_StatusTypeDef HAL_CAN_Stop( CAN_HandleTypeDef *hcan );
+HAL_StatusTypeDef HAL_CAN_AddTxMessage( CAN_HandleTypeDef *hcan, CAN_TxHeaderTypeDef *pHeader, uint8_t aData[], uint32_t *pTxMailbox );
+HAL_StatusTypeDef HAL_CAN_AbortTxRequest( CAN_HandleTypeDef *hcan, uint32_t TxMailboxes );
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel( CAN_HandleTypeDef *hcan );
+uint32_t HAL_CAN_IsTxMessagePending( CAN_HandleTypeDef *hcan, uint32_t TxMailboxes );
+HAL_StatusTypeDef HAL_CAN_GetRxMessage( CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader, uint8_t aData[] );
+uint32_t HAL_CAN_GetRxFifoFillLevel( CAN_HandleTypeDef *hcan, uint32_t RxFifo );
+HAL_StatusTypeDef HAL_CAN_ActivateNotification( CAN_HandleTypeDef *hcan, uint32_t ActiveITs );
+HAL_StatusTypeDef HAL_CAN_DeactivateNotification( CAN_HandleTypeDef *hcan, uint32_t InactiveITs );
+
+void HAL_CAN_RxFifo0MsgPendingCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_RxFifo1MsgPendingCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox0CompleteCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox1CompleteCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox2CompleteCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox0AbortCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox1AbortCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_TxMailbox2AbortCallback( CAN_HandleTypeDef *hcan );
+void HAL_CAN_ErrorCallback( CAN_HandleTypeDef *hcan );
+
+/// Core clock of the simulated MCU, 168MHz by default
+extern uint32_t SystemCoreClock;
+
+uint32_t HAL_GetTick( void );
+void HAL_Delay( uint32_t Delay );
+
+void Error_Handler( void );
+
+// Simulated core registers, the interrupts are delivered when they are enabled.
+uint32_t __get_PRIMASK( void );
+void __set_PRIMASK( uint32_t priMask );
+void __disable_irq( void );
+void __enable_irq( void );
+uint32_t __get_IPSR( void );
+void __WFI( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void __DMB( void ){ __sync_synchronize(); }
+
+#endif /* STM32_CLASS_FACTORY_HOST_SIM_STM32F4XX_HAL_H_ */
@@ -0,0 +1,17 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_HOST_SIM_USART_H_
+#define STM32_CLASS_FACTORY_HOST_SIM_USART_H_
+
+// In a CubeMX project this file declares the UART handles. On the host
+// the handles are created by the program, see sim_hal.hpp.
+#include "stm32f4xx_hal.h"
+
+#endif /* STM32_CLASS_FACTORY_HOST_SIM_USART_H_ */
@@ -0,0 +1,1904 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+/// Benchmark suite of the Serial library on the simulated HAL
+///
+/// Every case runs in rounds until the given time elapses, then the time and
+/// the host cycles of one call in the fastest round, the throughput and the
+/// number of UART transfers per call are printed. The CPU cases use an unlimited baudrate, so they measure
+/// only the library. The line cases run on real baudrates in virtual time,
+/// and they show the throughput on the wire.
+///
+/// Usage:
+///
+///     serial_bench [--time ms] [--csv file] [--baseline file] [--tolerance percent]
+///
+/// With --baseline the ns per call of every case is compared with the
+/// given CSV file, that was written by an earlier run with --csv. If a case
+/// is slower by more than the tolerance( 25% by default ), the exit code is 1.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+#include "Serial.hpp"
+#include "SerialTelemetry.hpp"
+#include "SerialCANGateway.hpp"
+#include "CANdalorianFilter.hpp"
+#include "sim_hal.hpp"
+
+/// Result of a benchmark case
+struct benchResult_t{
+	std::string name;
+	uint64_t calls;
+	double ns_per_call;
+	double cycles_per_call;
+	double bytes_per_second;
+	double transfers_per_call;
+};
+
+static std::vector< benchResult_t > results;
+
+/// Minimum running time of a case in ns
+static uint64_t min_time = 20000000ULL;
+
+/// Number of rounds of a case, the time of the fastest round is reported
+#define BENCH_ROUNDS 5
+
+static uint64_t hostTime(){
+
+	return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+
+}
+
+static uint64_t hostCycles(){
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+	return __rdtsc();
+
+#else
+
+	return 0;
+
+#endif
+
+}
+
+static void report( const benchResult_t &result ){
+
+	results.push_back( result );
+
+	printf( "%-40s %12llu %10.1f %10.1f %14.0f %8.2f\n",
+			result.name.c_str(),
+			(unsigned long long)result.calls,
+			result.ns_per_call,
+			result.cycles_per_call,
+			result.bytes_per_second,
+			result.transfers_per_call );
+
+}
+
+/// Print a number the way the integer prints did before SerialFormat
+///
+/// The number is formatted with snprintf into a stack buffer, the length is
+/// measured with strlen, then the text is written to the port.
+/// @param port the port under test.
+/// @param format printf format of the number.
+/// @param value the number.
+template< typename T >
+static size_t printSnprintf( SerialPort &port, const char *format, T value ){
+
+	char buff[ 24 ];
+
+	snprintf( buff, sizeof( buff ), format, value );
+
+	return port.write( (const uint8_t*)buff, strlen( buff ) );
+
+}
+
+/// Run a transmitt case
+///
+/// @param config name of the buffer configuration.
+/// @param name name of the case.
+/// @param port the port under test.
+/// @param huart the UART of the port.
+/// @param body the function that is measured.
+template< typename F >
+static void benchTransmit( const char *config, const char *name, SerialPort &port, UART_HandleTypeDef *huart, F body ){
+
+	benchResult_t result;
+	uint64_t bytes_start;
+	uint64_t transfers_start;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t time;
+	uint64_t cycles;
+	uint64_t calls;
+	uint64_t total_time = 0;
+	uint64_t total_calls = 0;
+	int round;
+	int i;
+
+	result.name = std::string( config ) + "/" + name;
+	result.ns_per_call = 0;
+	result.cycles_per_call = 0;
+
+	port.flush();
+
+	bytes_start = simUartTxBytes( huart );
+	transfers_start = simUartTxTransfers( huart );
+
+	for( round = 0; round < BENCH_ROUNDS; round++ ){
+
+		calls = 0;
+		time_start = hostTime();
+		cycles_start = hostCycles();
+
+		do{
+
+			for( i = 0; i < 64; i++ ){
+
+				body();
+
+			}
+
+			calls += 64;
+
+		}while( hostTime() - time_start < min_time / BENCH_ROUNDS );
+
+		port.flush();
+
+		time = hostTime() - time_start;
+		cycles = hostCycles() - cycles_start;
+
+		if( ( round == 0 ) || ( (double)time / calls < result.ns_per_call ) ){
+
+			result.ns_per_call = (double)time / calls;
+			result.cycles_per_call = (double)cycles / calls;
+
+		}
+
+		total_time += time;
+		total_calls += calls;
+
+	}
+
+	result.calls = total_calls;
+	result.bytes_per_second = ( simUartTxBytes( huart ) - bytes_start ) * 1e9 / total_time;
+	result.transfers_per_call = (double)( simUartTxTransfers( huart ) - transfers_start ) / total_calls;
+
+	report( result );
+
+}
+
+/// Run a recive case
+///
+/// The recive buffer is filled before every round, only the reading is measured.
+/// @param config name of the buffer configuration.
+/// @param name name of the case.
+/// @param port the port under test.
+/// @param huart the UART of the port.
+/// @param rx_length size of the recive buffer.
+/// @param body the function that is measured. It gets the number of bytes in the buffer, and returns the number of calls.
+template< typename F >
+static void benchRecive( const char *config, const char *name, SerialPort &port, UART_HandleTypeDef *huart, uint32_t rx_length, F body ){
+
+	benchResult_t result;
+	std::vector< uint8_t > data( rx_length - 1 );
+	uint64_t time;
+	uint64_t cycles;
+	uint64_t calls;
+	uint64_t total_time = 0;
+	uint64_t total_calls = 0;
+	uint64_t bytes = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint32_t i;
+	int round;
+
+	result.name = std::string( config ) + "/" + name;
+	result.ns_per_call = 0;
+	result.cycles_per_call = 0;
+
+	for( i = 0; i < data.size(); i++ ){
+
+		data[ i ] = ( i % 64 == 63 ) ? '\n' : 'a' + i % 26;
+
+	}
+
+	for( round = 0; round < BENCH_ROUNDS; round++ ){
+
+		time = 0;
+		cycles = 0;
+		calls = 0;
+
+		do{
+
+			simUartFeed( huart, data.data(), data.size() );
+
+			// With unlimited baudrate the bytes arrive at the next interrupt point.
+			simPoll();
+
+			time_start = hostTime();
+			cycles_start = hostCycles();
+
+			calls += body( (uint32_t)data.size() );
+
+			time += hostTime() - time_start;
+			cycles += hostCycles() - cycles_start;
+			bytes += data.size();
+
+		}while( time < min_time / BENCH_ROUNDS );
+
+		if( ( round == 0 ) || ( (double)time / calls < result.ns_per_call ) ){
+
+			result.ns_per_call = (double)time / calls;
+			result.cycles_per_call = (double)cycles / calls;
+
+		}
+
+		total_time += time;
+		total_calls += calls;
+
+	}
+
+	result.calls = total_calls;
+	result.bytes_per_second = bytes * 1e9 / total_time;
+	result.transfers_per_call = 0;
+
+	if( port.stats().rx_overruns > 0 ){
+
+		fprintf( stderr, "%s: unexpected recive overrun\n", result.name.c_str() );
+		exit( 1 );
+
+	}
+
+	report( result );
+
+}
+
+/// Run a line case on a real baudrate in virtual time
+///
+/// @param config name of the buffer configuration.
+/// @param port the port under test.
+/// @param huart the UART of the port.
+/// @param baudrate the baudrate of the line.
+static void benchLine( const char *config, SerialPort &port, UART_HandleTypeDef *huart, uint32_t baudrate ){
+
+	benchResult_t result;
+	char name[ 64 ];
+	uint64_t bytes_start;
+	uint64_t transfers_start;
+	uint64_t time_start;
+	uint64_t time;
+	uint32_t lines = 200;
+	uint32_t i;
+
+	port.begin( baudrate );
+
+	bytes_start = simUartTxBytes( huart );
+	transfers_start = simUartTxTransfers( huart );
+	time_start = simTime();
+
+	for( i = 0; i < lines; i++ ){
+
+		port.println( "The quick brown fox jumps over the lazy dog" );
+
+	}
+
+	port.flush();
+
+	time = simTime() - time_start;
+
+	snprintf( name, sizeof( name ), "line %lu/println", (unsigned long)baudrate );
+
+	result.name = std::string( config ) + "/" + name;
+	result.calls = lines;
+	result.ns_per_call = (double)time / lines;
+	result.cycles_per_call = 0;
+	result.bytes_per_second = ( simUartTxBytes( huart ) - bytes_start ) * 1e9 / time;
+	result.transfers_per_call = (double)( simUartTxTransfers( huart ) - transfers_start ) / lines;
+
+	report( result );
+
+	printf( "%-40s stalls: %lu, stall time: %lu ms, peak fill: %lu\n", "", (unsigned long)port.stats().tx_stalls, (unsigned long)port.stats().tx_stall_time, (unsigned long)port.stats().tx_peak );
+
+	port.begin( SIM_BAUDRATE_UNLIMITED );
+
+}
+
+/// Run every case on a port
+///
+/// @param config name of the buffer configuration.
+/// @param port the port under test.
+/// @param huart the UART of the port.
+/// @param rx_length size of the recive buffer.
+static void benchPort( const char *config, SerialPort &port, UART_HandleTypeDef *huart, uint32_t rx_length ){
+
+	static uint8_t block[ 64 ];
+	static uint8_t buffer[ 1024 ];
+	volatile uint32_t counter = 0;
+
+	port.begin( SIM_BAUDRATE_UNLIMITED );
+
+	benchTransmit( config, "print(char)", port, huart, [&]{ port.print( 'a' ); } );
+	benchTransmit( config, "print(const char*)", port, huart, [&]{ port.print( "Hello World! :)" ); } );
+	benchTransmit( config, "print(int8_t)", port, huart, [&]{ port.print( (int8_t)( -100 - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint8_t)", port, huart, [&]{ port.print( (uint8_t)( 200 + ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(int16_t)", port, huart, [&]{ port.print( (int16_t)( -30000 - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint16_t)", port, huart, [&]{ port.print( (uint16_t)( 60000 + ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(int32_t)", port, huart, [&]{ port.print( (int32_t)( -2000000000 - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint32_t)", port, huart, [&]{ port.print( (uint32_t)( 4000000000U + ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint32_t,HEX)", port, huart, [&]{ port.print( (uint32_t)( 0xDEADBEEF + ( counter++ & 7 ) ), HEX ); } );
+	benchTransmit( config, "print(int64_t)", port, huart, [&]{ port.print( (int64_t)( -9000000000000000000LL - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint64_t)", port, huart, [&]{ port.print( (uint64_t)( 18000000000000000000ULL + ( counter++ & 7 ) ) ); } );
+	// The snprintf + strlen path, that the integer prints used before serialFormatSigned
+	// and serialFormatUnsigned, with the same values as the cases above.
+	benchTransmit( config, "print(int32_t) snprintf", port, huart, [&]{ printSnprintf( port, "%" PRId32, (int32_t)( -2000000000 - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint32_t) snprintf", port, huart, [&]{ printSnprintf( port, "%" PRIu32, (uint32_t)( 4000000000U + ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(uint32_t,HEX) snprintf", port, huart, [&]{ printSnprintf( port, "%" PRIX32, (uint32_t)( 0xDEADBEEF + ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(int64_t) snprintf", port, huart, [&]{ printSnprintf( port, "%" PRId64, (int64_t)( -9000000000000000000LL - ( counter++ & 7 ) ) ); } );
+	benchTransmit( config, "print(float)", port, huart, [&]{ port.print( 3.14159f + ( counter++ & 7 ) ); } );
+	benchTransmit( config, "print(double)", port, huart, [&]{ port.print( 2.718281828 + ( counter++ & 7 ) ); } );
+	benchTransmit( config, "println()", port, huart, [&]{ port.println(); } );
+	benchTransmit( config, "println(const char*)", port, huart, [&]{ port.println( "Hello World! :)" ); } );
+	benchTransmit( config, "println(int32_t)", port, huart, [&]{ port.println( (int32_t)( counter++ ) ); } );
+	benchTransmit( config, "println(float)", port, huart, [&]{ port.println( 3.14159f + ( counter++ & 7 ) ); } );
+	benchTransmit( config, "printf(\"%d\")", port, huart, [&]{ port.printf( "%d", (int)counter++ ); } );
+	benchTransmit( config, "printf(\"%d %s %.3f\\n\")", port, huart, [&]{ port.printf( "%d %s %.3f\n", (int)counter++, "volts", 3.3 ); } );
+	benchTransmit( config, "format(\"{}\")", port, huart, [&]{ port.format( SERIAL_FMT( "{}" ), (int)counter++ ); } );
+	benchTransmit( config, "format(\"{} {} {:.3f}\\n\")", port, huart, [&]{ port.format( SERIAL_FMT( "{} {} {:.3f}\n" ), (int)counter++, "volts", 3.3 ); } );
+	benchTransmit( config, "dbgPrintf", port, huart, [&]{ port.dbgPrintf( "adc: %u\n", (unsigned)counter++ ); } );
+	benchTransmit( config, "write(64)", port, huart, [&]{ port.write( block, sizeof( block ) ); } );
+
+	benchRecive( config, "available+read", port, huart, rx_length, [&]( uint32_t size ){
+
+		uint32_t calls = 0;
+
+		while( port.available() ){
+
+			counter += port.read();
+			calls++;
+
+		}
+
+		if( calls != size ){
+
+			fprintf( stderr, "available+read: %lu bytes instead of %lu\n", (unsigned long)calls, (unsigned long)size );
+			exit( 1 );
+
+		}
+
+		return calls;
+
+	} );
+
+	benchRecive( config, "readAvailable", port, huart, rx_length, [&]( uint32_t size ){
+
+		return ( port.readAvailable( buffer, sizeof( buffer ) ) == size ) ? 1 : 0;
+
+	} );
+
+	benchRecive( config, "readBytes(timeout)", port, huart, rx_length, [&]( uint32_t size ){
+
+		return ( port.readBytes( buffer, size, 10 ) == size ) ? 1 : 0;
+
+	} );
+
+	benchRecive( config, "readBytesUntil", port, huart, rx_length, [&]( uint32_t size ){
+
+		uint32_t calls = 0;
+
+		while( port.available() ){
+
+			port.readBytesUntil( '\n', buffer, sizeof( buffer ), 0 );
+			calls++;
+
+		}
+
+		( void )size;
+
+		return calls;
+
+	} );
+
+	benchLine( config, port, huart, 115200 );
+	benchLine( config, port, huart, 921600 );
+
+}
+
+/// Number of channels in the telemetry frames
+#define TELEMETRY_CHANNELS 8
+
+/// Number of frames in the telemetry case
+#define TELEMETRY_FRAMES 20000
+
+/// Generate a frame of typical sensor data
+///
+/// Slow and fast sine waves with noise, a counter, a temperature that
+/// rarely changes and noisy accelerometer axes, all of them fit in 16-bit.
+/// @param frame index of the frame.
+/// @param values output, \link TELEMETRY_CHANNELS \endlink values.
+static void telemetrySamples( uint32_t frame, int32_t *values ){
+
+	static uint32_t seed = 12345;
+	int32_t noise[ TELEMETRY_CHANNELS ];
+	uint32_t i;
+
+	for( i = 0; i < TELEMETRY_CHANNELS; i++ ){
+
+		seed = seed * 1103515245UL + 12345UL;
+		noise[ i ] = (int32_t)( ( seed >> 16 ) % 9 ) - 4;
+
+	}
+
+	values[ 0 ] = (int32_t)( 2000.0 * sin( frame * 2.0 * M_PI / 500.0 ) ) + noise[ 0 ];
+	values[ 1 ] = (int32_t)( 12000.0 * sin( frame * 2.0 * M_PI / 50.0 ) ) + noise[ 1 ];
+	values[ 2 ] = (int16_t)frame;
+	values[ 3 ] = 2500 + (int32_t)( frame / 1000 );
+	values[ 4 ] = 16384 + noise[ 4 ] * 4;
+	values[ 5 ] = -120 + noise[ 5 ] * 4;
+	values[ 6 ] = 310 + noise[ 6 ] * 4;
+	values[ 7 ] = noise[ 7 ];
+
+}
+
+/// Run the telemetry compression case
+///
+/// The same frames are sent as raw 16-bit samples and with SerialTelemetry
+/// through SerialPacket. Then the compressed stream is decoded on an other
+/// port and compared with the samples.
+/// @param tx_port the transmitting port.
+/// @param tx_huart the UART of the transmitting port.
+/// @param rx_port the reciving port.
+/// @param rx_huart the UART of the reciving port.
+static void benchTelemetry( SerialPort &tx_port, UART_HandleTypeDef *tx_huart, SerialPort &rx_port, UART_HandleTypeDef *rx_huart ){
+
+	static int32_t samples[ TELEMETRY_FRAMES ][ TELEMETRY_CHANNELS ];
+	static uint8_t tx_packet_buffer[ 64 ];
+	static uint8_t rx_packet_buffer[ 64 ];
+	int16_t raw[ TELEMETRY_CHANNELS ];
+	benchResult_t result;
+	std::string stream;
+	uint64_t raw_bytes = 0;
+	uint64_t compressed_bytes = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t raw_time;
+	uint64_t raw_cycles;
+	uint64_t time;
+	uint64_t cycles;
+	uint32_t frame;
+	uint32_t decoded = 0;
+	uint32_t pos;
+	uint32_t chunk;
+	uint32_t i;
+
+	SerialPacket tx_packets( &tx_port, tx_packet_buffer, sizeof( tx_packet_buffer ) );
+	SerialPacket rx_packets( &rx_port, rx_packet_buffer, sizeof( rx_packet_buffer ) );
+	SerialTelemetryBuffered< TELEMETRY_CHANNELS > tx_telemetry( &tx_packets );
+	SerialTelemetryBuffered< TELEMETRY_CHANNELS > rx_telemetry( &rx_packets );
+
+	tx_port.begin( SIM_BAUDRATE_UNLIMITED );
+	rx_port.begin( SIM_BAUDRATE_UNLIMITED );
+
+	for( frame = 0; frame < TELEMETRY_FRAMES; frame++ ){
+
+		telemetrySamples( frame, samples[ frame ] );
+
+	}
+
+	// Raw 16-bit samples in packets, this is the reference.
+	time_start = hostTime();
+	cycles_start = hostCycles();
+
+	for( frame = 0; frame < TELEMETRY_FRAMES; frame++ ){
+
+		for( i = 0; i < TELEMETRY_CHANNELS; i++ ){
+
+			raw[ i ] = samples[ frame ][ i ];
+
+		}
+
+		raw_bytes += tx_packets.send( (uint8_t*)raw, sizeof( raw ) );
+
+	}
+
+	tx_port.flush();
+
+	raw_time = hostTime() - time_start;
+	raw_cycles = hostCycles() - cycles_start;
+
+	simUartSetCapture( tx_huart, true );
+
+	time_start = hostTime();
+	cycles_start = hostCycles();
+
+	for( frame = 0; frame < TELEMETRY_FRAMES; frame++ ){
+
+		compressed_bytes += tx_telemetry.send( samples[ frame ] );
+
+	}
+
+	tx_port.flush();
+
+	time = hostTime() - time_start;
+	cycles = hostCycles() - cycles_start;
+
+	simUartSetCapture( tx_huart, false );
+	stream = simUartOutput( tx_huart );
+
+	// Decode the stream on the other port, in pieces that fit in its recive buffer.
+	for( pos = 0; pos < stream.size(); pos += chunk ){
+
+		chunk = stream.size() - pos < 128 ? stream.size() - pos : 128;
+
+		simUartFeed( rx_huart, (const uint8_t*)stream.data() + pos, chunk );
+		simPoll();
+
+		while( rx_telemetry.receive() >= 0 ){
+
+			if( memcmp( rx_telemetry.values(), samples[ decoded ], sizeof( samples[ 0 ] ) ) != 0 ){
+
+				fprintf( stderr, "telemetry: frame %lu decoded wrong\n", (unsigned long)decoded );
+				exit( 1 );
+
+			}
+
+			decoded++;
+
+		}
+
+	}
+
+	if( ( decoded != TELEMETRY_FRAMES ) || ( rx_telemetry.lostFrames() != 0 ) ){
+
+		fprintf( stderr, "telemetry: %lu frames decoded, %lu lost\n", (unsigned long)decoded, (unsigned long)rx_telemetry.lostFrames() );
+		exit( 1 );
+
+	}
+
+	result.name = "telemetry/raw int16 packet";
+	result.calls = TELEMETRY_FRAMES;
+	result.ns_per_call = (double)raw_time / TELEMETRY_FRAMES;
+	result.cycles_per_call = (double)raw_cycles / TELEMETRY_FRAMES;
+	result.bytes_per_second = raw_bytes * 1e9 / raw_time;
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	result.name = "telemetry/delta varint packet";
+	result.ns_per_call = (double)time / TELEMETRY_FRAMES;
+	result.cycles_per_call = (double)cycles / TELEMETRY_FRAMES;
+	result.bytes_per_second = compressed_bytes * 1e9 / time;
+
+	report( result );
+
+	printf( "%-40s %.2f line bytes/frame instead of %.2f, ratio: %.2fx, %.1f cycles/sample byte\n", "",
+			(double)compressed_bytes / TELEMETRY_FRAMES,
+			(double)raw_bytes / TELEMETRY_FRAMES,
+			(double)raw_bytes / compressed_bytes,
+			(double)cycles / ( TELEMETRY_FRAMES * sizeof( raw ) ) );
+
+}
+
+/// Number of frames in the gateway cases
+#define GATEWAY_FRAMES 8000
+
+/// Maximum number of frames in a gateway packet
+#define GATEWAY_BATCH 16
+
+/// Period of the main loop in the gateway cases in ns
+#define GATEWAY_POLL_PERIOD 50000ULL
+
+/// Flush delay of the batching gateway case in us
+#define GATEWAY_FLUSH_DELAY 500
+
+/// Number of frames that the host sends ahead of the CAN bus
+#define GATEWAY_HOST_WINDOW 64
+
+/// The test frames are mixed: every 2nd has an extended ID, every 7th is a remote frame
+static bool gateway_mixed = false;
+
+/// Generate a test frame for the gateway
+static void gatewayFrame( uint32_t index, simCanFrame_t *frame ){
+
+	uint32_t i;
+
+	frame -> id = ( index * 37 + 1 ) & 0x7FF;
+	frame -> extended = false;
+	frame -> remote = false;
+	frame -> dlc = ( index % 16 ) ? 8 : ( index / 16 ) % 9;
+
+	if( gateway_mixed ){
+
+		frame -> extended = ( index % 2 ) == 1;
+		frame -> remote = ( index % 7 ) == 3;
+
+		if( frame -> extended ){
+
+			frame -> id = ( index * 0x9E3779B1UL ) & 0x1FFFFFFF;
+
+		}
+
+	}
+
+	for( i = 0; i < 8; i++ ){
+
+		frame -> data[ i ] = ( ( i < frame -> dlc ) && !frame -> remote ) ? (uint8_t)( index + i * 31 ) : 0;
+
+	}
+
+}
+
+/// Returns the CANdalorian flags of a simulated frame
+static uint8_t gatewayFlags( const simCanFrame_t *frame ){
+
+	return ( frame -> extended ? CANDALORIAN_IDE : 0 ) | ( frame -> remote ? CANDALORIAN_RTR : 0 );
+
+}
+
+/// Compare a frame of the gateway with the test frame
+///
+/// The data of the remote frames is not compared.
+static bool gatewayCheck( uint32_t index, uint32_t id, uint8_t flags, const uint8_t *data, uint8_t dlc ){
+
+	simCanFrame_t expected;
+
+	gatewayFrame( index, &expected );
+
+	if( ( id != expected.id ) || ( flags != gatewayFlags( &expected ) ) || ( dlc != expected.dlc ) ){
+
+		return false;
+
+	}
+
+	return expected.remote || ( memcmp( data, expected.data, dlc ) == 0 );
+
+}
+
+/// Move the bytes between the two UARTs, like a cable
+static void gatewayWire( UART_HandleTypeDef *huart_a, UART_HandleTypeDef *huart_b ){
+
+	std::string data;
+
+	data = simUartOutput( huart_a );
+	simUartFeed( huart_b, (const uint8_t*)data.data(), data.size() );
+
+	data = simUartOutput( huart_b );
+	simUartFeed( huart_a, (const uint8_t*)data.data(), data.size() );
+
+}
+
+/// Report a gateway case
+static void gatewayReport( std::string name, uint64_t time, uint64_t cycles, uint64_t line_bytes, uint64_t sim_time, uint32_t packets ){
+
+	benchResult_t result;
+
+	if( gateway_mixed ){
+
+		name += " mixed";
+
+	}
+
+	result.name = "gateway/" + name;
+	result.calls = GATEWAY_FRAMES;
+	result.ns_per_call = (double)time / GATEWAY_FRAMES;
+	result.cycles_per_call = (double)cycles / GATEWAY_FRAMES;
+	result.bytes_per_second = line_bytes * 1e9 / sim_time;
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	printf( "%-40s %.0f frames/s, %.2f line bytes/frame, %.2f frames/packet\n", "",
+			GATEWAY_FRAMES * 1e9 / sim_time,
+			(double)line_bytes / GATEWAY_FRAMES,
+			(double)GATEWAY_FRAMES / packets );
+
+}
+
+/// Run the serial to CAN gateway cases
+///
+/// The gateway runs in a main loop with \link GATEWAY_POLL_PERIOD \endlink
+/// period. First the CAN bus is fully loaded with frames, without and with
+/// flush delay, then the host
+/// sends the frames to the bus in batches. Every frame has to arrive in
+/// order, without loss. The virtual time does not run with the host, the
+/// ns and the cycles are spent in the gateway per frame. With
+/// \link gateway_mixed \endlink the extended and remote frames are tested too.
+/// @param gateway_port the port of the gateway.
+/// @param gateway_huart the UART of the gateway.
+/// @param host_port the port of the host.
+/// @param host_huart the UART of the host.
+/// @param can the CAN peripherial of the gateway.
+/// @param hcan the CAN of the gateway.
+static void benchGateway( SerialPort &gateway_port, UART_HandleTypeDef *gateway_huart, SerialPort &host_port, UART_HandleTypeDef *host_huart, CANdalorian &can, CAN_HandleTypeDef *hcan ){
+
+	static uint8_t gateway_packet_buffer[ GATEWAY_BATCH * SERIAL_CAN_GATEWAY_RECORD_LENGTH + 2 ];
+	static uint8_t host_packet_buffer[ GATEWAY_BATCH * SERIAL_CAN_GATEWAY_RECORD_LENGTH + 2 ];
+	uint8_t batch[ GATEWAY_BATCH * SERIAL_CAN_GATEWAY_RECORD_LENGTH ];
+	std::vector< simCanFrame_t > frames;
+	std::vector< simCanFrame_t > output;
+	simCanFrame_t frame;
+	const uint8_t *payload;
+	uint64_t time = 0;
+	uint64_t cycles = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t sim_start;
+	uint64_t line_start;
+	uint32_t payload_size;
+	uint32_t batch_size;
+	uint32_t record_id;
+	uint32_t id_size;
+	uint8_t header;
+	uint32_t decoded = 0;
+	uint32_t sent = 0;
+	uint32_t packets = 0;
+	uint32_t pos;
+	uint32_t i;
+	int round;
+
+	SerialPacket gateway_packets( &gateway_port, gateway_packet_buffer, sizeof( gateway_packet_buffer ) );
+	SerialPacket host_packets( &host_port, host_packet_buffer, sizeof( host_packet_buffer ) );
+	SerialCANGatewayBuffered< GATEWAY_BATCH > gateway( &gateway_packets, &can );
+
+	gateway_port.begin( 2000000 );
+	host_port.begin( 2000000 );
+
+	simUartSetCapture( gateway_huart, true );
+	simUartSetCapture( host_huart, true );
+
+	// The main loop takes GATEWAY_POLL_PERIOD, independently of the host.
+	simUseHostClock( false );
+
+	// The frames have to leave the mailboxes in the order of the packets.
+	hcan -> Init.TransmitFifoPriority = ENABLE;
+
+	can.normalMode();
+	can.begin();
+
+	for( i = 0; i < GATEWAY_FRAMES; i++ ){
+
+		gatewayFrame( i, &frame );
+		frames.push_back( frame );
+
+	}
+
+	// CAN to serial, the bus is fully loaded. With the flush delay the frames are batched.
+	for( round = 0; round < 2; round++ ){
+
+		time = 0;
+		cycles = 0;
+		decoded = 0;
+		packets = 0;
+
+		gateway.setFlushDelay( round ? GATEWAY_FLUSH_DELAY : 0 );
+
+		sim_start = simTime();
+		line_start = simUartTxBytes( gateway_huart );
+
+		simCanFeed( hcan, frames.data(), frames.size() );
+
+		while( ( decoded < GATEWAY_FRAMES ) && ( simTime() - sim_start < 10000000000ULL ) ){
+
+			time_start = hostTime();
+			cycles_start = hostCycles();
+
+			gateway.poll();
+
+			time += hostTime() - time_start;
+			cycles += hostCycles() - cycles_start;
+
+			gatewayWire( gateway_huart, host_huart );
+
+			while( host_packets.receive() >= 0 ){
+
+				payload = host_packets.data();
+				payload_size = host_packets.size();
+				packets++;
+
+				for( pos = 0; pos < payload_size; pos += 1 + id_size + ( ( header & SERIAL_CAN_GATEWAY_RTR ) ? 0 : ( header & SERIAL_CAN_GATEWAY_DLC_MASK ) ) ){
+
+					header = payload[ pos ];
+					id_size = ( header & SERIAL_CAN_GATEWAY_IDE ) ? 4 : 2;
+					record_id = payload[ pos + 1 ] | ( payload[ pos + 2 ] << 8 );
+
+					if( id_size == 4 ){
+
+						record_id |= ( (uint32_t)payload[ pos + 3 ] << 16 ) | ( (uint32_t)payload[ pos + 4 ] << 24 );
+
+					}
+
+					if( !gatewayCheck( decoded, record_id, header & ( SERIAL_CAN_GATEWAY_IDE | SERIAL_CAN_GATEWAY_RTR ), &payload[ pos + 1 + id_size ], header & SERIAL_CAN_GATEWAY_DLC_MASK ) ){
+
+						fprintf( stderr, "gateway: frame %lu arrived wrong on the UART\n", (unsigned long)decoded );
+						exit( 1 );
+
+					}
+
+					decoded++;
+
+				}
+
+			}
+
+			simAdvance( GATEWAY_POLL_PERIOD );
+
+		}
+
+		if( ( decoded != GATEWAY_FRAMES ) || ( simCanOverruns( hcan, CAN_RX_FIFO0 ) != 0 ) ){
+
+			fprintf( stderr, "gateway: %lu frames arrived on the UART, %lu lost in the CAN FIFO\n", (unsigned long)decoded, (unsigned long)simCanOverruns( hcan, CAN_RX_FIFO0 ) );
+			exit( 1 );
+
+		}
+
+		gatewayReport( round ? "can to serial 500us flush" : "can to serial", time, cycles, simUartTxBytes( gateway_huart ) - line_start, simTime() - sim_start, packets );
+
+	}
+
+	// Serial to CAN, the host keeps a window of frames in flight.
+	time = 0;
+	cycles = 0;
+	decoded = 0;
+	packets = 0;
+
+	sim_start = simTime();
+	line_start = simUartTxBytes( host_huart );
+
+	while( ( decoded < GATEWAY_FRAMES ) && ( simTime() - sim_start < 10000000000ULL ) ){
+
+		while( ( sent < GATEWAY_FRAMES ) && ( sent - decoded + GATEWAY_BATCH <= GATEWAY_HOST_WINDOW ) ){
+
+			batch_size = 0;
+
+			for( i = 0; ( i < GATEWAY_BATCH ) && ( sent < GATEWAY_FRAMES ); i++ ){
+
+				gatewayFrame( sent++, &frame );
+
+				batch[ batch_size++ ] = gatewayFlags( &frame ) | frame.dlc;
+				batch[ batch_size++ ] = frame.id & 0xFF;
+				batch[ batch_size++ ] = ( frame.id >> 8 ) & 0xFF;
+
+				if( frame.extended ){
+
+					batch[ batch_size++ ] = ( frame.id >> 16 ) & 0xFF;
+					batch[ batch_size++ ] = ( frame.id >> 24 ) & 0xFF;
+
+				}
+
+				if( !frame.remote ){
+
+					memcpy( &batch[ batch_size ], frame.data, frame.dlc );
+					batch_size += frame.dlc;
+
+				}
+
+			}
+
+			host_packets.send( batch, batch_size );
+			packets++;
+
+		}
+
+		gatewayWire( gateway_huart, host_huart );
+
+		time_start = hostTime();
+		cycles_start = hostCycles();
+
+		gateway.poll();
+
+		time += hostTime() - time_start;
+		cycles += hostCycles() - cycles_start;
+
+		output = simCanOutput( hcan );
+
+		for( i = 0; i < output.size(); i++ ){
+
+			if( !gatewayCheck( decoded, output[ i ].id, gatewayFlags( &output[ i ] ), output[ i ].data, output[ i ].dlc ) ){
+
+				fprintf( stderr, "gateway: frame %lu arrived wrong on the CAN bus\n", (unsigned long)decoded );
+				exit( 1 );
+
+			}
+
+			decoded++;
+
+		}
+
+		simAdvance( GATEWAY_POLL_PERIOD );
+
+	}
+
+	if( ( decoded != GATEWAY_FRAMES ) || ( gateway_port.stats().rx_overruns != 0 ) || ( gateway.stats().rejected != 0 ) ){
+
+		fprintf( stderr, "gateway: %lu frames arrived on the CAN bus, %lu UART overruns\n", (unsigned long)decoded, (unsigned long)gateway_port.stats().rx_overruns );
+		exit( 1 );
+
+	}
+
+	gatewayReport( "serial to can", time, cycles, simUartTxBytes( host_huart ) - line_start, simTime() - sim_start, packets );
+
+	simUartSetCapture( gateway_huart, false );
+	simUartSetCapture( host_huart, false );
+
+	simUseHostClock( true );
+
+}
+
+/// Number of frames in the CAN recive cases
+#define CAN_RX_FRAMES 8000
+
+/// Period of the main loop in the CAN recive cases in ns
+#define CAN_RX_POLL_PERIOD 50000ULL
+
+/// The main loop stalls in every CAN_RX_STALL_PERIOD loops
+#define CAN_RX_STALL_PERIOD 40
+
+/// Length of the stall in ns, about 8 frames arrive meanwhile
+#define CAN_RX_STALL 1000000ULL
+
+/// Maximum number of frames read by one readBatch call
+#define CAN_RX_BATCH 16
+
+/// Run a CAN recive case
+///
+/// The bus is fully loaded and the main loop reads the frames in every
+/// \link CAN_RX_POLL_PERIOD \endlink, but in every 2 ms it is busy for
+/// \link CAN_RX_STALL \endlink. The 3 deep hardware FIFO can not hold the frames
+/// of a stall, the interrupt driven recive ring can.
+/// @param name name of the case.
+/// @param can the CAN peripherial.
+/// @param hcan the CAN handle.
+/// @param batch true to read with \link CANdalorian::readBatch \endlink.
+static void benchCanRecive( const char *name, CANdalorian &can, CAN_HandleTypeDef *hcan, bool batch ){
+
+	std::vector< simCanFrame_t > frames;
+	simCanFrame_t frame;
+	CANdalorian::frame_t recived[ CAN_RX_BATCH ];
+	CANdalorian::stats_t can_stats;
+	benchResult_t result;
+	uint64_t time = 0;
+	uint64_t cycles = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t sim_start;
+	uint32_t decoded = 0;
+	uint32_t expected = 0;
+	uint32_t loops = 0;
+	uint32_t count;
+	uint32_t i;
+	uint32_t j;
+
+	simUseHostClock( false );
+
+	can.normalMode();
+	can.begin();
+	can.resetStats();
+
+	for( i = 0; i < CAN_RX_FRAMES; i++ ){
+
+		gatewayFrame( i, &frame );
+		frames.push_back( frame );
+
+	}
+
+	sim_start = simTime();
+
+	simCanFeed( hcan, frames.data(), frames.size() );
+
+	while( !simCanIdle( hcan ) || ( can.available() > 0 ) ){
+
+		while( true ){
+
+			// Only the read is measured, not the check.
+			time_start = hostTime();
+			cycles_start = hostCycles();
+
+			if( batch ){
+
+				count = can.readBatch( recived, CAN_RX_BATCH );
+
+			}
+
+			else{
+
+				count = ( can.read( &recived[ 0 ] ) == HAL_OK ) ? 1 : 0;
+
+			}
+
+			time += hostTime() - time_start;
+			cycles += hostCycles() - cycles_start;
+
+			if( count == 0 ){
+
+				break;
+
+			}
+
+			for( j = 0; j < count; j++ ){
+
+				// The lost frames are skipped, but the order has to be kept.
+				while( ( expected < CAN_RX_FRAMES ) && !gatewayCheck( expected, recived[ j ].id, recived[ j ].flags, recived[ j ].data, recived[ j ].dlc ) ){
+
+					expected++;
+
+				}
+
+				if( expected == CAN_RX_FRAMES ){
+
+					fprintf( stderr, "can: frame %lu arrived wrong\n", (unsigned long)decoded );
+					exit( 1 );
+
+				}
+
+				expected++;
+				decoded++;
+
+			}
+
+		}
+
+		if( ++loops % CAN_RX_STALL_PERIOD == 0 ){
+
+			simAdvance( CAN_RX_STALL );
+
+		}
+
+		simAdvance( CAN_RX_POLL_PERIOD );
+
+	}
+
+	can_stats = can.stats();
+
+	result.name = std::string( "can/" ) + name + ( gateway_mixed ? " mixed" : "" );
+	result.calls = decoded;
+	result.ns_per_call = decoded ? (double)time / decoded : 0;
+	result.cycles_per_call = decoded ? (double)cycles / decoded : 0;
+	result.bytes_per_second = decoded * 8 * 1e9 / ( simTime() - sim_start );
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	printf( "%-40s %lu of %lu frames, FIFO overruns: %lu, ring drops: %lu, ring peak: %lu\n", "",
+			(unsigned long)decoded,
+			(unsigned long)CAN_RX_FRAMES,
+			(unsigned long)simCanOverruns( hcan, CAN_RX_FIFO0 ),
+			(unsigned long)can_stats.rx_dropped,
+			(unsigned long)can_stats.rx_peak );
+
+	simUseHostClock( true );
+
+}
+
+/// Number of frames in the CAN transmitt cases
+#define CAN_TX_FRAMES 2000
+
+/// Period of the main loop in the queued CAN transmitt case in ns
+#define CAN_TX_POLL_PERIOD 1000000ULL
+
+/// Number of the messages reported by the transmitt callback
+static uint32_t can_tx_reported = 0;
+
+/// The transmitt callback got a ticket out of order or a failed message
+static bool can_tx_wrong = false;
+
+/// Transmitt callback of the queued case
+static void canTransmittCallback( uint32_t ticket, CANdalorian::txResult_t result ){
+
+	if( ( ticket != can_tx_reported ) || ( result != CANdalorian::TX_SENT ) ){
+
+		can_tx_wrong = true;
+
+	}
+
+	can_tx_reported++;
+
+}
+
+/// Report a CAN transmitt case
+static void canTransmittReport( const char *name, uint64_t time, uint64_t cycles, uint64_t blocked, uint64_t sim_time ){
+
+	benchResult_t result;
+
+	result.name = std::string( "can/" ) + name;
+	result.calls = CAN_TX_FRAMES;
+	result.ns_per_call = (double)time / CAN_TX_FRAMES;
+	result.cycles_per_call = (double)cycles / CAN_TX_FRAMES;
+	result.bytes_per_second = CAN_TX_FRAMES * 1e9 / sim_time;
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	printf( "%-40s %.0f frames/s, %.1f us blocked/frame\n", "",
+			CAN_TX_FRAMES * 1e9 / sim_time,
+			blocked / 1000.0 / CAN_TX_FRAMES );
+
+}
+
+/// Check the frames on the bus
+///
+/// @param hcan the CAN handle.
+/// @param decoded number of frames checked so far, it is incremented.
+static void canTransmittCheck( CAN_HandleTypeDef *hcan, uint32_t *decoded ){
+
+	std::vector< simCanFrame_t > output;
+	uint32_t i;
+
+	output = simCanOutput( hcan );
+
+	for( i = 0; i < output.size(); i++ ){
+
+		if( !gatewayCheck( *decoded, output[ i ].id, gatewayFlags( &output[ i ] ), output[ i ].data, output[ i ].dlc ) ){
+
+			fprintf( stderr, "can: frame %lu was sent wrong\n", (unsigned long)*decoded );
+			exit( 1 );
+
+		}
+
+		( *decoded )++;
+
+	}
+
+}
+
+/// Run the CAN transmitt cases
+///
+/// First every frame is sent with the blocking \link CANdalorian::transmitt \endlink,
+/// then a main loop with \link CAN_TX_POLL_PERIOD \endlink period fills the
+/// transmitt queue, one frame per call and with \link CANdalorian::transmittBatch \endlink.
+/// The frames have to be sent in order. The bytes/s column
+/// shows the frames/s on the bus, the blocked time is the virtual time spent
+/// in the transmitt calls.
+/// @param blocking the CAN peripherial without transmitt queue.
+/// @param hcan_blocking the CAN handle of blocking.
+/// @param queued the CAN peripherial with transmitt queue.
+/// @param hcan_queued the CAN handle of queued.
+static void benchCanTransmitt( CANdalorian &blocking, CAN_HandleTypeDef *hcan_blocking, CANdalorian &queued, CAN_HandleTypeDef *hcan_queued ){
+
+	std::vector< CANdalorian::frame_t > frames;
+	CANdalorian::frame_t can_frame;
+	simCanFrame_t frame;
+	uint64_t time = 0;
+	uint64_t cycles = 0;
+	uint64_t blocked = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t sim_start;
+	uint64_t call_start;
+	uint32_t decoded = 0;
+	uint32_t sent = 0;
+	uint32_t i;
+	int round;
+
+	simUseHostClock( false );
+
+	hcan_blocking -> Init.TransmitFifoPriority = ENABLE;
+	hcan_queued -> Init.TransmitFifoPriority = ENABLE;
+
+	blocking.normalMode();
+	blocking.begin();
+
+	queued.normalMode();
+	queued.begin();
+	queued.resetStats();
+	queued.setTransmittCallback( canTransmittCallback );
+
+	// Blocking, one mailbox is used and the call returns after the transmission.
+	sim_start = simTime();
+
+	for( sent = 0; sent < CAN_TX_FRAMES; sent++ ){
+
+		gatewayFrame( sent, &frame );
+
+		call_start = simTime();
+		time_start = hostTime();
+		cycles_start = hostCycles();
+
+		if( blocking.transmitt( frame.id, frame.data, frame.dlc ) != HAL_OK ){
+
+			fprintf( stderr, "can: blocking transmitt failed at frame %lu\n", (unsigned long)sent );
+			exit( 1 );
+
+		}
+
+		time += hostTime() - time_start;
+		cycles += hostCycles() - cycles_start;
+		blocked += simTime() - call_start;
+
+		canTransmittCheck( hcan_blocking, &decoded );
+
+	}
+
+	if( decoded != CAN_TX_FRAMES ){
+
+		fprintf( stderr, "can: %lu frames were sent by the blocking transmitt\n", (unsigned long)decoded );
+		exit( 1 );
+
+	}
+
+	canTransmittReport( "transmitt blocking", time, cycles, blocked, simTime() - sim_start );
+
+	for( i = 0; i < CAN_TX_FRAMES; i++ ){
+
+		gatewayFrame( i, &frame );
+
+		memset( &can_frame, 0, sizeof( can_frame ) );
+
+		can_frame.id = frame.id;
+		can_frame.dlc = frame.dlc;
+		memcpy( can_frame.data, frame.data, sizeof( can_frame.data ) );
+
+		frames.push_back( can_frame );
+
+	}
+
+	// Queued, the main loop fills the queue and does not wait.
+	for( round = 0; round < 2; round++ ){
+
+		time = 0;
+		cycles = 0;
+		blocked = 0;
+		decoded = 0;
+		sent = 0;
+
+		queued.resetStats();
+
+		sim_start = simTime();
+
+		while( ( decoded < CAN_TX_FRAMES ) && ( simTime() - sim_start < 10000000000ULL ) ){
+
+			call_start = simTime();
+			time_start = hostTime();
+			cycles_start = hostCycles();
+
+			if( round ){
+
+				sent += queued.transmittBatch( &frames[ sent ], CAN_TX_FRAMES - sent );
+
+			}
+
+			else{
+
+				while( ( sent < CAN_TX_FRAMES ) && ( queued.transmittAsync( &frames[ sent ] ) == HAL_OK ) ){
+
+					sent++;
+
+				}
+
+			}
+
+			time += hostTime() - time_start;
+			cycles += hostCycles() - cycles_start;
+			blocked += simTime() - call_start;
+
+			simAdvance( CAN_TX_POLL_PERIOD );
+
+			canTransmittCheck( hcan_queued, &decoded );
+
+		}
+
+		// The tickets go on from the previous round.
+		if( ( decoded != CAN_TX_FRAMES ) || ( can_tx_reported != CAN_TX_FRAMES * (uint32_t)( round + 1 ) ) || can_tx_wrong || ( queued.transmittPending() != 0 ) ){
+
+			fprintf( stderr, "can: %lu frames were sent from the queue, %lu reported\n", (unsigned long)decoded, (unsigned long)can_tx_reported );
+			exit( 1 );
+
+		}
+
+		canTransmittReport( round ? "transmitt batch" : "transmitt queued", time, cycles, blocked, simTime() - sim_start );
+
+		printf( "%-40s queue peak: %lu\n", "", (unsigned long)queued.stats().tx_peak );
+
+	}
+
+	queued.setTransmittCallback( NULL );
+
+	simUseHostClock( true );
+
+}
+
+/// Number of frames in the CAN filter cases
+#define CAN_FILTER_FRAMES 8000
+
+/// Number of random extended IDs in the CAN filter check
+#define CAN_FILTER_SAMPLES 1000000
+
+/// A requested range of the CAN filter cases
+struct canFilterRange_t{
+	uint32_t first;
+	uint32_t last;
+	bool extended;
+	uint32_t fifo;
+};
+
+/// The requested IDs of the CAN filter cases
+static const canFilterRange_t can_filter_ranges[] = {
+	{ 0x100, 0x17F, false, CAN_RX_FIFO0 },
+	{ 0x000, 0x000, false, CAN_RX_FIFO0 },
+	{ 0x200, 0x201, false, CAN_RX_FIFO0 },
+	{ 0x305, 0x305, false, CAN_RX_FIFO0 },
+	{ 0x7FF, 0x7FF, false, CAN_RX_FIFO0 },
+	{ 0x3A3, 0x3B7, false, CAN_RX_FIFO1 },
+	{ 0x555, 0x555, false, CAN_RX_FIFO1 },
+	{ 0x18FF1234, 0x18FF1234, true, CAN_RX_FIFO0 },
+	{ 0x1FFFFFFF, 0x1FFFFFFF, true, CAN_RX_FIFO0 },
+	{ 0x00001000, 0x0001FF0A, true, CAN_RX_FIFO0 },
+	{ 0x0CF00400, 0x0CF004FF, true, CAN_RX_FIFO1 }
+};
+
+/// Number of the requested ranges
+#define CAN_FILTER_RANGES ( sizeof( can_filter_ranges ) / sizeof( can_filter_ranges[ 0 ] ) )
+
+/// Check if an ID is requested
+///
+/// @param id the ID.
+/// @param extended true for extended ID.
+/// @param fifo output, the FIFO of the ID.
+/// @returns true if the ID is requested.
+static bool canFilterWanted( uint32_t id, bool extended, uint32_t *fifo ){
+
+	uint32_t i;
+
+	for( i = 0; i < CAN_FILTER_RANGES; i++ ){
+
+		if( ( can_filter_ranges[ i ].extended == extended ) && ( id >= can_filter_ranges[ i ].first ) && ( id <= can_filter_ranges[ i ].last ) ){
+
+			*fifo = can_filter_ranges[ i ].fifo;
+			return true;
+
+		}
+
+	}
+
+	return false;
+
+}
+
+/// Compare the hardware filters with the requested IDs
+///
+/// @param hcan the CAN handle.
+/// @param id the ID.
+/// @param extended true for extended ID.
+/// @param remote true for a remote frame.
+/// @param remote_accepted true if the filters accept the remote frames.
+static void canFilterCheck( CAN_HandleTypeDef *hcan, uint32_t id, bool extended, bool remote, bool remote_accepted ){
+
+	simCanFrame_t frame;
+	uint32_t wanted_fifo = 0;
+	uint32_t fifo = 0;
+	bool wanted;
+	bool accepted;
+
+	memset( &frame, 0, sizeof( frame ) );
+
+	frame.id = id;
+	frame.extended = extended;
+	frame.remote = remote;
+
+	wanted = canFilterWanted( id, extended, &wanted_fifo ) && ( !remote || remote_accepted );
+	accepted = simCanAccepts( hcan, frame, &fifo );
+
+	if( ( wanted != accepted ) || ( wanted && ( fifo != wanted_fifo ) ) ){
+
+		fprintf( stderr, "can: filter %s the %s %s ID 0x%lX%s\n", accepted ? "accepts" : "drops", extended ? "extended" : "standard",
+				remote ? "remote" : "data", (unsigned long)id, ( wanted && accepted ) ? " to the wrong FIFO" : "" );
+		exit( 1 );
+
+	}
+
+}
+
+/// Run a CAN filter case under full bus load
+///
+/// @param name name of the case.
+/// @param can the CAN peripherial.
+/// @param hcan the CAN handle.
+/// @param software true if the frames are filtered by software.
+static void canFilterLoad( const char *name, CANdalorian &can, CAN_HandleTypeDef *hcan, bool software ){
+
+	std::vector< simCanFrame_t > frames;
+	simCanFrame_t frame;
+	CANdalorian::frame_t recived;
+	benchResult_t result;
+	uint64_t time = 0;
+	uint64_t cycles = 0;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint32_t fifo;
+	uint32_t kept = 0;
+	uint32_t wanted = 0;
+	uint32_t i;
+
+	for( i = 0; i < CAN_FILTER_FRAMES; i++ ){
+
+		gatewayFrame( i, &frame );
+		frames.push_back( frame );
+
+		if( canFilterWanted( frame.id, false, &fifo ) ){
+
+			wanted++;
+
+		}
+
+	}
+
+	can.resetStats();
+
+	simCanFeed( hcan, frames.data(), frames.size() );
+
+	while( !simCanIdle( hcan ) || ( can.available() > 0 ) ){
+
+		time_start = hostTime();
+		cycles_start = hostCycles();
+
+		while( can.read( &recived ) == HAL_OK ){
+
+			if( !software || canFilterWanted( recived.id, false, &fifo ) ){
+
+				kept++;
+
+			}
+
+		}
+
+		time += hostTime() - time_start;
+		cycles += hostCycles() - cycles_start;
+
+		simAdvance( CAN_RX_POLL_PERIOD );
+
+	}
+
+	if( kept != wanted ){
+
+		fprintf( stderr, "can: %lu frames were kept instead of %lu\n", (unsigned long)kept, (unsigned long)wanted );
+		exit( 1 );
+
+	}
+
+	result.name = std::string( "can/" ) + name;
+	result.calls = CAN_FILTER_FRAMES;
+	result.ns_per_call = (double)time / CAN_FILTER_FRAMES;
+	result.cycles_per_call = (double)cycles / CAN_FILTER_FRAMES;
+	result.bytes_per_second = 0;
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	printf( "%-40s %lu of %lu frames reached the CPU, %lu kept\n", "",
+			(unsigned long)can.stats().rx_frames,
+			(unsigned long)CAN_FILTER_FRAMES,
+			(unsigned long)kept );
+
+}
+
+/// Run the CAN filter cases
+///
+/// The requested IDs are programmed to the filter banks, then every
+/// standard ID, the extended IDs around the ranges and random extended IDs
+/// are checked: exactly the requested IDs have to pass, to their FIFO.
+/// The remote frames are checked too, first they have to be dropped, then
+/// with \link CANdalorianFilter::acceptRemote \endlink they have to pass.
+/// The load cases compare an accept all filter and a software check with
+/// the hardware filters on a fully loaded bus.
+/// @param can the CAN peripherial, it has to have a recive ring.
+/// @param hcan the CAN handle.
+static void benchCanFilter( CANdalorian &can, CAN_HandleTypeDef *hcan ){
+
+	CANdalorianFilter filters;
+	benchResult_t result;
+	uint64_t time_start;
+	uint64_t cycles_start;
+	uint64_t time = 0;
+	uint64_t cycles = 0;
+	uint64_t checked = 0;
+	uint32_t random = 1;
+	uint32_t first;
+	uint32_t last;
+	uint32_t remote_banks;
+	uint32_t id;
+	uint32_t i;
+	int round;
+
+	simUseHostClock( false );
+
+	can.normalMode();
+	can.begin();
+
+	// begin installs an accept all filter.
+	canFilterLoad( "filter software", can, hcan, true );
+
+	for( i = 0; i < CAN_FILTER_RANGES; i++ ){
+
+		if( can_filter_ranges[ i ].extended ){
+
+			filters.addExtendedRange( can_filter_ranges[ i ].first, can_filter_ranges[ i ].last, can_filter_ranges[ i ].fifo );
+
+		}
+
+		else{
+
+			filters.addRange( can_filter_ranges[ i ].first, can_filter_ranges[ i ].last, can_filter_ranges[ i ].fifo );
+
+		}
+
+	}
+
+	for( round = 0; round < BENCH_ROUNDS; round++ ){
+
+		time_start = hostTime();
+		cycles_start = hostCycles();
+
+		if( filters.program( hcan ) != HAL_OK ){
+
+			fprintf( stderr, "can: the filters do not fit\n" );
+			exit( 1 );
+
+		}
+
+		if( ( round == 0 ) || ( hostTime() - time_start < time ) ){
+
+			time = hostTime() - time_start;
+			cycles = hostCycles() - cycles_start;
+
+		}
+
+	}
+
+	// Every standard ID and the small extended ranges.
+	for( id = 0; id <= 0x7FF; id++ ){
+
+		canFilterCheck( hcan, id, false, false, false );
+		canFilterCheck( hcan, id, true, false, false );
+		canFilterCheck( hcan, id, false, true, false );
+		checked += 3;
+
+	}
+
+	for( i = 0; i < CAN_FILTER_RANGES; i++ ){
+
+		if( !can_filter_ranges[ i ].extended ){
+
+			continue;
+
+		}
+
+		first = can_filter_ranges[ i ].first;
+		last = can_filter_ranges[ i ].last;
+
+		if( last - first < 0x40000 ){
+
+			first = ( first > 8 ) ? first - 8 : 0;
+			last = ( last < 0x1FFFFFFF - 8 ) ? last + 8 : 0x1FFFFFFF;
+
+			for( id = first; id <= last; id++ ){
+
+				canFilterCheck( hcan, id, true, false, false );
+				canFilterCheck( hcan, id, true, true, false );
+				canFilterCheck( hcan, id & 0x7FF, false, false, false );
+				checked += 3;
+
+			}
+
+		}
+
+	}
+
+	for( i = 0; i < CAN_FILTER_SAMPLES; i++ ){
+
+		random = random * 1664525 + 1013904223;
+
+		canFilterCheck( hcan, random & 0x1FFFFFFF, true, false, false );
+		checked++;
+
+	}
+
+	// The same IDs with the remote frames.
+	filters.acceptRemote( true );
+	remote_banks = filters.banks();
+
+	if( filters.program( hcan ) != HAL_OK ){
+
+		fprintf( stderr, "can: the filters with remote frames do not fit\n" );
+		exit( 1 );
+
+	}
+
+	for( id = 0; id <= 0x7FF; id++ ){
+
+		canFilterCheck( hcan, id, false, false, true );
+		canFilterCheck( hcan, id, false, true, true );
+		canFilterCheck( hcan, id, true, true, true );
+		checked += 3;
+
+	}
+
+	for( i = 0; i < CAN_FILTER_SAMPLES; i++ ){
+
+		random = random * 1664525 + 1013904223;
+
+		canFilterCheck( hcan, random & 0x1FFFFFFF, true, ( i % 2 ) == 1, true );
+		checked++;
+
+	}
+
+	filters.acceptRemote( false );
+
+	if( filters.program( hcan ) != HAL_OK ){
+
+		fprintf( stderr, "can: the filters do not fit\n" );
+		exit( 1 );
+
+	}
+
+	result.name = "can/filter program";
+	result.calls = 1;
+	result.ns_per_call = (double)time;
+	result.cycles_per_call = (double)cycles;
+	result.bytes_per_second = 0;
+	result.transfers_per_call = 0;
+
+	report( result );
+
+	printf( "%-40s %lu ranges in %lu banks, %lu with remote frames, %llu IDs checked\n", "",
+			(unsigned long)CAN_FILTER_RANGES,
+			(unsigned long)filters.banks(),
+			(unsigned long)remote_banks,
+			(unsigned long long)checked );
+
+	canFilterLoad( "filter hardware", can, hcan, false );
+
+	// The next cases get the accept all filter of begin.
+	filters.clear();
+	filters.program( hcan );
+
+	simUseHostClock( true );
+
+}
+
+/// Compare the results with a baseline
+///
+/// @param path path of the CSV file.
+/// @param tolerance allowed slowdown in percent.
+/// @returns the number of regressions.
+static int compareBaseline( const char *path, double tolerance ){
+
+	std::map< std::string, double > baseline;
+	FILE *file;
+	char line[ 256 ];
+	char *separator;
+	int regressions = 0;
+	size_t i;
+
+	file = fopen( path, "r" );
+
+	if( file == NULL ){
+
+		fprintf( stderr, "Can not open %s\n", path );
+		return 1;
+
+	}
+
+	while( fgets( line, sizeof( line ), file ) != NULL ){
+
+		// The names can have commas, so the numbers are after the last '"'.
+		// The first one is the number of calls, the second is the ns per call.
+		separator = strrchr( line, '"' );
+
+		if( ( line[ 0 ] != '"' ) || ( separator == NULL ) || ( separator == line ) ){
+
+			continue;
+
+		}
+
+		*separator = '\0';
+		separator = strchr( separator + 2, ',' );
+
+		if( separator == NULL ){
+
+			continue;
+
+		}
+
+		baseline[ std::string( line + 1 ) ] = atof( separator + 1 );
+
+	}
+
+	fclose( file );
+
+	for( i = 0; i < results.size(); i++ ){
+
+		if( baseline.count( results[ i ].name ) == 0 ){
+
+			continue;
+
+		}
+
+		if( results[ i ].ns_per_call > baseline[ results[ i ].name ] * ( 1.0 + tolerance / 100.0 ) ){
+
+			printf( "REGRESSION %s: %.1f ns instead of %.1f ns\n", results[ i ].name.c_str(), results[ i ].ns_per_call, baseline[ results[ i ].name ] );
+			regressions++;
+
+		}
+
+	}
+
+	return regressions;
+
+}
+
+static void writeCsv( const char *path ){
+
+	FILE *file;
+	size_t i;
+
+	file = fopen( path, "w" );
+
+	if( file == NULL ){
+
+		fprintf( stderr, "Can not open %s\n", path );
+		exit( 1 );
+
+	}
+
+	fprintf( file, "name,calls,ns_per_call,cycles_per_call,bytes_per_second,transfers_per_call\n" );
+
+	for( i = 0; i < results.size(); i++ ){
+
+		fprintf( file, "\"%s\",%llu,%.2f,%.2f,%.0f,%.3f\n",
+				results[ i ].name.c_str(),
+				(unsigned long long)results[ i ].calls,
+				results[ i ].ns_per_call,
+				results[ i ].cycles_per_call,
+				results[ i ].bytes_per_second,
+				results[ i ].transfers_per_call );
+
+	}
+
+	fclose( file );
+
+}
+
+static UART_HandleTypeDef huart_64;
+static UART_HandleTypeDef huart_256;
+static UART_HandleTypeDef huart_1024;
+static UART_HandleTypeDef huart_1000;
+static UART_HandleTypeDef huart_telemetry_tx;
+static UART_HandleTypeDef huart_telemetry_rx;
+static UART_HandleTypeDef huart_gateway;
+static UART_HandleTypeDef huart_gateway_host;
+static CAN_HandleTypeDef hcan_gateway;
+static CAN_HandleTypeDef hcan_polling;
+static CAN_HandleTypeDef hcan_ring;
+
+int main( int argc, char **argv ){
+
+	const char *csv = NULL;
+	const char *baseline = NULL;
+	double tolerance = 25.0;
+	int regressions = 0;
+	int i;
+
+	for( i = 1; i < argc; i++ ){
+
+		if( ( strcmp( argv[ i ], "--time" ) == 0 ) && ( i + 1 < argc ) ){
+
+			min_time = strtoull( argv[ ++i ], NULL, 10 ) * 1000000ULL;
+
+		}
+
+		else if( ( strcmp( argv[ i ], "--csv" ) == 0 ) && ( i + 1 < argc ) ){
+
+			csv = argv[ ++i ];
+
+		}
+
+		else if( ( strcmp( argv[ i ], "--baseline" ) == 0 ) && ( i + 1 < argc ) ){
+
+			baseline = argv[ ++i ];
+
+		}
+
+		else if( ( strcmp( argv[ i ], "--tolerance" ) == 0 ) && ( i + 1 < argc ) ){
+
+			tolerance = atof( argv[ ++i ] );
+
+		}
+
+		else{
+
+			fprintf( stderr, "Usage: %s [--time ms] [--csv file] [--baseline file] [--tolerance percent]\n", argv[ 0 ] );
+			return 2;
+
+		}
+
+	}
+
+	simUartCreate( &huart_64, true );
+	simUartCreate( &huart_256, true );
+	simUartCreate( &huart_1024, true );
+	simUartCreate( &huart_1000, true );
+	simUartCreate( &huart_telemetry_tx, true );
+	simUartCreate( &huart_telemetry_rx, true );
+	simUartCreate( &huart_gateway, true );
+	simUartCreate( &huart_gateway_host, true );
+	simCanCreate( &hcan_gateway, 1000000 );
+	simCanCreate( &hcan_polling, 1000000 );
+	simCanCreate( &hcan_ring, 1000000 );
+
+	// Every port and CAN is registered for the HAL callbacks, so they live until the end.
+	static SerialBuffered< 256, 64 > port_64( &huart_64 );
+	static SerialBuffered< 256, 256 > port_256( &huart_256 );
+	static SerialBuffered< 256, 1024 > port_1024( &huart_1024 );
+	static SerialBuffered< 250, 1000 > port_1000( &huart_1000 );
+	static SerialBuffered< 64, 1024 > port_telemetry_tx( &huart_telemetry_tx );
+	static SerialBuffered< 1024, 64 > port_telemetry_rx( &huart_telemetry_rx );
+	static SerialBuffered< 1024, 1024 > port_gateway( &huart_gateway );
+	static SerialBuffered< 1024, 1024 > port_gateway_host( &huart_gateway_host );
+	static CANdalorian can_gateway( &hcan_gateway );
+	static CANdalorian can_polling( &hcan_polling );
+	static CANdalorianBuffered< 32 > can_ring( &hcan_ring );
+
+	printf( "%-40s %12s %10s %10s %14s %8s\n", "case", "calls", "ns/call", "cyc/call", "bytes/s", "xfer" );
+
+	benchPort( "rx256_tx64", port_64, &huart_64, 256 );
+	benchPort( "rx256_tx256", port_256, &huart_256, 256 );
+	benchPort( "rx256_tx1024", port_1024, &huart_1024, 256 );
+	benchPort( "rx250_tx1000", port_1000, &huart_1000, 250 );
+
+	benchTelemetry( port_telemetry_tx, &huart_telemetry_tx, port_telemetry_rx, &huart_telemetry_rx );
+
+	benchGateway( port_gateway, &huart_gateway, port_gateway_host, &huart_gateway_host, can_gateway, &hcan_gateway );
+
+	gateway_mixed = true;
+	benchGateway( port_gateway, &huart_gateway, port_gateway_host, &huart_gateway_host, can_gateway, &hcan_gateway );
+	gateway_mixed = false;
+
+	benchCanRecive( "recive polling", can_polling, &hcan_polling, false );
+	benchCanRecive( "recive interrupt ring", can_ring, &hcan_ring, false );
+	benchCanRecive( "recive ring batch", can_ring, &hcan_ring, true );
+
+	gateway_mixed = true;
+	benchCanRecive( "recive interrupt ring", can_ring, &hcan_ring, false );
+	gateway_mixed = false;
+
+	benchCanTransmitt( can_polling, &hcan_polling, can_ring, &hcan_ring );
+
+	benchCanFilter( can_ring, &hcan_ring );
+
+	if( csv != NULL ){
+
+		writeCsv( csv );
+
+	}
+
+	if( baseline != NULL ){
+
+		regressions = compareBaseline( baseline, tolerance );
+
+		printf( "%d regression(s) with %.0f%% tolerance\n", regressions, tolerance );
+
+	}
+
+	return regressions ? 1 : 0;
+
+}
@@ -0,0 +1,1980 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "sim_hal.hpp"
+
+/// Maximum number of simulated UARTs
+#define SIM_MAX_UARTS 8
+
+/// Time that never comes
+#define SIM_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+/// Number of interrupt points without interrupt that is handled as a busy wait
+///
+/// The library waits for the DMA in loops. After this many empty rounds the
+/// clock jumps to the next event, so a slow baudrate does not slow down the host.
+#define SIM_SPIN_LIMIT 256
+
+/// Maximum number of simulated CAN peripherials
+#define SIM_MAX_CANS 3
+
+/// Number of filter banks of the bxCAN
+#define SIM_CAN_FILTER_BANKS 28
+
+/// Number of transmitt mailboxes of the bxCAN
+#define SIM_CAN_MAILBOXES 3
+
+/// Depth of the recive FIFOs of the bxCAN
+#define SIM_CAN_FIFO_DEPTH 3
+
+/// Types of the simulated interrupts
+enum simEventType_t{
+	SIM_TX_COMPLETE,
+	SIM_RX_HALF_COMPLETE,
+	SIM_RX_COMPLETE,
+	SIM_RX_EVENT,
+	SIM_ERROR,
+	SIM_CAN_RX_FIFO0,
+	SIM_CAN_RX_FIFO1,
+	SIM_CAN_TX_COMPLETE,
+	SIM_CAN_TX_ABORT,
+	SIM_CAN_ERROR
+};
+
+/// State of a simulated UART with its DMA streams
+struct simUart_t{
+	UART_HandleTypeDef *huart;
+	USART_TypeDef registers;
+	DMA_HandleTypeDef dma_tx;
+	DMA_Stream_TypeDef stream_tx;
+	DMA_HandleTypeDef dma_rx;
+	DMA_Stream_TypeDef stream_rx;
+
+	uint64_t byte_time;					///< Time of one byte on the line in ns.
+
+	bool tx_active;						///< A TX DMA transfer is running.
+	uint64_t tx_done;					///< Time when the running transfer finishes.
+	uint64_t tx_line_free;				///< Time when the last byte leaves the line.
+	uint64_t tx_bytes;
+	uint64_t tx_transfers;
+	bool capture;
+	std::string output;
+
+	bool rx_active;						///< The DMA reception is running.
+	bool rx_to_idle;					///< The reception was started with HAL_UARTEx_ReceiveToIdle_DMA.
+	uint8_t *rx_buffer;
+	uint32_t rx_length;
+	uint32_t rx_index;					///< The next element that the DMA writes.
+	uint32_t rx_reported;				///< Index of the last reported event, for the idle line detection.
+	std::vector< uint8_t > rx_pending;	///< Bytes on the line.
+	size_t rx_pending_pos;				///< The next byte that arrives.
+	uint64_t rx_next_arrival;			///< Time when the next byte arrives.
+	bool rx_idle_armed;
+	uint64_t rx_idle_time;
+};
+
+/// A filter bank of the bxCAN
+struct simCanFilter_t{
+	bool active;
+	uint32_t mode;
+	uint32_t scale;
+	uint32_t fifo;
+	uint32_t fr1;						///< Filter register 1, like CAN_FxR1.
+	uint32_t fr2;						///< Filter register 2, like CAN_FxR2.
+};
+
+/// A transmitt mailbox of the bxCAN
+struct simCanMailbox_t{
+	bool pending;						///< The mailbox has a transmission request.
+	uint64_t request;					///< Sequence number of the request, for the FIFO priority.
+	uint64_t ready;						///< Time of the request.
+	simCanFrame_t frame;
+};
+
+/// A frame from an other node, that waits for the bus
+struct simCanPending_t{
+	uint64_t ready;						///< Time when the node wants to send it.
+	simCanFrame_t frame;
+};
+
+/// A frame in a recive FIFO
+struct simCanRxEntry_t{
+	simCanFrame_t frame;
+	uint32_t filter_index;
+	uint32_t timestamp;
+};
+
+/// State of a simulated bxCAN with its bus
+struct simCan_t{
+	CAN_HandleTypeDef *hcan;
+	CAN_TypeDef registers;
+
+	uint64_t bit_time;					///< Time of one bit on the bus in ns.
+
+	simCanFilter_t filters[ SIM_CAN_FILTER_BANKS ];
+	simCanMailbox_t mailboxes[ SIM_CAN_MAILBOXES ];
+	uint64_t requests;					///< Number of transmission requests.
+	std::deque< simCanPending_t > rx_pending;
+	std::vector< simCanFrame_t > output;
+
+	simCanRxEntry_t fifo[ 2 ][ SIM_CAN_FIFO_DEPTH ];
+	uint32_t fifo_head[ 2 ];
+	uint32_t fifo_count[ 2 ];
+	uint32_t overruns[ 2 ];
+	uint32_t filtered;
+
+	uint32_t interrupts;				///< Enabled interrupts, like CAN_IER.
+	bool fifo_event[ 2 ];				///< A message pending interrupt is queued.
+
+	bool busy;							///< A frame is on the bus.
+	int32_t source;						///< The mailbox that sends the frame on the bus, -1 for an other node.
+	simCanFrame_t frame;				///< The frame on the bus.
+	uint64_t frame_start;
+	uint64_t frame_end;
+	uint64_t bus_free;					///< Time when the bus got free.
+};
+
+/// A pending interrupt
+struct simEvent_t{
+	simEventType_t type;
+	simUart_t *uart;
+	uint16_t size;						///< Number of bytes, or the index of the mailbox.
+	simCan_t *can;
+};
+
+static simUart_t uarts[ SIM_MAX_UARTS ];
+static uint32_t uart_count = 0;
+
+static simCan_t cans[ SIM_MAX_CANS ];
+static uint32_t can_count = 0;
+
+static std::deque< simEvent_t > events;
+
+static uint32_t primask = 0;
+static uint32_t isr_depth = 0;
+
+/// Number of interrupt points since the last interrupt
+static uint32_t empty_polls = 0;
+
+/// The virtual time is ahead of the host clock by this offset
+static uint64_t time_offset = 0;
+
+static std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+
+/// The virtual time runs together with the clock of the host
+static bool host_clock = true;
+
+static simUart_t *findUart( const UART_HandleTypeDef *huart ){
+
+	uint32_t i;
+
+	for( i = 0; i < uart_count; i++ ){
+
+		if( uarts[ i ].huart == huart ){
+
+			return &uarts[ i ];
+
+		}
+
+	}
+
+	fprintf( stderr, "sim_hal: the UART handle is not created with simUartCreate\n" );
+	abort();
+
+}
+
+static uint64_t hostElapsed(){
+
+	return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - time_start ).count();
+
+}
+
+uint64_t simTime(){
+
+	if( !host_clock ){
+
+		return time_offset;
+
+	}
+
+	return hostElapsed() + time_offset;
+
+}
+
+void simUseHostClock( bool enable ){
+
+	uint64_t now;
+
+	if( enable == host_clock ){
+
+		return;
+
+	}
+
+	now = simTime();
+
+	// The virtual time continues from the same point.
+	time_offset = enable ? now - hostElapsed() : now;
+	host_clock = enable;
+
+}
+
+/// Write the arrived bytes to the recive buffer and queue the interrupts
+static void updateRecive( simUart_t *uart, uint64_t now ){
+
+	uint64_t next_byte;
+
+	while( true ){
+
+		next_byte = ( uart -> rx_pending_pos < uart -> rx_pending.size() ) ? uart -> rx_next_arrival : SIM_NEVER;
+
+		// The line was idle for a frame after the last byte.
+		if( uart -> rx_idle_armed && ( uart -> rx_idle_time <= now ) && ( uart -> rx_idle_time < next_byte ) ){
+
+			uart -> rx_idle_armed = false;
+
+			if( uart -> rx_active && uart -> rx_to_idle && ( uart -> rx_index != uart -> rx_reported ) ){
+
+				uart -> rx_reported = uart -> rx_index;
+				events.push_back( { SIM_RX_EVENT, uart, (uint16_t)uart -> rx_index, NULL } );
+
+			}
+
+			continue;
+
+		}
+
+		if( next_byte > now ){
+
+			break;
+
+		}
+
+		uart -> rx_idle_armed = true;
+		uart -> rx_idle_time = next_byte + uart -> byte_time;
+		uart -> rx_next_arrival += uart -> byte_time;
+
+		// Without reception the byte is lost, like on the real UART.
+		if( !uart -> rx_active ){
+
+			uart -> rx_pending_pos++;
+			continue;
+
+		}
+
+		uart -> rx_buffer[ uart -> rx_index ] = uart -> rx_pending[ uart -> rx_pending_pos ];
+		uart -> rx_pending_pos++;
+		uart -> rx_index++;
+
+		if( uart -> rx_index == uart -> rx_length / 2 ){
+
+			if( uart -> rx_to_idle ){
+
+				uart -> rx_reported = uart -> rx_index;
+				events.push_back( { SIM_RX_EVENT, uart, (uint16_t)uart -> rx_index, NULL } );
+
+			}
+
+			else{
+
+				events.push_back( { SIM_RX_HALF_COMPLETE, uart, 0, NULL } );
+
+			}
+
+		}
+
+		if( uart -> rx_index == uart -> rx_length ){
+
+			// Circular mode, the DMA starts again at the beginning.
+			uart -> rx_index = 0;
+
+			if( uart -> rx_to_idle ){
+
+				uart -> rx_reported = 0;
+				events.push_back( { SIM_RX_EVENT, uart, (uint16_t)uart -> rx_length, NULL } );
+
+			}
+
+			else{
+
+				events.push_back( { SIM_RX_COMPLETE, uart, 0, NULL } );
+
+			}
+
+		}
+
+	}
+
+	if( uart -> rx_pending_pos == uart -> rx_pending.size() ){
+
+		uart -> rx_pending.clear();
+		uart -> rx_pending_pos = 0;
+
+	}
+
+}
+
+/// Finish the TX transfer if its time has come
+static void updateTransmit( simUart_t *uart, uint64_t now ){
+
+	if( uart -> tx_active && ( uart -> tx_done <= now ) ){
+
+		uart -> tx_active = false;
+		uart -> huart -> gState = HAL_UART_STATE_READY;
+
+		events.push_back( { SIM_TX_COMPLETE, uart, 0, NULL } );
+
+	}
+
+}
+
+static void updateCan( simCan_t *can, uint64_t now );
+
+static void updateAll(){
+
+	uint64_t now;
+	uint32_t i;
+
+	now = simTime();
+
+	for( i = 0; i < uart_count; i++ ){
+
+		updateTransmit( &uarts[ i ], now );
+		updateRecive( &uarts[ i ], now );
+
+	}
+
+	for( i = 0; i < can_count; i++ ){
+
+		updateCan( &cans[ i ], now );
+
+	}
+
+}
+
+static void dispatchCan( const simEvent_t &event );
+
+static void dispatch( const simEvent_t &event ){
+
+	UART_HandleTypeDef *huart;
+
+	if( event.can != NULL ){
+
+		dispatchCan( event );
+		return;
+
+	}
+
+	huart = event.uart -> huart;
+
+	switch( event.type ){
+
+		case SIM_TX_COMPLETE:
+			HAL_UART_TxCpltCallback( huart );
+			break;
+
+		case SIM_RX_HALF_COMPLETE:
+			HAL_UART_RxHalfCpltCallback( huart );
+			break;
+
+		case SIM_RX_COMPLETE:
+			HAL_UART_RxCpltCallback( huart );
+			break;
+
+		case SIM_RX_EVENT:
+			HAL_UARTEx_RxEventCallback( huart, event.size );
+			break;
+
+		case SIM_ERROR:
+			HAL_UART_ErrorCallback( huart );
+			huart -> ErrorCode = HAL_UART_ERROR_NONE;
+			break;
+
+		default:
+			break;
+
+	}
+
+}
+
+static uint64_t nextEventTime( uint64_t now );
+
+/// Call the handlers of the queued interrupts
+static void deliverEvents(){
+
+	simEvent_t event;
+
+	while( !events.empty() ){
+
+		event = events.front();
+		events.pop_front();
+
+		isr_depth++;
+		dispatch( event );
+		isr_depth--;
+
+		// The interrupt could start a transfer that is already finished.
+		updateAll();
+
+	}
+
+}
+
+void simPoll(){
+
+	uint64_t now;
+	uint64_t next;
+
+	if( primask || isr_depth ){
+
+		return;
+
+	}
+
+	updateAll();
+
+	if( events.empty() ){
+
+		if( ++empty_polls < SIM_SPIN_LIMIT ){
+
+			return;
+
+		}
+
+		// The program waits in a loop, skip to the next event.
+		now = simTime();
+		next = nextEventTime( now );
+
+		if( next > now ){
+
+			time_offset += next - now;
+
+		}
+
+		updateAll();
+
+	}
+
+	empty_polls = 0;
+
+	deliverEvents();
+
+}
+
+void simAdvance( uint64_t ns ){
+
+	uint64_t now;
+	uint64_t next;
+	uint64_t end;
+
+	end = simTime() + ns;
+
+	// The time moves from event to event, so the interrupts come in time,
+	// not only at the end of the step.
+	while( true ){
+
+		now = simTime();
+
+		if( now >= end ){
+
+			break;
+
+		}
+
+		next = nextEventTime( now );
+
+		if( next > end ){
+
+			next = end;
+
+		}
+
+		if( next <= now ){
+
+			next = now + 1;
+
+		}
+
+		time_offset += next - now;
+
+		updateAll();
+
+		if( !primask && !isr_depth ){
+
+			deliverEvents();
+
+		}
+
+	}
+
+	simPoll();
+
+}
+
+void simUartCreate( UART_HandleTypeDef *huart, bool tx_dma ){
+
+	simUart_t *uart;
+
+	if( uart_count >= SIM_MAX_UARTS ){
+
+		fprintf( stderr, "sim_hal: too many UARTs\n" );
+		abort();
+
+	}
+
+	uart = &uarts[ uart_count++ ];
+
+	uart -> huart = huart;
+	uart -> dma_tx.Instance = &uart -> stream_tx;
+	uart -> dma_rx.Instance = &uart -> stream_rx;
+	uart -> stream_tx.NDTR.owner = NULL;
+	uart -> stream_tx.NDTR.value = 0;
+	uart -> stream_rx.NDTR.owner = NULL;
+	uart -> stream_rx.NDTR.value = 0;
+
+	huart -> Instance = &uart -> registers;
+	huart -> hdmatx = tx_dma ? &uart -> dma_tx : NULL;
+	huart -> hdmarx = &uart -> dma_rx;
+	huart -> gState = HAL_UART_STATE_RESET;
+	huart -> RxState = HAL_UART_STATE_RESET;
+	huart -> ErrorCode = HAL_UART_ERROR_NONE;
+
+}
+
+void simUartFeed( UART_HandleTypeDef *huart, const uint8_t *data, uint32_t size ){
+
+	simUart_t *uart = findUart( huart );
+	uint64_t now;
+
+	updateAll();
+
+	now = simTime();
+
+	// An idle line, the first byte starts now.
+	if( uart -> rx_pending_pos == uart -> rx_pending.size() ){
+
+		uart -> rx_next_arrival = now + uart -> byte_time;
+
+	}
+
+	uart -> rx_pending.insert( uart -> rx_pending.end(), data, data + size );
+
+}
+
+void simUartError( UART_HandleTypeDef *huart, uint32_t error ){
+
+	simUart_t *uart = findUart( huart );
+
+	updateAll();
+
+	// The HAL stops the reception after an error in DMA mode.
+	uart -> rx_active = false;
+	huart -> RxState = HAL_UART_STATE_READY;
+	huart -> ErrorCode |= error;
+
+	events.push_back( { SIM_ERROR, uart, 0, NULL } );
+
+}
+
+void simUartSetCapture( UART_HandleTypeDef *huart, bool enable ){
+
+	findUart( huart ) -> capture = enable;
+
+}
+
+std::string simUartOutput( UART_HandleTypeDef *huart ){
+
+	simUart_t *uart = findUart( huart );
+	std::string ret;
+
+	ret.swap( uart -> output );
+
+	return ret;
+
+}
+
+uint64_t simUartTxBytes( UART_HandleTypeDef *huart ){
+
+	return findUart( huart ) -> tx_bytes;
+
+}
+
+uint64_t simUartTxTransfers( UART_HandleTypeDef *huart ){
+
+	return findUart( huart ) -> tx_transfers;
+
+}
+
+bool simUartIdle( UART_HandleTypeDef *huart ){
+
+	simUart_t *uart = findUart( huart );
+
+	updateAll();
+
+	return !uart -> tx_active && uart -> rx_pending.empty() && events.empty();
+
+}
+
+uint32_t SystemCoreClock = 168000000UL;
+
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+
+// Cycles of the core clock since the start of the simulation.
+static uint32_t simCycles(){
+
+	uint64_t now = simTime();
+
+	// The multiplication is split, so it does not overflow.
+	return (uint32_t)( ( now / 1000000000ULL ) * SystemCoreClock + ( now % 1000000000ULL ) * SystemCoreClock / 1000000000ULL );
+
+}
+
+SimCyccnt_t::operator uint32_t() const{
+
+	if( !( sim_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk ) ){
+
+		// The counter stops, the register keeps its value.
+		return -offset;
+
+	}
+
+	return simCycles() - offset;
+
+}
+
+SimCyccnt_t &SimCyccnt_t::operator=( uint32_t value_p ){
+
+	offset = ( ( sim_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk ) ? simCycles() : 0 ) - value_p;
+	return *this;
+
+}
+
+SimNdtr_t::operator uint32_t() const{
+
+	simUart_t *uart;
+
+	if( owner == NULL ){
+
+		return value;
+
+	}
+
+	uart = findUart( owner );
+
+	// The DMA works in the background, even if the interrupts are disabled.
+	updateRecive( uart, simTime() );
+
+	return uart -> rx_length - uart -> rx_index;
+
+}
+
+/// Write the bytes of a transfer to the line
+static void lineTransmit( simUart_t *uart, const uint8_t *data, uint16_t size ){
+
+	uart -> tx_bytes += size;
+	uart -> tx_transfers++;
+
+	if( uart -> capture ){
+
+		uart -> output.append( (const char*)data, size );
+
+	}
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Init( UART_HandleTypeDef *huart ){
+
+	simUart_t *uart = findUart( huart );
+
+	if( ( huart -> Init.BaudRate == 0 ) || ( huart -> Init.BaudRate == SIM_BAUDRATE_UNLIMITED ) ){
+
+		uart -> byte_time = 0;
+
+	}
+
+	else{
+
+		// 8 data bits, a start and a stop bit.
+		uart -> byte_time = 10000000000ULL / huart -> Init.BaudRate;
+
+	}
+
+	huart -> gState = HAL_UART_STATE_READY;
+	huart -> RxState = HAL_UART_STATE_READY;
+	huart -> ErrorCode = HAL_UART_ERROR_NONE;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_DeInit( UART_HandleTypeDef *huart ){
+
+	simUart_t *uart = findUart( huart );
+
+	uart -> tx_active = false;
+	uart -> rx_active = false;
+
+	huart -> gState = HAL_UART_STATE_RESET;
+	huart -> RxState = HAL_UART_STATE_RESET;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Transmit( UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout ){
+
+	simUart_t *uart = findUart( huart );
+	uint64_t now;
+	uint64_t start;
+
+	( void )Timeout;
+
+	if( uart -> tx_active ){
+
+		return HAL_BUSY;
+
+	}
+
+	now = simTime();
+	start = ( uart -> tx_line_free > now ) ? uart -> tx_line_free : now;
+
+	uart -> tx_line_free = start + Size * uart -> byte_time;
+
+	lineTransmit( uart, pData, Size );
+
+	// The CPU waits until the last byte is out, the clock jumps there.
+	if( uart -> tx_line_free > now ){
+
+		time_offset += uart -> tx_line_free - now;
+
+	}
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Transmit_DMA( UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size ){
+
+	simUart_t *uart = findUart( huart );
+	uint64_t now;
+	uint64_t start;
+
+	if( uart -> tx_active || ( huart -> hdmatx == NULL ) ){
+
+		return HAL_BUSY;
+
+	}
+
+	now = simTime();
+	start = ( uart -> tx_line_free > now ) ? uart -> tx_line_free : now;
+
+	uart -> tx_active = true;
+	uart -> tx_done = start + Size * uart -> byte_time;
+	uart -> tx_line_free = uart -> tx_done;
+
+	huart -> gState = HAL_UART_STATE_BUSY_TX;
+
+	lineTransmit( uart, pData, Size );
+
+	return HAL_OK;
+
+}
+
+/// Start the circular DMA reception
+static HAL_StatusTypeDef startRecive( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, bool to_idle ){
+
+	simUart_t *uart = findUart( huart );
+
+	if( uart -> rx_active ){
+
+		return HAL_BUSY;
+
+	}
+
+	updateAll();
+
+	uart -> rx_active = true;
+	uart -> rx_to_idle = to_idle;
+	uart -> rx_buffer = pData;
+	uart -> rx_length = Size;
+	uart -> rx_index = 0;
+	uart -> rx_reported = 0;
+
+	uart -> stream_rx.NDTR.owner = huart;
+
+	huart -> RxState = HAL_UART_STATE_BUSY_RX;
+	huart -> ErrorCode = HAL_UART_ERROR_NONE;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Receive_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size ){
+
+	return startRecive( huart, pData, Size, false );
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size ){
+
+	return startRecive( huart, pData, Size, true );
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_AbortReceive( UART_HandleTypeDef *huart ){
+
+	simUart_t *uart = findUart( huart );
+
+	updateAll();
+
+	uart -> rx_active = false;
+	huart -> RxState = HAL_UART_STATE_READY;
+
+	return HAL_OK;
+
+}
+
+static simCan_t *findCan( const CAN_HandleTypeDef *hcan ){
+
+	uint32_t i;
+
+	for( i = 0; i < can_count; i++ ){
+
+		if( cans[ i ].hcan == hcan ){
+
+			return &cans[ i ];
+
+		}
+
+	}
+
+	fprintf( stderr, "sim_hal: the CAN handle is not created with simCanCreate\n" );
+	abort();
+
+}
+
+/// Returns the length of a frame on the bus in bits
+static uint32_t canFrameBits( const simCanFrame_t &frame ){
+
+	uint32_t data;
+	uint32_t stuffed;
+
+	data = frame.remote ? 0 : 8 * ( frame.dlc > 8 ? 8 : frame.dlc );
+
+	// From the SOF to the end of the CRC the bits are stuffed.
+	stuffed = ( frame.extended ? 54 : 34 ) + data;
+
+	// The CRC delimiter, the ACK, the EOF and the intermission are 13 bits.
+	return stuffed + 13 + stuffed / 8;
+
+}
+
+/// Returns the value that decides the arbitration, the lower wins
+static uint64_t canArbitration( const simCanFrame_t &frame ){
+
+	uint64_t base;
+
+	// The 11-bit base ID goes first. A standard frame wins against an
+	// extended frame with the same base ID, because its IDE bit is dominant.
+	base = frame.extended ? ( frame.id >> 18 ) : frame.id;
+
+	return ( base << 32 ) | ( frame.extended ? ( 1ULL << 31 ) | ( ( frame.id & 0x3FFFF ) << 1 ) : 0 ) | ( frame.remote ? 1 : 0 );
+
+}
+
+/// Returns the frame in the format of the 32-bit filters
+static uint32_t canFilterImage32( const simCanFrame_t &frame ){
+
+	uint32_t image;
+
+	image = frame.extended ? ( ( frame.id << 3 ) | 0x4 ) : ( frame.id << 21 );
+
+	return image | ( frame.remote ? 0x2 : 0 );
+
+}
+
+/// Returns the frame in the format of the 16-bit filters
+static uint32_t canFilterImage16( const simCanFrame_t &frame ){
+
+	uint32_t image;
+
+	if( frame.extended ){
+
+		image = ( ( frame.id >> 18 ) << 5 ) | 0x8 | ( ( frame.id >> 15 ) & 0x7 );
+
+	}
+
+	else{
+
+		image = frame.id << 5;
+
+	}
+
+	return image | ( frame.remote ? 0x10 : 0 );
+
+}
+
+/// Find the filter that accepts a frame
+///
+/// The priority of the filters is like in the bxCAN: 32-bit before 16-bit,
+/// list mode before mask mode, then the lower bank.
+/// @param can the CAN.
+/// @param frame the recived frame.
+/// @param fifo output, the FIFO of the filter.
+/// @param index output, the filter match index.
+/// @returns true if a filter accepts the frame.
+static bool canFilterMatch( simCan_t *can, const simCanFrame_t &frame, uint32_t *fifo, uint32_t *index ){
+
+	static const uint32_t order[ 4 ][ 2 ] = {
+		{ CAN_FILTERSCALE_32BIT, CAN_FILTERMODE_IDLIST },
+		{ CAN_FILTERSCALE_32BIT, CAN_FILTERMODE_IDMASK },
+		{ CAN_FILTERSCALE_16BIT, CAN_FILTERMODE_IDLIST },
+		{ CAN_FILTERSCALE_16BIT, CAN_FILTERMODE_IDMASK }
+	};
+
+	simCanFilter_t *filter;
+	uint32_t image32;
+	uint32_t image16;
+	uint32_t number;
+	uint32_t element;
+	uint32_t bank;
+	uint32_t i;
+	int32_t match;
+
+	image32 = canFilterImage32( frame );
+	image16 = canFilterImage16( frame );
+
+	for( i = 0; i < 4; i++ ){
+
+		for( bank = 0; bank < SIM_CAN_FILTER_BANKS; bank++ ){
+
+			filter = &can -> filters[ bank ];
+
+			if( !filter -> active || ( filter -> scale != order[ i ][ 0 ] ) || ( filter -> mode != order[ i ][ 1 ] ) ){
+
+				continue;
+
+			}
+
+			match = -1;
+
+			if( filter -> scale == CAN_FILTERSCALE_32BIT ){
+
+				if( filter -> mode == CAN_FILTERMODE_IDLIST ){
+
+					match = ( ( image32 | 1 ) == ( filter -> fr1 | 1 ) ) ? 0 : ( ( image32 | 1 ) == ( filter -> fr2 | 1 ) ) ? 1 : -1;
+
+				}
+
+				else if( ( ( image32 ^ filter -> fr1 ) & filter -> fr2 & 0xFFFFFFFE ) == 0 ){
+
+					match = 0;
+
+				}
+
+			}
+
+			else if( filter -> mode == CAN_FILTERMODE_IDLIST ){
+
+				if( image16 == ( filter -> fr1 & 0xFFFF ) ){ match = 0; }
+				else if( image16 == ( filter -> fr1 >> 16 ) ){ match = 1; }
+				else if( image16 == ( filter -> fr2 & 0xFFFF ) ){ match = 2; }
+				else if( image16 == ( filter -> fr2 >> 16 ) ){ match = 3; }
+
+			}
+
+			else{
+
+				if( ( ( image16 ^ filter -> fr1 ) & ( filter -> fr1 >> 16 ) & 0xFFFF ) == 0 ){ match = 0; }
+				else if( ( ( image16 ^ filter -> fr2 ) & ( filter -> fr2 >> 16 ) & 0xFFFF ) == 0 ){ match = 1; }
+
+			}
+
+			if( match < 0 ){
+
+				continue;
+
+			}
+
+			// The filter numbers go through the banks of the FIFO, active or not.
+			number = 0;
+
+			for( element = 0; element < bank; element++ ){
+
+				if( can -> filters[ element ].fifo != filter -> fifo ){
+
+					continue;
+
+				}
+
+				// A bank has 1 to 4 filters, the list mode and the 16-bit scale double them.
+				number += ( ( can -> filters[ element ].scale == CAN_FILTERSCALE_32BIT ) ? 1 : 2 ) * ( ( can -> filters[ element ].mode == CAN_FILTERMODE_IDLIST ) ? 2 : 1 );
+
+			}
+
+			*fifo = filter -> fifo;
+			*index = number + match;
+
+			return true;
+
+		}
+
+	}
+
+	return false;
+
+}
+
+/// Queue the message pending interrupt of a FIFO, if it is enabled and not empty
+static void canPendingInterrupt( simCan_t *can, uint32_t fifo ){
+
+	if( ( can -> interrupts & ( fifo ? CAN_IT_RX_FIFO1_MSG_PENDING : CAN_IT_RX_FIFO0_MSG_PENDING ) ) &&
+		( can -> fifo_count[ fifo ] > 0 ) && !can -> fifo_event[ fifo ] ){
+
+		can -> fifo_event[ fifo ] = true;
+		events.push_back( { fifo ? SIM_CAN_RX_FIFO1 : SIM_CAN_RX_FIFO0, NULL, 0, can } );
+
+	}
+
+}
+
+/// Deliver a CAN interrupt
+static void dispatchCan( const simEvent_t &event ){
+
+	simCan_t *can = event.can;
+	uint32_t fifo;
+
+	switch( event.type ){
+
+		case SIM_CAN_RX_FIFO0:
+		case SIM_CAN_RX_FIFO1:
+			fifo = ( event.type == SIM_CAN_RX_FIFO1 ) ? 1 : 0;
+			can -> fifo_event[ fifo ] = false;
+
+			// Like the HAL, the callback is called only if the FIFO has a message.
+			if( can -> fifo_count[ fifo ] > 0 ){
+
+				if( fifo ){
+
+					HAL_CAN_RxFifo1MsgPendingCallback( can -> hcan );
+
+				}
+
+				else{
+
+					HAL_CAN_RxFifo0MsgPendingCallback( can -> hcan );
+
+				}
+
+			}
+
+			// The interrupt is level triggered, it comes again while the FIFO is not empty.
+			canPendingInterrupt( can, fifo );
+			break;
+
+		case SIM_CAN_TX_COMPLETE:
+			if( event.size == 0 ){
+
+				HAL_CAN_TxMailbox0CompleteCallback( can -> hcan );
+
+			}
+
+			else if( event.size == 1 ){
+
+				HAL_CAN_TxMailbox1CompleteCallback( can -> hcan );
+
+			}
+
+			else{
+
+				HAL_CAN_TxMailbox2CompleteCallback( can -> hcan );
+
+			}
+
+			break;
+
+		case SIM_CAN_TX_ABORT:
+			if( event.size == 0 ){
+
+				HAL_CAN_TxMailbox0AbortCallback( can -> hcan );
+
+			}
+
+			else if( event.size == 1 ){
+
+				HAL_CAN_TxMailbox1AbortCallback( can -> hcan );
+
+			}
+
+			else{
+
+				HAL_CAN_TxMailbox2AbortCallback( can -> hcan );
+
+			}
+
+			break;
+
+		case SIM_CAN_ERROR:
+			HAL_CAN_ErrorCallback( can -> hcan );
+			break;
+
+		default:
+			break;
+
+	}
+
+}
+
+/// Store a recived frame in its FIFO
+static void canRecive( simCan_t *can, const simCanFrame_t &frame, uint64_t start ){
+
+	simCanRxEntry_t *entry;
+	uint32_t fifo;
+	uint32_t index;
+
+	if( !canFilterMatch( can, frame, &fifo, &index ) ){
+
+		can -> filtered++;
+		return;
+
+	}
+
+	if( can -> fifo_count[ fifo ] == SIM_CAN_FIFO_DEPTH ){
+
+		can -> overruns[ fifo ]++;
+
+		if( can -> interrupts & ( fifo ? CAN_IT_RX_FIFO1_OVERRUN : CAN_IT_RX_FIFO0_OVERRUN ) ){
+
+			can -> hcan -> ErrorCode |= fifo ? HAL_CAN_ERROR_RX_FOV1 : HAL_CAN_ERROR_RX_FOV0;
+			events.push_back( { SIM_CAN_ERROR, NULL, 0, can } );
+
+		}
+
+		if( can -> hcan -> Init.ReceiveFifoLocked == ENABLE ){
+
+			return;
+
+		}
+
+		// Without the lock the last message is overwritten.
+		entry = &can -> fifo[ fifo ][ ( can -> fifo_head[ fifo ] + SIM_CAN_FIFO_DEPTH - 1 ) % SIM_CAN_FIFO_DEPTH ];
+
+	}
+
+	else{
+
+		entry = &can -> fifo[ fifo ][ ( can -> fifo_head[ fifo ] + can -> fifo_count[ fifo ] ) % SIM_CAN_FIFO_DEPTH ];
+		can -> fifo_count[ fifo ]++;
+
+	}
+
+	entry -> frame = frame;
+	entry -> filter_index = index;
+
+	// The 16-bit timer counts the bits, it is captured at the SOF.
+	entry -> timestamp = ( start / can -> bit_time ) & 0xFFFF;
+
+	canPendingInterrupt( can, fifo );
+
+}
+
+/// Select the next frame for the bus
+///
+/// @param can the CAN.
+/// @param start output, the time when the frame starts.
+/// @returns the mailbox of the frame, -1 for an other node, -2 if there is no frame.
+static int32_t canNextFrame( simCan_t *can, uint64_t *start ){
+
+	simCanMailbox_t *mailbox;
+	simCanMailbox_t *best = NULL;
+	uint64_t mailbox_start = 0;
+	uint64_t node_start;
+	uint32_t i;
+
+	if( can -> hcan -> State != HAL_CAN_STATE_LISTENING ){
+
+		return -2;
+
+	}
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		mailbox = &can -> mailboxes[ i ];
+
+		if( !mailbox -> pending ){
+
+			continue;
+
+		}
+
+		if( best == NULL ){
+
+			best = mailbox;
+			continue;
+
+		}
+
+		// The mailboxes go in the order of the requests or by their ID.
+		if( can -> hcan -> Init.TransmitFifoPriority == ENABLE ){
+
+			if( mailbox -> request < best -> request ){
+
+				best = mailbox;
+
+			}
+
+		}
+
+		else if( canArbitration( mailbox -> frame ) < canArbitration( best -> frame ) ){
+
+			best = mailbox;
+
+		}
+
+	}
+
+	if( best != NULL ){
+
+		mailbox_start = ( best -> ready > can -> bus_free ) ? best -> ready : can -> bus_free;
+
+	}
+
+	// In loop back mode the node does not see the bus.
+	if( can -> rx_pending.empty() || ( can -> hcan -> Init.Mode == CAN_MODE_LOOPBACK ) ){
+
+		if( best == NULL ){
+
+			return -2;
+
+		}
+
+		*start = mailbox_start;
+		return best - can -> mailboxes;
+
+	}
+
+	node_start = ( can -> rx_pending.front().ready > can -> bus_free ) ? can -> rx_pending.front().ready : can -> bus_free;
+
+	if( ( best != NULL ) && ( ( mailbox_start < node_start ) || ( ( mailbox_start == node_start ) && ( canArbitration( best -> frame ) < canArbitration( can -> rx_pending.front().frame ) ) ) ) ){
+
+		*start = mailbox_start;
+		return best - can -> mailboxes;
+
+	}
+
+	*start = node_start;
+	return -1;
+
+}
+
+/// Move the bus forward to the given time
+static void updateCan( simCan_t *can, uint64_t now ){
+
+	uint64_t start;
+	int32_t source;
+
+	while( true ){
+
+		if( can -> busy ){
+
+			if( can -> frame_end > now ){
+
+				break;
+
+			}
+
+			can -> busy = false;
+			can -> bus_free = can -> frame_end;
+
+			if( can -> source < 0 ){
+
+				canRecive( can, can -> frame, can -> frame_start );
+
+			}
+
+			else{
+
+				can -> mailboxes[ can -> source ].pending = false;
+				can -> output.push_back( can -> frame );
+
+				if( can -> interrupts & CAN_IT_TX_MAILBOX_EMPTY ){
+
+					events.push_back( { SIM_CAN_TX_COMPLETE, NULL, (uint16_t)can -> source, can } );
+
+				}
+
+				if( can -> hcan -> Init.Mode == CAN_MODE_LOOPBACK ){
+
+					canRecive( can, can -> frame, can -> frame_start );
+
+				}
+
+			}
+
+		}
+
+		source = canNextFrame( can, &start );
+
+		if( ( source == -2 ) || ( start > now ) ){
+
+			break;
+
+		}
+
+		if( source < 0 ){
+
+			can -> frame = can -> rx_pending.front().frame;
+			can -> rx_pending.pop_front();
+
+		}
+
+		else{
+
+			can -> frame = can -> mailboxes[ source ].frame;
+
+		}
+
+		can -> busy = true;
+		can -> source = source;
+		can -> frame_start = start;
+		can -> frame_end = start + canFrameBits( can -> frame ) * can -> bit_time;
+
+	}
+
+}
+
+/// Returns the time when the bus changes next
+static uint64_t canNextTime( simCan_t *can ){
+
+	uint64_t start;
+
+	if( can -> busy ){
+
+		return can -> frame_end;
+
+	}
+
+	if( canNextFrame( can, &start ) == -2 ){
+
+		return SIM_NEVER;
+
+	}
+
+	return start;
+
+}
+
+void simCanCreate( CAN_HandleTypeDef *hcan, uint32_t bitrate ){
+
+	simCan_t *can;
+
+	if( can_count >= SIM_MAX_CANS ){
+
+		fprintf( stderr, "sim_hal: too many CANs\n" );
+		abort();
+
+	}
+
+	can = &cans[ can_count++ ];
+
+	can -> hcan = hcan;
+	can -> bit_time = 1000000000ULL / bitrate;
+
+	hcan -> Instance = &can -> registers;
+	hcan -> State = HAL_CAN_STATE_RESET;
+	hcan -> ErrorCode = HAL_CAN_ERROR_NONE;
+
+}
+
+void simCanFeed( CAN_HandleTypeDef *hcan, const simCanFrame_t *frames, uint32_t count ){
+
+	simCan_t *can = findCan( hcan );
+	simCanPending_t pending;
+	uint32_t i;
+
+	updateAll();
+
+	pending.ready = simTime();
+
+	for( i = 0; i < count; i++ ){
+
+		pending.frame = frames[ i ];
+		can -> rx_pending.push_back( pending );
+
+	}
+
+}
+
+std::vector< simCanFrame_t > simCanOutput( CAN_HandleTypeDef *hcan ){
+
+	simCan_t *can = findCan( hcan );
+	std::vector< simCanFrame_t > ret;
+
+	updateAll();
+
+	ret.swap( can -> output );
+
+	return ret;
+
+}
+
+uint32_t simCanOverruns( CAN_HandleTypeDef *hcan, uint32_t fifo ){
+
+	updateAll();
+
+	return findCan( hcan ) -> overruns[ fifo & 1 ];
+
+}
+
+uint32_t simCanFiltered( CAN_HandleTypeDef *hcan ){
+
+	updateAll();
+
+	return findCan( hcan ) -> filtered;
+
+}
+
+bool simCanAccepts( CAN_HandleTypeDef *hcan, const simCanFrame_t &frame, uint32_t *fifo ){
+
+	uint32_t index;
+
+	return canFilterMatch( findCan( hcan ), frame, fifo, &index );
+
+}
+
+bool simCanIdle( CAN_HandleTypeDef *hcan ){
+
+	simCan_t *can = findCan( hcan );
+	uint32_t i;
+
+	updateAll();
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		if( can -> mailboxes[ i ].pending ){
+
+			return false;
+
+		}
+
+	}
+
+	return !can -> busy && can -> rx_pending.empty();
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_Init( CAN_HandleTypeDef *hcan ){
+
+	simCan_t *can = findCan( hcan );
+
+	updateAll();
+
+	can -> fifo_count[ 0 ] = 0;
+	can -> fifo_count[ 1 ] = 0;
+
+	hcan -> State = HAL_CAN_STATE_READY;
+	hcan -> ErrorCode = HAL_CAN_ERROR_NONE;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_DeInit( CAN_HandleTypeDef *hcan ){
+
+	simCan_t *can = findCan( hcan );
+	uint32_t i;
+
+	updateAll();
+
+	// The pending requests are dropped, the filters keep their values.
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		can -> mailboxes[ i ].pending = false;
+
+	}
+
+	can -> fifo_count[ 0 ] = 0;
+	can -> fifo_count[ 1 ] = 0;
+	can -> interrupts = 0;
+	can -> fifo_event[ 0 ] = false;
+	can -> fifo_event[ 1 ] = false;
+
+	hcan -> State = HAL_CAN_STATE_RESET;
+	hcan -> ErrorCode = HAL_CAN_ERROR_NONE;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_ConfigFilter( CAN_HandleTypeDef *hcan, CAN_FilterTypeDef *sFilterConfig ){
+
+	simCan_t *can = findCan( hcan );
+	simCanFilter_t *filter;
+
+	if( ( hcan -> State != HAL_CAN_STATE_READY ) && ( hcan -> State != HAL_CAN_STATE_LISTENING ) ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	if( sFilterConfig -> FilterBank >= SIM_CAN_FILTER_BANKS ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	filter = &can -> filters[ sFilterConfig -> FilterBank ];
+
+	filter -> active = sFilterConfig -> FilterActivation == CAN_FILTER_ENABLE;
+	filter -> mode = sFilterConfig -> FilterMode;
+	filter -> scale = sFilterConfig -> FilterScale;
+	filter -> fifo = sFilterConfig -> FilterFIFOAssignment;
+
+	// The registers are filled like in the HAL.
+	if( filter -> scale == CAN_FILTERSCALE_16BIT ){
+
+		filter -> fr1 = ( ( sFilterConfig -> FilterMaskIdLow & 0xFFFF ) << 16 ) | ( sFilterConfig -> FilterIdLow & 0xFFFF );
+		filter -> fr2 = ( ( sFilterConfig -> FilterMaskIdHigh & 0xFFFF ) << 16 ) | ( sFilterConfig -> FilterIdHigh & 0xFFFF );
+
+	}
+
+	else{
+
+		filter -> fr1 = ( ( sFilterConfig -> FilterIdHigh & 0xFFFF ) << 16 ) | ( sFilterConfig -> FilterIdLow & 0xFFFF );
+		filter -> fr2 = ( ( sFilterConfig -> FilterMaskIdHigh & 0xFFFF ) << 16 ) | ( sFilterConfig -> FilterMaskIdLow & 0xFFFF );
+
+	}
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_Start( CAN_HandleTypeDef *hcan ){
+
+	if( hcan -> State != HAL_CAN_STATE_READY ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	findCan( hcan ) -> bus_free = simTime();
+
+	hcan -> State = HAL_CAN_STATE_LISTENING;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_Stop( CAN_HandleTypeDef *hcan ){
+
+	if( hcan -> State != HAL_CAN_STATE_LISTENING ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	hcan -> State = HAL_CAN_STATE_READY;
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_AddTxMessage( CAN_HandleTypeDef *hcan, CAN_TxHeaderTypeDef *pHeader, uint8_t aData[], uint32_t *pTxMailbox ){
+
+	simCan_t *can = findCan( hcan );
+	simCanMailbox_t *mailbox;
+	uint32_t i;
+
+	if( ( hcan -> State != HAL_CAN_STATE_READY ) && ( hcan -> State != HAL_CAN_STATE_LISTENING ) ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		if( !can -> mailboxes[ i ].pending ){
+
+			break;
+
+		}
+
+	}
+
+	if( i == SIM_CAN_MAILBOXES ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+
+	}
+
+	mailbox = &can -> mailboxes[ i ];
+
+	mailbox -> pending = true;
+	mailbox -> request = can -> requests++;
+	mailbox -> ready = simTime();
+
+	mailbox -> frame.extended = pHeader -> IDE == CAN_ID_EXT;
+	mailbox -> frame.id = mailbox -> frame.extended ? ( pHeader -> ExtId & 0x1FFFFFFF ) : ( pHeader -> StdId & 0x7FF );
+	mailbox -> frame.remote = pHeader -> RTR == CAN_RTR_REMOTE;
+	mailbox -> frame.dlc = pHeader -> DLC & 0x0F;
+
+	memset( mailbox -> frame.data, 0, 8 );
+	memcpy( mailbox -> frame.data, aData, mailbox -> frame.dlc > 8 ? 8 : mailbox -> frame.dlc );
+
+	*pTxMailbox = 1UL << i;
+
+	// The bus could be idle, the frame starts now.
+	updateAll();
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_AbortTxRequest( CAN_HandleTypeDef *hcan, uint32_t TxMailboxes ){
+
+	simCan_t *can = findCan( hcan );
+	uint32_t i;
+
+	updateAll();
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		// The frame on the bus can not be aborted, it finishes.
+		if( ( TxMailboxes & ( 1UL << i ) ) && can -> mailboxes[ i ].pending && !( can -> busy && ( can -> source == (int32_t)i ) ) ){
+
+			can -> mailboxes[ i ].pending = false;
+
+			if( can -> interrupts & CAN_IT_TX_MAILBOX_EMPTY ){
+
+				events.push_back( { SIM_CAN_TX_ABORT, NULL, (uint16_t)i, can } );
+
+			}
+
+		}
+
+	}
+
+	return HAL_OK;
+
+}
+
+extern "C" uint32_t HAL_CAN_GetTxMailboxesFreeLevel( CAN_HandleTypeDef *hcan ){
+
+	simCan_t *can = findCan( hcan );
+	uint32_t free_level = 0;
+	uint32_t i;
+
+	updateAll();
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		if( !can -> mailboxes[ i ].pending ){
+
+			free_level++;
+
+		}
+
+	}
+
+	return free_level;
+
+}
+
+extern "C" uint32_t HAL_CAN_IsTxMessagePending( CAN_HandleTypeDef *hcan, uint32_t TxMailboxes ){
+
+	simCan_t *can = findCan( hcan );
+	uint32_t i;
+
+	updateAll();
+
+	for( i = 0; i < SIM_CAN_MAILBOXES; i++ ){
+
+		if( ( TxMailboxes & ( 1UL << i ) ) && can -> mailboxes[ i ].pending ){
+
+			return 1;
+
+		}
+
+	}
+
+	return 0;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_GetRxMessage( CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader, uint8_t aData[] ){
+
+	simCan_t *can = findCan( hcan );
+	simCanRxEntry_t *entry;
+
+	if( ( hcan -> State != HAL_CAN_STATE_READY ) && ( hcan -> State != HAL_CAN_STATE_LISTENING ) ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	RxFifo &= 1;
+
+	if( can -> fifo_count[ RxFifo ] == 0 ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+
+	}
+
+	entry = &can -> fifo[ RxFifo ][ can -> fifo_head[ RxFifo ] ];
+
+	pHeader -> IDE = entry -> frame.extended ? CAN_ID_EXT : CAN_ID_STD;
+	pHeader -> StdId = entry -> frame.extended ? 0 : entry -> frame.id;
+	pHeader -> ExtId = entry -> frame.extended ? entry -> frame.id : 0;
+	pHeader -> RTR = entry -> frame.remote ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+	pHeader -> DLC = entry -> frame.dlc;
+	pHeader -> Timestamp = entry -> timestamp;
+	pHeader -> FilterMatchIndex = entry -> filter_index;
+
+	// Like the HAL, every byte of the mailbox is copied.
+	memcpy( aData, entry -> frame.data, 8 );
+
+	can -> fifo_head[ RxFifo ] = ( can -> fifo_head[ RxFifo ] + 1 ) % SIM_CAN_FIFO_DEPTH;
+	can -> fifo_count[ RxFifo ]--;
+
+	return HAL_OK;
+
+}
+
+extern "C" uint32_t HAL_CAN_GetRxFifoFillLevel( CAN_HandleTypeDef *hcan, uint32_t RxFifo ){
+
+	updateAll();
+
+	return findCan( hcan ) -> fifo_count[ RxFifo & 1 ];
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_ActivateNotification( CAN_HandleTypeDef *hcan, uint32_t ActiveITs ){
+
+	simCan_t *can = findCan( hcan );
+
+	if( ( hcan -> State != HAL_CAN_STATE_READY ) && ( hcan -> State != HAL_CAN_STATE_LISTENING ) ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	can -> interrupts |= ActiveITs;
+
+	// A message could be waiting already.
+	canPendingInterrupt( can, 0 );
+	canPendingInterrupt( can, 1 );
+
+	simPoll();
+
+	return HAL_OK;
+
+}
+
+extern "C" HAL_StatusTypeDef HAL_CAN_DeactivateNotification( CAN_HandleTypeDef *hcan, uint32_t InactiveITs ){
+
+	simCan_t *can = findCan( hcan );
+
+	if( ( hcan -> State != HAL_CAN_STATE_READY ) && ( hcan -> State != HAL_CAN_STATE_LISTENING ) ){
+
+		hcan -> ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+
+	}
+
+	updateAll();
+
+	can -> interrupts &= ~InactiveITs;
+
+	return HAL_OK;
+
+}
+
+// The callbacks are weak, like in the HAL, the library overrides them.
+extern "C" __attribute__(( weak )) void HAL_UART_TxCpltCallback( UART_HandleTypeDef *huart ){ ( void )huart; }
+extern "C" __attribute__(( weak )) void HAL_UART_RxHalfCpltCallback( UART_HandleTypeDef *huart ){ ( void )huart; }
+extern "C" __attribute__(( weak )) void HAL_UART_RxCpltCallback( UART_HandleTypeDef *huart ){ ( void )huart; }
+extern "C" __attribute__(( weak )) void HAL_UART_ErrorCallback( UART_HandleTypeDef *huart ){ ( void )huart; }
+extern "C" __attribute__(( weak )) void HAL_UARTEx_RxEventCallback( UART_HandleTypeDef *huart, uint16_t Size ){ ( void )huart; ( void )Size; }
+extern "C" __attribute__(( weak )) void HAL_CAN_RxFifo0MsgPendingCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_RxFifo1MsgPendingCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox0CompleteCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox1CompleteCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox2CompleteCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox0AbortCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox1AbortCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_TxMailbox2AbortCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+extern "C" __attribute__(( weak )) void HAL_CAN_ErrorCallback( CAN_HandleTypeDef *hcan ){ ( void )hcan; }
+
+extern "C" uint32_t HAL_GetTick( void ){
+
+	// The SysTick interrupt could deliver the others too.
+	simPoll();
+
+	return simTime() / 1000000ULL;
+
+}
+
+extern "C" void HAL_Delay( uint32_t Delay ){
+
+	simAdvance( (uint64_t)Delay * 1000000ULL );
+
+}
+
+extern "C" void Error_Handler( void ){
+
+	fprintf( stderr, "sim_hal: Error_Handler called\n" );
+	abort();
+
+}
+
+extern "C" uint32_t __get_PRIMASK( void ){
+
+	return primask;
+
+}
+
+extern "C" void __set_PRIMASK( uint32_t priMask ){
+
+	primask = priMask;
+
+	if( primask == 0 ){
+
+		simPoll();
+
+	}
+
+}
+
+extern "C" void __disable_irq( void ){
+
+	primask = 1;
+
+}
+
+extern "C" void __enable_irq( void ){
+
+	primask = 0;
+
+	simPoll();
+
+}
+
+extern "C" uint32_t __get_IPSR( void ){
+
+	// Any value but 0 means an exception handler, 0x35 is the USART1 IRQ.
+	return isr_depth ? 0x35 : 0;
+
+}
+
+/// Returns the time of the next interrupt
+static uint64_t canNextTime( simCan_t *can );
+
+static uint64_t nextEventTime( uint64_t now ){
+
+	uint64_t next;
+	uint64_t can_next;
+	uint32_t i;
+	simUart_t *uart;
+
+	// The SysTick wakes up the core in every ms.
+	next = ( now / 1000000ULL + 1 ) * 1000000ULL;
+
+	for( i = 0; i < uart_count; i++ ){
+
+		uart = &uarts[ i ];
+
+		if( uart -> tx_active && ( uart -> tx_done < next ) ){
+
+			next = uart -> tx_done;
+
+		}
+
+		if( ( uart -> rx_pending_pos < uart -> rx_pending.size() ) && ( uart -> rx_next_arrival < next ) ){
+
+			next = uart -> rx_next_arrival;
+
+		}
+
+		if( uart -> rx_idle_armed && ( uart -> rx_idle_time < next ) ){
+
+			next = uart -> rx_idle_time;
+
+		}
+
+	}
+
+	for( i = 0; i < can_count; i++ ){
+
+		can_next = canNextTime( &cans[ i ] );
+
+		if( can_next < next ){
+
+			next = can_next;
+
+		}
+
+	}
+
+	return next;
+
+}
+
+extern "C" void __WFI( void ){
+
+	uint64_t now;
+	uint64_t next;
+
+	updateAll();
+
+	if( events.empty() ){
+
+		now = simTime();
+		next = nextEventTime( now );
+
+		if( next > now ){
+
+			time_offset += next - now;
+
+		}
+
+	}
+
+	simPoll();
+
+}
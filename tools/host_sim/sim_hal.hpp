@@ -0,0 +1,177 @@
+/*
+* Created on April 5 2020
+*
+* Copyright (c) 2020 - Daniel Hajnal
+* hajnal.daniel96@gmail.com
+*
+* This file is part of the STM32 Class Factory project.
+*/
+
+#ifndef STM32_CLASS_FACTORY_HOST_SIM_SIM_HAL_HPP_
+#define STM32_CLASS_FACTORY_HOST_SIM_SIM_HAL_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "stm32f4xx_hal.h"
+
+/// Control functions of the simulated HAL
+///
+/// The simulation has a virtual clock in ns. It runs together with the
+/// clock of the host, so the time spent in the library is part of the
+/// simulation. __WFI and the blocking transmission jump forward to the
+/// next event instead of waiting. The CAN frames are timed by the bitrate
+/// in the same way.
+///
+/// Every byte on the line takes 10 bit times( 8N1 ). The TX DMA finishes
+/// after the last byte left the line, the RX DMA writes the fed bytes to the
+/// recive buffer at the time they arrive. The interrupts( transfer complete,
+/// half transfer, idle line, error ) are delivered, when the library enables
+/// the interrupts, calls __WFI or HAL_GetTick. The NDTR register is always
+/// up to date, so the pending interrupts are modeled too.
+///
+/// Example code:
+/// \code{.cpp}
+///
+/// UART_HandleTypeDef huart2;
+///
+/// simUartCreate( &huart2, true );
+/// simUartSetCapture( &huart2, true );
+///
+/// Serial SerialToPC( &huart2 );
+///
+/// SerialToPC.begin( 115200 );
+/// SerialToPC.println( "Hello host :)" );
+/// SerialToPC.flush();
+///
+/// printf( "%s", simUartOutput( &huart2 ).c_str() );
+///
+/// \endcode
+
+/// Baudrate that makes the line infinitely fast
+///
+/// With this baudrate every transfer finishes at the next interrupt point,
+/// so the benchmarks measure only the time spent in the library.
+#define SIM_BAUDRATE_UNLIMITED 0xFFFFFFFFU
+
+/// Set up a UART handle for the simulation
+///
+/// The DMA handles are owned by the simulation. The baudrate is set by
+/// HAL_UART_Init, like on the target.
+/// @param huart the handle to initialise.
+/// @param tx_dma true to link a TX DMA stream to the handle.
+void simUartCreate( UART_HandleTypeDef *huart, bool tx_dma );
+
+/// Send bytes to the UART
+///
+/// The bytes arrive one after the other with the timing of the baudrate,
+/// starting now or after the previously fed bytes.
+/// @param huart the recipient.
+/// @param data pointer to the bytes.
+/// @param size number of bytes.
+void simUartFeed( UART_HandleTypeDef *huart, const uint8_t *data, uint32_t size );
+
+/// Signal a UART error
+///
+/// Like the real HAL, it stops the DMA reception and calls HAL_UART_ErrorCallback.
+/// @param huart the UART.
+/// @param error HAL_UART_ERROR_ORE, HAL_UART_ERROR_FE or HAL_UART_ERROR_NE.
+void simUartError( UART_HandleTypeDef *huart, uint32_t error );
+
+/// Keep a copy of the transmitted bytes
+///
+/// @param huart the UART.
+/// @param enable true to collect the bytes.
+void simUartSetCapture( UART_HandleTypeDef *huart, bool enable );
+
+/// Returns the captured bytes and clears the capture buffer
+std::string simUartOutput( UART_HandleTypeDef *huart );
+
+/// Returns the number of bytes that left the line
+uint64_t simUartTxBytes( UART_HandleTypeDef *huart );
+
+/// Returns the number of transmit transfers( blocking and DMA )
+uint64_t simUartTxTransfers( UART_HandleTypeDef *huart );
+
+/// Returns true if every fed byte arrived and every transfer finished
+bool simUartIdle( UART_HandleTypeDef *huart );
+
+/// A frame on the simulated CAN bus
+struct simCanFrame_t{
+	uint32_t id;			///< 11-bit or 29-bit identifier.
+	bool extended;			///< The identifier is 29-bit long.
+	bool remote;			///< Remote transmission request.
+	uint8_t dlc;			///< Data length code, 0 - 8.
+	uint8_t data[ 8 ];
+};
+
+/// Set up a CAN handle for the simulation
+///
+/// Every handle has its own bus with the other nodes. The frames of the
+/// nodes are given with \link simCanFeed \endlink, and the frames
+/// transmitted by the mailboxes are collected for \link simCanOutput \endlink.
+/// The bus is shared by both directions, the frames win the arbitration by
+/// their ID. A frame takes its nominal length and one stuff bit in every
+/// 8 bits of the stuffed fields, so a standard frame with 8 data bytes takes
+/// 123 bits, about 8100 frames/s at 1 Mbit/s. Every frame is acknowledged.
+/// @param hcan the handle to initialise.
+/// @param bitrate the bitrate in bit/s.
+void simCanCreate( CAN_HandleTypeDef *hcan, uint32_t bitrate );
+
+/// Send frames from the other nodes
+///
+/// The frames go to the bus one after the other, starting now or after the
+/// previously fed frames, so a long list loads the bus fully. The frames
+/// that do not pass the acceptance filters are not stored.
+/// @param hcan the recipient.
+/// @param frames pointer to the frames.
+/// @param count number of frames.
+void simCanFeed( CAN_HandleTypeDef *hcan, const simCanFrame_t *frames, uint32_t count );
+
+/// Returns the frames transmitted by the mailboxes and clears the list
+std::vector< simCanFrame_t > simCanOutput( CAN_HandleTypeDef *hcan );
+
+/// Returns the number of frames lost because the recive FIFO was full( FOVR )
+///
+/// @param hcan the CAN.
+/// @param fifo CAN_RX_FIFO0 or CAN_RX_FIFO1.
+uint32_t simCanOverruns( CAN_HandleTypeDef *hcan, uint32_t fifo );
+
+/// Returns the number of recived frames that did not pass the acceptance filters
+uint32_t simCanFiltered( CAN_HandleTypeDef *hcan );
+
+/// Check a frame against the acceptance filters
+///
+/// The frame is not recived, only the filters are evaluated like in the bxCAN.
+/// @param hcan the CAN.
+/// @param frame the frame.
+/// @param fifo output, the FIFO of the filter that accepts the frame.
+/// @returns true if a filter accepts the frame.
+bool simCanAccepts( CAN_HandleTypeDef *hcan, const simCanFrame_t &frame, uint32_t *fifo );
+
+/// Returns true if every fed frame and every mailbox is sent
+bool simCanIdle( CAN_HandleTypeDef *hcan );
+
+/// Returns the virtual time in ns
+uint64_t simTime();
+
+/// Run the virtual time together with the clock of the host
+///
+/// It is enabled by default. Without it the time moves only with
+/// \link simAdvance \endlink, __WFI and the waits of the library, so the
+/// timing of the simulation does not depend on the speed of the host.
+/// @param enable true to use the clock of the host.
+void simUseHostClock( bool enable );
+
+/// Move the virtual time forward and deliver the due interrupts
+///
+/// @param ns the time step.
+void simAdvance( uint64_t ns );
+
+/// Deliver the due interrupts, if they are enabled
+void simPoll();
+
+#endif /* STM32_CLASS_FACTORY_HOST_SIM_SIM_HAL_HPP_ */
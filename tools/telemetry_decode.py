@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+#
+# Created on April 5 2020
+#
+# Copyright (c) 2020 - Daniel Hajnal
+# hajnal.daniel96@gmail.com
+#
+# This file is part of the STM32 Class Factory project.
+
+"""Decoder for the compressed telemetry stream of SerialTelemetry.
+
+The stream is a sequence of SerialPacket frames: COBS( payload, CRC ) 0x00.
+The payload is a header byte( bit 7: key frame, bit 0-6: sequence number )
+and a zigzag varint delta for every channel. Every decoded frame is written
+as a CSV line, the broken and the undecodable frames are counted.
+
+Usage:
+    telemetry_decode.py [--crc32] capture.bin
+    telemetry_decode.py [--crc32] /dev/ttyUSB0
+    telemetry_decode.py [--crc32] - < capture.bin
+"""
+
+import struct
+import sys
+
+# They have to match SerialTelemetry.hpp.
+KEY_FRAME = 0x80
+SEQUENCE_MASK = 0x7F
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, like SerialPacket::crc16."""
+    crc = 0xFFFF
+
+    for byte in data:
+        crc ^= byte << 8
+
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+
+    return crc
+
+
+def crc32(data):
+    """CRC-32/MPEG-2 on little endian words, like the STM32 CRC unit."""
+    crc = 0xFFFFFFFF
+    data = data + b"\0" * (-len(data) % 4)
+
+    for word, in struct.iter_unpack("<I", data):
+        crc ^= word
+
+        for _ in range(32):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else (crc << 1)
+            crc &= 0xFFFFFFFF
+
+    return crc
+
+
+def cobs_decode(frame):
+    """Returns the decoded frame, or None if it is broken."""
+    out = bytearray()
+    pos = 0
+
+    while pos < len(frame):
+        code = frame[pos]
+
+        if code == 0 or pos + code > len(frame):
+            return None
+
+        out += frame[pos + 1:pos + code]
+        pos += code
+
+        if code < 0xFF and pos < len(frame):
+            out.append(0)
+
+    return bytes(out)
+
+
+def read_varint(data, pos):
+    """Returns the value and the new position, or None if the varint is broken."""
+    value = 0
+
+    for i in range(5):
+        if pos + i >= len(data):
+            return None
+
+        value |= (data[pos + i] & 0x7F) << (7 * i)
+
+        if not data[pos + i] & 0x80:
+            return value & 0xFFFFFFFF, pos + i + 1
+
+    return None
+
+
+class Decoder:
+    """State of the reciver, it works like SerialTelemetry::receive."""
+
+    def __init__(self, crc_size):
+        self.crc_size = crc_size
+        self.reference = None
+        self.sequence = 0
+        self.synced = False
+        self.lost = 0
+        self.broken = 0
+
+    def frame(self, frame):
+        """Returns the values of the frame, or None."""
+        data = cobs_decode(frame)
+
+        if data is None or len(data) < 1 + self.crc_size:
+            self.broken += 1
+            return None
+
+        payload, crc = data[:-self.crc_size], data[-self.crc_size:]
+
+        if self.crc_size == 2:
+            valid = struct.unpack("<H", crc)[0] == crc16(payload)
+        else:
+            valid = struct.unpack("<I", crc)[0] == crc32(payload)
+
+        if not valid:
+            self.broken += 1
+            return None
+
+        header = payload[0]
+        key = bool(header & KEY_FRAME)
+
+        if self.synced and (header & SEQUENCE_MASK) != (self.sequence & SEQUENCE_MASK):
+            self.lost += (header - self.sequence) & SEQUENCE_MASK
+            self.synced = False
+
+        if not self.synced and not key:
+            self.lost += 1
+            return None
+
+        deltas = []
+        pos = 1
+
+        while pos < len(payload):
+            result = read_varint(payload, pos)
+
+            if result is None:
+                break
+
+            value, pos = result
+            deltas.append((value >> 1) ^ -(value & 1))
+
+        if pos != len(payload) or (self.reference is not None and not key and len(deltas) != len(self.reference)):
+            self.lost += 1
+            self.synced = False
+            return None
+
+        if key:
+            self.reference = [0] * len(deltas)
+
+        values = []
+
+        for previous, delta in zip(self.reference, deltas):
+            value = (previous + delta) & 0xFFFFFFFF
+            values.append(value - (1 << 32) if value & 0x80000000 else value)
+
+        self.reference = values
+        self.synced = True
+        self.sequence = header + 1
+
+        return values
+
+
+def decode(decoder, stream, output):
+    buffer = b""
+    frames = 0
+
+    while True:
+        chunk = stream.read(256)
+
+        if not chunk:
+            break
+
+        buffer += chunk
+
+        while True:
+            end = buffer.find(b"\0")
+
+            if end < 0:
+                break
+
+            frame, buffer = buffer[:end], buffer[end + 1:]
+
+            if not frame:
+                continue
+
+            values = decoder.frame(frame)
+
+            if values is not None:
+                output.write(",".join(str(value) for value in values) + "\n")
+                frames += 1
+
+        output.flush()
+
+    return frames
+
+
+def main():
+    args = sys.argv[1:]
+    crc_size = 2
+
+    if args and args[0] == "--crc32":
+        crc_size = 4
+        args = args[1:]
+
+    if len(args) != 1:
+        sys.stderr.write(__doc__)
+        return 1
+
+    decoder = Decoder(crc_size)
+
+    if args[0] == "-":
+        frames = decode(decoder, sys.stdin.buffer, sys.stdout)
+    else:
+        with open(args[0], "rb", buffering=0) as stream:
+            frames = decode(decoder, stream, sys.stdout)
+
+    sys.stderr.write("%d frames, %d lost, %d broken\n" % (frames, decoder.lost, decoder.broken))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())